@@ -0,0 +1,61 @@
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <string>
+
+#include "../gboy/Aot.h"
+#include "../gboy/Workloads.h"
+
+// Recompiles a ROM file (or a synthetic workload) into a C++ source defining
+// an AotImage, to be linked into a build that runs with EngineAot
+int main(int argc, char *argv[]) {
+    std::string outPath, symbol = "AotLinkedImage", romPath;
+    Workload workload = WorkloadCount;
+    bool valid = true;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (arg == "--out" && hasValue)
+            outPath = argv[++i];
+        else if (arg == "--symbol" && hasValue)
+            symbol = argv[++i];
+        else if (arg == "--workload" && hasValue && WorkloadFromName(argv[i + 1], workload))
+            i++;
+        else if (romPath.empty() && arg[0] != '-')
+            romPath = arg;
+        else
+            valid = false;
+    }
+    if (!valid || outPath.empty() || (romPath.empty() == (workload == WorkloadCount))) {
+        printf("Usage: %s --out file.cc [--symbol name] (rom | --workload name)\n", argv[0]);
+        return 1;
+    }
+
+    std::vector<uint8_t> rom;
+    std::string name;
+    if (workload != WorkloadCount) {
+        rom = BuildWorkloadRom(workload);
+        name = WorkloadName(workload);
+    } else {
+        std::ifstream file(romPath, std::ifstream::binary);
+        if (!file.is_open()) {
+            printf("Unable to read %s\n", romPath.c_str());
+            return 1;
+        }
+        rom.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+        name = romPath.substr(romPath.find_last_of("/\\") + 1);
+    }
+
+    FILE *out = fopen(outPath.c_str(), "w");
+    if (!out) {
+        printf("Unable to write %s\n", outPath.c_str());
+        return 1;
+    }
+    AotTranslator translator(rom);
+    translator.Trace();
+    size_t runs = translator.Write(out, symbol, name);
+    fclose(out);
+    printf("Wrote %s (%zu runs)\n", outPath.c_str(), runs);
+    return 0;
+}
@@ -0,0 +1,463 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <iterator>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../gboy/GBoy.h"
+#include "../gboy/Workloads.h"
+#include "../gboy/FramePacer.h"
+#include "../gboy/Instrument.h"
+#include "../gboy/Trace.h"
+#include "../gboy/Debugger.h"
+#include "../gboy/Log.h"
+
+// White-box access to the private scanline and sprite paths of the PPU
+struct BenchmarkAccess {
+    static void WriteBGWindowLine(PixelProcessingUnit *ppu, uint8_t line) { ppu->writeBGWindowLine(line); }
+    static void DrawSprite(PixelProcessingUnit *ppu, uint8_t sprite) { ppu->drawSprite(sprite); }
+};
+
+struct BenchmarkResult {
+    std::string name;
+    std::string kind;
+    std::vector<std::pair<std::string, double>> metrics;
+};
+
+typedef std::chrono::steady_clock Clock;
+
+static volatile uint32_t sink;
+static std::vector<BenchmarkResult> results;
+static double scale = 1.0;
+static CpuEngine engine = EngineInterpreter;
+static bool idleSkipping = true;
+static bool fusion = true;
+static uint32_t drawEvery = 1;      // frames, as when fast-forwarding
+static std::string countersPath;
+static std::string profilePrefix;
+static bool tracing = false;
+static bool debugging = false;   // attached with nothing set, which should cost nothing
+static size_t pairProfile = 0;
+
+static double secondsSince(Clock::time_point start) {
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+static uint64_t scaled(uint64_t iterations) {
+    uint64_t n = (uint64_t)(iterations * scale);
+    return n > 0 ? n : 1;
+}
+
+template <typename Body>
+static void runMicro(const std::string &name, uint64_t iterations, Body body) {
+    iterations = scaled(iterations);
+    body(iterations / 16 + 1); // warm up caches and branch predictors
+
+    Clock::time_point start = Clock::now();
+    body(iterations);
+    double seconds = secondsSince(start);
+
+    BenchmarkResult r;
+    r.name = name;
+    r.kind = "micro";
+    r.metrics.push_back({"iterations", (double)iterations});
+    r.metrics.push_back({"seconds", seconds});
+    r.metrics.push_back({"ns_per_op", seconds * 1e9 / iterations});
+    r.metrics.push_back({"ops_per_sec", iterations / seconds});
+    results.push_back(r);
+    printf("%-32s %10.2f ns/op\n", name.c_str(), seconds * 1e9 / iterations);
+}
+
+// False, with the reason printed, when path holds no ROM image
+static bool loadRom(const std::string &path, std::vector<uint8_t> &rom) {
+    std::ifstream file(path, std::ifstream::binary);
+    if (!file) {
+        printf("Unable to read %s, skipped\n", path.c_str());
+        return false;
+    }
+    rom.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    if (rom.size() < CartMinSize) {
+        printf("%s is %zu bytes, too short for a ROM image, skipped\n", path.c_str(), rom.size());
+        return false;
+    }
+    return true;
+}
+
+// Writes code at addr followed by a JR back to addr so it can run forever
+static void loadLoop(MemoryManagementUnit *mmu, uint16_t addr, const std::vector<uint8_t> &code) {
+    for (size_t i = 0; i < code.size(); i++)
+        mmu->Write(addr + i, code[i], true);
+    mmu->Write(addr + code.size(), 0x18, true);
+    mmu->Write(addr + code.size() + 1, (uint8_t)(-(int)(code.size() + 2)), true);
+}
+
+static void benchCpu(const std::string &name, const std::vector<uint8_t> &code) {
+    Cartridge cart(BuildBlankRom());
+    MemoryManagementUnit mmu(&cart);
+    CentralProcessingUnit cpu(&mmu);
+    cpu.SetEngine(engine);
+    loadLoop(&mmu, 0xc000, code);
+    cpu.programCounter = 0xc000;
+    cpu.h = 0xc1, cpu.l = 0x00;
+
+    runMicro(name, 20000000, [&](uint64_t n) {
+        uint32_t cycles = 0;
+        for (uint64_t i = 0; i < n; i++)
+            cycles += cpu.ExecuteInstruction();
+        sink = cycles;
+    });
+}
+
+static void benchMemory() {
+    Cartridge cart(BuildBlankRom());
+    MemoryManagementUnit mmu(&cart);
+
+    const struct { const char *name; uint16_t start; uint16_t size; bool writable; } regions[] = {
+        {"rom0", 0x0100, 0x3f00, false},
+        {"romx", 0x4000, 0x4000, false},
+        {"vram", 0x8000, 0x2000, true},
+        {"wram", 0xc000, 0x2000, true},
+        {"oam", 0xfe00, 0x00a0, true},
+        {"io", 0xff40, 0x000c, false},
+        {"hram", 0xff80, 0x007f, true},
+    };
+
+    for (auto &region : regions) {
+        runMicro(std::string("mmu.read.") + region.name, 50000000, [&](uint64_t n) {
+            uint32_t acc = 0;
+            for (uint64_t i = 0; i < n; i++)
+                acc += mmu.Read(region.start + (i % region.size));
+            sink = acc;
+        });
+        if (!region.writable)
+            continue;
+        runMicro(std::string("mmu.write.") + region.name, 50000000, [&](uint64_t n) {
+            for (uint64_t i = 0; i < n; i++)
+                mmu.Write(region.start + (i % region.size), (uint8_t)i);
+        });
+    }
+}
+
+static void fillVideoMemory(MemoryManagementUnit *mmu) {
+    for (uint16_t addr = 0x8000; addr < 0x9800; addr++)
+        mmu->Write(addr, (uint8_t)(addr * 37));
+    for (uint16_t addr = 0x9800; addr < 0xa000; addr++)
+        mmu->Write(addr, (uint8_t)addr);
+    for (uint8_t sprite = 0; sprite < 40; sprite++) {
+        uint16_t oam = AddrOAMStart + sprite * 4;
+        mmu->Write(oam, 16 + (sprite * 3) % 128);
+        mmu->Write(oam + 1, 8 + (sprite * 4) % 152);
+        mmu->Write(oam + 2, sprite);
+        mmu->Write(oam + 3, (sprite & 0x7) << 4);
+    }
+}
+
+static void benchPpu() {
+    Cartridge cart(BuildBlankRom());
+    MemoryManagementUnit mmu(&cart);
+    PixelProcessingUnit ppu(&mmu);
+    fillVideoMemory(&mmu);
+    mmu.Write(AddrRegLcdControl, 0x93);
+
+    runMicro("ppu.write_bg_line", 200000, [&](uint64_t n) {
+        for (uint64_t i = 0; i < n; i++)
+            BenchmarkAccess::WriteBGWindowLine(&ppu, i % 144);
+    });
+
+    mmu.Write(AddrRegLcdControl, 0xb3);
+    mmu.Write(AddrRegWindowX, 87);
+    mmu.Write(AddrRegWindowY, 40);
+    runMicro("ppu.write_window_line", 200000, [&](uint64_t n) {
+        for (uint64_t i = 0; i < n; i++)
+            BenchmarkAccess::WriteBGWindowLine(&ppu, i % 144);
+    });
+
+    runMicro("ppu.draw_sprite", 1000000, [&](uint64_t n) {
+        for (uint64_t i = 0; i < n; i++)
+            BenchmarkAccess::DrawSprite(&ppu, i % 40);
+    });
+
+    runMicro("ppu.cycle", 20000000, [&](uint64_t n) {
+        for (uint64_t i = 0; i < n; i++)
+            ppu.Cycle(4);
+    });
+}
+
+static void benchTimer() {
+    Cartridge cart(BuildBlankRom());
+    MemoryManagementUnit mmu(&cart);
+    Timer timer(&mmu);
+
+    mmu.Write(AddrRegTAC, 0x00);
+    runMicro("timer.cycle.stopped", 20000000, [&](uint64_t n) {
+        for (uint64_t i = 0; i < n; i++)
+            timer.Cycle(4);
+    });
+
+    mmu.Write(AddrRegTAC, 0x05);
+    runMicro("timer.cycle.running", 20000000, [&](uint64_t n) {
+        for (uint64_t i = 0; i < n; i++)
+            timer.Cycle(4);
+    });
+}
+
+// One op is an emulated frame of sound: the cycles handed over in CPU sized
+// steps, a register write, then a flush into the ring buffer
+static void benchApu() {
+    Cartridge cart(BuildBlankRom());
+    MemoryManagementUnit mmu(&cart);
+    AudioProcessingUnit apu(&mmu);
+    int16_t frames[1024 * 2];
+    const double frameNs = 1e9 * CyclesFrame / CyclesCpu;
+
+    for (int playing = 0; playing < 2; playing++) {
+        if (playing) {
+            const uint8_t setup[][2] = {
+                {0x26, 0x80}, {0x24, 0x77}, {0x25, 0xff},
+                {0x10, 0x15}, {0x11, 0x80}, {0x12, 0xf3}, {0x13, 0x00}, {0x14, 0x86},
+                {0x16, 0x40}, {0x17, 0xa0}, {0x18, 0x00}, {0x19, 0x87},
+                {0x1a, 0x80}, {0x1c, 0x20}, {0x1d, 0x00}, {0x1e, 0x85},
+                {0x21, 0xf0}, {0x22, 0x52}, {0x23, 0x80},
+            };
+            for (int i = 0; i < 16; i++)
+                mmu.Write(AddrWaveRamStart + i, i * 17);
+            for (auto &w : setup)
+                mmu.Write(0xFF00 + w[0], w[1]);
+        }
+        runMicro(playing ? "apu.frame.tones" : "apu.frame.silent", 2000, [&](uint64_t n) {
+            for (uint64_t i = 0; i < n; i++) {
+                for (uint32_t c = 0; c < CyclesFrame; c += 4)
+                    apu.Cycle(4);
+                mmu.Write(0xFF18, (uint8_t)i);
+                apu.Flush();
+                while (apu.GetOutput().Read(frames, 1024)) {}
+            }
+        });
+        double share = results.back().metrics[2].second / frameNs;
+        results.back().metrics.push_back({"frame_share", share});
+        printf("%-32s %10.2f %% of a frame\n", "", share * 100);
+    }
+}
+
+// Real-time run of the joypad workload paced to the clock. Another thread
+// presses and releases a key at random moments; latency is the time from
+// that call to the presentation of the first frame showing it.
+static void benchInputLatency(uint32_t presses) {
+    GBoy gb(new Cartridge(BuildWorkloadRom(WorkloadJoypad)));
+    gb.SetCpuEngine(engine);
+    FramePacer pacer(PacingClock, AudioSampleRate);
+    Input *input = gb.GetInput();
+    std::atomic<int64_t> changedAt(0);
+    std::atomic<bool> held(false);
+
+    std::thread presser([&] {
+        std::mt19937 random(1);
+        for (uint32_t i = 0; i < presses * 2; i++) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(20 + random() % 50));
+            held = !held;
+            changedAt = FramePacer::Now();
+            if (held)
+                input->ButtonPressed(A);
+            else
+                input->ButtonReleased(A);
+            while (changedAt != 0)
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    });
+
+    std::vector<double> latencies;
+    uint32_t frameCycles = 0;
+    while (latencies.size() < presses * 2) {
+        frameCycles += gb.ExecuteStep();
+        if (!gb.GetFrameBufferUpdatedFlag())
+            continue;
+        gb.SetFrameBufferUpdatedFlag(false);
+        FramePacer::Wait(pacer.FrameDone(FramePacer::Now(), frameCycles, 0));
+        frameCycles = 0;
+
+        // Presented now; the workload shows a held key as a white screen
+        uint8_t red, green, blue;
+        gb.GetFrameBufferColor(red, green, blue, 0, 0);
+        int64_t at = changedAt;
+        if (at != 0 && (red > 128) == held) {
+            latencies.push_back((FramePacer::Now() - at) / 1e6);
+            changedAt = 0;
+        }
+    }
+    presser.join();
+
+    double sum = 0, squares = 0, worst = 0, best = 1e9;
+    for (double l : latencies) {
+        sum += l;
+        squares += l * l;
+        worst = std::max(worst, l);
+        best = std::min(best, l);
+    }
+    double mean = sum / latencies.size();
+    BenchmarkResult r;
+    r.name = "input.latency";
+    r.kind = "latency";
+    r.metrics.push_back({"changes", (double)latencies.size()});
+    r.metrics.push_back({"mean_ms", mean});
+    r.metrics.push_back({"min_ms", best});
+    r.metrics.push_back({"max_ms", worst});
+    r.metrics.push_back({"jitter_ms", sqrt(std::max(0.0, squares / latencies.size() - mean * mean))});
+    results.push_back(r);
+    printf("%-32s %10.2f ms mean %7.2f ms max\n", r.name.c_str(), mean, worst);
+}
+
+static void benchSystem(const std::string &name, const std::vector<uint8_t> &rom, uint32_t frames) {
+    GBoy gb(new Cartridge(rom));
+    gb.SetCpuEngine(engine);
+    gb.SetIdleLoopSkipping(idleSkipping);
+    gb.SetFusion(fusion);
+    gb.GetCPU()->SetPairProfiling(pairProfile > 0);
+    Profiler profiler;
+    if (!profilePrefix.empty())
+        gb.SetProfiler(&profiler);
+    TraceBuffer tracer;
+    if (tracing)
+        gb.SetTracer(&tracer);
+    Debugger debugger;
+    if (debugging)
+        gb.SetDebugger(&debugger);
+    uint64_t instructions = 0, cycles = 0;
+    uint32_t framesDone = 0;
+
+    Clock::time_point start = Clock::now();
+    while (framesDone < frames) {
+        cycles += gb.ExecuteStep();
+        instructions++;
+        if (gb.GetFrameBufferUpdatedFlag()) {
+            gb.SetFrameBufferUpdatedFlag(false);
+            framesDone++;
+            gb.SetFrameOutput(framesDone % drawEvery == drawEvery - 1);
+        }
+    }
+    double seconds = secondsSince(start);
+
+    BenchmarkResult r;
+    r.name = name;
+    r.kind = "macro";
+    r.metrics.push_back({"frames", (double)framesDone});
+    r.metrics.push_back({"instructions", (double)instructions});
+    r.metrics.push_back({"cycles", (double)cycles});
+    r.metrics.push_back({"seconds", seconds});
+    r.metrics.push_back({"mips", instructions / seconds / 1e6});
+    r.metrics.push_back({"fps", framesDone / seconds});
+    r.metrics.push_back({"cycles_per_instruction", (double)cycles / instructions});
+    r.metrics.push_back({"speed_vs_dmg", cycles / seconds / CyclesCpu});
+    results.push_back(r);
+    printf("%-32s %10.2f MIPS %10.1f fps\n", name.c_str(), instructions / seconds / 1e6, framesDone / seconds);
+    if (pairProfile > 0)
+        gb.GetCPU()->DumpPairProfile(stdout, pairProfile);
+    if (!profilePrefix.empty()) {
+        profiler.WriteHotspots(stdout, 5);
+        profiler.WriteFolded((profilePrefix + name + ".folded").c_str());
+    }
+    // Rewritten after each run, so the file ends up covering all of them
+    if (!countersPath.empty())
+        WriteInstrumentJson(countersPath.c_str(), gb.GetCPU());
+}
+
+static void writeJson(FILE *out, const std::string &label) {
+    fprintf(out, "{\n  \"label\": \"%s\",\n  \"engine\": \"%s\",\n  \"benchmarks\": [\n", label.c_str(), CpuEngineName(engine));
+    for (size_t i = 0; i < results.size(); i++) {
+        const BenchmarkResult &r = results[i];
+        fprintf(out, "    {\"name\": \"%s\", \"kind\": \"%s\"", r.name.c_str(), r.kind.c_str());
+        for (auto &metric : r.metrics)
+            fprintf(out, ", \"%s\": %.6g", metric.first.c_str(), metric.second);
+        fprintf(out, "}%s\n", (i + 1 < results.size()) ? "," : "");
+    }
+    fprintf(out, "  ]\n}\n");
+}
+
+static void usage(const char *argv0) {
+    printf("Usage: %s [--out file.json] [--label name] [--scale factor] [--frames n] [--rom path]... [--macro-only] [--engine interpreter|cached|jit] [--no-idle-skip] [--no-fusion] [--draw-every n] [--pair-profile n] [--profile prefix] [--trace] [--debugger] [--counters file.json]\n", argv0);
+}
+
+int main(int argc, char *argv[]) {
+    std::string outPath = "bench.json";
+    std::string label = "";
+    uint32_t frames = 600;
+    bool macroOnly = false;
+    std::vector<std::string> roms;
+    // Machines are built over and over; only problems are worth reporting
+    SetLogLevel(LogWarning);
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (arg == "--out" && hasValue)
+            outPath = argv[++i];
+        else if (arg == "--label" && hasValue)
+            label = argv[++i];
+        else if (arg == "--scale" && hasValue)
+            scale = atof(argv[++i]);
+        else if (arg == "--frames" && hasValue)
+            frames = atoi(argv[++i]);
+        else if (arg == "--rom" && hasValue)
+            roms.push_back(argv[++i]);
+        else if (arg == "--engine" && hasValue && CpuEngineFromName(argv[i + 1], engine))
+            i++;
+        else if (arg == "--macro-only")
+            macroOnly = true;
+        else if (arg == "--no-idle-skip")
+            idleSkipping = false;
+        else if (arg == "--no-fusion")
+            fusion = false;
+        else if (arg == "--draw-every" && hasValue)
+            drawEvery = std::max(1, atoi(argv[++i]));
+        else if (arg == "--pair-profile" && hasValue)
+            pairProfile = atoi(argv[++i]);
+        else if (arg == "--profile" && hasValue)
+            profilePrefix = argv[++i];
+        else if (arg == "--trace")
+            tracing = true;
+        else if (arg == "--debugger")
+            debugging = true;
+        else if (arg == "--counters" && hasValue)
+            countersPath = argv[++i];
+        else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (!macroOnly) {
+        benchCpu("cpu.dispatch.nop", {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00});
+        benchCpu("cpu.dispatch.alu", {0x80, 0x04, 0xa9, 0x0d, 0x91, 0xb0, 0x2f, 0x3c});
+        benchCpu("cpu.dispatch.load", {0x78, 0x41, 0x7e, 0x77, 0x23, 0x2b, 0x3e, 0x12});
+        benchCpu("cpu.dispatch.cb", {0xcb, 0x37, 0xcb, 0x7f, 0xcb, 0x11, 0xcb, 0xc6});
+        benchMemory();
+        benchPpu();
+        benchTimer();
+        benchApu();
+        benchInputLatency(scaled(20));
+    }
+
+    ResetInstrumentCounters();
+    for (int i = 0; i < WorkloadCount; i++)
+        benchSystem(std::string("system.") + WorkloadName((Workload)i), BuildWorkloadRom((Workload)i), frames);
+    for (auto &path : roms) {
+        std::vector<uint8_t> rom;
+        if (loadRom(path, rom))
+            benchSystem("system.rom." + path.substr(path.find_last_of("/\\") + 1), rom, frames);
+    }
+
+    FILE *out = fopen(outPath.c_str(), "w");
+    if (!out) {
+        printf("Unable to write %s\n", outPath.c_str());
+        return 1;
+    }
+    writeJson(out, label);
+    fclose(out);
+    printf("Results written to %s\n", outPath.c_str());
+    return 0;
+}
@@ -0,0 +1,45 @@
+#include <cstdio>
+#include <fstream>
+#include <string>
+
+#include "../gboy/Workloads.h"
+
+// Writes every synthetic workload ROM (or just the named ones) to a directory
+int main(int argc, char *argv[]) {
+    std::string outDir = ".";
+    std::vector<Workload> selected;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        Workload workload;
+        if (arg == "--out" && i + 1 < argc)
+            outDir = argv[++i];
+        else if (WorkloadFromName(arg, workload))
+            selected.push_back(workload);
+        else {
+            printf("Usage: %s [--out dir] [workload]...\nWorkloads:", argv[0]);
+            for (int w = 0; w < WorkloadCount; w++)
+                printf(" %s", WorkloadName((Workload)w));
+            printf("\n");
+            return 1;
+        }
+    }
+
+    if (selected.empty()) {
+        for (int w = 0; w < WorkloadCount; w++)
+            selected.push_back((Workload)w);
+    }
+
+    for (Workload workload : selected) {
+        std::string path = outDir + "/" + WorkloadName(workload) + ".gb";
+        std::vector<uint8_t> rom = BuildWorkloadRom(workload);
+        std::ofstream file(path, std::ofstream::binary);
+        if (!file.is_open()) {
+            printf("Unable to write %s\n", path.c_str());
+            return 1;
+        }
+        file.write((const char*)&rom[0], rom.size());
+        printf("Wrote %s (%zu bytes)\n", path.c_str(), rom.size());
+    }
+    return 0;
+}
@@ -0,0 +1,41 @@
+#include <cstdio>
+#include <string>
+
+#include "../gboy/CPU.h"
+#include "../gboy/Trace.h"
+
+// Decodes a trace written by picoboy --trace into one line per instruction
+int main(int argc, char *argv[]) {
+    std::string path;
+    size_t last = 0;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--last" && i + 1 < argc)
+            last = std::stoul(argv[++i]);
+        else if (path.empty() && arg[0] != '-')
+            path = arg;
+        else {
+            path.clear();
+            break;
+        }
+    }
+    if (path.empty()) {
+        printf("Usage: %s [--last n] trace.bin\n", argv[0]);
+        return 1;
+    }
+
+    std::vector<TraceRecord> records;
+    if (!TraceBuffer::Read(path.c_str(), records))
+        return 1;
+
+    // Only the instruction table is used
+    Cartridge cart(std::vector<uint8_t>(0x8000, 0));
+    MemoryManagementUnit mmu(&cart);
+    CentralProcessingUnit cpu(&mmu);
+
+    size_t first = (last && last < records.size()) ? records.size() - last : 0;
+    for (size_t i = first; i < records.size(); i++)
+        printf("%s\n", FormatTraceRecord(records[i], &cpu).c_str());
+    return 0;
+}
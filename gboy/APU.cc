@@ -0,0 +1,490 @@
+#include "APU.h"
+#include <algorithm>
+#include <cmath>
+
+// Impulse table for the band-limited steps: one windowed sinc per fraction of
+// a sample, each summing to 1 << BlipUnitBits
+static const int BlipPhaseBits = 5;
+static const int BlipPhases = 1 << BlipPhaseBits;
+static const int BlipTaps = 16;
+static const int BlipUnitBits = 15;
+static const double BlipCutoff = 0.9;   // of the Nyquist frequency
+static const int HighPassShift = 9;     // about 15 Hz at 48 kHz
+
+// Output level of one channel at full master volume is 15 * 8
+static const int32_t AudioLevelScale = 64;
+
+static const uint8_t DutyPatterns[4] = {0x01, 0x81, 0x87, 0x7e};
+
+// Bits that always read back as 1, from NR10 to NR52; unused registers read 0xFF
+static const uint8_t ReadMasks[0x17] = {
+    0x80, 0x3f, 0x00, 0xff, 0xbf,
+    0xff, 0x3f, 0x00, 0xff, 0xbf,
+    0x7f, 0xff, 0x9f, 0xff, 0xbf,
+    0xff, 0xff, 0x00, 0x00, 0xbf,
+    0x00, 0x00, 0x70,
+};
+
+struct BlipKernel {
+    int16_t taps[BlipPhases][BlipTaps];
+
+    BlipKernel() {
+        const double pi = 3.14159265358979323846;
+        for(int phase = 0; phase < BlipPhases; phase++) {
+            double values[BlipTaps], sum = 0;
+            for(int k = 0; k < BlipTaps; k++) {
+                double x = k - (BlipTaps / 2 - 1) - (double)phase / BlipPhases;
+                double window = 0.42 + 0.5 * cos(2 * pi * x / BlipTaps) + 0.08 * cos(4 * pi * x / BlipTaps);
+                double sinc = (x == 0) ? 1 : sin(pi * x * BlipCutoff) / (pi * x * BlipCutoff);
+                values[k] = (fabs(x) < BlipTaps / 2) ? sinc * window : 0;
+                sum += values[k];
+            }
+            // Rounding error goes to the centre tap so every phase sums exactly to one step
+            int total = 0;
+            for(int k = 0; k < BlipTaps; k++) {
+                taps[phase][k] = (int16_t)lround(values[k] / sum * (1 << BlipUnitBits));
+                total += taps[phase][k];
+            }
+            taps[phase][BlipTaps / 2 - 1] += (1 << BlipUnitBits) - total;
+        }
+    }
+};
+
+static const BlipKernel &blipKernel() {
+    static BlipKernel kernel;
+    return kernel;
+}
+
+AudioRingBuffer::AudioRingBuffer(size_t frames) {
+    size_t size = 1;
+    while(size < frames)
+        size <<= 1;
+    samples.resize(size * 2);
+    mask = size - 1;
+    readIndex = 0;
+    writeIndex = 0;
+}
+
+size_t AudioRingBuffer::Write(const int16_t *frames, size_t count) {
+    size_t w = writeIndex.load(std::memory_order_relaxed);
+    size_t r = readIndex.load(std::memory_order_acquire);
+    count = std::min(count, mask + 1 - (w - r));
+    for(size_t i = 0; i < count; i++) {
+        size_t slot = ((w + i) & mask) * 2;
+        samples[slot] = frames[i * 2];
+        samples[slot + 1] = frames[i * 2 + 1];
+    }
+    writeIndex.store(w + count, std::memory_order_release);
+    return count;
+}
+
+size_t AudioRingBuffer::Read(int16_t *frames, size_t count) {
+    size_t r = readIndex.load(std::memory_order_relaxed);
+    size_t w = writeIndex.load(std::memory_order_acquire);
+    count = std::min(count, w - r);
+    for(size_t i = 0; i < count; i++) {
+        size_t slot = ((r + i) & mask) * 2;
+        frames[i * 2] = samples[slot];
+        frames[i * 2 + 1] = samples[slot + 1];
+    }
+    readIndex.store(r + count, std::memory_order_release);
+    return count;
+}
+
+size_t AudioRingBuffer::Available() {
+    return writeIndex.load(std::memory_order_acquire) - readIndex.load(std::memory_order_acquire);
+}
+
+BandLimitedBuffer::BandLimitedBuffer(uint32_t clockRate, uint32_t sampleRate, size_t capacity) {
+    deltas.assign(capacity + BlipTaps, 0);
+    factor = ((uint64_t)sampleRate << 32) / clockRate;
+    offset = 0;
+    integrator = 0;
+    dcLevel = 0;
+    blipKernel();
+}
+
+void BandLimitedBuffer::AddDelta(uint32_t cycle, int32_t delta) {
+    uint64_t position = offset + cycle * factor;
+    const int16_t *taps = blipKernel().taps[(position >> (32 - BlipPhaseBits)) & (BlipPhases - 1)];
+    int32_t *out = &deltas[position >> 32];
+    for(int k = 0; k < BlipTaps; k++)
+        out[k] += taps[k] * delta;
+}
+
+void BandLimitedBuffer::EndFrame(uint32_t cycles) {
+    offset += cycles * factor;
+}
+
+size_t BandLimitedBuffer::SamplesAvailable() {
+    return offset >> 32;
+}
+
+size_t BandLimitedBuffer::ReadSamples(int16_t *out, size_t count, size_t stride) {
+    size_t available = SamplesAvailable();
+    count = std::min(count, available);
+    for(size_t i = 0; i < count; i++) {
+        integrator += deltas[i];
+        int32_t sample = (integrator >> BlipUnitBits) - (int32_t)(dcLevel >> 16);
+        dcLevel += (int64_t)sample << (16 - HighPassShift);
+        out[i * stride] = (int16_t)std::max(-32768, std::min(32767, sample));
+    }
+
+    // Keep the samples still pending and the impulse tails reaching past them
+    size_t remaining = available - count + BlipTaps;
+    std::copy(deltas.begin() + count, deltas.begin() + count + remaining, deltas.begin());
+    std::fill(deltas.begin() + remaining, deltas.begin() + remaining + count, 0);
+    offset -= (uint64_t)count << 32;
+    return count;
+}
+
+AudioProcessingUnit::AudioProcessingUnit(MemoryManagementUnit *mmu, uint32_t sampleRate) :
+    left(CyclesCpu, sampleRate, (uint64_t)CyclesAudioCatchUp * sampleRate / CyclesCpu + 1),
+    right(CyclesCpu, sampleRate, (uint64_t)CyclesAudioCatchUp * sampleRate / CyclesCpu + 1),
+    output(AudioRingFrames) {
+    this->mmu = mmu;
+    pendingCycles = 0;
+    droppedFrames = 0;
+    frameSequencerStep = 0;
+    frameSequencerCountdown = CyclesFrameSequencer;
+    sweepFrequency = 0;
+    sweepTimer = 8;
+    sweepEnabled = false;
+    lfsr = 0x7fff;
+
+    // Start from the registers the boot ROM left behind; its chime has
+    // decayed to silence, but the channels it enabled are still on
+    for(int i = 0; i < 0x30; i++)
+        regs[i] = mmu->Read(AddrRegAudioStart + i, true);
+    powered = (regs[AddrRegSoundOn - AddrRegAudioStart] >> FlagSoundOn) & 1;
+    memset(channels, 0, sizeof(channels));
+    for(int i = 0; i < 4; i++) {
+        AudioChannel &ch = channels[i];
+        ch.dacOn = (i == 2) ? (regs[0x0a] & 0x80) : (regs[i * 5 + 2] & 0xf8);
+        ch.enabled = ch.dacOn && ((regs[AddrRegSoundOn - AddrRegAudioStart] >> i) & 1);
+        updatePeriod(i);
+        ch.countdown = ch.period;
+    }
+    mmu->SetAudio(this);
+}
+
+AudioProcessingUnit::~AudioProcessingUnit() {
+    mmu->SetAudio(nullptr);
+}
+
+void AudioProcessingUnit::catchUp() {
+    while(pendingCycles) {
+        uint32_t chunk = std::min(pendingCycles, CyclesAudioCatchUp);
+        pendingCycles -= chunk;
+
+        // Channels run independently between frame sequencer clocks, which
+        // are the only other place their levels change
+        for(uint32_t t = 0; t < chunk; ) {
+            uint32_t end = chunk;
+            if(powered && frameSequencerCountdown <= chunk - t)
+                end = t + frameSequencerCountdown;
+            for(int i = 0; i < 4; i++)
+                runChannel(i, t, end);
+            if(powered) {
+                frameSequencerCountdown -= end - t;
+                if(frameSequencerCountdown == 0) {
+                    frameSequencerCountdown = CyclesFrameSequencer;
+                    clockFrameSequencer(end);
+                }
+            }
+            t = end;
+        }
+        left.EndFrame(chunk);
+        right.EndFrame(chunk);
+        queueSamples();
+    }
+}
+
+void AudioProcessingUnit::runChannel(int index, uint32_t from, uint32_t to) {
+    AudioChannel &ch = channels[index];
+    if(!ch.enabled)
+        return;
+
+    // A silent channel only needs its timer phase kept. The noise shift
+    // register is left alone, nothing can tell where it was.
+    bool silent = !ch.dacOn || (regs[AddrRegSoundPanning - AddrRegAudioStart] & (0x11 << index)) == 0
+        || (index == 2 ? (regs[0x0c] & 0x60) == 0 : ch.volume == 0);
+    if(silent) {
+        uint32_t span = to - from;
+        if(ch.countdown > span) {
+            ch.countdown -= span;
+            return;
+        }
+        span -= ch.countdown;
+        uint32_t ticks = 1 + span / ch.period;
+        ch.countdown = ch.period - span % ch.period;
+        if(index != 3)
+            ch.position = (ch.position + ticks) & (index == 2 ? 31 : 7);
+        return;
+    }
+
+    uint32_t t = from;
+    while(ch.countdown <= to - t) {
+        t += ch.countdown;
+        ch.countdown = ch.period;
+        tickChannel(index);
+        updateOutput(index, t);
+    }
+    ch.countdown -= to - t;
+}
+
+void AudioProcessingUnit::tickChannel(int index) {
+    AudioChannel &ch = channels[index];
+    if(index < 2)
+        ch.position = (ch.position + 1) & 7;
+    else if(index == 2)
+        ch.position = (ch.position + 1) & 31;
+    else {
+        uint16_t bit = (lfsr ^ (lfsr >> 1)) & 1;
+        lfsr = (lfsr >> 1) | (bit << 14);
+        if(regs[0x12] & 0x08)
+            lfsr = (lfsr & ~0x40) | (bit << 6);
+    }
+}
+
+// Digital output of a channel, 0 to 15
+uint8_t AudioProcessingUnit::channelLevel(int index) {
+    AudioChannel &ch = channels[index];
+    if(!ch.enabled || !ch.dacOn)
+        return 0;
+    if(index < 2)
+        return ((DutyPatterns[regs[index * 5 + 1] >> 6] >> ch.position) & 1) ? ch.volume : 0;
+    if(index == 2) {
+        uint8_t code = (regs[0x0c] >> 5) & 3;
+        uint8_t sample = regs[AddrWaveRamStart - AddrRegAudioStart + ch.position / 2];
+        sample = (ch.position & 1) ? (sample & 0xf) : (sample >> 4);
+        return code ? sample >> (code - 1) : 0;
+    }
+    return (lfsr & 1) ? 0 : ch.volume;
+}
+
+// Adds a step to each output whose level from this channel changed
+void AudioProcessingUnit::updateOutput(int index, uint32_t cycle) {
+    AudioChannel &ch = channels[index];
+    int32_t level = channelLevel(index);
+    uint8_t panning = regs[AddrRegSoundPanning - AddrRegAudioStart];
+    uint8_t volume = regs[AddrRegMasterVolume - AddrRegAudioStart];
+    int32_t l = ((panning >> (4 + index)) & 1) ? level * (((volume >> 4) & 7) + 1) : 0;
+    int32_t r = ((panning >> index) & 1) ? level * ((volume & 7) + 1) : 0;
+    if(l != ch.left) {
+        left.AddDelta(cycle, (l - ch.left) * AudioLevelScale);
+        ch.left = l;
+    }
+    if(r != ch.right) {
+        right.AddDelta(cycle, (r - ch.right) * AudioLevelScale);
+        ch.right = r;
+    }
+}
+
+// 512 Hz: length counters on even steps, sweep on 2 and 6, envelopes on 7
+void AudioProcessingUnit::clockFrameSequencer(uint32_t cycle) {
+    uint8_t step = frameSequencerStep;
+    frameSequencerStep = (step + 1) & 7;
+
+    if((step & 1) == 0) {
+        for(int i = 0; i < 4; i++) {
+            AudioChannel &ch = channels[i];
+            if(ch.lengthEnabled && ch.length && --ch.length == 0)
+                ch.enabled = false;
+        }
+    }
+    if(step == 2 || step == 6)
+        clockSweep();
+    if(step == 7) {
+        for(int i = 0; i < 4; i++) {
+            uint8_t envelope = regs[i * 5 + 2];
+            uint8_t period = envelope & 7;
+            AudioChannel &ch = channels[i];
+            if(i == 2 || period == 0 || --ch.envelopeTimer)
+                continue;
+            ch.envelopeTimer = period;
+            if((envelope & 0x08) && ch.volume < 15)
+                ch.volume++;
+            else if(!(envelope & 0x08) && ch.volume > 0)
+                ch.volume--;
+        }
+    }
+    for(int i = 0; i < 4; i++)
+        updateOutput(i, cycle);
+}
+
+void AudioProcessingUnit::clockSweep() {
+    if(--sweepTimer)
+        return;
+    uint8_t period = (regs[0] >> 4) & 7;
+    sweepTimer = period ? period : 8;
+    if(!sweepEnabled || period == 0)
+        return;
+
+    uint16_t target = sweepTarget();
+    if(target > 2047) {
+        channels[0].enabled = false;
+        return;
+    }
+    if(regs[0] & 7) {
+        sweepFrequency = target;
+        regs[3] = target & 0xff;
+        regs[4] = (regs[4] & ~7) | (target >> 8);
+        updatePeriod(0);
+        if(sweepTarget() > 2047)
+            channels[0].enabled = false;
+    }
+}
+
+uint16_t AudioProcessingUnit::sweepTarget() {
+    uint16_t delta = sweepFrequency >> (regs[0] & 7);
+    return (regs[0] & 0x08) ? sweepFrequency - delta : sweepFrequency + delta;
+}
+
+void AudioProcessingUnit::trigger(int index) {
+    AudioChannel &ch = channels[index];
+    uint8_t base = index * 5;
+    ch.enabled = ch.dacOn;
+    if(ch.length == 0)
+        ch.length = (index == 2) ? 256 : 64;
+    updatePeriod(index);
+    ch.countdown = ch.period;
+    if(index != 2) {
+        ch.volume = regs[base + 2] >> 4;
+        ch.envelopeTimer = (regs[base + 2] & 7) ? (regs[base + 2] & 7) : 8;
+    }
+
+    if(index == 0) {
+        uint8_t period = (regs[0] >> 4) & 7, shift = regs[0] & 7;
+        sweepFrequency = regs[3] | ((regs[4] & 7) << 8);
+        sweepTimer = period ? period : 8;
+        sweepEnabled = period || shift;
+        if(shift && sweepTarget() > 2047)
+            ch.enabled = false;
+    } else if(index == 2) {
+        ch.position = 0;
+    } else if(index == 3) {
+        lfsr = 0x7fff;
+    }
+}
+
+void AudioProcessingUnit::updatePeriod(int index) {
+    uint8_t base = index * 5;
+    if(index == 3) {
+        uint8_t polynomial = regs[base + 3];
+        uint8_t divisor = polynomial & 7;
+        channels[index].period = (divisor ? divisor * 16 : 8) << (polynomial >> 4);
+        return;
+    }
+    uint16_t frequency = regs[base + 3] | ((regs[base + 4] & 7) << 8);
+    channels[index].period = (2048 - frequency) * (index == 2 ? 2 : 4);
+}
+
+// Turning the APU off clears every register up to NR51 and stops all channels
+void AudioProcessingUnit::setPower(bool on) {
+    powered = on;
+    regs[AddrRegSoundOn - AddrRegAudioStart] = on << FlagSoundOn;
+    if(on) {
+        frameSequencerStep = 0;
+        frameSequencerCountdown = CyclesFrameSequencer;
+        return;
+    }
+    memset(regs, 0, AddrRegSoundOn - AddrRegAudioStart);
+    for(int i = 0; i < 4; i++) {
+        channels[i].enabled = false;
+        channels[i].dacOn = false;
+        channels[i].lengthEnabled = false;
+        updateOutput(i, 0);
+    }
+}
+
+void AudioProcessingUnit::queueSamples() {
+    const size_t chunk = 256;
+    int16_t frames[chunk * 2];
+    while(size_t available = left.SamplesAvailable()) {
+        size_t count = std::min(available, chunk);
+        left.ReadSamples(&frames[0], count, 2);
+        right.ReadSamples(&frames[1], count, 2);
+        droppedFrames += count - output.Write(frames, count);
+    }
+}
+
+uint8_t AudioProcessingUnit::Read(uint16_t addr) {
+    uint8_t index = addr - AddrRegAudioStart;
+    if(addr == AddrRegSoundOn) {
+        catchUp();
+        uint8_t status = (powered << FlagSoundOn) | ReadMasks[index];
+        for(int i = 0; i < 4; i++)
+            status |= channels[i].enabled << i;
+        return status;
+    }
+    if(addr >= AddrWaveRamStart)
+        return regs[index];
+    return regs[index] | (index < sizeof(ReadMasks) ? ReadMasks[index] : 0xff);
+}
+
+void AudioProcessingUnit::Write(uint16_t addr, uint8_t value) {
+    catchUp();
+    uint8_t index = addr - AddrRegAudioStart;
+    if(addr >= AddrWaveRamStart) {
+        regs[index] = value;
+        updateOutput(2, 0);
+        return;
+    }
+    if(addr == AddrRegSoundOn) {
+        if(((value >> FlagSoundOn) & 1) != powered)
+            setPower((value >> FlagSoundOn) & 1);
+        return;
+    }
+    if(!powered || addr > AddrRegSoundOn)
+        return;
+
+    regs[index] = value;
+    if(addr == AddrRegMasterVolume || addr == AddrRegSoundPanning) {
+        for(int i = 0; i < 4; i++)
+            updateOutput(i, 0);
+        return;
+    }
+
+    int i = index / 5;
+    AudioChannel &ch = channels[i];
+    switch(index % 5) {
+        case 0:
+            if(i == 2) {
+                ch.dacOn = value & 0x80;
+                ch.enabled &= ch.dacOn;
+            }
+            break;
+        case 1:
+            ch.length = (i == 2) ? 256 - value : 64 - (value & 0x3f);
+            break;
+        case 2:
+            if(i != 2) {
+                ch.dacOn = value & 0xf8;
+                ch.enabled &= ch.dacOn;
+            }
+            break;
+        case 3:
+            updatePeriod(i);
+            break;
+        case 4:
+            ch.lengthEnabled = value & 0x40;
+            updatePeriod(i);
+            if(value & 0x80)
+                trigger(i);
+            break;
+    }
+    updateOutput(i, 0);
+}
+
+void AudioProcessingUnit::Flush() {
+    catchUp();
+}
+
+AudioRingBuffer &AudioProcessingUnit::GetOutput() {
+    return output;
+}
+
+uint64_t AudioProcessingUnit::GetDroppedFrames() {
+    return droppedFrames;
+}
@@ -0,0 +1,134 @@
+#pragma once
+
+#include <atomic>
+#include <vector>
+
+#include "constants.h"
+#include "MMU.h"
+
+// Sound output.
+//
+// The APU does not run alongside the CPU. Cycle() only counts the cycles
+// that went by; the channels are brought up to date when a sound register is
+// accessed, when Flush() is called or once a frame's worth of cycles is
+// pending. Catching up walks each channel from one timer tick to the next and
+// records every change of its output level as a band-limited step, so the
+// cost follows the number of level changes rather than the number of cycles.
+
+const uint32_t AudioSampleRate = 48000;
+const size_t AudioRingFrames = 8192;           // about 170 ms at 48 kHz
+const uint32_t CyclesFrameSequencer = CyclesCpu / 512;
+const uint32_t CyclesAudioCatchUp = CyclesFrame;
+
+// Single producer, single consumer queue of interleaved stereo samples. The
+// emulator thread writes and the frontend's audio callback reads, without locks.
+class AudioRingBuffer {
+private:
+    std::vector<int16_t> samples;
+    size_t mask;
+    std::atomic<size_t> readIndex, writeIndex;     // in stereo frames, wrapping
+
+public:
+    AudioRingBuffer(size_t frames);
+    // Both return the number of stereo frames actually moved
+    size_t Write(const int16_t *frames, size_t count);
+    size_t Read(int16_t *frames, size_t count);
+    size_t Available();
+};
+
+// Band-limited step synthesis. A change of level is added as a windowed-sinc
+// impulse at its exact position between two output samples, and samples are
+// produced by integrating those impulses.
+class BandLimitedBuffer {
+private:
+    std::vector<int32_t> deltas;
+    uint64_t factor;        // output samples per cycle, 32.32 fixed point
+    uint64_t offset;        // position of the current frame start, 32.32
+    int32_t integrator;
+    int64_t dcLevel;        // running average removed by the high-pass, 16.16
+
+public:
+    BandLimitedBuffer(uint32_t clockRate, uint32_t sampleRate, size_t capacity);
+    // cycle is counted from the start of the current frame
+    void AddDelta(uint32_t cycle, int32_t delta);
+    // Makes the samples of the first cycles of the frame readable
+    void EndFrame(uint32_t cycles);
+    size_t SamplesAvailable();
+    size_t ReadSamples(int16_t *out, size_t count, size_t stride);
+};
+
+struct AudioChannel {
+    bool enabled;
+    bool dacOn;
+    bool lengthEnabled;
+    uint16_t length;
+    uint8_t volume;
+    uint8_t envelopeTimer;
+    uint32_t period;        // cycles per timer tick
+    uint32_t countdown;     // cycles to the next tick
+    uint8_t position;       // duty step or wave sample
+    int32_t left, right;    // level last added to each output
+};
+
+class AudioProcessingUnit {
+private:
+    MemoryManagementUnit *mmu;
+    uint8_t regs[0x30];
+    bool powered;
+    AudioChannel channels[4];
+    uint8_t frameSequencerStep;
+    uint32_t frameSequencerCountdown;
+
+    // Channel 1 frequency sweep
+    uint16_t sweepFrequency;
+    uint8_t sweepTimer;
+    bool sweepEnabled;
+    // Channel 4 shift register
+    uint16_t lfsr;
+
+    uint32_t pendingCycles;
+    BandLimitedBuffer left, right;
+    AudioRingBuffer output;
+    uint64_t droppedFrames;
+
+    void catchUp();
+    void runChannel(int index, uint32_t from, uint32_t to);
+    void tickChannel(int index);
+    uint8_t channelLevel(int index);
+    void updateOutput(int index, uint32_t cycle);
+    void clockFrameSequencer(uint32_t cycle);
+    void clockSweep();
+    uint16_t sweepTarget();
+    void trigger(int index);
+    void updatePeriod(int index);
+    void setPower(bool on);
+    void queueSamples();
+
+public:
+    AudioProcessingUnit(MemoryManagementUnit *mmu, uint32_t sampleRate = AudioSampleRate);
+    ~AudioProcessingUnit();
+
+    void Cycle(uint32_t cycles) {
+        pendingCycles += cycles;
+        if(pendingCycles >= CyclesAudioCatchUp)
+            catchUp();
+    }
+    // Called by the MMU for 0xFF10-0xFF3F
+    uint8_t Read(uint16_t addr);
+    void Write(uint16_t addr, uint8_t value);
+    // Runs the channels up to now and queues every finished sample
+    void Flush();
+
+    AudioRingBuffer &GetOutput();
+    // Stereo frames lost because the ring buffer was full
+    uint64_t GetDroppedFrames();
+};
+
+const uint16_t AddrRegAudioStart = 0xFF10;
+const uint16_t AddrRegAudioEnd = 0xFF3F;
+const uint16_t AddrRegMasterVolume = 0xFF24;
+const uint16_t AddrRegSoundPanning = 0xFF25;
+const uint16_t AddrRegSoundOn = 0xFF26;
+const uint16_t AddrWaveRamStart = 0xFF30;
+
+const uint8_t FlagSoundOn = 7;
@@ -0,0 +1,225 @@
+#include "Aot.h"
+#include "Cartridge.h"
+
+#include <algorithm>
+#include <cstdarg>
+
+// Same limit as decodeBlock, which ends a block after this many instructions
+static const size_t AotBlockOps = 32;
+
+static const char *const RegName[8] = {"b", "c", "d", "e", "h", "l", "(hl)", "a"};
+static const char *const AluName[8] = {"AotAdd", "AotAdc", "AotSub", "AotSbc", "AotAnd", "AotXor", "AotOr", "AotCp"};
+static const char *const ConditionTest[4] = {"!(f & 0x80)", "(f & 0x80)", "!(f & 0x10)", "(f & 0x10)"};
+
+static bool isUndefined(uint8_t op) {
+    switch (op) {
+        case 0xd3: case 0xdb: case 0xdd: case 0xe3: case 0xe4:
+        case 0xeb: case 0xec: case 0xed: case 0xf4: case 0xfc: case 0xfd:
+            return true;
+    }
+    return false;
+}
+
+static uint8_t instructionSize(uint8_t op) {
+    int x = op >> 6, z = op & 7;
+    switch (op) {
+        case 0x01: case 0x11: case 0x21: case 0x31: case 0x08:
+        case 0xc2: case 0xc3: case 0xc4: case 0xca: case 0xcc: case 0xcd:
+        case 0xd2: case 0xd4: case 0xda: case 0xdc: case 0xea: case 0xfa:
+            return 3;
+        case 0x10: case 0x18: case 0x20: case 0x28: case 0x30: case 0x38:
+        case 0xcb: case 0xe0: case 0xe8: case 0xf0: case 0xf8:
+            return 2;
+    }
+    if ((x == 0 || x == 3) && z == 6)
+        return 2;
+    return 1;
+}
+
+static std::string format(const char *pattern, ...) {
+    char line[256];
+    va_list args;
+    va_start(args, pattern);
+    vsnprintf(line, sizeof(line), pattern, args);
+    va_end(args);
+    return line;
+}
+
+// C++ for one register-only instruction, matching emitBody in Jit.cc
+static std::string emitBody(const uint8_t *code) {
+    uint8_t op = code[0];
+    int x = op >> 6, y = (op >> 3) & 7, z = op & 7;
+
+    if (op == 0x00)
+        return "";
+    if (x == 1)
+        return (y != z) ? format("%s = %s;", RegName[y], RegName[z]) : "";
+    if (x == 2)
+        return format("%s(a, %s, f);", AluName[y], RegName[z]);
+    if (x == 3)
+        return format("%s(a, 0x%02x, f);", AluName[y], code[1]);
+    if (z == 6)
+        return format("%s = 0x%02x;", RegName[y], code[1]);
+    if (z == 4 || z == 5)
+        return format("%s(%s, f);", z == 4 ? "AotInc" : "AotDec", RegName[y]);
+    if (z == 3) {
+        const char *hi = RegName[(y >> 1) * 2], *lo = RegName[(y >> 1) * 2 + 1];
+        return format("%s(%s, %s);", (y & 1) ? "AotDec16" : "AotInc16", hi, lo);
+    }
+    if (op == 0x2f)
+        return "a = ~a; f |= 0x60;";
+    if (op == 0x37)
+        return "f = (f & 0x80) | 0x10;";
+    if (op == 0x3f)
+        return "f = (f & 0x90) ^ 0x10;";
+    return "";
+}
+
+AotTranslator::AotTranslator(const std::vector<uint8_t> &r, const JitOptions &o) : rom(r), options(o) {
+}
+
+void AotTranslator::addEntry(uint16_t addr, std::vector<uint16_t> &work) {
+    if (addr >= 0x8000 || addr >= rom.size())
+        return;
+    if (entries.insert(addr).second)
+        work.push_back(addr);
+}
+
+size_t AotTranslator::pageLength(uint16_t addr) {
+    return std::min((size_t)(0x100 - (addr & 0xff)), rom.size() - addr);
+}
+
+// Walks the block starting at addr the way decodeBlock cuts it and queues
+// every address the cached engine can look a block up at afterwards
+void AotTranslator::traceFrom(uint16_t addr, std::vector<uint16_t> &work) {
+    RunPlan plan;
+    if (PlanRun(&rom[addr], pageLength(addr), addr, options, plan)) {
+        addEntry(plan.fallthrough, work);
+        if (plan.hasBranch)
+            addEntry(plan.target, work);
+    }
+
+    uint16_t page = addr >> 8;
+    for (size_t ops = 0; addr < 0x8000 && addr < rom.size(); ops++) {
+        uint8_t op = rom[addr];
+        uint8_t size = instructionSize(op);
+        if (isUndefined(op))
+            return;
+        if (ops == AotBlockOps || ((addr + size - 1) >> 8) != page || addr + size > rom.size()) {
+            addEntry(addr, work);
+            return;
+        }
+
+        uint16_t next = addr + size;
+        uint16_t immediate = (size == 3) ? (rom[addr + 1] | (rom[addr + 2] << 8)) : 0;
+        switch (op) {
+            case 0x18:
+                addEntry(next + (int8_t)rom[addr + 1], work);
+                return;
+            case 0x20: case 0x28: case 0x30: case 0x38:
+                addEntry(next + (int8_t)rom[addr + 1], work);
+                addEntry(next, work);
+                return;
+            case 0xc3:
+                addEntry(immediate, work);
+                return;
+            case 0xc2: case 0xca: case 0xd2: case 0xda:
+            case 0xc4: case 0xcc: case 0xd4: case 0xdc: case 0xcd:
+                addEntry(immediate, work);
+                addEntry(next, work);
+                return;
+            case 0xc7: case 0xcf: case 0xd7: case 0xdf: case 0xe7: case 0xef: case 0xf7: case 0xff:
+                addEntry(op & 0x38, work);
+                addEntry(next, work);
+                return;
+            case 0xc9: case 0xd9: case 0xe9:
+                return;
+            case 0xc0: case 0xc8: case 0xd0: case 0xd8: case 0x10: case 0x76:
+                addEntry(next, work);
+                return;
+        }
+        addr = next;
+    }
+}
+
+void AotTranslator::Trace() {
+    std::vector<uint16_t> work;
+    addEntry(0x100, work);
+    for (uint16_t vector = 0x00; vector <= 0x60; vector += 8)
+        addEntry(vector, work);
+
+    while (!work.empty()) {
+        uint16_t addr = work.back();
+        work.pop_back();
+        traceFrom(addr, work);
+    }
+}
+
+std::string AotTranslator::emitRun(uint16_t addr, const RunPlan &plan) {
+    std::string out = format("static void run%d_%04x(JitState *s, const uint8_t *) {\n", addr >= 0x4000, addr);
+    out += "    uint8_t a = s->a, b = s->b, c = s->c, d = s->d, e = s->e, h = s->h, l = s->l, f = s->f;\n";
+    out += "    uint32_t cycles = 0;\n";
+    out += "    for (;;) {\n";
+
+    uint16_t at = addr;
+    for (size_t i = 0; i < plan.bodyOps; i++) {
+        std::string body = emitBody(&rom[at]);
+        std::string bytes;
+        for (uint8_t j = 0; j < instructionSize(rom[at]); j++)
+            bytes += format(" %02x", rom[at + j]);
+        if (body.empty())
+            out += format("        // %04x:%s\n", at, bytes.c_str());
+        else
+            out += format("        %-40s// %04x:%s\n", body.c_str(), at, bytes.c_str());
+        at += instructionSize(rom[at]);
+    }
+
+    if (!plan.hasBranch) {
+        out += format("        cycles += %u;\n        s->pc = 0x%04x;\n        break;\n", plan.bodyCycles, plan.fallthrough);
+    } else {
+        uint32_t taken = plan.bodyCycles + plan.branchCycles;
+        std::string indent = (plan.condition >= 0) ? "            " : "        ";
+        if (plan.condition >= 0)
+            out += format("        if (%s) {\n", ConditionTest[plan.condition]);
+        out += indent + format("cycles += %u;\n", taken);
+        if (plan.loops)
+            out += indent + format("if (cycles <= %u)\n", JitMaxRunCycles - taken) + indent + "    continue;\n";
+        out += indent + format("s->pc = 0x%04x;\n", plan.target) + indent + "break;\n";
+        if (plan.condition >= 0) {
+            out += "        }\n";
+            out += format("        cycles += %u;\n        s->pc = 0x%04x;\n        break;\n",
+                plan.bodyCycles + plan.branchNotTakenCycles, plan.fallthrough);
+        }
+    }
+
+    out += "    }\n";
+    out += "    s->a = a, s->b = b, s->c = c, s->d = d, s->e = e, s->h = h, s->l = l, s->f = f;\n";
+    out += "    s->cycles = cycles;\n";
+    out += "}\n\n";
+    return out;
+}
+
+size_t AotTranslator::Write(FILE *out, const std::string &symbol, const std::string &name) {
+    Cartridge cartridge(rom);
+    fprintf(out, "// Generated by picoboyaotgen from %s, do not edit\n\n", name.c_str());
+    fprintf(out, "#include \"Aot.h\"\n\n");
+
+    std::vector<uint16_t> runs;
+    for (uint16_t addr : entries) {
+        RunPlan plan;
+        if (!PlanRun(&rom[addr], pageLength(addr), addr, options, plan))
+            continue;
+        fputs(emitRun(addr, plan).c_str(), out);
+        runs.push_back(addr);
+    }
+
+    fprintf(out, "static const AotBlock blocks[] = {\n");
+    for (uint16_t addr : runs)
+        fprintf(out, "    {%d, 0x%04x, run%d_%04x},\n", addr >= 0x4000, addr, addr >= 0x4000, addr);
+    fprintf(out, "    {0, 0, nullptr},\n};\n\n");
+
+    fprintf(out, "extern const AotImage %s;\n", symbol.c_str());
+    fprintf(out, "const AotImage %s = {\"%s\", 0x%08x, {%u, %zu, %s}, blocks, %zu};\n", symbol.c_str(), name.c_str(),
+        cartridge.GetRomHash(), options.threshold, options.maxOps, options.loops ? "true" : "false", runs.size());
+    return runs.size();
+}
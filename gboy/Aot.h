@@ -0,0 +1,82 @@
+#pragma once
+
+#include <cstdio>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "Jit.h"
+
+// Ahead-of-time recompilation of a ROM into C++.
+//
+// AotTranslator traces the code reachable from the entry points of a ROM and
+// writes a C++ source with one function per run, picked by PlanRun exactly
+// like the JIT picks them and following the JitState run ABI. The generated
+// file defines an AotImage that is linked into a specialized build; the
+// cached engine then calls those functions where the JIT would have compiled
+// a run. Code in RAM, banks other than 1 and addresses the trace did not
+// reach fall back to the cached engine. No code is generated at run time, so
+// the same source also builds for hosts without a JIT.
+
+struct AotBlock {
+    uint8_t bank;           // 0 for 0x0000-0x3FFF, the switchable bank above
+    uint16_t addr;
+    JitRunFunction run;
+};
+
+struct AotImage {
+    const char *name;
+    uint32_t romHash;       // Cartridge::GetRomHash of the ROM it was built from
+    JitOptions options;
+    const AotBlock *blocks;
+    size_t count;
+};
+
+// Flag helpers for generated code. F is kept in the SM83 layout.
+inline uint8_t AotZero(uint8_t value) { return value ? 0 : 0x80; }
+
+inline void AotAdd(uint8_t &a, uint8_t value, uint8_t &f, uint8_t carry = 0) {
+    uint32_t result = a + value + carry;
+    f = AotZero(result) | (((a & 0xf) + (value & 0xf) + carry > 0xf) ? 0x20 : 0) | (result > 0xff ? 0x10 : 0);
+    a = result;
+}
+inline void AotAdc(uint8_t &a, uint8_t value, uint8_t &f) { AotAdd(a, value, f, (f >> 4) & 1); }
+
+inline uint8_t AotSubtract(uint8_t a, uint8_t value, uint8_t &f, uint8_t carry = 0) {
+    uint8_t result = a - value - carry;
+    f = AotZero(result) | 0x40 | (((a & 0xf) < (value & 0xf) + carry) ? 0x20 : 0) | ((a < value + carry) ? 0x10 : 0);
+    return result;
+}
+inline void AotSub(uint8_t &a, uint8_t value, uint8_t &f) { a = AotSubtract(a, value, f); }
+inline void AotSbc(uint8_t &a, uint8_t value, uint8_t &f) { a = AotSubtract(a, value, f, (f >> 4) & 1); }
+inline void AotCp(uint8_t a, uint8_t value, uint8_t &f) { AotSubtract(a, value, f); }
+
+inline void AotAnd(uint8_t &a, uint8_t value, uint8_t &f) { a &= value; f = AotZero(a) | 0x20; }
+inline void AotXor(uint8_t &a, uint8_t value, uint8_t &f) { a ^= value; f = AotZero(a); }
+inline void AotOr(uint8_t &a, uint8_t value, uint8_t &f) { a |= value; f = AotZero(a); }
+
+inline void AotInc(uint8_t &r, uint8_t &f) { r++; f = (f & 0x10) | AotZero(r) | ((r & 0xf) == 0 ? 0x20 : 0); }
+inline void AotDec(uint8_t &r, uint8_t &f) { r--; f = (f & 0x10) | AotZero(r) | 0x40 | ((r & 0xf) == 0xf ? 0x20 : 0); }
+
+inline void AotInc16(uint8_t &hi, uint8_t &lo) { if (++lo == 0) hi++; }
+inline void AotDec16(uint8_t &hi, uint8_t &lo) { if (lo-- == 0) hi--; }
+
+class AotTranslator {
+private:
+    std::vector<uint8_t> rom;
+    JitOptions options;
+    std::set<uint16_t> entries;     // addresses the cached engine can start a block at
+
+    void addEntry(uint16_t addr, std::vector<uint16_t> &work);
+    void traceFrom(uint16_t addr, std::vector<uint16_t> &work);
+    size_t pageLength(uint16_t addr);
+    std::string emitRun(uint16_t addr, const RunPlan &plan);
+
+public:
+    AotTranslator(const std::vector<uint8_t> &rom, const JitOptions &options = JitDefaultOptions);
+
+    // Follows the control flow from the reset and interrupt vectors
+    void Trace();
+    // Writes the C++ source defining the AotImage symbol; returns the number of runs
+    size_t Write(FILE *out, const std::string &symbol, const std::string &name);
+};
@@ -1,14 +1,45 @@
 #include "CPU.h"
+#include <algorithm>
+#include <functional>
+#include "Instrument.h"
+#include "Log.h"
 
 CentralProcessingUnit::CentralProcessingUnit(MemoryManagementUnit *m) {
     mmu = m;
     isHalted = false;
     programCounter = 0x00;
-    isZero = isSubtract = isCarry = isHalfCarry = false;
+    flags = 0;
+    lazyOp = LazyNone;
     stackPointer = 0x0;
     time = deltaTime = 0;
     interruptMasterFlag = false;
+    interruptEnablePending = false;
+    interruptEnabledNow = false;
     accumulator = b = c = d = e = h = l = 0;
+    engine = EngineInterpreter;
+    jit = nullptr;
+    jitOptions = JitDefaultOptions;
+    aotOptions = JitDefaultOptions;
+    currentBlock = nullptr;
+    currentOp = 0;
+    nextOpAddress = 0;
+    fetchPage = nullptr;
+    fetchPageIndex = 0x100;
+    fetchMappingVersion = 0;
+    eventHorizon = nullptr;
+    eventHorizonContext = nullptr;
+    fusion = true;
+    lastOpcode = 0;
+    profiler = nullptr;
+    tracer = nullptr;
+    debugger = nullptr;
+    if(!mmu->IsBootRomEnabled()) {
+        // Register state left behind by the DMG boot ROM
+        accumulator = 0x01, b = 0x00, c = 0x13, d = 0x00, e = 0xd8, h = 0x01, l = 0x4d;
+        SetFlags(0xb0);
+        stackPointer = 0xfffe;
+        programCounter = 0x100;
+    }
     const std::string regName[8] = {"B", "C", "D", "E", "H", "L", "(HL)", "A"};
 
     instructionSet[0x0] = new Instruction("NOP", 1, 4, &CentralProcessingUnit::instruction_NOP);
@@ -46,8 +77,8 @@ CentralProcessingUnit::CentralProcessingUnit(MemoryManagementUnit *m) {
 
     for (int i = 0; i < 64; i++) {
         std::string name = std::to_string(i/8) + "," + regName[i%8];
-        instructionSet[0x40 + i] = new Instruction("LD " + regName[i/8] + "," + regName[i%8], 1, (i%8) == 6 ? 8 : 4, &CentralProcessingUnit::instruction_LoadReg2Reg);
-        instructionSetExtended[0x40 + i] = new Instruction("BIT " + name, 1, (i%8) == 6 ? 16 : 8, &CentralProcessingUnit::instruction_CheckBit);
+        instructionSet[0x40 + i] = new Instruction("LD " + regName[i/8] + "," + regName[i%8], 1, ((i%8) == 6 || (i/8) == 6) ? 8 : 4, &CentralProcessingUnit::instruction_LoadReg2Reg);
+        instructionSetExtended[0x40 + i] = new Instruction("BIT " + name, 1, (i%8) == 6 ? 12 : 8, &CentralProcessingUnit::instruction_CheckBit);
         instructionSetExtended[0x80 + i] = new Instruction("RES " + name, 1, (i%8) == 6 ? 16 : 8, &CentralProcessingUnit::instruction_ResetBit);
         instructionSetExtended[0xc0 + i] = new Instruction("SET " + name, 1, (i%8) == 6 ? 16 : 8, &CentralProcessingUnit::instruction_SetBit);
     }
@@ -96,8 +127,8 @@ CentralProcessingUnit::CentralProcessingUnit(MemoryManagementUnit *m) {
     instructionSet[0xc4] = new Instruction("CALL NZ nn", 3, 12, &CentralProcessingUnit::instruction_Call);
     instructionSet[0xcc] = new Instruction("CALL Z nn", 3, 12, &CentralProcessingUnit::instruction_Call);
     instructionSet[0xcd] = new Instruction("CALL nn", 3, 24, &CentralProcessingUnit::instruction_Call);
-    instructionSet[0xd4] = new Instruction("CALL NC nn", 3, 24, &CentralProcessingUnit::instruction_Call);
-    instructionSet[0xdc] = new Instruction("CALL C nn", 3, 24, &CentralProcessingUnit::instruction_Call);
+    instructionSet[0xd4] = new Instruction("CALL NC nn", 3, 12, &CentralProcessingUnit::instruction_Call);
+    instructionSet[0xdc] = new Instruction("CALL C nn", 3, 12, &CentralProcessingUnit::instruction_Call);
 
     instructionSet[0xc5] = new Instruction("PUSH BC", 1, 16, &CentralProcessingUnit::instruction_Push);
     instructionSet[0xd5] = new Instruction("PUSH DE", 1, 16, &CentralProcessingUnit::instruction_Push);
@@ -151,6 +182,7 @@ CentralProcessingUnit::CentralProcessingUnit(MemoryManagementUnit *m) {
     instructionSet[0xff] = new Instruction("RST 38h", 1, 16, &CentralProcessingUnit::instruction_Reset);
 
     instructionSet[0x27] = new Instruction("DAA", 1, 4, &CentralProcessingUnit::instruction_DAA);
+    instructionSet[0xe8] = new Instruction("ADD SP,i8", 2, 16, &CentralProcessingUnit::instruction_AddSP);
     instructionSet[0xf8] = new Instruction("LD HL,SP+i8", 2, 12, &CentralProcessingUnit::instruction_LoadHL);
     instructionSet[0xf9] = new Instruction("LD SP,HL", 1, 8, &CentralProcessingUnit::instruction_LoadSPHL);
 
@@ -158,12 +190,10 @@ CentralProcessingUnit::CentralProcessingUnit(MemoryManagementUnit *m) {
     instructionSet[0x76] = new Instruction("HALT", 1, 4, &CentralProcessingUnit::instruction_Halt);
     instructionSet[0xf4] = new Instruction("UNDEF", 1, 4, &CentralProcessingUnit::instruction_NOP);
     instructionSet[0xd3] = new Instruction("UNDEF", 1, 4, &CentralProcessingUnit::instruction_NOP);
-    instructionSet[0xd8] = new Instruction("UNDEF", 1, 4, &CentralProcessingUnit::instruction_NOP);
     instructionSet[0xdb] = new Instruction("UNDEF", 1, 4, &CentralProcessingUnit::instruction_NOP);
     instructionSet[0xdd] = new Instruction("UNDEF", 1, 4, &CentralProcessingUnit::instruction_NOP);
     instructionSet[0xe3] = new Instruction("UNDEF", 1, 4, &CentralProcessingUnit::instruction_NOP);
     instructionSet[0xe4] = new Instruction("UNDEF", 1, 4, &CentralProcessingUnit::instruction_NOP);
-    instructionSet[0xe8] = new Instruction("UNDEF", 1, 4, &CentralProcessingUnit::instruction_NOP);
     instructionSet[0xec] = new Instruction("UNDEF", 1, 4, &CentralProcessingUnit::instruction_NOP);
     instructionSet[0xed] = new Instruction("UNDEF", 1, 4, &CentralProcessingUnit::instruction_NOP);
     instructionSet[0xeb] = new Instruction("UNDEF", 1, 4, &CentralProcessingUnit::instruction_NOP);
@@ -180,27 +210,89 @@ CentralProcessingUnit::CentralProcessingUnit(MemoryManagementUnit *m) {
 }
 
 CentralProcessingUnit::~CentralProcessingUnit() {
-}
-
-uint8_t CentralProcessingUnit::getFlags() {
-	uint8_t val = 0;
-	val |= (((uint8_t)isZero) << 7);
-	val |= (((uint8_t)isSubtract) << 6);
-	val |= (((uint8_t)isHalfCarry) << 5);
-	val |= (((uint8_t)isCarry) << 4);
-	return val & 0xf0;
+    FlushBlockCache();
+    delete jit;
+}
+
+uint8_t CentralProcessingUnit::packFlags(bool zero, bool subtract, bool halfCarry, bool carry) {
+    return (zero << FlagCpuZero) | (subtract << FlagCpuSubtract) | (halfCarry << FlagCpuHalfCarry) | (carry << FlagCpuCarry);
+}
+
+void CentralProcessingUnit::setLazyFlags(uint8_t op, uint8_t left, uint8_t right, uint8_t result) {
+    lazyOp = op;
+    lazyLeft = left;
+    lazyRight = right;
+    lazyResult = result;
+}
+
+uint8_t CentralProcessingUnit::GetFlags() {
+    uint8_t zero = (lazyResult == 0);
+    switch (lazyOp) {
+    case LazyNone:
+        return flags;
+    case LazyAdd:
+        flags = packFlags(zero, false, (lazyLeft & 0xf) + (lazyRight & 0xf) > 0xf, lazyLeft + lazyRight > 0xff);
+        break;
+    case LazyAdc:
+        flags = packFlags(zero, false, (lazyLeft & 0xf) + (lazyRight & 0xf) + lazyCarry > 0xf, lazyLeft + lazyRight + lazyCarry > 0xff);
+        break;
+    case LazySub:
+        flags = packFlags(zero, true, (lazyLeft & 0xf) < (lazyRight & 0xf), lazyLeft < lazyRight);
+        break;
+    case LazySbc:
+        flags = packFlags(zero, true, (lazyLeft & 0xf) < (lazyRight & 0xf) + lazyCarry, lazyLeft < lazyRight + lazyCarry);
+        break;
+    case LazyAnd:
+        flags = packFlags(zero, false, true, false);
+        break;
+    case LazyLogic:
+        flags = packFlags(zero, false, false, false);
+        break;
+    case LazyInc:
+        flags = packFlags(zero, false, (lazyResult & 0xf) == 0, lazyCarry);
+        break;
+    case LazyDec:
+        flags = packFlags(zero, true, (lazyResult & 0xf) == 0xf, lazyCarry);
+        break;
+    }
+    lazyOp = LazyNone;
+    return flags;
+}
+
+bool CentralProcessingUnit::zeroFlag() {
+    if (lazyOp == LazyNone)
+        return check_bit(flags, FlagCpuZero);
+    return lazyResult == 0;
+}
+
+bool CentralProcessingUnit::carryFlag() {
+    switch (lazyOp) {
+    case LazyAdd:
+        return lazyLeft + lazyRight > 0xff;
+    case LazyAdc:
+        return lazyLeft + lazyRight + lazyCarry > 0xff;
+    case LazySub:
+        return lazyLeft < lazyRight;
+    case LazySbc:
+        return lazyLeft < lazyRight + lazyCarry;
+    case LazyAnd:
+    case LazyLogic:
+        return false;
+    case LazyInc:
+    case LazyDec:
+        return lazyCarry;
+    default:
+        return check_bit(flags, FlagCpuCarry);
+    }
 }
 
 bool CentralProcessingUnit::check_bit(const uint8_t value, const uint8_t bit) {
     return (value & (1 << bit)) != 0;
 }
 
-void CentralProcessingUnit::setFlags(uint8_t val) {
-    val &= 0xf0;
-	isZero        = (val >> 7) & 1;
-	isSubtract   = (val >> 6) & 1;
-	isHalfCarry   = (val >> 5) & 1;
-	isCarry       = (val >> 4) & 1;
+void CentralProcessingUnit::SetFlags(uint8_t val) {
+    flags = val & 0xf0;
+    lazyOp = LazyNone;
 }
 
 void CentralProcessingUnit::stackPush(uint16_t val) {
@@ -222,15 +314,6 @@ uint16_t CentralProcessingUnit::stackPop() {
     return stitch(hi, lo);
 }
 
-void CentralProcessingUnit::setHL(uint16_t addr) {
-    h = (addr >> 8) & 0xff;
-    l = addr & 0xff;
-}
-
-uint16_t CentralProcessingUnit::getHL() {
-    return stitch(h, l);
-}
-
 uint16_t CentralProcessingUnit::stitch(uint8_t hi, uint8_t lo) {
     return ((((uint16_t)hi) << 8) | lo);
 }
@@ -244,167 +327,657 @@ void CentralProcessingUnit::Print() {
 	printf("├───────────────┼───────────────┤\n");
 	printf("│ sp = %04x\t│ pc = %04x\t│\n", stackPointer, programCounter);
 	printf("├───────────────┼───────────────┤\n");
-	printf("│ zero = %u\t│ subtract = %u\t│\n", isZero, isSubtract);
-	printf("│ carry = %u\t│ hcarry = %u\t│\n", isCarry, isHalfCarry);
+	uint8_t f = GetFlags();
+	printf("│ zero = %u\t│ subtract = %u\t│\n", check_bit(f, FlagCpuZero), check_bit(f, FlagCpuSubtract));
+	printf("│ carry = %u\t│ hcarry = %u\t│\n", check_bit(f, FlagCpuCarry), check_bit(f, FlagCpuHalfCarry));
 	printf("└───────────────┴───────────────┘\n");
 }
 
+// Fetches go through a cached pointer to the current code page, refreshed when
+// the PC leaves the page or the memory mapping changes
 uint8_t CentralProcessingUnit::readMemoryFromProgramCounter() {
-    uint8_t val = mmu->Read(programCounter);
+    uint16_t page = programCounter >> 8;
+    if(page != fetchPageIndex || fetchMappingVersion != mmu->GetMappingVersion()) {
+        fetchPage = mmu->GetReadPage(programCounter);
+        fetchPageIndex = page;
+        fetchMappingVersion = mmu->GetMappingVersion();
+    }
+    uint8_t val = fetchPage ? fetchPage[programCounter & 0xff] : mmu->Peek(programCounter);
     programCounter++;
     return val;
 }
 
-uint8_t CentralProcessingUnit::ExecuteInstruction(uint16_t skipDebug) {
-    bool debug = (programCounter >= skipDebug);
+uint8_t CentralProcessingUnit::ExecuteInstruction() {
+    if(debugger && debugger->IsStopped())
+        return 0;
     deltaTime = 0;
-    memset(data, 0, sizeof(data));
     handleInterrupts();
+    // EI only takes effect once the instruction after it has run
+    interruptEnabledNow = interruptEnablePending;
+    if(interruptEnablePending) {
+        interruptMasterFlag = true;
+        interruptEnablePending = false;
+    }
 
-    if(isHalted)
-        return 1;
+    if(isHalted) {
+        // HALT ends once an enabled interrupt is requested, even with IME off
+        if(!mmu->GetPendingInterrupts())
+            return 4;
+        isHalted = false;
+    }
+    // After the interrupt dispatch, so a breakpoint on a vector stops there
+    if(debugger && debugger->CheckBreakpoint(programCounter))
+        return 0;
 
-    if(debug) 
-        printf("Executing at 0x%04x", programCounter);
+    if(engine != EngineInterpreter)
+        return executeCached();
+    return executeInterpreted();
+}
+
+uint8_t CentralProcessingUnit::executeInterpreted() {
+    uint16_t pc = programCounter;
+    memset(data, 0, sizeof(data));
     uint16_t opcode = readMemoryFromProgramCounter();
-    if(debug) 
-        printf(", OpCode: 0x%02x", opcode);
     bool isExtended = false;
     if(opcode == 0xcb) {
-        if(debug) 
-            printf("Executing at 0x%04x", programCounter);
         opcode = readMemoryFromProgramCounter();
         isExtended = true;
-        if(debug) 
-            printf(", ExtOpCode: 0x%02x", opcode);
     }
 
+    if(!pairCounts.empty())
+        countPair(isExtended ? 0x100 | opcode : opcode);
+    PICOBOY_COUNT(opcodes[isExtended ? 0x100 | opcode : opcode], 1);
+
     std::map<uint16_t, Instruction*> &iset = isExtended ? instructionSetExtended : instructionSet;
     std::map<uint16_t, Instruction*>::iterator it = iset.find(opcode);
     if (it != iset.end()) {
         Instruction *inst = it->second;
-        if(debug) printf(", Name: %s, ", inst->name.c_str());
-        if(debug && inst->size > 1) printf("Data: ");
-        for (size_t i = 0; i < inst->size; i++) {
+        for (size_t i = 0; i < inst->size; i++)
             data[i] = (i == 0) ? opcode : readMemoryFromProgramCounter();
-            if(debug && i > 0) printf("%d, ", data[i]);
-        }
-        if(debug) printf("\n");
-        
+        if(tracer)
+            traceInstruction(pc, isExtended ? 0x100 | opcode : opcode, &data[1], inst->size - 1);
+
         deltaTime = inst->cycles;
         (this->*(inst->code))(data);
+        if(profiler)
+            profiler->Count(GetCodeBank(pc), pc, deltaTime);
 
         time += deltaTime;
     } else {
-        printf("OpCode Not Implemented at 0x%04x, OpCode: 0x%02x Ext: %d\n", programCounter, opcode, isExtended);
+        // The log is flushed by exit()
+        PICOBOY_LOG(LogError, LogCpu, "OpCode Not Implemented at 0x%04x, OpCode: 0x%02x Ext: %d", programCounter, opcode, isExtended);
         exit(0);
     }
 
-    // if(debug) Print();
     return deltaTime;
 }
 
-void CentralProcessingUnit::handleInterrupts() {
-    if(!interruptMasterFlag)
+// Runs the next pre-decoded instruction, one per call like the interpreter so
+// the PPU and timer still step between instructions
+uint8_t CentralProcessingUnit::executeCached() {
+    if(currentBlock == nullptr || programCounter != nextOpAddress || currentOp >= currentBlock->ops.size()
+        || (currentBlock->isRam && mmu->GetWriteVersion(programCounter) != currentBlock->version)) {
+        currentBlock = lookupBlock(programCounter);
+        currentOp = 0;
+        if(currentBlock == nullptr)
+            return executeInterpreted();
+        // Compiled runs and fused groups would hide instructions from the
+        // trace and run past breakpoints
+        if(engine == EngineJit && !tracer && !debugger && compileBlock(currentBlock, programCounter)
+            && runFitsHorizon(currentBlock) && !interruptDueNext())
+            return executeRun(currentBlock);
+        if(engine == EngineAot && !tracer && !debugger && attachAotRun(currentBlock, programCounter)
+            && runFitsHorizon(currentBlock) && !interruptDueNext())
+            return executeRun(currentBlock);
+    }
+
+    const DecodedOp *group = &currentBlock->ops[currentOp];
+    if(group->fused && fusion && !tracer && !debugger && eventHorizon && group->fusedLeadCycles < eventHorizon(eventHorizonContext)
+        && !interruptDueNext()) {
+        uint16_t start = programCounter;
+        programCounter += group->fusedSize;
+        nextOpAddress = programCounter;
+        if((this->*(group->fused))(group)) {
+            if(profiler) {
+                // Each op keeps its own cycles; the last one takes the rest
+                uint16_t pc = start;
+                uint32_t lead = 0;
+                for(size_t i = 0; i + 1 < group->fusedOps; i++) {
+                    profiler->Count(GetCodeBank(pc), pc, group[i].cycles);
+                    lead += group[i].cycles;
+                    pc += group[i].size;
+                }
+                profiler->Count(GetCodeBank(pc), pc, deltaTime - lead);
+            }
+#ifdef PICOBOY_INSTRUMENT
+            for(size_t i = 0; i < group->fusedOps; i++)
+                PICOBOY_COUNT(opcodes[group[i].opcode], 1);
+#endif
+            // Only once the group ran: otherwise its ops run, and are
+            // counted, one at a time
+            if(!pairCounts.empty()) {
+                for(size_t i = 0; i < group->fusedOps; i++)
+                    countPair(group[i].opcode);
+            }
+            currentOp += group->fusedOps;
+            time += deltaTime;
+            return deltaTime;
+        }
+        programCounter -= group->fusedSize;
+    }
+
+    const DecodedOp &op = currentBlock->ops[currentOp++];
+    PICOBOY_COUNT(opcodes[op.opcode], 1);
+    if(!pairCounts.empty())
+        countPair(op.opcode);
+    uint16_t pc = programCounter;
+    if(tracer)
+        traceInstruction(pc, op.opcode, &op.data[1], (op.opcode & 0x100) ? 0 : op.size - 1);
+    programCounter += op.size;
+    nextOpAddress = programCounter;
+    deltaTime = op.cycles;
+    (this->*(op.code))((uint8_t*)op.data);
+    if(profiler)
+        profiler->Count(GetCodeBank(pc), pc, deltaTime);
+
+    time += deltaTime;
+    return deltaTime;
+}
+
+// Control transfers, and HALT/STOP which stop execution
+static bool endsBlock(uint8_t opcode) {
+    switch(opcode) {
+        case 0x10: case 0x76:
+        case 0x18: case 0x20: case 0x28: case 0x30: case 0x38:
+        case 0xc2: case 0xc3: case 0xca: case 0xd2: case 0xda: case 0xe9:
+        case 0xc4: case 0xcc: case 0xcd: case 0xd4: case 0xdc:
+        case 0xc0: case 0xc8: case 0xc9: case 0xd0: case 0xd8: case 0xd9:
+        case 0xc7: case 0xcf: case 0xd7: case 0xdf: case 0xe7: case 0xef: case 0xf7: case 0xff:
+            return true;
+    }
+    return false;
+}
+
+// ROM, VRAM, WRAM and HRAM; the boot ROM overlay and echo/IO space always
+// go through the interpreter
+bool CentralProcessingUnit::isCacheable(uint16_t addr) {
+    if(addr < 0x100)
+        return !mmu->IsBootRomEnabled();
+    return addr < 0xE000 || (addr >= 0xFF80 && addr != 0xFFFF);
+}
+
+CentralProcessingUnit::DecodedBlock *CentralProcessingUnit::lookupBlock(uint16_t addr) {
+    if(!isCacheable(addr))
+        return nullptr;
+
+    uint32_t bank = (addr >= 0x4000 && addr <= 0x7FFF) ? mmu->GetRomBank() : 0;
+    DecodedBlock *&block = blockCache[(bank << 16) | addr];
+    if(block == nullptr) {
+        block = new DecodedBlock();
+        decodeBlock(block, addr);
+    } else if(block->isRam && mmu->GetWriteVersion(addr) != block->version)
+        decodeBlock(block, addr);
+
+    return block->ops.empty() ? nullptr : block;
+}
+
+void CentralProcessingUnit::decodeBlock(DecodedBlock *block, uint16_t addr) {
+    const size_t MaxBlockOps = 32;
+    uint16_t page = addr >> 8;
+
+    block->ops.clear();
+    block->hits = 0;
+    block->run = nullptr;
+    block->runFailed = false;
+    block->runCycles = JitMaxRunCycles;
+    block->isRam = addr >= 0x8000;
+    block->version = mmu->GetWriteVersion(addr);
+
+    while(block->ops.size() < MaxBlockOps && isCacheable(addr)) {
+        uint8_t opcode = mmu->Peek(addr);
+        bool isExtended = (opcode == 0xcb);
+        std::map<uint16_t, Instruction*> &iset = isExtended ? instructionSetExtended : instructionSet;
+        uint8_t first = isExtended ? mmu->Peek(addr + 1) : opcode;
+        std::map<uint16_t, Instruction*>::iterator it = iset.find(first);
+        if(it == iset.end())
+            break;
+
+        Instruction *inst = it->second;
+        uint8_t size = inst->size + (isExtended ? 1 : 0);
+        if(((addr + size - 1) >> 8) != page)
+            break;
+
+        DecodedOp op;
+        op.code = inst->code;
+        op.size = size;
+        op.cycles = inst->cycles;
+        op.data[0] = first;
+        op.data[1] = (inst->size > 1) ? mmu->Peek(addr + (isExtended ? 2 : 1)) : 0;
+        op.data[2] = (inst->size > 2) ? mmu->Peek(addr + (isExtended ? 3 : 2)) : 0;
+        op.opcode = isExtended ? 0x100 | first : first;
+        op.fused = nullptr;
+        op.fusedOps = op.fusedSize = op.fusedLeadCycles = 0;
+        block->ops.push_back(op);
+        addr += size;
+
+        if(!isExtended && endsBlock(opcode))
+            break;
+    }
+    fuseBlock(block);
+}
+
+// Marks the groups picked from pair profiles of the workloads and test ROMs:
+// block copies, counted loops, compare and branch, register polling and
+// 16-bit counter tests
+void CentralProcessingUnit::fuseBlock(DecodedBlock *block) {
+    std::vector<DecodedOp> &ops = block->ops;
+    for(size_t i = 0; i + 1 < ops.size(); i++) {
+        uint16_t first = ops[i].opcode, second = ops[i + 1].opcode;
+        uint16_t third = (i + 2 < ops.size()) ? ops[i + 2].opcode : 0xffff;
+        bool isJumpZero = (second == 0x20 || second == 0x28);
+        bool (CentralProcessingUnit::*fused)(const DecodedOp *ops) = nullptr;
+        uint8_t count = 2;
+
+        if((first == 0x2a || first == 0x3a) && (second == 0x02 || second == 0x12)) {
+            fused = &CentralProcessingUnit::fused_LoadHLStore;
+        } else if(first < 0x100 && (first & 0xc7) == 0x05 && first != 0x35 && second == 0x20) {
+            fused = &CentralProcessingUnit::fused_DecJumpNotZero;
+        } else if(first == 0xfe && isJumpZero) {
+            fused = &CentralProcessingUnit::fused_CompareJump;
+        } else if(first == 0xf0 && second == 0xfe && (third == 0x20 || third == 0x28)) {
+            fused = &CentralProcessingUnit::fused_PollCompareJump;
+            count = 3;
+        } else if((first == 0x78 || first == 0x7a || first == 0x7c) && second == first + 0x39 && (third == 0x20 || third == 0x28)) {
+            fused = &CentralProcessingUnit::fused_PairTestJump;
+            count = 3;
+        }
+        if(fused == nullptr)
+            continue;
+
+        DecodedOp &head = ops[i];
+        head.fused = fused;
+        head.fusedOps = count;
+        head.fusedSize = head.fusedLeadCycles = 0;
+        for(size_t j = i; j < i + count; j++) {
+            head.fusedSize += ops[j].size;
+            if(j + 1 < i + count)
+                head.fusedLeadCycles += ops[j].cycles;
+        }
+    }
+}
+
+// LD A,(HL+/-) then LD (BC/DE),A
+bool CentralProcessingUnit::fused_LoadHLStore(const DecodedOp *ops) {
+    uint16_t dest = (ops[1].opcode == 0x12) ? de : bc;
+    // An IO write has to see the PPU and timer stepped past the load first
+    if(dest >= 0xff00)
+        return false;
+    accumulator = mmu->Read(hl);
+    hl += (ops[0].opcode == 0x2a) ? 1 : -1;
+    mmu->Write(dest, accumulator);
+    deltaTime = 16;
+    return true;
+}
+
+// DEC r then JR NZ
+bool CentralProcessingUnit::fused_DecJumpNotZero(const DecodedOp *ops) {
+    instruction_Dec((uint8_t*)ops[0].data);
+    deltaTime = 12;
+    if(lazyResult != 0) {
+        programCounter += (int8_t)ops[1].data[1];
+        deltaTime = 16;
+    }
+    return true;
+}
+
+// CP n then JR Z/NZ
+bool CentralProcessingUnit::fused_CompareJump(const DecodedOp *ops) {
+    uint8_t n = ops[0].data[1];
+    setLazyFlags(LazySub, accumulator, n, accumulator - n);
+    deltaTime = 16;
+    if((accumulator == n) == (ops[1].opcode == 0x28)) {
+        programCounter += (int8_t)ops[1].data[1];
+        deltaTime = 20;
+    }
+    return true;
+}
+
+// LD A,hi then OR lo then JR Z/NZ on BC, DE or HL, the 16-bit loop counter test
+bool CentralProcessingUnit::fused_PairTestJump(const DecodedOp *ops) {
+    uint16_t pair = (ops[0].opcode == 0x78) ? bc : (ops[0].opcode == 0x7a) ? de : hl;
+    accumulator = pair >> 8;
+    setLazyFlags(LazyLogic, 0, 0, accumulator | (pair & 0xff));
+    accumulator |= pair & 0xff;
+    deltaTime = 16;
+    if((pair == 0) == (ops[2].opcode == 0x28)) {
+        programCounter += (int8_t)ops[2].data[1];
+        deltaTime = 20;
+    }
+    return true;
+}
+
+// LDH A,(n) then CP n then JR Z/NZ, the usual wait on LY or STAT
+bool CentralProcessingUnit::fused_PollCompareJump(const DecodedOp *ops) {
+    accumulator = mmu->Read(0xff00 + ops[0].data[1]);
+    uint8_t n = ops[1].data[1];
+    setLazyFlags(LazySub, accumulator, n, accumulator - n);
+    deltaTime = 28;
+    if((accumulator == n) == (ops[2].opcode == 0x28)) {
+        programCounter += (int8_t)ops[2].data[1];
+        deltaTime = 32;
+    }
+    return true;
+}
+
+// Compiles the run at the start of a block once it has been entered often
+// enough; returns true when there is a current run to execute
+bool CentralProcessingUnit::compileBlock(DecodedBlock *block, uint16_t addr) {
+    if(block->run && block->runGeneration == jit->GetGeneration())
+        return true;
+    if(block->runFailed || ++block->hits < jitOptions.threshold)
+        return false;
+
+    if(jit->IsFull())
+        jit->Reset();
+
+    uint8_t code[0x100];
+    size_t length = readRunCode(addr, code);
+    block->run = jit->Compile(code, length, addr, jitOptions);
+    block->runGeneration = jit->GetGeneration();
+    block->runFailed = (block->run == nullptr);
+    RunPlan plan;
+    if(block->run && PlanRun(code, length, addr, jitOptions, plan))
+        block->runCycles = RunMaxCycles(plan);
+    return block->run != nullptr;
+}
+
+// The bytes from addr to the end of its page, which a run never leaves
+size_t CentralProcessingUnit::readRunCode(uint16_t addr, uint8_t *code) {
+    size_t length = 0x100 - (addr & 0xff);
+    for(size_t i = 0; i < length; i++)
+        code[i] = mmu->Peek(addr + i);
+    return length;
+}
+
+// An interrupt raised during a run would only be taken after it, so a run is
+// entered only when it ends before the next event
+bool CentralProcessingUnit::runFitsHorizon(DecodedBlock *block) {
+    return !eventHorizon || block->runCycles < eventHorizon(eventHorizonContext);
+}
+
+// Right after EI an interrupt already pending is taken once this one
+// instruction has run, so nothing running several may start
+bool CentralProcessingUnit::interruptDueNext() {
+    return interruptEnabledNow && mmu->GetPendingInterrupts();
+}
+
+// Looks up the ahead-of-time run for a ROM block once per decode
+bool CentralProcessingUnit::attachAotRun(DecodedBlock *block, uint16_t addr) {
+    if(block->run)
+        return true;
+    if(block->runFailed || block->isRam)
+        return false;
+
+    uint32_t bank = (addr >= 0x4000) ? mmu->GetRomBank() : 0;
+    std::unordered_map<uint32_t, JitRunFunction>::iterator it = aotRuns.find((bank << 16) | addr);
+    block->runFailed = (it == aotRuns.end());
+    if(block->runFailed)
+        return false;
+    block->run = it->second;
+    // Planned again, as the image was, for the cycles of the run
+    uint8_t code[0x100];
+    size_t length = readRunCode(addr, code);
+    RunPlan plan;
+    if(PlanRun(code, length, addr, aotOptions, plan))
+        block->runCycles = RunMaxCycles(plan);
+    return true;
+}
+
+uint8_t CentralProcessingUnit::executeRun(DecodedBlock *block) {
+    JitState state;
+    state.a = accumulator;
+    state.b = b, state.c = c, state.d = d;
+    state.e = e, state.h = h, state.l = l;
+    state.f = GetFlags();
+    uint16_t pc = programCounter;
+    block->run(&state, JitCompiler::FlagTable());
+    PICOBOY_COUNT(nativeRuns, 1);
+    if(profiler)
+        profiler->Count(GetCodeBank(pc), pc, state.cycles);
+
+    accumulator = state.a;
+    b = state.b, c = state.c, d = state.d;
+    e = state.e, h = state.h, l = state.l;
+    SetFlags(state.f);
+    programCounter = state.pc;
+    currentBlock = nullptr;
+
+    deltaTime = state.cycles;
+    time += deltaTime;
+    return deltaTime;
+}
+
+void CentralProcessingUnit::SetEngine(CpuEngine e) {
+    FlushBlockCache();
+    engine = e;
+    if(engine == EngineJit && jit == nullptr)
+        jit = new JitCompiler();
+    if(engine == EngineJit && !jit->IsAvailable()) {
+        PICOBOY_LOG(LogWarning, LogCpu, "JIT not available on this host, using the cached engine");
+        engine = EngineCached;
+    }
+}
+
+void CentralProcessingUnit::SetAotImage(const AotImage *image) {
+    aotRuns.clear();
+    aotOptions = image->options;
+    for(size_t i = 0; i < image->count; i++)
+        aotRuns[(image->blocks[i].bank << 16) | image->blocks[i].addr] = image->blocks[i].run;
+    FlushBlockCache();
+}
+
+void CentralProcessingUnit::SetJitOptions(const JitOptions &options) {
+    jitOptions = options;
+    FlushBlockCache();
+}
+
+void CentralProcessingUnit::SetEventHorizon(EventHorizonFunction horizon, void *context) {
+    eventHorizon = horizon;
+    eventHorizonContext = context;
+}
+
+void CentralProcessingUnit::SetFusion(bool enabled) {
+    fusion = enabled;
+}
+
+void CentralProcessingUnit::SetPairProfiling(bool enabled) {
+    if(enabled)
+        pairCounts.assign(0x200 * 0x200, 0);
+    else
+        pairCounts.clear();
+    lastOpcode = 0;
+}
+
+void CentralProcessingUnit::countPair(uint16_t opcode) {
+    pairCounts[lastOpcode * 0x200 + opcode]++;
+    lastOpcode = opcode;
+}
+
+// Prints the most frequent pairs with their share of all counted pairs
+void CentralProcessingUnit::DumpPairProfile(FILE *out, size_t top) {
+    std::vector<std::pair<uint64_t, uint32_t> > pairs;
+    uint64_t total = 0;
+    for(uint32_t i = 0; i < pairCounts.size(); i++) {
+        total += pairCounts[i];
+        if(pairCounts[i])
+            pairs.push_back(std::make_pair(pairCounts[i], i));
+    }
+    std::sort(pairs.begin(), pairs.end(), std::greater<std::pair<uint64_t, uint32_t> >());
+    if(pairs.size() > top)
+        pairs.resize(top);
+
+    for(const std::pair<uint64_t, uint32_t> &p : pairs) {
+        uint16_t opcodes[2] = {(uint16_t)(p.second / 0x200), (uint16_t)(p.second % 0x200)};
+        fprintf(out, "%12llu %6.2f%%  %03x %-20s %03x %s\n", (unsigned long long)p.first, 100.0 * p.first / total,
+            opcodes[0], GetInstructionName(opcodes[0]).c_str(), opcodes[1], GetInstructionName(opcodes[1]).c_str());
+    }
+}
+
+void CentralProcessingUnit::SetProfiler(Profiler *profiler) {
+    this->profiler = profiler;
+}
+
+void CentralProcessingUnit::SetTracer(TraceBuffer *tracer) {
+    this->tracer = tracer;
+}
+
+void CentralProcessingUnit::SetDebugger(Debugger *debugger) {
+    this->debugger = debugger;
+}
+
+// Registers as they are before the instruction runs
+void CentralProcessingUnit::traceInstruction(uint16_t pc, uint16_t opcode, const uint8_t *operands, uint8_t count) {
+    TraceRecord *r = tracer->Next(GetCodeBank(pc), pc);
+    if(!r)
         return;
+    GetFlags();
+    r->opcode = opcode;
+    r->af = af, r->bc = bc, r->de = de, r->hl = hl;
+    r->sp = stackPointer;
+    r->operands[0] = count > 0 ? operands[0] : 0;
+    r->operands[1] = count > 1 ? operands[1] : 0;
+    r->operandCount = count;
+    r->ime = interruptMasterFlag;
+}
+
+uint8_t CentralProcessingUnit::GetCodeBank(uint16_t addr) {
+    return (addr >= 0x4000 && addr < 0x8000) ? mmu->GetRomBank() : 0;
+}
+
+std::string CentralProcessingUnit::GetInstructionName(uint16_t opcode) {
+    std::map<uint16_t, Instruction*> &iset = (opcode & 0x100) ? instructionSetExtended : instructionSet;
+    std::map<uint16_t, Instruction*>::iterator it = iset.find(opcode & 0xff);
+    return (it != iset.end()) ? it->second->name : "?";
+}
+
+CpuEngine CentralProcessingUnit::GetEngine() {
+    return engine;
+}
+
+void CentralProcessingUnit::FlushBlockCache() {
+    for(auto &entry : blockCache)
+        delete entry.second;
+    blockCache.clear();
+    currentBlock = nullptr;
+    if(jit)
+        jit->Reset();
+}
 
-    bool vBlankInterrupt =  mmu->ReadIORegisterBit(AddrRegInterruptEnabled, FlagInterruptVBlank)
-                            && mmu->ReadIORegisterBit(AddrRegInterruptFlag, FlagInterruptVBlank);
-    bool lcdInterrupt =     mmu->ReadIORegisterBit(AddrRegInterruptEnabled, FlagInterruptLcd)
-                            && mmu->ReadIORegisterBit(AddrRegInterruptFlag, FlagInterruptLcd);
-    bool timerInterrupt =   mmu->ReadIORegisterBit(AddrRegInterruptEnabled, FlagInterruptTimer)
-                            && mmu->ReadIORegisterBit(AddrRegInterruptFlag, FlagInterruptTimer);
-    bool serialInterrupt =  mmu->ReadIORegisterBit(AddrRegInterruptEnabled, FlagInterruptSerial)
-                            && mmu->ReadIORegisterBit(AddrRegInterruptFlag, FlagInterruptSerial);
-    bool joypadInterrupt =  mmu->ReadIORegisterBit(AddrRegInterruptEnabled, FlagInterruptInput)
-                            && mmu->ReadIORegisterBit(AddrRegInterruptFlag, FlagInterruptInput);
-
-    if(vBlankInterrupt) {
-        serviceInterrupts(AddrVectorVBlank, FlagInterruptVBlank);
-    } else if(lcdInterrupt) {
-        serviceInterrupts(AddrVectorLcd, FlagInterruptLcd);
-    } else if(timerInterrupt) {
-        serviceInterrupts(AddrVectorTimer, FlagInterruptTimer);
-    } else if(serialInterrupt) {
-        serviceInterrupts(AddrVectorSerial, FlagInterruptSerial);
-    } else if(joypadInterrupt) {
-        serviceInterrupts(AddrVectorInput, FlagInterruptInput);
+const char *CpuEngineName(CpuEngine engine) {
+    switch(engine) {
+        case EngineInterpreter: return "interpreter";
+        case EngineCached: return "cached";
+        case EngineJit: return "jit";
+        case EngineAot: return "aot";
+        default: return "unknown";
     }
 }
 
+bool CpuEngineFromName(const std::string &name, CpuEngine &engine) {
+    for(int i = 0; i < EngineCount; i++) {
+        if(name == CpuEngineName((CpuEngine)i)) {
+            engine = (CpuEngine)i;
+            return true;
+        }
+    }
+    return false;
+}
+
+void CentralProcessingUnit::handleInterrupts() {
+    uint8_t pending = mmu->GetPendingInterrupts();
+    if(!interruptMasterFlag || !pending)
+        return;
+
+    // The lowest bit wins, from VBlank (0x40) up to joypad (0x60)
+    uint8_t flag = FlagInterruptVBlank;
+    while(!((pending >> flag) & 1))
+        flag++;
+    serviceInterrupts(AddrVectorVBlank + flag * 8, flag);
+}
+
 void CentralProcessingUnit::serviceInterrupts(uint16_t addr, uint8_t flag) {
+    PICOBOY_COUNT(interrupts[flag], 1);
     mmu->WriteIORegisterBit(AddrRegInterruptFlag, flag, false);
     interruptMasterFlag = false;
     isHalted = false;
+    if(tracer) {
+        uint8_t from[2] = {(uint8_t)programCounter, (uint8_t)(programCounter >> 8)};
+        traceInstruction(addr, TraceOpcodeInterrupt | flag, from, 2);
+    }
     stackPush(programCounter);
     programCounter = addr;
+    if(profiler)
+        profiler->Interrupt(flag, stackPointer + 2);
 }
 
 void CentralProcessingUnit::instruction_NOP(uint8_t* data) {
 }
 
 void CentralProcessingUnit::instruction_LoadSP(uint8_t* data) {
-    uint8_t hi, lo;
-    if (data[0] == 0x31) {
-        lo = data[1];
-        hi = data[2];
-    } else if (data[0] == 0xf9) {
-        lo = l;
-        hi = h;
-    }
-    stackPointer = stitch(hi, lo);
+    if (data[0] == 0x31)
+        stackPointer = stitch(data[2], data[1]);
+    else if (data[0] == 0xf9)
+        stackPointer = hl;
 }
 
 void CentralProcessingUnit::instruction_XOROP(uint8_t* data) {
-    uint8_t d;
+    uint8_t n;
     
     if (data[0] == 0xa8)
-        d = b;
+        n = b;
     else if (data[0] == 0xa9)
-        d = c;
+        n = c;
     else if (data[0] == 0xaa)
-        d = d;
+        n = d;
     else if (data[0] == 0xab)
-        d = e;
+        n = e;
     else if (data[0] == 0xac)
-        d = h;
+        n = h;
     else if (data[0] == 0xad)
-        d = l;
+        n = l;
     else if (data[0] == 0xae) {
-        uint16_t addr = getHL();
-        d = mmu->Read(addr);
+        uint16_t addr = hl;
+        n = mmu->Read(addr);
     } else if (data[0] == 0xaf)
-        d = accumulator;
-    else if (data[0] == 0xee)
-        d = data[1];
+        n = accumulator;
+    else
+        n = data[1];
 
-    accumulator ^= d;
-    isZero = (accumulator == 0);
-    isCarry = isHalfCarry = isSubtract = false;
+    accumulator ^= n;
+    setLazyFlags(LazyLogic, 0, 0, accumulator);
 }
 
 void CentralProcessingUnit::instruction_LoadPair(uint8_t* data) {
-    uint8_t *hi, *lo;
+    uint16_t *pair;
     if (data[0] == 0x01)
-        hi = &(b), lo = &(c);
+        pair = &bc;
     else if (data[0] == 0x11)
-        hi = &(d), lo = &(e);
-    else if (data[0] == 0x21)
-        hi = &(h), lo = &(l);
+        pair = &de;
+    else
+        pair = &hl;
 
-    *lo = data[1];
-    *hi = data[2];
+    *pair = stitch(data[2], data[1]);
 }
 
 void CentralProcessingUnit::instruction_Load(uint8_t* data) {
     if (data[0] == 0x22) {
-        uint16_t addr = getHL();
+        uint16_t addr = hl;
         mmu->Write(addr, accumulator);
-        setHL(++addr);
+        hl = addr + 1;
     } else if (data[0] == 0x32) {
-        uint16_t addr = getHL();
+        uint16_t addr = hl;
         mmu->Write(addr, accumulator);
-        setHL(--addr);
+        hl = addr - 1;
     } else if (data[0] == 0xe2) {
         uint16_t addr = 0xFF00;
         mmu->Write(addr + c, accumulator);
@@ -419,13 +992,13 @@ void CentralProcessingUnit::instruction_JR(uint8_t* data) {
     if (data[0] == 0x18)
         condition = true;
     else if (data[0] == 0x20)
-        condition = !(isZero);
+        condition = !zeroFlag();
     else if (data[0] == 0x28)
-        condition = (isZero);
+        condition = zeroFlag();
     else if (data[0] == 0x30)
-        condition = !(isCarry);
+        condition = !carryFlag();
     else if (data[0] == 0x38)
-        condition = (isCarry);
+        condition = carryFlag();
 
     if (condition) {
         deltaTime = 12;
@@ -450,10 +1023,10 @@ void CentralProcessingUnit::instruction_LoadMem2Reg(uint8_t* data) {
     else if (data[0] == 0x2e)
         reg = &(l);
     else if (data[0] == 0x36) {
-        uint16_t addr = getHL();
+        uint16_t addr = hl;
         mmu->Write(addr, data[1]);
         return;
-    } else if (data[0] == 0x3e)
+    } else
         reg = &(accumulator);
 
     *reg = data[1];
@@ -474,21 +1047,19 @@ void CentralProcessingUnit::instruction_Inc(uint8_t* data) {
     else if (data[0] == 0x2c)
         reg = &( l);
     else if (data[0] == 0x34) {
-        uint16_t addr = getHL();
+        uint16_t addr = hl;
         uint8_t val = mmu->Read(addr);
         val++;
         mmu->Write(addr, val);
-        isZero = (val == 0);
-        isHalfCarry = ((val & 0xf) == 0);
-        isSubtract = false;
+        lazyCarry = carryFlag();
+        setLazyFlags(LazyInc, 0, 0, val);
         return;
-    } else if (data[0] == 0x3c)
+    } else
         reg = &(accumulator);
 
     (*reg) = (*reg) + 1;
-    isHalfCarry = (((*reg) & 0xf) == 0);
-    isZero = (*reg) == 0;
-    isSubtract = false;
+    lazyCarry = carryFlag();
+    setLazyFlags(LazyInc, 0, 0, *reg);
 }
 
 void CentralProcessingUnit::instruction_Dec(uint8_t* data) {
@@ -506,84 +1077,62 @@ void CentralProcessingUnit::instruction_Dec(uint8_t* data) {
     else if (data[0] == 0x2d)
         reg = &(l);
     else if (data[0] == 0x35) {
-        uint16_t addr = getHL();
+        uint16_t addr = hl;
         uint8_t val = mmu->Read(addr);
         val--;
-        isHalfCarry = ((val & 0x0f) == 0x0f);
-        isZero = (val == 0);
-        isSubtract = true;
+        lazyCarry = carryFlag();
+        setLazyFlags(LazyDec, 0, 0, val);
         mmu->Write(addr, val);
         return;
-    } else if (data[0] == 0x3d)
+    } else
         reg = &(accumulator);
 
     (*reg) = (*reg) - 1;
-    isHalfCarry = (((*reg) & 0x0f) == 0x0f);
-    isZero = (*reg) == 0;
-    isSubtract = true;
+    lazyCarry = carryFlag();
+    setLazyFlags(LazyDec, 0, 0, *reg);
 }
 
 void CentralProcessingUnit::instruction_Inc16Bit(uint8_t* data) {
-    uint8_t *hi, *lo;
     if (data[0] == 0x03)
-        hi = &(b), lo = &(c);
+        bc++;
     else if (data[0] == 0x13)
-        hi = &(d), lo = &(e);
+        de++;
     else if (data[0] == 0x23)
-        hi = &(h), lo = &(l);
-    else if (data[0] == 0x33) {
+        hl++;
+    else if (data[0] == 0x33)
         stackPointer++;
-        return;
-    }
-
-    uint16_t val = stitch(*hi, *lo);
-    val++;
-    *hi = (val >> 8) & 0xff;
-    *lo = val & 0xff;
 }
 
 void CentralProcessingUnit::instruction_Dec16Bit(uint8_t* data) {
-    uint8_t *hi, *lo;
     if (data[0] == 0x0b)
-        hi = &(b), lo = &(c);
+        bc--;
     else if (data[0] == 0x1b)
-        hi = &(d), lo = &(e);
+        de--;
     else if (data[0] == 0x2b)
-        hi = &(h), lo = &(l);
-    else if (data[0] == 0x3b) {
+        hl--;
+    else if (data[0] == 0x3b)
         stackPointer--;
-        return;
-    }
-
-    uint16_t val = stitch(*hi, *lo);
-    val--;
-    *hi = (val >> 8) & 0xff;
-    *lo = val & 0xff;
 }
 
 void CentralProcessingUnit::instruction_LoadAIndirect(uint8_t* data) {
-    uint16_t hi, lo;
+    uint16_t addr;
     if (data[0] == 0x0a)
-        hi = b, lo = c;
+        addr = bc;
     else if (data[0] == 0x1a)
-        hi = d, lo = e;
-    else if (data[0] == 0xfa)
-        hi = data[2], lo = data[1];
-
-    uint16_t addr = stitch(hi, lo);
+        addr = de;
+    else
+        addr = stitch(data[2], data[1]);
     accumulator = mmu->Read(addr);
 }
 
 void CentralProcessingUnit::instruction_LoadA2Mem(uint8_t* data) {
-    uint16_t hi, lo;
+    uint16_t addr;
     if (data[0] == 0x02)
-        hi = b, lo = c;
+        addr = bc;
     else if (data[0] == 0x12)
-        hi = d, lo = e;
-    else if (data[0] == 0xea)
-        hi = data[2], lo = data[1];
-
-    uint16_t addr = stitch(hi, lo);
+        addr = de;
+    else
+        addr = stitch(data[2], data[1]);
     mmu->Write(addr, accumulator);
 }
 
@@ -605,7 +1154,7 @@ void CentralProcessingUnit::instruction_LoadReg2Reg(uint8_t* data) {
     else if (dreg == 0x5)
         val = l;
     else if (dreg == 0x6) {
-        uint16_t addr = getHL();
+        uint16_t addr = hl;
         val = mmu->Read(addr);
     } else if (dreg == 0x7)
         val = accumulator;
@@ -623,7 +1172,7 @@ void CentralProcessingUnit::instruction_LoadReg2Reg(uint8_t* data) {
     else if(dval == 0x5)
         l = val;
     else if(dval == 0x6) {
-        uint16_t addr = getHL();
+        uint16_t addr = hl;
         mmu->Write(addr, val);
     } else if(dval == 0x7)
         accumulator = val;
@@ -634,13 +1183,13 @@ void CentralProcessingUnit::instruction_Call(uint8_t* data) {
     if (data[0] == 0xcd)
         condition = true;
     else if (data[0] == 0xc4)
-        condition = !isZero;
+        condition = !zeroFlag();
     else if (data[0] == 0xcc)
-        condition = isZero;
+        condition = zeroFlag();
     else if (data[0] == 0xd4)
-        condition = !isCarry;
-    else if (data[0] == 0xdc)
-        condition = isCarry;
+        condition = !carryFlag();
+    else
+        condition = carryFlag();
 
     if (condition) {
         deltaTime = 24;
@@ -648,56 +1197,54 @@ void CentralProcessingUnit::instruction_Call(uint8_t* data) {
 
         uint16_t next = stitch(data[2], data[1]);
         programCounter = next;
+        if(profiler)
+            profiler->Call(GetCodeBank(next), next, stackPointer + 2);
     }
 }
 
 void CentralProcessingUnit::instruction_Push(uint8_t* data) {
-    uint8_t hi, lo;
     if (data[0] == 0xc5)
-        hi = b, lo = c;
+        stackPush(bc);
     else if (data[0] == 0xd5)
-        hi = d, lo = e;
+        stackPush(de);
     else if (data[0] == 0xe5)
-        hi = h, lo = l;
-    else if (data[0] == 0xf5)
-        hi = (accumulator), lo = getFlags();
-
-    stackPush(hi, lo);
+        stackPush(hl);
+    else if (data[0] == 0xf5) {
+        GetFlags();
+        stackPush(af);
+    }
 }
 
 void CentralProcessingUnit::instruction_Pop(uint8_t* data) {
-    uint8_t *hi, *lo;
     if (data[0] == 0xc1)
-        hi = &(b), lo = &(c);
+        bc = stackPop();
     else if (data[0] == 0xd1)
-        hi = &(d), lo = &(e);
+        de = stackPop();
     else if (data[0] == 0xe1)
-        hi = &(h), lo = &(l);
-    else if (data[0] == 0xf1)
-        hi = &(accumulator);
-
-    if (data[0] == 0xf1)
-        setFlags(mmu->Read(stackPointer++));
-    else
-        *lo = mmu->Read(stackPointer++);
-    *hi = mmu->Read(stackPointer++);
+        hl = stackPop();
+    else if (data[0] == 0xf1) {
+        af = stackPop();
+        SetFlags(flags);
+    }
 }
 
 void CentralProcessingUnit::instruction_Return(uint8_t* data) {
     bool condition = false;
     if (data[0] == 0xc0)
-        condition = !(isZero);
+        condition = !zeroFlag();
     else if (data[0] == 0xc8)
-        condition = isZero;
+        condition = zeroFlag();
     else if (data[0] == 0xc9)
         condition = true;
     else if (data[0] == 0xd0)
-        condition = !(isCarry);
+        condition = !carryFlag();
     else if (data[0] == 0xd8)
-        condition = isCarry;
+        condition = carryFlag();
 
     if (condition) {
         programCounter = stackPop();
+        if(profiler)
+            profiler->Return(stackPointer);
         if (data[0] == 0xc9)
             deltaTime = 16;
         else
@@ -720,20 +1267,13 @@ void CentralProcessingUnit::instruction_Compare(uint8_t* data) {
     else if (data[0] == 0xbd)
         n = l;
     else if (data[0] == 0xbe)
-        n = mmu->Read(getHL());
+        n = mmu->Read(hl);
     else if (data[0] == 0xbf)
         n = accumulator;
     else if (data[0] == 0xfe)
         n = data[1];
 
-    uint8_t reg = accumulator;
-    uint16_t r1 = (uint16_t)((accumulator & 0xF)-((n) & 0xF));
-    uint16_t r2 = (uint16_t)(reg - n);
-
-    isZero = (((uint8_t)r2) == 0);
-    isSubtract = true;
-    isHalfCarry = (r1 > 0xf);
-    isCarry = (r2 > 0xff);
+    setLazyFlags(LazySub, accumulator, n, accumulator - n);
 }
 
 void CentralProcessingUnit::instruction_LoadAnn(uint8_t* data) {
@@ -745,103 +1285,88 @@ void CentralProcessingUnit::instruction_LoadAnn(uint8_t* data) {
 }
 
 void CentralProcessingUnit::instruction_LoadSPHL(uint8_t* data) {
-    stackPointer = getHL();
+    stackPointer = hl;
 }
 
 void CentralProcessingUnit::instruction_Sub(uint8_t* data) {
-    uint8_t d;
+    uint8_t n;
     
     if (data[0] == 0x90)
-        d = b;
+        n = b;
     else if (data[0] == 0x91)
-        d = c;
+        n = c;
     else if (data[0] == 0x92)
-        d = d;
+        n = d;
     else if (data[0] == 0x93)
-        d = e;
+        n = e;
     else if (data[0] == 0x94)
-        d = h;
+        n = h;
     else if (data[0] == 0x95)
-        d = l;
+        n = l;
     else if (data[0] == 0x96) {
-        uint16_t addr = getHL();
-        d = mmu->Read(addr);
+        uint16_t addr = hl;
+        n = mmu->Read(addr);
     } else if (data[0] == 0x97)
-        d = accumulator;
-    else if (data[0] == 0xd6)
-        d = data[1];
+        n = accumulator;
+    else
+        n = data[1];
 
-    isZero = (accumulator == d);
-    isSubtract = true;
-    isCarry = (accumulator < d);
-    isHalfCarry = ((accumulator & 0xf) - (d & 0xf)) < 0;
-    accumulator = accumulator - d;
+    setLazyFlags(LazySub, accumulator, n, accumulator - n);
+    accumulator = accumulator - n;
 }
 
 void CentralProcessingUnit::instruction_Add(uint8_t* data) {
-    uint8_t d;
+    uint8_t n;
     if (data[0] == 0x80)
-        d = b;
+        n = b;
     else if (data[0] == 0x81)
-        d = c;
+        n = c;
     else if (data[0] == 0x82)
-        d = d;
+        n = d;
     else if (data[0] == 0x83)
-        d = e;
+        n = e;
     else if (data[0] == 0x84)
-        d = h;
+        n = h;
     else if (data[0] == 0x85)
-        d = l;
+        n = l;
     else if (data[0] == 0x86) {
-        uint16_t addr = getHL();
-        d = mmu->Read(addr);
+        uint16_t addr = hl;
+        n = mmu->Read(addr);
     } else if (data[0] == 0x87)
-        d = accumulator;
-    else if (data[0] == 0xc6)
-        d = data[1];
-
-    uint16_t val = accumulator + d;
-
-    isZero = (val & 0xff) == 0;
-    isCarry = (val & 0x100) != 0;
-    isHalfCarry = (accumulator & 0xf) + (d & 0xf) > 0xf;
-    isSubtract = false;
+        n = accumulator;
+    else
+        n = data[1];
 
-    accumulator = static_cast<uint8_t>(val);
+    uint8_t val = accumulator + n;
+    setLazyFlags(LazyAdd, accumulator, n, val);
+    accumulator = val;
 }
 
 void CentralProcessingUnit::instruction_Adc(uint8_t* data) {
-    uint8_t d;
+    uint8_t n;
     if (data[0] == 0x88)
-        d = b;
+        n = b;
     else if (data[0] == 0x89)
-        d = c;
+        n = c;
     else if (data[0] == 0x8a)
-        d = d;
+        n = d;
     else if (data[0] == 0x8b)
-        d = e;
+        n = e;
     else if (data[0] == 0x8c)
-        d = h;
+        n = h;
     else if (data[0] == 0x8d)
-        d = l;
+        n = l;
     else if (data[0] == 0x8e) {
-        uint16_t addr = getHL();
-        d = mmu->Read(addr);
+        uint16_t addr = hl;
+        n = mmu->Read(addr);
     } else if (data[0] == 0x8f)
-        d = accumulator;
-    else if (data[0] == 0xce)
-        d = data[1];
-
-    uint8_t reg = accumulator;
-    uint8_t carry = isCarry;
-
-    uint result_full = reg + d + carry;
-    uint8_t result = static_cast<uint8_t>(result_full);
+        n = accumulator;
+    else
+        n = data[1];
 
-    isZero = (result == 0);
-    isSubtract = false;
-    isHalfCarry = (((reg & 0xf) + (d & 0xf) + carry) > 0xf);
-    isCarry = (result_full > 0xff);
+    lazyCarry = carryFlag();
+    uint8_t result = accumulator + n + lazyCarry;
+    setLazyFlags(LazyAdc, accumulator, n, result);
     accumulator = result;
 }
 
@@ -850,13 +1375,13 @@ void CentralProcessingUnit::instruction_Jump(uint8_t* data) {
     if (data[0] == 0xc3)
         condition = true;
     else if (data[0] == 0xc2)
-        condition = !(isZero);
+        condition = !zeroFlag();
     else if (data[0] == 0xca)
-        condition = (isZero);
+        condition = zeroFlag();
     else if (data[0] == 0xd2)
-        condition = !(isCarry);
+        condition = !carryFlag();
     else if (data[0] == 0xda)
-        condition = (isCarry);
+        condition = carryFlag();
 
     if (condition) {
         programCounter = stitch(data[2], data[1]);
@@ -865,87 +1390,92 @@ void CentralProcessingUnit::instruction_Jump(uint8_t* data) {
 }
 
 void CentralProcessingUnit::instruction_SetInterrupt(uint8_t* data) {
-    if (data[0] == 0xfb)
-        interruptMasterFlag = true;
-    else if (data[0] == 0xf3)
+    if (data[0] == 0xfb) {
+        interruptEnablePending = true;
+    } else if (data[0] == 0xf3) {
         interruptMasterFlag = false;
+        interruptEnablePending = false;
+    }
 }
 
 void CentralProcessingUnit::instruction_LoadAHL(uint8_t* data) {
-    uint16_t addr = getHL();
+    uint16_t addr = hl;
     accumulator = mmu->Read(addr);
     if(data[0] == 0x2a)
         addr++;
     else if(data[0] == 0x3a)
         addr--;
-    setHL(addr);
+    hl = addr;
 }
 
 void CentralProcessingUnit::instruction_LoadHL(uint8_t* data) {
     int8_t value = static_cast<int8_t>(data[1]);
     int16_t result = stackPointer + value;
-    isZero = false;
-    isSubtract = false;
-    isHalfCarry = (((stackPointer ^ value ^ (result & 0xFFFF)) & 0x10) == 0x10);
-    isCarry = (((stackPointer ^ value ^ (result & 0xFFFF)) & 0x100) == 0x100);
-    setHL(result);
+    uint16_t carries = stackPointer ^ value ^ (result & 0xFFFF);
+    SetFlags(packFlags(false, false, (carries & 0x10) != 0, (carries & 0x100) != 0));
+    hl = result;
+}
+
+void CentralProcessingUnit::instruction_AddSP(uint8_t* data) {
+    int8_t value = static_cast<int8_t>(data[1]);
+    int16_t result = stackPointer + value;
+    uint16_t carries = stackPointer ^ value ^ (result & 0xFFFF);
+    SetFlags(packFlags(false, false, (carries & 0x10) != 0, (carries & 0x100) != 0));
+    stackPointer = result;
 }
 
 void CentralProcessingUnit::instruction_OR(uint8_t* data) {
-    uint8_t d;
+    uint8_t n;
     if (data[0] == 0xb0)
-        d = b;
+        n = b;
     else if (data[0] == 0xb1)
-        d = c;
+        n = c;
     else if (data[0] == 0xb2)
-        d = d;
+        n = d;
     else if (data[0] == 0xb3)
-        d = e;
+        n = e;
     else if (data[0] == 0xb4)
-        d = h;
+        n = h;
     else if (data[0] == 0xb5)
-        d = l;
+        n = l;
     else if (data[0] == 0xb6) {
-        uint16_t addr = getHL();
-        d = mmu->Read(addr);
+        uint16_t addr = hl;
+        n = mmu->Read(addr);
     } else if (data[0] == 0xb7)
-        d = accumulator;
-    else if (data[0] == 0xf6)
-        d = data[1];
+        n = accumulator;
+    else
+        n = data[1];
 
     uint8_t res = accumulator;
-    res = res | d;
+    res = res | n;
     accumulator = res;
-    isZero = (res == 0);
-    isCarry = isHalfCarry = isSubtract = false;
+    setLazyFlags(LazyLogic, 0, 0, res);
 }
 
 void CentralProcessingUnit::instruction_AND(uint8_t* data) {
-    uint8_t d;
+    uint8_t n;
     if (data[0] == 0xa0)
-        d = b;
+        n = b;
     else if (data[0] == 0xa1)
-        d = c;
+        n = c;
     else if (data[0] == 0xa2)
-        d = d;
+        n = d;
     else if (data[0] == 0xa3)
-        d = e;
+        n = e;
     else if (data[0] == 0xa4)
-        d = h;
+        n = h;
     else if (data[0] == 0xa5)
-        d = l;
+        n = l;
     else if (data[0] == 0xa6) {
-        uint16_t addr = getHL();
-        d = mmu->Read(addr);
+        uint16_t addr = hl;
+        n = mmu->Read(addr);
     } else if (data[0] == 0xa7)
-        d = accumulator;
-    else if (data[0] == 0xe6)
-        d = data[1];
+        n = accumulator;
+    else
+        n = data[1];
 
-    accumulator &= d;
-    isZero = (accumulator == 0);
-    isHalfCarry = true;
-    isCarry = isSubtract = false;
+    accumulator &= n;
+    setLazyFlags(LazyAnd, 0, 0, accumulator);
 }
 
 void CentralProcessingUnit::instruction_SRL(uint8_t* data) {
@@ -963,21 +1493,18 @@ void CentralProcessingUnit::instruction_SRL(uint8_t* data) {
     else if (data[0] == 0x3d)
         reg = &(l);
     else if (data[0] == 0x3e) {
-        uint16_t addr = getHL();
+        uint16_t addr = hl;
         uint8_t val = mmu->Read(addr);
-        isCarry = val & 1;
+        bool carry = val & 1;
         val >>= 1;
         mmu->Write(addr, val);
-        isZero = (val == 0);
-        isHalfCarry = isSubtract = false;
+        SetFlags(packFlags(val == 0, false, false, carry));
         return;
-    } else if (data[0] == 0x3f)
+    } else
         reg = &(accumulator);
 
-    isHalfCarry = isSubtract = false;
     uint8_t val = (*reg) >> 1;
-    isZero = (val == 0);
-    isCarry = (*reg) & 1;
+    SetFlags(packFlags(val == 0, false, false, (*reg) & 1));
     *reg = val;
 }
 
@@ -985,15 +1512,16 @@ void CentralProcessingUnit::instruction_Reti(uint8_t* data) {
     programCounter = stackPop();
     interruptMasterFlag = true;
     deltaTime = 16;
+    if(profiler)
+        profiler->Return(stackPointer);
 }
 
 void CentralProcessingUnit::instruction_CPL(uint8_t* data) {
     accumulator = ~(accumulator);
-    isSubtract = isHalfCarry = true;
+    SetFlags(GetFlags() | (1 << FlagCpuSubtract) | (1 << FlagCpuHalfCarry));
 }
 
 void CentralProcessingUnit::instruction_Swap(uint8_t* data) {
-    isSubtract = isHalfCarry = isCarry = false;
     uint8_t* reg;
     if (data[0] == 0x30)
         reg = &(b);
@@ -1008,22 +1536,20 @@ void CentralProcessingUnit::instruction_Swap(uint8_t* data) {
     else if (data[0] == 0x35)
         reg = &(l);
     else if (data[0] == 0x36) {
-        uint16_t addr = getHL();
+        uint16_t addr = hl;
         uint8_t data = mmu->Read(addr);
         uint8_t val = (data >> 4);
         val |= (data << 4);
         mmu->Write(addr, val);
-        isZero = (val == 0);
-        isSubtract = isCarry = isHalfCarry = false;
+        SetFlags(packFlags(val == 0, false, false, false));
         return;
-    } else if (data[0] == 0x37)
+    } else
         reg = &(accumulator);
 
     uint8_t val = (*reg) >> 4;
     val |= ((*reg) << 4);
     *reg = val;
-    isZero = (val == 0);
-    isSubtract = isCarry = isHalfCarry = false;
+    SetFlags(packFlags(val == 0, false, false, false));
 }
 
 void CentralProcessingUnit::instruction_Reset(uint8_t* data) {
@@ -1046,31 +1572,30 @@ void CentralProcessingUnit::instruction_Reset(uint8_t* data) {
         programCounter = 0x30;
     else if (data[0] == 0xff)
         programCounter = 0x38;
+    if(profiler)
+        profiler->Call(0, programCounter, stackPointer + 2);
 }
 
 void CentralProcessingUnit::instruction_AddPair(uint8_t* data) {
-    uint8_t hi, lo;
+    uint16_t val;
     if (data[0] == 0x09)
-        hi = b, lo = c;
+        val = bc;
     else if (data[0] == 0x19)
-        hi = d, lo = e;
+        val = de;
     else if (data[0] == 0x29)
-        hi = h, lo = l;
-    else if (data[0] == 0x39)
-        hi = (stackPointer) >> 8, lo = (stackPointer) & 0xff;
+        val = hl;
+    else
+        val = stackPointer;
 
-    uint16_t reg = getHL();
-    uint16_t val = stitch(hi, lo);
-    uint result = reg + val;
+    uint16_t reg = hl;
+    uint32_t result = reg + val;
 
-    isSubtract = false;
-    isHalfCarry = ((reg & 0xfff) + (val & 0xfff) > 0xfff);
-    isCarry = ((result & 0x10000) != 0);
-    setHL(result);
+    SetFlags(packFlags(zeroFlag(), false, (reg & 0xfff) + (val & 0xfff) > 0xfff, (result & 0x10000) != 0));
+    hl = result;
 }
 
 void CentralProcessingUnit::instruction_JumpHL(uint8_t* data) {
-    uint16_t addr = getHL();
+    uint16_t addr = hl;
     programCounter = addr;
 }
 
@@ -1091,7 +1616,7 @@ void CentralProcessingUnit::instruction_ResetBit(uint8_t* data) {
     else if (dreg == 0x5)
         reg = &(l);
     else if (dreg == 0x6) {
-        uint16_t addr = getHL();
+        uint16_t addr = hl;
         uint8_t val = mmu->Read(addr);
         val &= ~(1 << dbit);
         mmu->Write(addr, val);
@@ -1119,7 +1644,7 @@ void CentralProcessingUnit::instruction_SetBit(uint8_t* data) {
     else if (dreg == 0x5)
         reg = &(l);
     else if (dreg == 0x6) {
-        uint16_t addr = getHL();
+        uint16_t addr = hl;
         uint8_t val = mmu->Read(addr);
         val |= (1 << dbit);
         mmu->Write(addr, val);
@@ -1132,7 +1657,8 @@ void CentralProcessingUnit::instruction_SetBit(uint8_t* data) {
 
 void CentralProcessingUnit::instruction_SP2Mem(uint8_t* data) {
     uint16_t addr = stitch(data[2], data[1]);
-    mmu->Write(addr, stackPointer);
+    mmu->Write(addr, stackPointer & 0xff);
+    mmu->Write(addr + 1, stackPointer >> 8);
 }
 
 void CentralProcessingUnit::instruction_CheckBit(uint8_t* data) {
@@ -1153,19 +1679,17 @@ void CentralProcessingUnit::instruction_CheckBit(uint8_t* data) {
     else if (dreg == 0x5)
         val = l;
     else if (dreg == 0x6) {
-        uint16_t addr = getHL();
+        uint16_t addr = hl;
         val = mmu->Read(addr);
     } else if (dreg == 0x7)
         val = accumulator;
 
-    isZero = (val & (1 << dbit)) == 0;
-    isHalfCarry = true;
-    isSubtract = false;
+    SetFlags(packFlags((val & (1 << dbit)) == 0, false, true, carryFlag()));
 }
 
 void CentralProcessingUnit::instruction_RollLeftA(uint8_t* data) {
     instruction_RollLeft(data);
-    isZero = false;
+    SetFlags(GetFlags() & ~(1 << FlagCpuZero));
 }
 
 void CentralProcessingUnit::instruction_RollLeft(uint8_t* data) {
@@ -1183,30 +1707,26 @@ void CentralProcessingUnit::instruction_RollLeft(uint8_t* data) {
     else if (data[0] == 0x15)
         reg = &(l);
     else if (data[0] == 0x16) {
-        uint16_t addr = getHL();
+        uint16_t addr = hl;
         uint8_t val = mmu->Read(addr);
 
-        int temp = isCarry;
-        isCarry = (val >> 7) & 1;
-        val = val << 1 | temp;
-        isZero = (val == 0);
-        isHalfCarry = isSubtract = false;
+        bool carry = (val >> 7) & 1;
+        val = val << 1 | carryFlag();
+        SetFlags(packFlags(val == 0, false, false, carry));
 
         mmu->Write(addr, val);
         return;
-    } else if (data[0] == 0x17)
+    } else
         reg = &(accumulator);
 
-    int temp = isCarry;
-    isCarry = check_bit((*reg), 7);
-    *reg = (*reg) << 1 | temp;
-    isZero = (*reg) == 0;
-    isHalfCarry = isSubtract = false;
+    bool carry = check_bit((*reg), 7);
+    *reg = (*reg) << 1 | carryFlag();
+    SetFlags(packFlags((*reg) == 0, false, false, carry));
 }
 
 void CentralProcessingUnit::instruction_RollRightA(uint8_t* data) {
     instruction_RollRight(data);
-    isZero = false;
+    SetFlags(GetFlags() & ~(1 << FlagCpuZero));
 }
 
 void CentralProcessingUnit::instruction_RollRight(uint8_t* data) {
@@ -1224,30 +1744,26 @@ void CentralProcessingUnit::instruction_RollRight(uint8_t* data) {
     else if (data[0] == 0x1d)
         reg = &(l);
     else if (data[0] == 0x1e) {
-        uint16_t addr = getHL();
+        uint16_t addr = hl;
         uint8_t val = mmu->Read(addr);
 
-        int temp = isCarry;
-        isCarry = check_bit(val, 0);
-        val = val >> 1 | (temp << 7);
-        isZero = (val == 0);
-        isHalfCarry = isSubtract = false;
+        bool carry = check_bit(val, 0);
+        val = val >> 1 | (carryFlag() << 7);
+        SetFlags(packFlags(val == 0, false, false, carry));
 
         mmu->Write(addr, val);
         return;
-    } else if (data[0] == 0x1f)
+    } else
         reg = &(accumulator);
 
-    int temp = isCarry;
-    isCarry = check_bit((*reg), 0);
-    *reg = (*reg) >> 1 | (temp << 7);
-    isZero = (*reg) == 0;
-    isHalfCarry = isSubtract = false;
+    bool carry = check_bit((*reg), 0);
+    *reg = (*reg) >> 1 | (carryFlag() << 7);
+    SetFlags(packFlags((*reg) == 0, false, false, carry));
 }
 
 void CentralProcessingUnit::instruction_RollLeftCarryA(uint8_t* data) {
     instruction_RollLeftCarry(data);
-    isZero = false;
+    SetFlags(GetFlags() & ~(1 << FlagCpuZero));
 }
 
 void CentralProcessingUnit::instruction_RollLeftCarry(uint8_t* data) {
@@ -1265,33 +1781,29 @@ void CentralProcessingUnit::instruction_RollLeftCarry(uint8_t* data) {
     else if (data[0] == 0x05)
         reg = &(l);
     else if (data[0] == 0x06) {
-        uint16_t addr = getHL();
+        uint16_t addr = hl;
         uint8_t val = mmu->Read(addr);
 
         uint8_t carry_flag = check_bit(val, 7);
         uint8_t truncated_bit = check_bit(val, 7);
         val = static_cast<uint8_t>((val << 1) | truncated_bit);
 
-        isCarry = carry_flag;
-        isZero = val == 0;
-        isHalfCarry = isSubtract = false;
+        SetFlags(packFlags(val == 0, false, false, carry_flag));
         mmu->Write(addr, val);
         return;
-    } else if (data[0] == 0x07)
+    } else
         reg = &(accumulator);
 
     uint8_t carry_flag = check_bit((*reg), 7);
     uint8_t truncated_bit = check_bit((*reg), 7);
     (*reg) = static_cast<uint8_t>(((*reg) << 1) | truncated_bit);
 
-    isCarry = carry_flag;
-    isZero = (*reg) == 0;
-    isHalfCarry = isSubtract = false;
+    SetFlags(packFlags((*reg) == 0, false, false, carry_flag));
 }
 
 void CentralProcessingUnit::instruction_RollRightCarryA(uint8_t* data) {
     instruction_RollRightCarry(data);
-    isZero = false;
+    SetFlags(GetFlags() & ~(1 << FlagCpuZero));
 }
 
 void CentralProcessingUnit::instruction_RollRightCarry(uint8_t* data) {
@@ -1309,35 +1821,34 @@ void CentralProcessingUnit::instruction_RollRightCarry(uint8_t* data) {
     else if (data[0] == 0x0d)
         reg = &(l);
     else if (data[0] == 0x0e) {
-        uint16_t addr = getHL();
+        uint16_t addr = hl;
         uint8_t val = mmu->Read(addr);
 
         uint8_t carry_flag = check_bit(val, 0);
         uint8_t truncated_bit = check_bit(val, 0);
         val = static_cast<uint8_t>((val >> 1) | (truncated_bit << 7));
 
-        isCarry = carry_flag;
-        isZero = (val == 0);
-        isHalfCarry = isSubtract = false;
+        SetFlags(packFlags(val == 0, false, false, carry_flag));
         mmu->Write(addr, val);
         return;
-    } else if (data[0] == 0x0f)
+    } else
         reg = &(accumulator);
 
     uint8_t carry_flag = check_bit(*reg, 0);
     uint8_t truncated_bit = check_bit(*reg, 0);
     *reg = static_cast<uint8_t>(((*reg) >> 1) | (truncated_bit << 7));
 
-    isCarry = carry_flag;
-    isZero = (*reg) == 0;
-    isHalfCarry = isSubtract = false;
+    SetFlags(packFlags((*reg) == 0, false, false, carry_flag));
 }
 
 void CentralProcessingUnit::instruction_DAA(uint8_t* data) {
     uint8_t reg = accumulator;
+    uint8_t f = GetFlags();
+    bool isSubtract = check_bit(f, FlagCpuSubtract);
+    bool isCarry = check_bit(f, FlagCpuCarry);
     uint16_t correction = isCarry ? 0x60 : 0x00;
 
-    if (isHalfCarry || (!isSubtract && ((reg & 0x0F) > 9)))
+    if (check_bit(f, FlagCpuHalfCarry) || (!isSubtract && ((reg & 0x0F) > 9)))
         correction |= 0x06;
 
     if (isCarry || (!isSubtract && (reg > 0x99)))
@@ -1349,52 +1860,43 @@ void CentralProcessingUnit::instruction_DAA(uint8_t* data) {
         reg = static_cast<uint8_t>(reg + correction);
 
 
-    isCarry = (((correction << 2) & 0x100) != 0);
-    isHalfCarry = false;
-    isZero = (reg == 0);
+    SetFlags(packFlags(reg == 0, isSubtract, false, ((correction << 2) & 0x100) != 0));
     accumulator = static_cast<uint8_t>(reg);
 }
 
 void CentralProcessingUnit::instruction_SCF(uint8_t* data) {
-    isCarry = true;
-    isHalfCarry = isSubtract = false;
+    SetFlags(packFlags(zeroFlag(), false, false, true));
 }
 
 void CentralProcessingUnit::instruction_CCF(uint8_t* data) {
-    isCarry = !isCarry;
-    isHalfCarry = isSubtract = false;
+    SetFlags(packFlags(zeroFlag(), false, false, !carryFlag()));
 }
 
 void CentralProcessingUnit::instruction_SBC(uint8_t* data) {
-    uint8_t d;
+    uint8_t n;
     if (data[0] == 0x98)
-        d = b;
+        n = b;
     else if (data[0] == 0x99)
-        d = c;
+        n = c;
     else if (data[0] == 0x9a)
-        d = d;
+        n = d;
     else if (data[0] == 0x9b)
-        d = e;
+        n = e;
     else if (data[0] == 0x9c)
-        d = h;
+        n = h;
     else if (data[0] == 0x9d)
-        d = l;
+        n = l;
     else if (data[0] == 0x9e) {
-        uint16_t addr = getHL();
-        d = mmu->Read(addr);
+        uint16_t addr = hl;
+        n = mmu->Read(addr);
     } else if (data[0] == 0x9f)
-        d = accumulator;
-    else if (data[0] == 0xde)
-        d = data[1];
-
-    uint8_t carry = isCarry;
-    int result_full = (int)accumulator - d - carry;
-    uint8_t result = static_cast<uint8_t>(result_full);
-
-    isZero = (result == 0);
-    isSubtract = true;
-    isCarry = (result_full < 0);
-    isHalfCarry = (((accumulator & 0xf) - (d & 0xf) - carry) < 0);
+        n = accumulator;
+    else
+        n = data[1];
+
+    lazyCarry = carryFlag();
+    uint8_t result = accumulator - n - lazyCarry;
+    setLazyFlags(LazySbc, accumulator, n, result);
     accumulator = result;
 }
 
@@ -1413,23 +1915,19 @@ void CentralProcessingUnit::instruction_SLA(uint8_t* data) {
     else if (data[0] == 0x25)
         reg = &l;
     else if (data[0] == 0x26) {
-        uint16_t addr = getHL();
+        uint16_t addr = hl;
         uint8_t d = mmu->Read(addr);
         uint8_t carry_bit = check_bit(d, 7);
         uint8_t result = static_cast<uint8_t>(d << 1);
-        isZero = (result == 0);
-        isSubtract = isHalfCarry = false;
-        isCarry = carry_bit;
+        SetFlags(packFlags(result == 0, false, false, carry_bit));
         mmu->Write(addr, result);
         return;
-    } else if (data[0] == 0x27)
+    } else
         reg = &accumulator;
 
     uint8_t carry_bit = check_bit(*reg, 7);
     uint8_t result = static_cast<uint8_t>(*reg << 1);
-    isZero = (result == 0);
-    isSubtract = isHalfCarry = false;
-    isCarry = carry_bit;
+    SetFlags(packFlags(result == 0, false, false, carry_bit));
     *reg = result;
 }
 
@@ -1448,7 +1946,7 @@ void CentralProcessingUnit::instruction_SRA(uint8_t* data) {
     else if (data[0] == 0x2d)
         reg = &l;
     else if (data[0] == 0x2e) {
-        uint16_t addr = getHL();
+        uint16_t addr = hl;
         uint8_t d = mmu->Read(addr);
         uint8_t carry_bit = check_bit(d, 0);
         uint8_t top_bit = check_bit(d, 7);
@@ -1457,12 +1955,10 @@ void CentralProcessingUnit::instruction_SRA(uint8_t* data) {
             result |= (1 << 7);
         else
             result &= ~(1 << 7);
-        isZero = (result == 0);
-        isSubtract = isHalfCarry = false;
-        isCarry = carry_bit;
+        SetFlags(packFlags(result == 0, false, false, carry_bit));
         mmu->Write(addr, result);
         return;
-    } else if (data[0] == 0x2f)
+    } else
         reg = &accumulator;
 
     uint8_t carry_bit = check_bit(*reg, 0);
@@ -1473,9 +1969,7 @@ void CentralProcessingUnit::instruction_SRA(uint8_t* data) {
     else
         result &= ~(1 << 7);
 
-    isZero = (result == 0);
-    isSubtract = isHalfCarry = false;
-    isCarry = carry_bit;
+    SetFlags(packFlags(result == 0, false, false, carry_bit));
     *reg = result;
 }
 
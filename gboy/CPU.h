@@ -1,15 +1,59 @@
 #pragma once
 
+#include <cstdio>
 #include <vector>
 #include <map>
+#include <unordered_map>
 #include "MMU.h"
+#include "Jit.h"
+#include "Aot.h"
+#include "Profiler.h"
+#include "Trace.h"
+#include "Debugger.h"
+
+enum CpuEngine {
+    EngineInterpreter,  // fetch, look up and decode every instruction
+    EngineCached,       // run pre-decoded basic blocks from a cache
+    EngineJit,          // cached engine with hot register-only runs compiled to x86-64
+    EngineAot,          // cached engine with the runs of an AotImage linked into the build
+    EngineCount,
+};
+
+// Returns the cycles until the next PPU or timer event of the machine in context
+typedef uint32_t (*EventHorizonFunction)(void *context);
+
+// Lays out the halves of a register pair so the pair reads as a host uint16_t
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#define REGISTER_PAIR(hi, lo) struct { uint8_t hi, lo; }
+#else
+#define REGISTER_PAIR(hi, lo) struct { uint8_t lo, hi; }
+#endif
+
+// Bit positions of the flags in F
+const uint8_t FlagCpuZero = 7;
+const uint8_t FlagCpuSubtract = 6;
+const uint8_t FlagCpuHalfCarry = 5;
+const uint8_t FlagCpuCarry = 4;
+
+// Last flag-setting ALU operation; its flags are only worked out when read
+enum LazyFlagOp {
+    LazyNone,   // flags holds F as is
+    LazyAdd,
+    LazyAdc,
+    LazySub,    // SUB and CP
+    LazySbc,
+    LazyAnd,
+    LazyLogic,  // OR and XOR
+    LazyInc,
+    LazyDec,
+};
+
+const char *CpuEngineName(CpuEngine engine);
+bool CpuEngineFromName(const std::string &name, CpuEngine &engine);
 
 class CentralProcessingUnit {
 private:
     uint16_t time, deltaTime;
-    bool interruptMasterFlag;
-
-    bool isHalted;
     MemoryManagementUnit *mmu;
 
     class Instruction {
@@ -31,15 +75,99 @@ private:
     std::map<uint16_t, Instruction*> instructionSetExtended;
     uint8_t data[8];
 
-    uint8_t getFlags();
-    void setFlags(uint8_t val);
+    // An instruction with its operands already fetched. An op heading a fused
+    // group also carries the handler that runs the whole group in one step.
+    struct DecodedOp {
+        void (CentralProcessingUnit::*code)(uint8_t*);
+        uint8_t data[3];
+        uint8_t size;
+        uint8_t cycles;
+        uint16_t opcode;            // 0x100 | opcode for CB-prefixed ops
+        bool (CentralProcessingUnit::*fused)(const DecodedOp *ops);
+        uint8_t fusedOps;
+        uint8_t fusedSize;
+        uint8_t fusedLeadCycles;    // cycles before the last op of the group
+    };
+
+    // Straight-line run of instructions ending at the first control transfer.
+    // Blocks never cross a 256 byte page, so a block in RAM is checked against
+    // the write version of that single page.
+    struct DecodedBlock {
+        std::vector<DecodedOp> ops;
+        bool isRam;
+        uint32_t version;
+        uint32_t hits;
+        JitRunFunction run;
+        uint32_t runGeneration;
+        bool runFailed;
+        uint32_t runCycles;         // at most
+    };
+
+    CpuEngine engine;
+    JitCompiler *jit;
+    JitOptions jitOptions;
+    std::unordered_map<uint32_t, DecodedBlock*> blockCache;
+    DecodedBlock *currentBlock;
+    size_t currentOp;
+    uint16_t nextOpAddress;
+
+    // Page the interpreter is fetching from; nullptr falls back to mmu->Read
+    const uint8_t *fetchPage;
+    uint16_t fetchPageIndex;
+    uint32_t fetchMappingVersion;
+
+    uint8_t executeInterpreted();
+    uint8_t executeCached();
+    bool isCacheable(uint16_t addr);
+    DecodedBlock *lookupBlock(uint16_t addr);
+    void decodeBlock(DecodedBlock *block, uint16_t addr);
+    bool compileBlock(DecodedBlock *block, uint16_t addr);
+    size_t readRunCode(uint16_t addr, uint8_t *code);
+    bool runFitsHorizon(DecodedBlock *block);
+    bool interruptDueNext();
+    bool interruptEnabledNow;   // EI's IME was set on this step
+    std::unordered_map<uint32_t, JitRunFunction> aotRuns;
+    JitOptions aotOptions;      // the image's runs were planned with
+    bool attachAotRun(DecodedBlock *block, uint16_t addr);
+    uint8_t executeRun(DecodedBlock *block);
+
+    // Superinstructions. A fused handler returns false, without touching any
+    // state, when the group cannot run as one step right now.
+    EventHorizonFunction eventHorizon;
+    void *eventHorizonContext;
+    bool fusion;
+    void fuseBlock(DecodedBlock *block);
+    bool fused_LoadHLStore(const DecodedOp *ops);
+    bool fused_DecJumpNotZero(const DecodedOp *ops);
+    bool fused_CompareJump(const DecodedOp *ops);
+    bool fused_PollCompareJump(const DecodedOp *ops);
+    bool fused_PairTestJump(const DecodedOp *ops);
+
+    // Executed opcode pairs, indexed by previous * 0x200 + current opcode
+    std::vector<uint64_t> pairCounts;
+    uint16_t lastOpcode;
+    void countPair(uint16_t opcode);
+
+    Profiler *profiler;
+
+    TraceBuffer *tracer;
+    void traceInstruction(uint16_t pc, uint16_t opcode, const uint8_t *operands, uint8_t count);
+
+    Debugger *debugger;
+
+    // Operands of the last ALU op whose flags are not in F yet. lazyCarry is
+    // the carry in for ADC/SBC and the preserved carry for INC/DEC.
+    uint8_t lazyOp, lazyLeft, lazyRight, lazyResult, lazyCarry;
+
+    void setLazyFlags(uint8_t op, uint8_t left, uint8_t right, uint8_t result);
+    uint8_t packFlags(bool zero, bool subtract, bool halfCarry, bool carry);
+    bool zeroFlag();
+    bool carryFlag();
     bool check_bit(const uint8_t value, const uint8_t bit);
     void stackPush(uint16_t val);
     void stackPush(uint8_t hi, uint8_t lo);
     uint16_t stackPop();
     uint8_t readMemoryFromProgramCounter();
-    void setHL(uint16_t addr);
-    uint16_t getHL();
     uint16_t stitch(uint8_t hi, uint8_t lo);
 
     void instruction_NOP(uint8_t* data);
@@ -60,6 +188,7 @@ private:
     void instruction_LoadReg2Reg(uint8_t* data);
     void instruction_LoadAHL(uint8_t* data);
     void instruction_LoadHL(uint8_t* data);
+    void instruction_AddSP(uint8_t* data);
 
     void instruction_JR(uint8_t* data);
     void instruction_Call(uint8_t* data);
@@ -117,11 +246,50 @@ public:
     ~CentralProcessingUnit();
     void Print();
 
-    uint8_t accumulator;
-	uint8_t b, c, d, e, h, l;
+    // Pairs alias their 8-bit halves; flags is only current after GetFlags()
+    union { uint16_t af; REGISTER_PAIR(accumulator, flags); };
+    union { uint16_t bc; REGISTER_PAIR(b, c); };
+    union { uint16_t de; REGISTER_PAIR(d, e); };
+    union { uint16_t hl; REGISTER_PAIR(h, l); };
     uint16_t stackPointer;
 	uint16_t programCounter;
-    bool isZero, isSubtract, isCarry, isHalfCarry;
+    bool interruptMasterFlag;
+    bool interruptEnablePending;    // EI ran, IME is set before the next instruction
+    bool isHalted;
 
-    uint8_t ExecuteInstruction(uint16_t skipDebug = 0x00);
+    uint8_t GetFlags();
+    void SetFlags(uint8_t val);
+    uint8_t ExecuteInstruction();
+    void SetEngine(CpuEngine e);
+    CpuEngine GetEngine();
+    void FlushBlockCache();
+    void SetJitOptions(const JitOptions &options);
+    // Runs used by EngineAot; the image has to come from the loaded ROM
+    void SetAotImage(const AotImage *image);
+    // The cached engine only runs a fused group when all but its last
+    // instruction end before the next PPU or timer event, and a compiled run
+    // when all of it does, so interrupts are taken exactly where the
+    // interpreter takes them. Fusion stays off until a horizon is set;
+    // without one compiled runs are not limited, as for a bare CPU.
+    void SetEventHorizon(EventHorizonFunction horizon, void *context);
+    void SetFusion(bool enabled);
+    // Counts consecutive opcode pairs run by the interpreter and cached
+    // engine (compiled runs are not seen) to choose new fusions from
+    void SetPairProfiling(bool enabled);
+    void DumpPairProfile(FILE *out, size_t top);
+    // Name in the instruction table, 0x100 | opcode for CB-prefixed ones
+    std::string GetInstructionName(uint16_t opcode);
+    // Attributes the cycles of every instruction to profiler, or stops with
+    // nullptr. A compiled run counts as one instruction at its start.
+    void SetProfiler(Profiler *profiler);
+    // Records every instruction and interrupt into tracer, or stops with
+    // nullptr. The cached engine runs neither fused groups nor compiled runs
+    // while tracing, so it records the same instructions as the interpreter.
+    void SetTracer(TraceBuffer *tracer);
+    // Checked before every instruction; set by the debugger itself, and only
+    // while it has breakpoints or watchpoints. ExecuteInstruction returns 0
+    // without running anything while it is stopped.
+    void SetDebugger(Debugger *debugger);
+    // ROM bank code at addr runs from, 0 outside the switchable area
+    uint8_t GetCodeBank(uint16_t addr);
 };
@@ -1,25 +1,48 @@
 #include "Cartridge.h"
+#include "Log.h"
 
 Cartridge::Cartridge(const std::string path) {
     selectedBank = 1;
     supported = false;
     cartridgeSize = 0;
 
-    printf("Loading Cartridge: %s\n", path.c_str());
+    PICOBOY_LOG(LogInfo, LogCartridge, "Loading Cartridge: %s", path.c_str());
     std::ifstream cartridgeFile;
     cartridgeFile.open(path, std::ifstream::binary);
-        
-    cartridgeFile.seekg(0, cartridgeFile.end);
-    cartridgeSize = (unsigned long) cartridgeFile.tellg();
-    cartridgeFile.seekg(0, cartridgeFile.beg);
+    if(!cartridgeFile) {
+        PICOBOY_LOG(LogError, LogCartridge, "Unable to open %s", path.c_str());
+    } else {
+        cartridgeFile.seekg(0, cartridgeFile.end);
+        cartridgeSize = (unsigned long) cartridgeFile.tellg();
+        cartridgeFile.seekg(0, cartridgeFile.beg);
 
-    printf("Cartridge Size: %ld\n", cartridgeSize);
-    data = std::vector<uint8_t>(cartridgeSize);
-    cartridgeFile.read((char*)&data[0], cartridgeSize);
-    cartridgeFile.close();
+        PICOBOY_LOG(LogInfo, LogCartridge, "Cartridge Size: %ld", cartridgeSize);
+        data = std::vector<uint8_t>(cartridgeSize);
+        cartridgeFile.read((char*)data.data(), cartridgeSize);
+        cartridgeFile.close();
+    }
 
+    checkImage();
+    PICOBOY_LOG(LogInfo, LogCartridge, "Cartridge Supported: %d", supported);
+}
+
+Cartridge::Cartridge(const std::vector<uint8_t> &rom) {
+    selectedBank = 1;
+    data = rom;
+    cartridgeSize = data.size();
+    checkImage();
+}
+
+// An image too short to hold both banks mapped at all times is padded, so
+// reads stay inside it, and is not supported
+void Cartridge::checkImage() {
+    if(data.size() < CartMinSize) {
+        PICOBOY_LOG(LogError, LogCartridge, "ROM image of %zu bytes, at least %u expected", data.size(), CartMinSize);
+        data.resize(CartMinSize, 0xFF);
+        supported = false;
+        return;
+    }
     supported = data[AddrCartType] >= CartTypeRom && data[AddrCartType] <= CartTypeMBC1;
-    printf("Cartridge Supported: %d\n", supported);
 }
 
 Cartridge::~Cartridge() {
@@ -32,6 +55,30 @@ uint8_t Cartridge::Read(const uint16_t addr) {
         return data[addr];
 }
 
+const uint8_t *Cartridge::GetPage(const uint16_t addr) {
+    size_t offset = addr & 0xFF00;
+    if(addr >= 0x4000 && addr <= 0x7FFF)
+        offset += (selectedBank - 1) * 0x4000;
+    if(offset + 0x100 > data.size())
+        return nullptr;
+    return &data[offset];
+}
+
+uint32_t Cartridge::GetRomHash() {
+    uint32_t hash = 2166136261u;
+    for(uint8_t byte : data)
+        hash = (hash ^ byte) * 16777619u;
+    return hash;
+}
+
+bool Cartridge::IsSupported() {
+    return supported;
+}
+
+uint8_t Cartridge::GetSelectedBank() {
+    return selectedBank;
+}
+
 void Cartridge::selectRomBank(const uint8_t bank) {
     selectedBank = bank;
 }
\ No newline at end of file
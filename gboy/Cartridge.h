@@ -13,14 +13,27 @@ private:
     uint8_t selectedBank;
     long cartridgeSize;
     bool supported;
+
+    void checkImage();
 public:
     Cartridge(const std::string path);
+    Cartridge(const std::vector<uint8_t> &rom);
     ~Cartridge();
 
     uint8_t Read(const uint16_t addr);
+    // Host pointer to the 256 byte page holding addr in the current bank, or
+    // nullptr when the ROM image does not cover all of it
+    const uint8_t *GetPage(const uint16_t addr);
+    bool IsSupported();
+    // FNV-1a hash of the whole ROM image, which ahead-of-time code is tied to
+    uint32_t GetRomHash();
+    uint8_t GetSelectedBank();
     void selectRomBank(const uint8_t bank);
 };
 
+// The fixed bank and the first switchable one, which every cartridge has
+const uint32_t CartMinSize = 0x8000;
+
 const uint16_t AddrCartType = 0x0147;
 const uint16_t AddrCartSwitchTriggerStart = 0x2000;
 const uint16_t AddrCartSwitchTriggerEnd = 0x3FFF;
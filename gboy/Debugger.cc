@@ -0,0 +1,149 @@
+#include "Debugger.h"
+#include <algorithm>
+#include <cstring>
+#include "CPU.h"
+
+Debugger::Debugger() {
+    cpu = nullptr;
+    mmu = nullptr;
+    memset(breakPages, 0, sizeof(breakPages));
+    memset(watchPages, 0, sizeof(watchPages));
+    stopped = false;
+    stop = DebugStop{StopNone, 0, 0, 0, 0};
+    skipping = false;
+    skipAddr = 0;
+    stepping = false;
+    stepStarted = false;
+}
+
+void Debugger::Attach(CentralProcessingUnit *cpu, MemoryManagementUnit *mmu) {
+    this->cpu = cpu;
+    this->mmu = mmu;
+    update();
+}
+
+void Debugger::Detach() {
+    if(cpu)
+        cpu->SetDebugger(nullptr);
+    if(mmu)
+        mmu->SetDebugger(nullptr);
+    cpu = nullptr;
+    mmu = nullptr;
+}
+
+// Rebuilds the page tables and only hands the debugger to the CPU and MMU
+// while they have something to check
+void Debugger::update() {
+    memset(breakPages, 0, sizeof(breakPages));
+    memset(watchPages, 0, sizeof(watchPages));
+    for(uint16_t addr : breakpoints)
+        breakPages[addr >> 8] = 1;
+    for(const Watchpoint &w : watchpoints) {
+        for(uint32_t page = w.start >> 8; page <= (uint32_t)(w.end >> 8); page++)
+            watchPages[page] |= w.kinds;
+    }
+    // The skip is only dropped by a check at its own page, so it goes with
+    // its breakpoint
+    if(skipping && std::find(breakpoints.begin(), breakpoints.end(), skipAddr) == breakpoints.end())
+        skipping = false;
+
+    if(cpu)
+        cpu->SetDebugger(IsActive() ? this : nullptr);
+    if(mmu)
+        mmu->SetDebugger(watchpoints.empty() ? nullptr : this);
+}
+
+void Debugger::AddBreakpoint(uint16_t addr) {
+    if(std::find(breakpoints.begin(), breakpoints.end(), addr) == breakpoints.end())
+        breakpoints.push_back(addr);
+    update();
+}
+
+bool Debugger::RemoveBreakpoint(uint16_t addr) {
+    auto it = std::find(breakpoints.begin(), breakpoints.end(), addr);
+    if(it == breakpoints.end())
+        return false;
+    breakpoints.erase(it);
+    update();
+    return true;
+}
+
+void Debugger::AddWatchpoint(uint16_t start, uint16_t end, uint8_t kinds) {
+    watchpoints.push_back(Watchpoint{std::min(start, end), std::max(start, end), kinds});
+    update();
+}
+
+bool Debugger::RemoveWatchpoint(uint16_t start, uint16_t end, uint8_t kinds) {
+    for(auto it = watchpoints.begin(); it != watchpoints.end(); ++it) {
+        if(it->start == std::min(start, end) && it->end == std::max(start, end) && it->kinds == kinds) {
+            watchpoints.erase(it);
+            update();
+            return true;
+        }
+    }
+    return false;
+}
+
+void Debugger::Clear() {
+    breakpoints.clear();
+    watchpoints.clear();
+    update();
+}
+
+void Debugger::Stop() {
+    if(stopped)
+        return;
+    stopped = true;
+    stop = DebugStop{StopRequested, 0, 0, 0, 0};
+    update();
+}
+
+// Only a breakpoint or step knows its PC when it stops; the others stop between
+// instructions, where the CPU is now
+const DebugStop &Debugger::GetStop() {
+    if(stopped && stop.reason != StopBreakpoint && stop.reason != StopStep && cpu)
+        stop.pc = cpu->programCounter;
+    return stop;
+}
+
+void Debugger::Resume() {
+    // Execution goes on with the instruction a breakpoint stopped before;
+    // other stops are between instructions and have nothing to pass over
+    skipping = stopped && stop.reason == StopBreakpoint;
+    skipAddr = stop.pc;
+    stopped = false;
+    stop.reason = StopNone;
+    update();
+}
+
+void Debugger::Step() {
+    stepping = true;
+    stepStarted = false;
+    Resume();
+}
+
+bool Debugger::hitBreakpoint(uint16_t pc) {
+    if(stepping) {
+        // The instruction stepped runs even when it has a breakpoint
+        if(!stepStarted) {
+            stepStarted = true;
+            skipping = false;
+            return false;
+        }
+        stepping = false;
+        stopped = true;
+        stop = DebugStop{StopStep, pc, 0, 0, 0};
+        return true;
+    }
+    // Only the first instruction after resuming is passed over
+    if(skipping) {
+        skipping = false;
+        if(pc == skipAddr)
+            return false;
+    }
+    if(std::find(breakpoints.begin(), breakpoints.end(), pc) == breakpoints.end())
+        return false;
+    stopped = true;
+    stop = DebugStop{StopBreakpoint, pc, 0, 0, 0};
+    return true;
+}
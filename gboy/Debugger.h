@@ -0,0 +1,111 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+class CentralProcessingUnit;
+class MemoryManagementUnit;
+
+// Kinds of access a watchpoint stops on
+const uint8_t WatchRead = 1;
+const uint8_t WatchWrite = 2;
+const uint8_t WatchAccess = WatchRead | WatchWrite;
+
+enum DebugStopReason {
+    StopNone,
+    StopBreakpoint,     // before the instruction at pc runs
+    StopWatchRead,      // after the instruction that read addr
+    StopWatchWrite,     // after the instruction that wrote value to addr
+    StopRequested,      // Stop() was called
+    StopStep,           // Step() ran one instruction
+};
+
+struct DebugStop {
+    DebugStopReason reason;
+    uint16_t pc;        // where execution resumes
+    uint16_t addr;
+    uint8_t value;
+    uint8_t kinds;      // of the watchpoint hit
+};
+
+// Execution breakpoints and memory watchpoints. Nothing is checked per
+// instruction or per access until one is set: the CPU and MMU only see the
+// debugger while it has any, and then only pages marked in a 256 entry table
+// go through the checks. Breakpoints are on addresses, in whatever bank is
+// mapped there.
+//
+// Once stopped, the CPU runs nothing until Resume(); a breakpoint stops
+// before its instruction, a watchpoint after the instruction that made the
+// access. While any are set the cached engine runs neither fused groups nor
+// compiled runs, so it stops at the same places as the interpreter, and
+// neither idle loops nor HALT are skipped, so time stops with the CPU.
+class Debugger {
+private:
+    struct Watchpoint {
+        uint16_t start, end;    // [start, end]
+        uint8_t kinds;
+    };
+
+    CentralProcessingUnit *cpu;
+    MemoryManagementUnit *mmu;
+    std::vector<uint16_t> breakpoints;
+    std::vector<Watchpoint> watchpoints;
+    uint8_t breakPages[0x100];
+    uint8_t watchPages[0x100];
+    bool stopped;
+    DebugStop stop;
+    bool skipping;
+    uint16_t skipAddr;      // the breakpoint resumed from, passed once
+    bool stepping;
+    bool stepStarted;
+
+    void update();
+    bool hitBreakpoint(uint16_t pc);
+    // The instruction still completes; the CPU stops before the next one
+    void hitWatchpoint(DebugStopReason reason, uint8_t kind, uint16_t addr, uint8_t value) {
+        if(stopped)
+            return;
+        for(const Watchpoint &w : watchpoints) {
+            if((w.kinds & kind) && addr >= w.start && addr <= w.end) {
+                stopped = true;
+                stop = DebugStop{reason, 0, addr, value, w.kinds};
+                return;
+            }
+        }
+    }
+
+public:
+    Debugger();
+    // Called by GBoy::SetDebugger
+    void Attach(CentralProcessingUnit *cpu, MemoryManagementUnit *mmu);
+    void Detach();
+
+    void AddBreakpoint(uint16_t addr);
+    bool RemoveBreakpoint(uint16_t addr);
+    void AddWatchpoint(uint16_t start, uint16_t end, uint8_t kinds);
+    bool RemoveWatchpoint(uint16_t start, uint16_t end, uint8_t kinds);
+    void Clear();
+
+    bool IsStopped() { return stopped; }
+    // The CPU and MMU only see the debugger while this holds, and the
+    // machine takes no shortcuts that would move time on past a stop
+    bool IsActive() { return !breakpoints.empty() || !watchpoints.empty() || stopped || stepping; }
+    const DebugStop &GetStop();
+    void Stop();
+    void Resume();
+    // Resumes for one instruction, or into the handler of an interrupt taken
+    // first; a HALT only completes once an interrupt wakes it
+    void Step();
+
+    // From the CPU before each instruction and the MMU on watched pages
+    bool CheckBreakpoint(uint16_t pc) {
+        return (breakPages[pc >> 8] || stepping) && hitBreakpoint(pc);
+    }
+    uint8_t GetWatchedKinds(uint16_t addr) { return watchPages[addr >> 8]; }
+    void CheckRead(uint16_t addr) {
+        hitWatchpoint(StopWatchRead, WatchRead, addr, 0);
+    }
+    void CheckWrite(uint16_t addr, uint8_t value) {
+        hitWatchpoint(StopWatchWrite, WatchWrite, addr, value);
+    }
+};
@@ -0,0 +1,151 @@
+#include "FramePacer.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <thread>
+
+const char *PacingModeName(PacingMode mode) {
+    switch(mode) {
+        case PacingOff: return "off";
+        case PacingClock: return "clock";
+        case PacingAudio: return "audio";
+        default: return "unknown";
+    }
+}
+
+bool PacingModeFromName(const std::string &name, PacingMode &mode) {
+    for(int i = 0; i < PacingCount; i++) {
+        if(name == PacingModeName((PacingMode)i)) {
+            mode = (PacingMode)i;
+            return true;
+        }
+    }
+    return false;
+}
+
+FramePacer::FramePacer(PacingMode mode, uint32_t audioRate) {
+    this->mode = mode;
+    this->audioRate = audioRate;
+    speed = 1;
+    audioTarget = PacingAudioTarget;
+    presentInterval = PacingPresentNSec;
+    start = -1;
+    cycles = 0;
+    lastFrame = lastDone = -1;
+    frameNSec = 0;
+    intervals = 0;
+    intervalSum = intervalSquares = 0;
+    late = 0;
+}
+
+PacingMode FramePacer::GetMode() {
+    return mode;
+}
+
+void FramePacer::SetAudioTarget(size_t frames) {
+    audioTarget = frames;
+}
+
+void FramePacer::SetSpeed(uint32_t speed) {
+    if(speed == this->speed)
+        return;
+    // Emulated time starts over at the new rate
+    this->speed = speed;
+    start = -1;
+    cycles = 0;
+}
+
+uint32_t FramePacer::GetSpeed() {
+    return speed;
+}
+
+void FramePacer::SetPresentInterval(int64_t nsec) {
+    presentInterval = nsec;
+}
+
+int64_t FramePacer::FrameDone(int64_t now, uint32_t frameCycles, size_t audioQueued, bool presented) {
+    int64_t wait = waitFor(now, frameCycles, audioQueued);
+
+    // The frame is presented once the wait is over
+    int64_t at = now + wait;
+    if(lastDone >= 0)
+        frameNSec = at - lastDone;
+    lastDone = at;
+    if(!presented)
+        return wait;
+    if(lastFrame >= 0) {
+        double interval = (double)(at - lastFrame);
+        double expected = speed == 1 ? OneFrameDurationNSec : presentInterval;
+        intervals++;
+        intervalSum += interval;
+        intervalSquares += interval * interval;
+        late += interval > 1.5 * expected;
+    }
+    lastFrame = at;
+    return wait;
+}
+
+bool FramePacer::WantsFrame(int64_t now) {
+    return speed == 1 || lastFrame < 0 || now + frameNSec - lastFrame >= presentInterval;
+}
+
+int64_t FramePacer::waitFor(int64_t now, uint32_t frameCycles, size_t audioQueued) {
+    if(mode == PacingOff || speed == PacingSpeedUnlimited)
+        return 0;
+
+    // The audio device consumes samples at its own clock; wait out whatever
+    // is queued beyond the target, but never more than two frames at once
+    if(mode == PacingAudio && speed == 1) {
+        if(audioQueued <= audioTarget)
+            return 0;
+        int64_t wait = (int64_t)(audioQueued - audioTarget) * 1000000000 / audioRate;
+        return std::min(wait, 2 * OneFrameDurationNSec);
+    }
+
+    // The first frame sets time zero; after that emulated time is held to the clock
+    if(start < 0) {
+        start = now;
+        return 0;
+    }
+    uint64_t rate = (uint64_t)CyclesCpu * speed;
+    cycles += frameCycles;
+    if(cycles >= rate) {
+        start += 1000000000;
+        cycles -= rate;
+    }
+    int64_t wait = start + (int64_t)(cycles * 1000000000 / rate) - now;
+    if(wait < -PacingMaxLagNSec) {
+        start = now;
+        cycles = 0;
+        return 0;
+    }
+    return std::max(wait, (int64_t)0);
+}
+
+PacingStats FramePacer::GetStats() {
+    PacingStats stats = {};
+    stats.frames = intervals;
+    stats.late = late;
+    if(intervals) {
+        stats.meanNSec = intervalSum / intervals;
+        stats.jitterNSec = sqrt(std::max(0.0, intervalSquares / intervals - stats.meanNSec * stats.meanNSec));
+    }
+    return stats;
+}
+
+int64_t FramePacer::Now() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Sleeps for most of the wait and spins the rest, since a sleep can
+// overshoot by a scheduler tick
+void FramePacer::Wait(int64_t nsec) {
+    if(nsec <= 0)
+        return;
+    int64_t deadline = Now() + nsec;
+    if(nsec > PacingSpinNSec)
+        std::this_thread::sleep_for(std::chrono::nanoseconds(nsec - PacingSpinNSec));
+    while(Now() < deadline)
+        std::this_thread::yield();
+}
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include "constants.h"
+
+enum PacingMode {
+    PacingOff,      // run as fast as possible
+    PacingClock,    // hold emulated time to a monotonic clock
+    PacingAudio,    // hold the audio ring buffer at a fill level
+    PacingCount,
+};
+
+const char *PacingModeName(PacingMode mode);
+bool PacingModeFromName(const std::string &name, PacingMode &mode);
+
+// Once the clock is this far behind, pacing restarts from now instead of
+// running flat out to catch up
+const int64_t PacingMaxLagNSec = 4 * OneFrameDurationNSec;
+// The last part of a wait is spun rather than slept, for low jitter
+const int64_t PacingSpinNSec = 1000000;
+// Stereo frames kept queued in audio mode, about 43 ms at 48 kHz
+const size_t PacingAudioTarget = 2048;
+// Speed factor that runs uncapped; 1 is normal speed
+const uint32_t PacingSpeedUnlimited = 0;
+// Host refresh interval assumed until the frontend sets the real one
+const int64_t PacingPresentNSec = 1000000000 / 60;
+
+struct PacingStats {
+    uint64_t frames;
+    double meanNSec;        // between presented frames
+    double jitterNSec;      // standard deviation of that interval
+    uint64_t late;          // intervals over 1.5 frames, or host refreshes when fast-forwarding
+};
+
+// Decides how long the frontend waits after each emulated frame and, when
+// fast-forwarding, which frames are worth drawing at all. The decisions take
+// the time and the audio fill level as arguments, so it can be driven by a
+// fake clock.
+class FramePacer {
+private:
+    PacingMode mode;
+    uint32_t speed;
+    int64_t start;
+    uint64_t cycles;        // emulated since start
+    size_t audioTarget;
+    uint32_t audioRate;
+    int64_t presentInterval;
+
+    int64_t lastFrame;
+    int64_t lastDone;
+    int64_t frameNSec;      // between the last two frames, shown or not
+    uint64_t intervals;
+    double intervalSum, intervalSquares;
+    uint64_t late;
+
+    int64_t waitFor(int64_t now, uint32_t frameCycles, size_t audioQueued);
+
+public:
+    FramePacer(PacingMode mode, uint32_t audioRate);
+    PacingMode GetMode();
+    void SetAudioTarget(size_t frames);
+    // Runs speed times faster than the DMG, or uncapped with
+    // PacingSpeedUnlimited; above normal speed the audio fill level is
+    // ignored and time is held to the clock instead
+    void SetSpeed(uint32_t speed);
+    uint32_t GetSpeed();
+    void SetPresentInterval(int64_t nsec);
+
+    // Called once a frame is ready, with the cycles emulated since the last
+    // call, the stereo frames still queued for the audio device and whether
+    // the frame will be presented; returns the nanoseconds to wait before
+    // presenting it and going on
+    int64_t FrameDone(int64_t now, uint32_t frameCycles, size_t audioQueued, bool presented = true);
+    // Whether the next frame should be drawn. Always at normal speed; when
+    // fast-forwarding only if it will be done once a host refresh has gone
+    // by since the last presented frame, so just the latest frame is shown.
+    bool WantsFrame(int64_t now);
+    PacingStats GetStats();
+
+    static int64_t Now();
+    static void Wait(int64_t nsec);
+};
@@ -1,23 +1,283 @@
 #include "GBoy.h"
+#include <algorithm>
+#include "Instrument.h"
+#include "Log.h"
 
-GBoy::GBoy(std::string path) {
-    Cartridge *cart = new Cartridge(path);
+GBoy::GBoy(std::string path) : GBoy(new Cartridge(path)) {
+}
+
+GBoy::GBoy(Cartridge *cart) {
+    cartridge = cart;
     mmu = new MemoryManagementUnit(cart);
     cpu = new CentralProcessingUnit(mmu);
     ppu = new PixelProcessingUnit(mmu);
     timer = new Timer(mmu);
+    apu = new AudioProcessingUnit(mmu);
+    inputSequence = 0;
+    profiler = nullptr;
+    tracer = nullptr;
+    debugger = nullptr;
+    idleSkipping = true;
+    idle = {};
+    idleCyclesSkipped = 0;
+    cpu->SetEventHorizon(&GBoy::eventHorizon, this);
 }
 
 GBoy::~GBoy() {
+    delete apu;
     delete mmu;
     delete cpu;
     delete ppu;
 }
 
-void GBoy::ExecuteStep() {
-    uint8_t opCycles = cpu->ExecuteInstruction(0xffff);
+uint32_t GBoy::ExecuteStep() {
+    // Key changes reach the joypad register between two instructions
+    uint32_t sequence = input.GetSequence();
+    if(sequence != inputSequence) {
+        inputSequence = sequence;
+        mmu->SetJoypad(input.GetPressed());
+    }
+
+    bool wasHalted = cpu->isHalted;
+    uint16_t pc = cpu->programCounter;
+    uint32_t opCycles = cpu->ExecuteInstruction();
+    if(!opCycles)
+        return 0; // stopped by the debugger
+    // Time only moves on instruction by instruction under a debugger, so a
+    // watchpoint leaves the machine right after the access
+    bool debugging = debugger && debugger->IsActive();
+    // Nothing can wake a halted CPU before the next PPU or timer event, so skip ahead to it
+    if(wasHalted && cpu->isHalted && !debugging) {
+        opCycles = std::min(cyclesUntilNextEvent(), (uint32_t)CyclesHaltStepMax) & ~3u;
+        opCycles = std::max(opCycles, 4u);
+        PICOBOY_COUNT(haltCycles, opCycles);
+        // Halted time goes to the HALT instruction
+        if(profiler)
+            profiler->Count(cpu->GetCodeBank(pc - 1), pc - 1, opCycles);
+    }
     ppu->Cycle(opCycles);
     timer->Cycle(opCycles);
+    apu->Cycle(opCycles);
+    if(debugging) {
+        // These steps go unmeasured, so the iteration being timed is dropped
+        idle.tracking = false;
+    } else if(idleSkipping) {
+        uint32_t skipped = skipIdleLoop(pc, opCycles);
+        if(skipped && profiler)
+            profiler->Count(cpu->GetCodeBank(cpu->programCounter), cpu->programCounter, skipped);
+        opCycles += skipped;
+    }
+    if(tracer)
+        tracer->Advance(opCycles);
+    return opCycles;
+}
+
+uint32_t GBoy::cyclesUntilNextEvent() {
+    return std::min(ppu->CyclesUntilNextEvent(), timer->CyclesUntilNextEvent());
+}
+
+uint32_t GBoy::eventHorizon(void *context) {
+    return ((GBoy*)context)->cyclesUntilNextEvent();
+}
+
+// Runs the PPU and timer for a stretch that contains no event
+void GBoy::advance(uint32_t cycles) {
+    apu->Cycle(cycles);
+    while(cycles) {
+        uint8_t step = std::min(cycles, (uint32_t)CyclesHaltStepMax);
+        ppu->Cycle(step);
+        timer->Cycle(step);
+        cycles -= step;
+    }
+}
+
+// Called after every step with the PC it started at; returns the cycles skipped
+uint32_t GBoy::skipIdleLoop(uint16_t pc, uint32_t cycles) {
+    uint16_t next = cpu->programCounter;
+    if(idle.tracking) {
+        // Leaving the body, including to an interrupt vector, ends the iteration being measured
+        if(next < idle.start || next >= idle.end)
+            idle.tracking = false;
+        else
+            idle.cycles += cycles;
+    }
+
+    if(cpu->isHalted || next > pc || pc - next >= IdleLoopMaxBytes)
+        return 0;
+
+    // Analysed again on every entry, as the pointers the body reads through
+    // were checked with the values they had then
+    if(next != idle.start || !idle.tracking) {
+        idle.start = next;
+        idle.polling = analyzeIdleLoop(next);
+        idle.tracking = false;
+    }
+    if(!idle.polling)
+        return 0;
+
+    uint32_t skipped = 0;
+    if(idle.tracking && idle.cycles < idle.deadline && matchesIdleSnapshot()) {
+        // Whole iterations that end before the next event
+        uint32_t length = idle.cycles;
+        skipped = (cyclesUntilNextEvent() - 1) / length * length;
+        advance(skipped);
+        idleCyclesSkipped += skipped;
+    }
+    snapshotIdleLoop();
+    return skipped;
+}
+
+void GBoy::snapshotIdleLoop() {
+    cpu->GetFlags();
+    idle.af = cpu->af, idle.bc = cpu->bc, idle.de = cpu->de, idle.hl = cpu->hl;
+    idle.sp = cpu->stackPointer;
+    idle.ime = cpu->interruptMasterFlag;
+    idle.cycles = 0;
+    idle.deadline = cyclesUntilNextEvent();
+    idle.tracking = true;
+}
+
+bool GBoy::matchesIdleSnapshot() {
+    cpu->GetFlags();
+    return idle.af == cpu->af && idle.bc == cpu->bc && idle.de == cpu->de && idle.hl == cpu->hl
+        && idle.sp == cpu->stackPointer && idle.ime == cpu->interruptMasterFlag;
+}
+
+// Memory whose value can only change through a CPU write or a PPU/timer
+// event. Key changes are only applied between steps, so a skip delays them
+// to the next event at most.
+bool GBoy::isEventDrivenRead(uint16_t addr) {
+    if(addr >= 0xA000 && addr <= 0xBFFF)
+        return false; // cartridge RAM may hold a clock
+    if(addr < 0xFF00 || addr >= 0xFF80)
+        return true;
+    return addr == 0xFF00 || addr == AddrRegInterruptFlag || (addr >= AddrRegLcdControl && addr <= AddrRegWindowX);
+}
+
+// Decodes the loop starting at start. The body may only read memory, change
+// registers and branch; it ends at the first branch back to start, and every
+// other branch has to leave the body.
+bool GBoy::analyzeIdleLoop(uint16_t start) {
+    const uint8_t regA = 7, regMemory = 6;
+    uint8_t written = 0;            // bit r set once register r is modified
+    uint16_t exits[IdleLoopMaxBytes];
+    int exitCount = 0;
+    uint16_t reads[IdleLoopMaxBytes + 4];
+    int readCount = 0;
+    bool closed = false;
+    bool readsHL = false, readsBC = false, readsDE = false, readsC = false;
+
+    uint16_t addr = start;
+    while(addr - start < IdleLoopMaxBytes) {
+        uint8_t op = mmu->Peek(addr);
+        uint8_t n = mmu->Peek(addr + 1);
+        uint16_t nn = (mmu->Peek(addr + 2) << 8) | n;
+        int x = op >> 6, y = (op >> 3) & 7, z = op & 7;
+        int size = 1;
+        bool branch = false, conditional = false;
+        uint16_t target = 0;
+
+        if(op == 0x00) {
+        } else if(x == 1) {
+            if(op == 0x76 || y == regMemory)
+                return false; // HALT, LD (HL),r
+            readsHL |= (z == regMemory);
+            written |= 1 << y;
+        } else if(x == 2) {
+            readsHL |= (z == regMemory);
+            written |= 1 << regA;
+        } else if(x == 0 && (z == 4 || z == 5 || z == 6)) {
+            if(y == regMemory)
+                return false; // INC/DEC/LD (HL)
+            written |= 1 << y;
+            size = (z == 6) ? 2 : 1;
+        } else if(x == 0 && z == 7) {
+            written |= 1 << regA; // rotates on A, DAA, CPL, SCF, CCF
+        } else if(op == 0x0a || op == 0x1a) {
+            readsBC |= (op == 0x0a);
+            readsDE |= (op == 0x1a);
+            written |= 1 << regA;
+        } else if(op == 0x18 || op == 0x20 || op == 0x28 || op == 0x30 || op == 0x38) {
+            size = 2;
+            branch = true;
+            conditional = (op != 0x18);
+            target = addr + 2 + (int8_t)n;
+        } else if(op == 0xc3 || op == 0xc2 || op == 0xca || op == 0xd2 || op == 0xda) {
+            size = 3;
+            branch = true;
+            conditional = (op != 0xc3);
+            target = nn;
+        } else if(x == 3 && z == 6) {
+            size = 2;
+            written |= 1 << regA;
+        } else if(op == 0xf0) {
+            size = 2;
+            reads[readCount++] = 0xFF00 + n;
+            written |= 1 << regA;
+        } else if(op == 0xfa) {
+            size = 3;
+            reads[readCount++] = nn;
+            written |= 1 << regA;
+        } else if(op == 0xf2) {
+            readsC = true;
+            written |= 1 << regA;
+        } else if(op == 0xcb) {
+            size = 2;
+            int cz = n & 7;
+            if((n >> 6) == 1)
+                readsHL |= (cz == regMemory); // BIT
+            else if(cz == regMemory)
+                return false;
+            else
+                written |= 1 << cz;
+        } else
+            return false;
+
+        addr += size;
+        if(!branch)
+            continue;
+        if(target == start) {
+            idle.end = addr;
+            closed = true;
+            break;
+        }
+        if(!conditional)
+            return false;
+        exits[exitCount++] = target;
+    }
+    if(!closed)
+        return false;
+
+    for(int i = 0; i < exitCount; i++)
+        if(exits[i] >= start && exits[i] < idle.end)
+            return false;
+
+    // Pointer registers must hold the same address on every pass
+    const uint8_t regB = 0, regC = 1, regD = 2, regE = 3, regH = 4, regL = 5;
+    if(readsHL) {
+        if(written & ((1 << regH) | (1 << regL)))
+            return false;
+        reads[readCount++] = cpu->hl;
+    }
+    if(readsBC) {
+        if(written & ((1 << regB) | (1 << regC)))
+            return false;
+        reads[readCount++] = cpu->bc;
+    }
+    if(readsDE) {
+        if(written & ((1 << regD) | (1 << regE)))
+            return false;
+        reads[readCount++] = cpu->de;
+    }
+    if(readsC) {
+        if(written & (1 << regC))
+            return false;
+        reads[readCount++] = 0xFF00 + cpu->c;
+    }
+    for(int i = 0; i < readCount; i++)
+        if(!isEventDrivenRead(reads[i]))
+            return false;
+    return true;
 }
 
 void GBoy::GetFrameBufferColor(uint8_t &red, uint8_t &green, uint8_t &blue, uint8_t x, uint8_t y) {
@@ -33,3 +293,71 @@ bool GBoy::GetFrameBufferUpdatedFlag() {
 void GBoy::SetFrameBufferUpdatedFlag(bool v) {
     ppu->HasFrameBufferUpdated = v;
 }
+
+void GBoy::SetFrameOutput(bool enabled) {
+    ppu->SetFrameOutput(enabled);
+}
+
+bool GBoy::GetFrameBufferRenderedFlag() {
+    return ppu->HasFrameBufferRendered;
+}
+
+void GBoy::SetCpuEngine(CpuEngine engine) {
+    cpu->SetEngine(engine);
+}
+
+bool GBoy::SetAotImage(const AotImage *image) {
+    if(image->romHash != cartridge->GetRomHash()) {
+        PICOBOY_LOG(LogError, LogCpu, "AOT image %s was built from a different ROM", image->name);
+        return false;
+    }
+    cpu->SetAotImage(image);
+    return true;
+}
+
+void GBoy::SetFusion(bool enabled) {
+    cpu->SetFusion(enabled);
+}
+
+void GBoy::SetIdleLoopSkipping(bool enabled) {
+    idleSkipping = enabled;
+    idle = {};
+}
+
+uint64_t GBoy::GetIdleCyclesSkipped() {
+    return idleCyclesSkipped;
+}
+
+CentralProcessingUnit *GBoy::GetCPU() {
+    return cpu;
+}
+
+MemoryManagementUnit *GBoy::GetMMU() {
+    return mmu;
+}
+
+AudioProcessingUnit *GBoy::GetAPU() {
+    return apu;
+}
+
+Input *GBoy::GetInput() {
+    return &input;
+}
+
+void GBoy::SetProfiler(Profiler *profiler) {
+    this->profiler = profiler;
+    cpu->SetProfiler(profiler);
+}
+
+void GBoy::SetDebugger(Debugger *debugger) {
+    if(this->debugger)
+        this->debugger->Detach();
+    this->debugger = debugger;
+    if(debugger)
+        debugger->Attach(cpu, mmu);
+}
+
+void GBoy::SetTracer(TraceBuffer *tracer) {
+    this->tracer = tracer;
+    cpu->SetTracer(tracer);
+}
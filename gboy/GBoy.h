@@ -6,22 +6,89 @@
 #include "Timer.h"
 #include "Cartridge.h"
 #include "PPU.h"
+#include "APU.h"
+#include "input.h"
 #include <time.h>
 
+// Longest single step while halted; PPU and Timer take their cycles as uint8_t
+const uint8_t CyclesHaltStepMax = 252;
+// Longest loop body, in bytes, considered for idle-loop skipping
+const uint8_t IdleLoopMaxBytes = 16;
+
+// A short loop that only reads memory changed by PPU or timer events. Once
+// an iteration runs without an event and leaves the registers unchanged, every
+// further iteration before the next event would do the same, so they are skipped.
+struct IdleLoop {
+    uint16_t start, end;    // body is [start, end)
+    bool polling;           // body passed analyzeIdleLoop
+    bool tracking;          // snapshot taken and PC has stayed in the body since
+    uint16_t af, bc, de, hl, sp;
+    bool ime;
+    uint32_t cycles;        // since the snapshot
+    uint32_t deadline;      // cycles from the snapshot to the next event
+};
+
 class GBoy {
 private:
+    Cartridge *cartridge;
     MemoryManagementUnit *mmu;
     CentralProcessingUnit *cpu; 
     PixelProcessingUnit *ppu;
     Timer *timer;
+    AudioProcessingUnit *apu;
+    Profiler *profiler;
+    TraceBuffer *tracer;
+    Debugger *debugger;
+    Input input;
+    uint32_t inputSequence;
+
+    bool idleSkipping;
+    IdleLoop idle;
+    uint64_t idleCyclesSkipped;
+
+    uint32_t cyclesUntilNextEvent();
+    static uint32_t eventHorizon(void *context);
+    void advance(uint32_t cycles);
+    uint32_t skipIdleLoop(uint16_t pc, uint32_t cycles);
+    bool analyzeIdleLoop(uint16_t start);
+    bool isEventDrivenRead(uint16_t addr);
+    void snapshotIdleLoop();
+    bool matchesIdleSnapshot();
 
 public:
     GBoy(std::string path);
+    GBoy(Cartridge *cart);
     ~GBoy();
     void Print();
-    void ExecuteStep();
+    uint32_t ExecuteStep();
     bool GetFrameBufferUpdatedFlag();
     void SetFrameBufferUpdatedFlag(bool v);
+    // Turns drawing off for the frames that start from now on, e.g. the ones
+    // a fast-forwarding frontend will not show; the emulation is unaffected
+    void SetFrameOutput(bool enabled);
+    // Whether the frame that last completed was drawn into the frame buffer
+    bool GetFrameBufferRenderedFlag();
+    void SetCpuEngine(CpuEngine engine);
+    // Hands the runs of a recompiled ROM to EngineAot; refused, returning
+    // false, when the image was built from a different ROM
+    bool SetAotImage(const AotImage *image);
+    // Fused instruction groups in the cached and JIT engines
+    void SetFusion(bool enabled);
+    void SetIdleLoopSkipping(bool enabled);
+    uint64_t GetIdleCyclesSkipped();
+    CentralProcessingUnit *GetCPU();
+    MemoryManagementUnit *GetMMU();
+    AudioProcessingUnit *GetAPU();
+    // Safe to press and release keys on from any thread
+    Input *GetInput();
+    // Profiles the emulated code, halted and skipped cycles included;
+    // nullptr stops
+    void SetProfiler(Profiler *profiler);
+    // Records every instruction into tracer, stamped with the machine cycles
+    // run since it was set; nullptr stops
+    void SetTracer(TraceBuffer *tracer);
+    // Breakpoints and watchpoints; ExecuteStep returns 0 while it is stopped
+    void SetDebugger(Debugger *debugger);
 
     void GetFrameBufferColor(uint8_t &red, uint8_t &green, uint8_t &blue, uint8_t x, uint8_t y);
 };
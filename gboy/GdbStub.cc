@@ -0,0 +1,364 @@
+#include "GdbStub.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "GBoy.h"
+
+// af bc de hl sp pc ix iy af' bc' de' hl' ir, as gdb's z80 target numbers them
+const int GdbRegisterCount = 13;
+const int GdbRegisterPc = 5;
+
+static const char *hexDigits = "0123456789abcdef";
+
+static std::string hexByte(uint8_t value) {
+    return std::string(1, hexDigits[value >> 4]) + hexDigits[value & 0xf];
+}
+
+static std::string hexWord(uint16_t value) {
+    return hexByte(value & 0xff) + hexByte(value >> 8);    // little-endian, as gdb reads registers
+}
+
+static int hexValue(char c) {
+    if(c >= '0' && c <= '9') return c - '0';
+    if(c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if(c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+// Parses hex digits from pos on, stopping at the first other character
+static uint32_t parseHex(const std::string &text, size_t &pos) {
+    uint32_t value = 0;
+    while(pos < text.size() && hexValue(text[pos]) >= 0)
+        value = value << 4 | hexValue(text[pos++]);
+    return value;
+}
+
+GdbStub::GdbStub(GBoy *gb, Debugger *debugger) {
+    this->gb = gb;
+    this->debugger = debugger;
+    listenFd = -1;
+    fd = -1;
+    acks = true;
+    running = false;
+}
+
+GdbStub::~GdbStub() {
+    if(fd >= 0)
+        close(fd);
+    if(listenFd >= 0)
+        close(listenFd);
+}
+
+bool GdbStub::Listen(const std::string &address) {
+    if(address.compare(0, 5, "unix:") == 0) {
+        sockaddr_un local = {};
+        local.sun_family = AF_UNIX;
+        std::string path = address.substr(5);
+        if(path.empty() || path.size() >= sizeof(local.sun_path)) {
+            printf("Bad socket path: %s\n", path.c_str());
+            return false;
+        }
+        memcpy(local.sun_path, path.c_str(), path.size());
+        unlink(path.c_str());
+        listenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if(listenFd < 0 || bind(listenFd, (sockaddr*)&local, sizeof(local)) != 0 || listen(listenFd, 1) != 0) {
+            printf("Cannot listen on %s: %s\n", path.c_str(), strerror(errno));
+            return false;
+        }
+        return true;
+    }
+
+    size_t colon = address.rfind(':');
+    std::string host = colon == std::string::npos ? "" : address.substr(0, colon);
+    std::string port = colon == std::string::npos ? address : address.substr(colon + 1);
+    if(!host.empty() && host != "localhost" && host != "127.0.0.1") {
+        printf("The gdb stub only listens on localhost, not %s\n", host.c_str());
+        return false;
+    }
+    sockaddr_in local = {};
+    local.sin_family = AF_INET;
+    local.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    local.sin_port = htons((uint16_t)atoi(port.c_str()));
+    listenFd = socket(AF_INET, SOCK_STREAM, 0);
+    int reuse = 1;
+    if(listenFd >= 0)
+        setsockopt(listenFd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    if(listenFd < 0 || bind(listenFd, (sockaddr*)&local, sizeof(local)) != 0 || listen(listenFd, 1) != 0) {
+        printf("Cannot listen on port %s: %s\n", port.c_str(), strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+bool GdbStub::Accept() {
+    if(listenFd < 0)
+        return false;
+    fd = accept(listenFd, nullptr, nullptr);
+    if(fd < 0)
+        return false;
+    input.clear();
+    acks = true;
+    running = false;
+    debugger->Stop();
+    return true;
+}
+
+bool GdbStub::IsConnected() {
+    return fd >= 0;
+}
+
+void GdbStub::disconnect() {
+    debugger->Clear();
+    if(debugger->IsStopped())
+        debugger->Resume();
+    close(fd);
+    fd = -1;
+    running = false;
+}
+
+// False once gdb has gone
+bool GdbStub::receive(int timeoutMs) {
+    pollfd p = {fd, POLLIN, 0};
+    if(poll(&p, 1, timeoutMs) <= 0)
+        return true;
+    char buffer[4096];
+    ssize_t n = read(fd, buffer, sizeof(buffer));
+    if(n == 0 || (n < 0 && errno != EINTR && errno != EAGAIN))
+        return false;
+    if(n > 0)
+        input.append(buffer, n);
+    return true;
+}
+
+void GdbStub::send(const std::string &payload) {
+    uint8_t checksum = 0;
+    for(char c : payload)
+        checksum += (uint8_t)c;
+    std::string packet = "$" + payload + "#" + hexByte(checksum);
+    const char *data = packet.c_str();
+    size_t left = packet.size();
+    while(left > 0) {
+        ssize_t n = write(fd, data, left);
+        if(n <= 0 && errno != EINTR)
+            return;
+        if(n > 0)
+            data += n, left -= n;
+    }
+}
+
+void GdbStub::Poll(int timeoutMs) {
+    if(fd < 0) {
+        // gdb may come back after detaching
+        pollfd p = {listenFd, POLLIN, 0};
+        if(listenFd < 0 || poll(&p, 1, timeoutMs) <= 0 || !Accept())
+            return;
+    }
+    if(running && debugger->IsStopped()) {
+        send(stopReply());
+        running = false;
+    }
+    if(!receive(running ? 0 : timeoutMs)) {
+        disconnect();
+        return;
+    }
+
+    while(!input.empty() && fd >= 0) {
+        if(input[0] == '+' || input[0] == '-') {
+            input.erase(0, 1);
+        } else if(input[0] == 0x03) {
+            // Ctrl-C
+            input.erase(0, 1);
+            debugger->Stop();
+            if(running) {
+                send(stopReply());
+                running = false;
+            }
+        } else if(input[0] != '$') {
+            input.erase(0, 1);
+        } else {
+            size_t end = input.find('#');
+            if(end == std::string::npos || end + 2 >= input.size())
+                break;
+            std::string packet = input.substr(1, end - 1);
+            size_t pos = end + 1;
+            uint8_t expected = parseHex(input.substr(0, end + 3), pos);
+            input.erase(0, end + 3);
+            uint8_t checksum = 0;
+            for(char c : packet)
+                checksum += (uint8_t)c;
+            if(acks && write(fd, checksum == expected ? "+" : "-", 1) != 1)
+                return;
+            if(checksum == expected)
+                handle(packet);
+        }
+    }
+}
+
+std::string GdbStub::stopReply() {
+    const DebugStop &stop = debugger->GetStop();
+    if(stop.reason == StopRequested)
+        return "S02";
+    if(stop.reason == StopWatchRead || stop.reason == StopWatchWrite) {
+        const char *kind = stop.kinds == WatchAccess ? "awatch" : stop.reason == StopWatchRead ? "rwatch" : "watch";
+        char reply[32];
+        snprintf(reply, sizeof(reply), "T05%s:%04x;", kind, stop.addr);
+        return reply;
+    }
+    return "S05";
+}
+
+uint16_t GdbStub::readRegister(int reg) {
+    CentralProcessingUnit *cpu = gb->GetCPU();
+    switch(reg) {
+        case 0: return (uint16_t)(cpu->accumulator << 8 | cpu->GetFlags());
+        case 1: return cpu->bc;
+        case 2: return cpu->de;
+        case 3: return cpu->hl;
+        case 4: return cpu->stackPointer;
+        case GdbRegisterPc: return cpu->programCounter;
+        default: return 0;
+    }
+}
+
+void GdbStub::writeRegister(int reg, uint16_t value) {
+    CentralProcessingUnit *cpu = gb->GetCPU();
+    switch(reg) {
+        case 0: cpu->accumulator = value >> 8; cpu->SetFlags(value & 0xff); break;
+        case 1: cpu->bc = value; break;
+        case 2: cpu->de = value; break;
+        case 3: cpu->hl = value; break;
+        case 4: cpu->stackPointer = value; break;
+        case GdbRegisterPc: cpu->programCounter = value; break;
+    }
+}
+
+std::string GdbStub::readRegisters() {
+    std::string reply;
+    for(int reg = 0; reg < GdbRegisterCount; reg++)
+        reply += hexWord(readRegister(reg));
+    return reply;
+}
+
+void GdbStub::handle(const std::string &packet) {
+    char command = packet.empty() ? 0 : packet[0];
+    size_t pos = 1;
+    switch(command) {
+    case '?':
+        send(stopReply());
+        return;
+    case 'g':
+        send(readRegisters());
+        return;
+    case 'G':
+        for(int reg = 0; reg < GdbRegisterCount && pos + 4 <= packet.size(); reg++, pos += 4) {
+            std::string word = packet.substr(pos, 4);
+            size_t at = 0;
+            uint16_t value = parseHex(word, at);
+            writeRegister(reg, (uint16_t)(value >> 8 | value << 8));
+        }
+        send("OK");
+        return;
+    case 'p': {
+        int reg = parseHex(packet, pos);
+        send(reg < GdbRegisterCount ? hexWord(readRegister(reg)) : "E01");
+        return;
+    }
+    case 'P': {
+        int reg = parseHex(packet, pos);
+        pos++;
+        uint16_t value = parseHex(packet, pos);
+        writeRegister(reg, (uint16_t)(value >> 8 | value << 8));
+        send("OK");
+        return;
+    }
+    case 'm': {
+        uint32_t addr = parseHex(packet, pos);
+        pos++;
+        uint32_t length = parseHex(packet, pos);
+        std::string reply;
+        // Peeked, so reading does not trip watchpoints or touch the joypad
+        for(uint32_t i = 0; i < length && addr + i < 0x10000; i++)
+            reply += hexByte(gb->GetMMU()->Peek(addr + i));
+        send(reply.empty() ? "E01" : reply);
+        return;
+    }
+    case 'M': {
+        uint32_t addr = parseHex(packet, pos);
+        pos++;
+        uint32_t length = parseHex(packet, pos);
+        pos++;
+        // Raw, so writing ROM or I/O registers has no effect beyond the byte
+        for(uint32_t i = 0; i < length && pos + 1 < packet.size() && addr + i < 0x10000; i++, pos += 2)
+            gb->GetMMU()->Write(addr + i, hexValue(packet[pos]) << 4 | hexValue(packet[pos + 1]), true);
+        send("OK");
+        return;
+    }
+    case 'c':
+    case 's':
+        if(pos < packet.size())
+            writeRegister(GdbRegisterPc, parseHex(packet, pos));
+        if(command == 's')
+            debugger->Step();
+        else
+            debugger->Resume();
+        running = true;
+        return;
+    case 'Z':
+    case 'z': {
+        int type = parseHex(packet, pos);
+        pos++;
+        uint16_t addr = parseHex(packet, pos);
+        pos++;
+        uint16_t length = std::max<uint32_t>(1, parseHex(packet, pos));
+        uint16_t end = addr + length - 1;
+        const uint8_t kinds[] = {0, 0, WatchWrite, WatchRead, WatchAccess};
+        if(type > 4) {
+            send("");
+        } else if(command == 'Z') {
+            if(type < 2)
+                debugger->AddBreakpoint(addr);
+            else
+                debugger->AddWatchpoint(addr, end, kinds[type]);
+            send("OK");
+        } else {
+            bool removed = type < 2 ? debugger->RemoveBreakpoint(addr) : debugger->RemoveWatchpoint(addr, end, kinds[type]);
+            send(removed ? "OK" : "E01");
+        }
+        return;
+    }
+    case 'D':
+        send("OK");
+        disconnect();
+        return;
+    case 'k':
+        disconnect();
+        return;
+    case 'H':
+        send("OK");
+        return;
+    }
+
+    if(packet.compare(0, 10, "qSupported") == 0) {
+        send("PacketSize=4000;QStartNoAckMode+");
+    } else if(packet == "QStartNoAckMode") {
+        send("OK");
+        acks = false;
+    } else if(packet == "qAttached") {
+        send("1");
+    } else if(packet == "qC") {
+        send("QC1");
+    } else if(packet == "qfThreadInfo") {
+        send("m1");
+    } else if(packet == "qsThreadInfo") {
+        send("l");
+    } else {
+        send("");
+    }
+}
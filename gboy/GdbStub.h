@@ -0,0 +1,46 @@
+#pragma once
+
+#include <string>
+#include "Debugger.h"
+
+class GBoy;
+
+// GDB remote serial protocol over a local TCP or Unix socket. Registers are
+// laid out as gdb's z80 target expects (af bc de hl sp pc, then the Z80-only
+// ones, always 0), memory is read without side effects and written raw, and
+// breakpoints, watchpoints and single steps go through a Debugger attached
+// to the machine.
+//
+// The stub never runs inside the emulation loop: the frontend calls Poll()
+// between frames while running, so gdb can interrupt, and in a loop while
+// the debugger is stopped.
+class GdbStub {
+private:
+    GBoy *gb;
+    Debugger *debugger;
+    int listenFd, fd;
+    std::string input;
+    bool acks;
+    bool running;       // gdb is waiting for a stop reply
+
+    bool receive(int timeoutMs);
+    void send(const std::string &payload);
+    void handle(const std::string &packet);
+    std::string stopReply();
+    std::string readRegisters();
+    void writeRegister(int reg, uint16_t value);
+    uint16_t readRegister(int reg);
+    void disconnect();
+
+public:
+    GdbStub(GBoy *gb, Debugger *debugger);
+    ~GdbStub();
+    // A port, host:port or unix:path; TCP only listens on the loopback
+    bool Listen(const std::string &address);
+    // Waits for gdb to connect, stopping the machine for it
+    bool Accept();
+    bool IsConnected();
+    // Handles what gdb sent, waiting up to timeoutMs for it, and tells gdb
+    // when the machine stopped
+    void Poll(int timeoutMs);
+};
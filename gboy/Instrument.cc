@@ -0,0 +1,95 @@
+#include "Instrument.h"
+#include <csignal>
+#include <cstring>
+#include "CPU.h"
+
+InstrumentCounters Instrument;
+
+static volatile sig_atomic_t dumpRequested = 0;
+
+const char *MemoryRegionName(MemoryRegion region) {
+    switch(region) {
+        case RegionRom: return "rom";
+        case RegionVram: return "vram";
+        case RegionCartRam: return "cart_ram";
+        case RegionWram: return "wram";
+        case RegionEcho: return "echo";
+        case RegionOam: return "oam";
+        case RegionUnusable: return "unusable";
+        case RegionIo: return "io";
+        case RegionHram: return "hram";
+        case RegionInterruptEnable: return "ie";
+        default: return "unknown";
+    }
+}
+
+void ResetInstrumentCounters() {
+    memset(&Instrument, 0, sizeof(Instrument));
+}
+
+static void writeRegions(FILE *out, const char *name, const uint64_t *counts) {
+    fprintf(out, "  \"%s\": {", name);
+    for(int i = 0; i < RegionCount; i++)
+        fprintf(out, "%s\"%s\": %llu", i ? ", " : "", MemoryRegionName((MemoryRegion)i), (unsigned long long)counts[i]);
+    fprintf(out, "},\n");
+}
+
+// Only opcodes that ran are listed
+void WriteInstrumentJson(FILE *out, CentralProcessingUnit *cpu) {
+    fprintf(out, "{\n  \"instrumented\": %s,\n",
+#ifdef PICOBOY_INSTRUMENT
+        "true"
+#else
+        "false"
+#endif
+    );
+    fprintf(out, "  \"opcodes\": [");
+    bool first = true;
+    for(uint16_t op = 0; op < 0x200; op++) {
+        if(!Instrument.opcodes[op])
+            continue;
+        fprintf(out, "%s\n    {\"opcode\": \"%03x\", \"name\": \"%s\", \"count\": %llu}", first ? "" : ",", op,
+            cpu->GetInstructionName(op).c_str(), (unsigned long long)Instrument.opcodes[op]);
+        first = false;
+    }
+    fprintf(out, "\n  ],\n");
+    fprintf(out, "  \"native_runs\": %llu,\n", (unsigned long long)Instrument.nativeRuns);
+    writeRegions(out, "reads", Instrument.reads);
+    writeRegions(out, "writes", Instrument.writes);
+    fprintf(out, "  \"bank_switches\": %llu,\n", (unsigned long long)Instrument.bankSwitches);
+    const char *interrupts[] = {"vblank", "lcd", "timer", "serial", "joypad"};
+    fprintf(out, "  \"interrupts\": {");
+    for(int i = 0; i < 5; i++)
+        fprintf(out, "%s\"%s\": %llu", i ? ", " : "", interrupts[i], (unsigned long long)Instrument.interrupts[i]);
+    fprintf(out, "},\n");
+    fprintf(out, "  \"halt_cycles\": %llu,\n", (unsigned long long)Instrument.haltCycles);
+    fprintf(out, "  \"lines_rendered\": %llu\n}\n", (unsigned long long)Instrument.linesRendered);
+}
+
+bool WriteInstrumentJson(const char *path, CentralProcessingUnit *cpu) {
+    FILE *out = fopen(path, "w");
+    if(!out) {
+        printf("Cannot write counters to %s\n", path);
+        return false;
+    }
+    WriteInstrumentJson(out, cpu);
+    fclose(out);
+    return true;
+}
+
+static void requestDump(int) {
+    dumpRequested = 1;
+}
+
+void InstallInstrumentSignal() {
+#ifdef SIGUSR1
+    signal(SIGUSR1, requestDump);
+#endif
+}
+
+bool InstrumentDumpRequested() {
+    if(!dumpRequested)
+        return false;
+    dumpRequested = 0;
+    return true;
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+
+// Counters for where emulated time goes, compiled in with -DPICOBOY_INSTRUMENT
+// (the PICOBOY_INSTRUMENT CMake option). Without it PICOBOY_COUNT expands to
+// nothing, so CPU.cc, MMU.cc and PPU.cc build exactly as before. The counters
+// are global and cover every machine in the process.
+
+enum MemoryRegion {
+    RegionRom,
+    RegionVram,
+    RegionCartRam,
+    RegionWram,
+    RegionEcho,
+    RegionOam,
+    RegionUnusable,
+    RegionIo,
+    RegionHram,
+    RegionInterruptEnable,
+    RegionCount,
+};
+
+const char *MemoryRegionName(MemoryRegion region);
+
+inline MemoryRegion MemoryRegionOf(uint16_t addr) {
+    if(addr < 0x8000) return RegionRom;
+    if(addr < 0xA000) return RegionVram;
+    if(addr < 0xC000) return RegionCartRam;
+    if(addr < 0xE000) return RegionWram;
+    if(addr < 0xFE00) return RegionEcho;
+    if(addr < 0xFEA0) return RegionOam;
+    if(addr < 0xFF00) return RegionUnusable;
+    if(addr < 0xFF80) return RegionIo;
+    if(addr < 0xFFFF) return RegionHram;
+    return RegionInterruptEnable;
+}
+
+struct InstrumentCounters {
+    uint64_t opcodes[0x200];        // 0x100 | opcode for CB-prefixed ones
+    uint64_t nativeRuns;            // JIT and AOT runs, whose opcodes are not counted
+    // The program's own accesses: neither instruction fetches, nor code read
+    // to decode or analyse it, nor the PPU and timer reading their registers
+    uint64_t reads[RegionCount];
+    uint64_t writes[RegionCount];
+    uint64_t bankSwitches;          // writes to the MBC bank select at 0x2000-0x3FFF
+    uint64_t interrupts[5];         // serviced, VBlank to joypad
+    uint64_t haltCycles;
+    uint64_t linesRendered;
+};
+
+extern InstrumentCounters Instrument;
+
+#ifdef PICOBOY_INSTRUMENT
+#define PICOBOY_COUNT(counter, n) (Instrument.counter += (n))
+#else
+#define PICOBOY_COUNT(counter, n) ((void)0)
+#endif
+
+class CentralProcessingUnit;
+
+void ResetInstrumentCounters();
+// Opcodes are named from the instruction table of cpu
+void WriteInstrumentJson(FILE *out, CentralProcessingUnit *cpu);
+bool WriteInstrumentJson(const char *path, CentralProcessingUnit *cpu);
+// Makes SIGUSR1 request a dump; the frontend checks for it once a frame,
+// since a signal handler cannot safely write the file itself
+void InstallInstrumentSignal();
+bool InstrumentDumpRequested();
@@ -0,0 +1,411 @@
+#include "Jit.h"
+
+#include <algorithm>
+#include <cstddef>
+
+#if defined(__x86_64__) && defined(__linux__)
+#define PICOBOY_JIT_SUPPORTED 1
+#include <sys/mman.h>
+#endif
+
+static_assert(offsetof(JitState, f) == 7, "JitState layout is part of the run ABI");
+static_assert(offsetof(JitState, pc) == 8, "JitState layout is part of the run ABI");
+static_assert(offsetof(JitState, cycles) == 10, "JitState layout is part of the run ABI");
+
+// Host registers holding B, C, D, E, H, L, (HL), A in SM83 register order
+static const int HostReg[8] = {9, 10, 11, 12, 13, 14, -1, 8};
+static const int HostA = 8;
+static const int HostF = 15;
+static const size_t MaxRunBytes = 2048;
+
+enum RunOpKind {
+    RunOpUnsupported,
+    RunOpBody,
+    RunOpBranch,
+};
+
+struct RunOp {
+    RunOpKind kind;
+    uint8_t size;
+    uint8_t cycles;         // taken cycles for branches
+    uint8_t notTakenCycles;
+    int8_t condition;       // -1 always, otherwise NZ Z NC C
+};
+
+static RunOp classify(const uint8_t *code) {
+    uint8_t op = code[0];
+    int x = op >> 6, y = (op >> 3) & 7, z = op & 7;
+
+    if (op == 0x00)
+        return {RunOpBody, 1, 4, 0, -1};
+    if (x == 1 && y != 6 && z != 6)
+        return {RunOpBody, 1, 4, 0, -1};
+    if (x == 2 && z != 6)
+        return {RunOpBody, 1, 4, 0, -1};
+    if (x == 3 && z == 6)
+        return {RunOpBody, 2, 8, 0, -1};
+    if (x == 0 && z == 6 && y != 6)
+        return {RunOpBody, 2, 8, 0, -1};
+    if (x == 0 && (z == 4 || z == 5) && y != 6)
+        return {RunOpBody, 1, 4, 0, -1};
+    if (x == 0 && z == 3 && (y >> 1) != 3)
+        return {RunOpBody, 1, 8, 0, -1};
+    if (op == 0x2f || op == 0x37 || op == 0x3f)
+        return {RunOpBody, 1, 4, 0, -1};
+
+    if (op == 0x18)
+        return {RunOpBranch, 2, 12, 12, -1};
+    if (op == 0x20 || op == 0x28 || op == 0x30 || op == 0x38)
+        return {RunOpBranch, 2, 12, 8, (int8_t)(y - 4)};
+    if (op == 0xc3)
+        return {RunOpBranch, 3, 16, 16, -1};
+    if (op == 0xc2 || op == 0xca || op == 0xd2 || op == 0xda)
+        return {RunOpBranch, 3, 16, 12, (int8_t)y};
+
+    return {RunOpUnsupported, 0, 0, 0, -1};
+}
+
+// Minimal x86-64 encoder for the handful of instructions runs need
+class Emitter {
+public:
+    uint8_t *start;
+    uint8_t *p;
+
+    Emitter(uint8_t *out) : start(out), p(out) {}
+
+    size_t Size() { return p - start; }
+    void Byte(uint8_t v) { *p++ = v; }
+    void Word(uint16_t v) { Byte(v & 0xff); Byte(v >> 8); }
+    void Dword(uint32_t v) { Word(v & 0xffff); Word(v >> 16); }
+
+    // op r/m8, r8 between two of r8b..r15b
+    void RegReg(uint8_t opcode, int rm, int reg) {
+        Byte(0x40 | ((reg >> 3) << 2) | (rm >> 3));
+        Byte(opcode);
+        Byte(0xc0 | ((reg & 7) << 3) | (rm & 7));
+    }
+    // group 1 op r/m8, imm8 (/digit)
+    void RegImm(int digit, int rm, uint8_t imm) {
+        Byte(0x40 | (rm >> 3));
+        Byte(0x80);
+        Byte(0xc0 | (digit << 3) | (rm & 7));
+        Byte(imm);
+    }
+    void Unary(uint8_t opcode, int digit, int rm) {
+        Byte(0x40 | (rm >> 3));
+        Byte(opcode);
+        Byte(0xc0 | (digit << 3) | (rm & 7));
+    }
+    void MovImm(int reg, uint8_t imm) {
+        Byte(0x40 | (reg >> 3));
+        Byte(0xb0 | (reg & 7));
+        Byte(imm);
+    }
+    // mov r8, [rdi + offset] / mov [rdi + offset], r8
+    void LoadState(int reg, uint8_t offset) {
+        Byte(0x40 | ((reg >> 3) << 2));
+        Byte(0x8a);
+        Byte(0x47 | ((reg & 7) << 3));
+        Byte(offset);
+    }
+    void StoreState(int reg, uint8_t offset) {
+        Byte(0x40 | ((reg >> 3) << 2));
+        Byte(0x88);
+        Byte(0x47 | ((reg & 7) << 3));
+        Byte(offset);
+    }
+
+    // F = table[AH from LAHF] after masking the host flags in mask. When keep
+    // is non-zero the bits of F it selects survive and the new flags merge in.
+    void FlagsFromHost(uint8_t mask, uint8_t keep) {
+        Byte(0x9f);                                 // lahf
+        Byte(0x0f); Byte(0xb6); Byte(0xc4);         // movzx eax, ah
+        if (mask != 0xff) {
+            Byte(0x24); Byte(mask);                 // and al, mask
+        }
+        if (keep) {
+            RegImm(4, 15, keep);                    // and r15b, keep
+            Byte(0x44); Byte(0x0a); Byte(0x3c); Byte(0x06); // or r15b, [rsi + rax]
+        } else {
+            Byte(0x44); Byte(0x8a); Byte(0x3c); Byte(0x06); // mov r15b, [rsi + rax]
+        }
+    }
+    void CarryToHost() {
+        Byte(0x41); Byte(0x0f); Byte(0xba); Byte(0xe7); Byte(0x04); // bt r15d, 4
+    }
+    void TestFlags(uint8_t mask) {
+        Byte(0x41); Byte(0xf6); Byte(0xc7); Byte(mask); // test r15b, mask
+    }
+    void AddCycles(uint32_t cycles) {
+        Byte(0x81); Byte(0xc1); Dword(cycles);      // add ecx, cycles
+    }
+    void CompareCycles(uint32_t cycles) {
+        Byte(0x81); Byte(0xf9); Dword(cycles);      // cmp ecx, cycles
+    }
+    void StorePc(uint16_t pc) {
+        Byte(0x66); Byte(0xc7); Byte(0x47); Byte(offsetof(JitState, pc)); Word(pc);
+    }
+    // Returns the position of the rel32 to patch
+    uint8_t *Jump() {
+        Byte(0xe9);
+        uint8_t *at = p;
+        Dword(0);
+        return at;
+    }
+    uint8_t *JumpIf(uint8_t condition) {
+        Byte(0x0f); Byte(0x80 | condition);
+        uint8_t *at = p;
+        Dword(0);
+        return at;
+    }
+    void JumpIfTo(uint8_t condition, uint8_t *target) {
+        uint8_t *at = JumpIf(condition);
+        Patch(at, target);
+    }
+    void Patch(uint8_t *at, uint8_t *target) {
+        int32_t rel = (int32_t)(target - (at + 4));
+        for (int i = 0; i < 4; i++)
+            at[i] = (rel >> (8 * i)) & 0xff;
+    }
+};
+
+const uint8_t X86CondZero = 0x4;
+const uint8_t X86CondNotZero = 0x5;
+const uint8_t X86CondBelowOrEqual = 0x6;
+
+static void emitAlu(Emitter &e, int op, int src, bool immediate, uint8_t value) {
+    static const uint8_t regOpcode[8] = {0x00, 0x10, 0x28, 0x18, 0x20, 0x30, 0x08, 0x38};
+    static const uint8_t immDigit[8] = {0, 2, 5, 3, 4, 6, 1, 7};
+
+    if (op == 1 || op == 3)
+        e.CarryToHost();
+    if (immediate)
+        e.RegImm(immDigit[op], HostA, value);
+    else
+        e.RegReg(regOpcode[op], HostA, src);
+
+    bool logic = (op >= 4 && op <= 6);
+    e.FlagsFromHost(logic ? 0x40 : 0xff, 0);
+    if (op == 2 || op == 3 || op == 7)
+        e.RegImm(1, HostF, 0x40);
+    else if (op == 4)
+        e.RegImm(1, HostF, 0x20);
+}
+
+static void emitBody(Emitter &e, const uint8_t *code) {
+    uint8_t op = code[0];
+    int x = op >> 6, y = (op >> 3) & 7, z = op & 7;
+
+    if (op == 0x00)
+        return;
+    if (x == 1) {
+        if (y != z)
+            e.RegReg(0x88, HostReg[y], HostReg[z]);
+    } else if (x == 2) {
+        emitAlu(e, y, HostReg[z], false, 0);
+    } else if (x == 3) {
+        emitAlu(e, y, 0, true, code[1]);
+    } else if (z == 6) {
+        e.MovImm(HostReg[y], code[1]);
+    } else if (z == 4 || z == 5) {
+        e.Unary(0xfe, z == 4 ? 0 : 1, HostReg[y]);
+        e.FlagsFromHost(0x50, 0x10);
+        if (z == 5)
+            e.RegImm(1, HostF, 0x40);
+    } else if (z == 3) {
+        int hi = HostReg[(y >> 1) * 2], lo = HostReg[(y >> 1) * 2 + 1];
+        if ((y & 1) == 0) {
+            e.RegImm(0, lo, 1);     // add lo, 1
+            e.RegImm(2, hi, 0);     // adc hi, 0
+        } else {
+            e.RegImm(5, lo, 1);     // sub lo, 1
+            e.RegImm(3, hi, 0);     // sbb hi, 0
+        }
+    } else if (op == 0x2f) {
+        e.Unary(0xf6, 2, HostA);    // not
+        e.RegImm(1, HostF, 0x60);
+    } else if (op == 0x37) {
+        e.RegImm(4, HostF, 0x80);
+        e.RegImm(1, HostF, 0x10);
+    } else if (op == 0x3f) {
+        e.RegImm(4, HostF, 0x90);
+        e.RegImm(6, HostF, 0x10);
+    }
+}
+
+JitCompiler::JitCompiler(size_t cap) {
+    buffer = nullptr;
+    capacity = 0;
+    used = 0;
+    generation = 0;
+#ifdef PICOBOY_JIT_SUPPORTED
+    void *memory = mmap(nullptr, cap, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (memory != MAP_FAILED) {
+        buffer = (uint8_t*)memory;
+        capacity = cap;
+    }
+#endif
+}
+
+JitCompiler::~JitCompiler() {
+#ifdef PICOBOY_JIT_SUPPORTED
+    if (buffer)
+        munmap(buffer, capacity);
+#endif
+}
+
+bool JitCompiler::IsAvailable() {
+    return buffer != nullptr;
+}
+
+bool JitCompiler::IsFull() {
+    return used + MaxRunBytes > capacity;
+}
+
+void JitCompiler::Reset() {
+    used = 0;
+    generation++;
+}
+
+uint32_t JitCompiler::GetGeneration() {
+    return generation;
+}
+
+const uint8_t *JitCompiler::FlagTable() {
+    static uint8_t table[256];
+    static bool built = false;
+    if (!built) {
+        for (int ah = 0; ah < 256; ah++)
+            table[ah] = ((ah & 0x40) ? 0x80 : 0) | ((ah & 0x10) ? 0x20 : 0) | ((ah & 0x01) ? 0x10 : 0);
+        built = true;
+    }
+    return table;
+}
+
+JitRunFunction JitCompiler::Compile(const uint8_t *code, size_t length, uint16_t pc, const JitOptions &options) {
+    if (!IsAvailable() || IsFull())
+        return nullptr;
+    FlagTable();
+
+    size_t size = emitRun(buffer + used, code, length, pc, options);
+    if (size == 0)
+        return nullptr;
+    JitRunFunction run = (JitRunFunction)(buffer + used);
+    used += (size + 15) & ~15;
+    return run;
+}
+
+bool PlanRun(const uint8_t *code, size_t length, uint16_t pc, const JitOptions &options, RunPlan &plan) {
+    plan.bodyOps = plan.bodyBytes = 0;
+    plan.bodyCycles = 0;
+    plan.hasBranch = false;
+    RunOp branch = {RunOpUnsupported, 0, 0, 0, -1};
+    while (plan.bodyOps < options.maxOps && plan.bodyBytes < length) {
+        RunOp op = classify(code + plan.bodyBytes);
+        if (op.kind == RunOpUnsupported || plan.bodyBytes + op.size > length)
+            break;
+        if (plan.bodyCycles + op.cycles > JitMaxRunCycles)
+            break;
+        if (op.kind == RunOpBranch) {
+            branch = op;
+            plan.hasBranch = true;
+            break;
+        }
+        plan.bodyOps++;
+        plan.bodyBytes += op.size;
+        plan.bodyCycles += op.cycles;
+    }
+    if (plan.bodyOps == 0 && !plan.hasBranch)
+        return false;
+
+    uint16_t next = pc + plan.bodyBytes;
+    plan.fallthrough = next;
+    plan.target = next;
+    plan.condition = -1;
+    plan.branchCycles = plan.branchNotTakenCycles = 0;
+    plan.loops = false;
+    if (plan.hasBranch) {
+        const uint8_t *branchCode = code + plan.bodyBytes;
+        plan.fallthrough = next + branch.size;
+        plan.target = (branch.size == 2) ? plan.fallthrough + (int8_t)branchCode[1] : (branchCode[1] | (branchCode[2] << 8));
+        plan.condition = branch.condition;
+        plan.branchCycles = branch.cycles;
+        plan.branchNotTakenCycles = branch.notTakenCycles;
+        uint32_t takenCycles = plan.bodyCycles + branch.cycles;
+        plan.loops = options.loops && plan.target == pc && takenCycles <= JitMaxRunCycles / 2;
+    }
+    return true;
+}
+
+uint32_t RunMaxCycles(const RunPlan &plan) {
+    // A loop only goes round again while the next iteration fits the budget
+    if (plan.loops)
+        return JitMaxRunCycles;
+    if (!plan.hasBranch)
+        return plan.bodyCycles;
+    return plan.bodyCycles + std::max(plan.branchCycles, plan.branchNotTakenCycles);
+}
+
+size_t JitCompiler::emitRun(uint8_t *out, const uint8_t *code, size_t length, uint16_t pc, const JitOptions &options) {
+    // Pick the run first so the cycle budget is known before emitting
+    RunPlan plan;
+    if (!PlanRun(code, length, pc, options, plan))
+        return 0;
+
+    Emitter e(out);
+    std::vector<uint8_t*> exits;
+
+    for (int reg = 12; reg <= 15; reg++) {
+        e.Byte(0x41); e.Byte(0x50 | (reg & 7));     // push r12..r15
+    }
+    const int stateRegs[8] = {8, 9, 10, 11, 12, 13, 14, 15};
+    for (int i = 0; i < 8; i++)
+        e.LoadState(stateRegs[i], i);
+    e.Byte(0x31); e.Byte(0xc9);                     // xor ecx, ecx
+
+    uint8_t *body = e.p;
+    for (size_t at = 0; at < plan.bodyBytes; at += classify(code + at).size)
+        emitBody(e, code + at);
+
+    if (!plan.hasBranch) {
+        e.AddCycles(plan.bodyCycles);
+        e.StorePc(plan.fallthrough);
+        exits.push_back(e.Jump());
+    } else {
+        uint8_t *notTaken = nullptr;
+        if (plan.condition >= 0) {
+            static const uint8_t masks[4] = {0x80, 0x80, 0x10, 0x10};
+            e.TestFlags(masks[plan.condition]);
+            // NZ/NC are taken when the bit is clear, so skip on set and vice versa
+            notTaken = e.JumpIf((plan.condition & 1) ? X86CondZero : X86CondNotZero);
+        }
+
+        uint32_t takenCycles = plan.bodyCycles + plan.branchCycles;
+        e.AddCycles(takenCycles);
+        if (plan.loops) {
+            e.CompareCycles(JitMaxRunCycles - takenCycles);
+            e.JumpIfTo(X86CondBelowOrEqual, body);
+        }
+        e.StorePc(plan.target);
+        exits.push_back(e.Jump());
+
+        if (notTaken) {
+            e.Patch(notTaken, e.p);
+            e.AddCycles(plan.bodyCycles + plan.branchNotTakenCycles);
+            e.StorePc(plan.fallthrough);
+            exits.push_back(e.Jump());
+        }
+    }
+
+    uint8_t *epilogue = e.p;
+    for (uint8_t *at : exits)
+        e.Patch(at, epilogue);
+    for (int i = 0; i < 8; i++)
+        e.StoreState(stateRegs[i], i);
+    e.Byte(0x66); e.Byte(0x89); e.Byte(0x4f); e.Byte(offsetof(JitState, cycles)); // mov [rdi + cycles], cx
+    for (int reg = 15; reg >= 12; reg--) {
+        e.Byte(0x41); e.Byte(0x58 | (reg & 7));     // pop r15..r12
+    }
+    e.Byte(0xc3);                                   // ret
+    return e.Size();
+}
@@ -0,0 +1,83 @@
+#pragma once
+
+#include "constants.h"
+
+// Native x86-64 translation of hot straight-line code.
+//
+// A run is the longest prefix of a block made of register-only instructions
+// (8-bit loads and ALU ops, INC/DEC, 16-bit INC/DEC of BC/DE/HL, CPL/SCF/CCF)
+// optionally closed by a JR or JP. Anything touching memory, the stack, SP or
+// interrupt state ends the run and is left to the cached engine, so a run can
+// never modify code or observe an interrupt mid-way.
+//
+// Compiled runs use the JitState ABI below: registers are loaded into host
+// registers (A..L in r8b..r14b, F in r15b), the run executes, and the state is
+// written back with the PC to continue from and the cycles consumed.
+
+struct JitState {
+    uint8_t a, b, c, d, e, h, l, f;
+    uint16_t pc;
+    uint16_t cycles;
+};
+
+typedef void (*JitRunFunction)(JitState *state, const uint8_t *flagTable);
+
+// A run stops adding instructions once it could exceed this many cycles, so
+// the PPU never sees a step long enough to skip a mode transition
+const uint32_t JitMaxRunCycles = 64;
+const size_t JitMaxRunOps = 32;
+const size_t JitDefaultCapacity = 4 * 1024 * 1024;
+
+struct JitOptions {
+    uint32_t threshold;     // block entries before a run is compiled
+    size_t maxOps;          // instructions in a compiled run
+    bool loops;             // a run branching back to its start iterates natively
+};
+
+const JitOptions JitDefaultOptions = {8, JitMaxRunOps, true};
+
+// The instructions a run covers. The JIT and the ahead-of-time recompiler both
+// pick runs this way, so their runs start and end at the same places.
+struct RunPlan {
+    size_t bodyOps;
+    size_t bodyBytes;
+    uint32_t bodyCycles;
+    bool hasBranch;             // the run closes with a JR or JP
+    int8_t condition;           // -1 always, otherwise NZ Z NC C
+    uint8_t branchCycles;       // taken
+    uint8_t branchNotTakenCycles;
+    uint16_t target;
+    uint16_t fallthrough;       // also where a run without a branch ends
+    bool loops;                 // a taken branch re-enters the body natively
+};
+
+// Returns false when no instruction at pc can be part of a run
+bool PlanRun(const uint8_t *code, size_t length, uint16_t pc, const JitOptions &options, RunPlan &plan);
+// The most cycles the run can take, iterations of a loop included
+uint32_t RunMaxCycles(const RunPlan &plan);
+
+class JitCompiler {
+private:
+    uint8_t *buffer;
+    size_t capacity;
+    size_t used;
+    uint32_t generation;
+
+    size_t emitRun(uint8_t *out, const uint8_t *code, size_t length, uint16_t pc, const JitOptions &options);
+
+public:
+    JitCompiler(size_t capacity = JitDefaultCapacity);
+    ~JitCompiler();
+
+    bool IsAvailable();
+    // Returns nullptr when no instruction at pc can be compiled or the buffer
+    // is full; code holds the bytes from pc to the end of its page
+    JitRunFunction Compile(const uint8_t *code, size_t length, uint16_t pc, const JitOptions &options);
+    bool IsFull();
+    // Drops all compiled code; runs from earlier generations must not be called
+    void Reset();
+    uint32_t GetGeneration();
+
+    // Maps the AH byte from LAHF to SM83 Z/H/C flags
+    static const uint8_t *FlagTable();
+};
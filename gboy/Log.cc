@@ -0,0 +1,116 @@
+#include "Log.h"
+#include <cstdarg>
+#include <cstdio>
+#include <mutex>
+
+const uint32_t LogRingSize = 256;
+
+LogLevel LogLevels[LogCategoryCount] = {LogInfo, LogInfo, LogInfo, LogInfo};
+
+static LogRecord ring[LogRingSize];
+static uint32_t ringCount = 0;
+static uint32_t passed[LogCategoryCount];
+static uint32_t dropped[LogCategoryCount];
+static LogSinkFunction sink = nullptr;
+static void *sinkContext = nullptr;
+// Machines are built on several threads at once, e.g. by picoboyromrunner;
+// this guards everything above
+static std::mutex lock;
+
+// Whatever is still buffered reaches the sink when the process exits
+static struct LogFlushAtExit {
+    ~LogFlushAtExit() { LogFlush(); }
+} flushAtExit;
+
+const char *LogLevelName(LogLevel level) {
+    switch(level) {
+        case LogDebug: return "debug";
+        case LogInfo: return "info";
+        case LogWarning: return "warning";
+        case LogError: return "error";
+        case LogOff: return "off";
+        default: return "unknown";
+    }
+}
+
+bool LogLevelFromName(const std::string &name, LogLevel &level) {
+    for(int l = LogDebug; l <= LogOff; l++) {
+        if(name == LogLevelName((LogLevel)l)) {
+            level = (LogLevel)l;
+            return true;
+        }
+    }
+    return false;
+}
+
+const char *LogCategoryName(LogCategory category) {
+    switch(category) {
+        case LogCartridge: return "cartridge";
+        case LogMemory: return "memory";
+        case LogSerial: return "serial";
+        case LogCpu: return "cpu";
+        default: return "unknown";
+    }
+}
+
+static void printRecord(const LogRecord &record, void *) {
+    if(record.level == LogInfo || record.level == LogDebug)
+        printf("[%s] %s\n", LogCategoryName(record.category), record.message);
+    else
+        printf("[%s %s] %s\n", LogCategoryName(record.category), LogLevelName(record.level), record.message);
+}
+
+void SetLogSink(LogSinkFunction function, void *context) {
+    LogFlush();
+    std::lock_guard<std::mutex> guard(lock);
+    sink = function;
+    sinkContext = context;
+}
+
+void SetLogLevel(LogCategory category, LogLevel level) {
+    LogLevels[category] = level;
+}
+
+void SetLogLevel(LogLevel level) {
+    for(int c = 0; c < LogCategoryCount; c++)
+        LogLevels[c] = level;
+}
+
+void LogMessage(LogLevel level, LogCategory category, const char *format, ...) {
+    if(level < LogLevels[category])
+        return;
+    std::lock_guard<std::mutex> guard(lock);
+    if(passed[category] >= LogRateLimit || ringCount == LogRingSize) {
+        dropped[category]++;
+        return;
+    }
+    passed[category]++;
+    LogRecord &record = ring[ringCount++];
+    record.level = level;
+    record.category = category;
+    va_list args;
+    va_start(args, format);
+    vsnprintf(record.message, sizeof(record.message), format, args);
+    va_end(args);
+}
+
+void LogFlush() {
+    std::lock_guard<std::mutex> guard(lock);
+    LogSinkFunction function = sink ? sink : printRecord;
+    bool any = ringCount > 0;
+    for(uint32_t i = 0; i < ringCount; i++)
+        function(ring[i], sinkContext);
+    ringCount = 0;
+    for(int c = 0; c < LogCategoryCount; c++) {
+        if(dropped[c]) {
+            LogRecord record = {LogWarning, (LogCategory)c, ""};
+            snprintf(record.message, sizeof(record.message), "%u messages dropped", dropped[c]);
+            function(record, sinkContext);
+            any = true;
+        }
+        passed[c] = 0;
+        dropped[c] = 0;
+    }
+    if(any && !sink)
+        fflush(stdout);
+}
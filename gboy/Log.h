@@ -0,0 +1,60 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+// Diagnostics from the emulator core. PICOBOY_LOG only formats the message
+// into a fixed ring, and not even that when its level is filtered out; the
+// sink sees the records when LogFlush() runs, which the frontend does
+// between frames and which also happens at exit. Each category passes at
+// most LogRateLimit records between flushes, the rest are counted and
+// reported as dropped. Messages may come from any thread; the sink is called
+// with the log locked, so it must not log itself. Levels are meant to be set
+// before machines start running.
+
+enum LogLevel {
+    LogDebug,
+    LogInfo,
+    LogWarning,
+    LogError,
+    LogOff,
+};
+
+enum LogCategory {
+    LogCartridge,
+    LogMemory,
+    LogSerial,      // lines test ROMs send over the serial port
+    LogCpu,
+    LogCategoryCount,
+};
+
+const uint32_t LogRateLimit = 64;
+const uint32_t LogMessageSize = 120;
+
+struct LogRecord {
+    LogLevel level;
+    LogCategory category;
+    char message[LogMessageSize];    // truncated to fit
+};
+
+typedef void (*LogSinkFunction)(const LogRecord &record, void *context);
+
+const char *LogLevelName(LogLevel level);
+bool LogLevelFromName(const std::string &name, LogLevel &level);
+const char *LogCategoryName(LogCategory category);
+
+// nullptr restores the default sink, which prints to stdout
+void SetLogSink(LogSinkFunction sink, void *context);
+// Records below level are dropped before being formatted; LogInfo by default
+void SetLogLevel(LogCategory category, LogLevel level);
+void SetLogLevel(LogLevel level);
+void LogFlush();
+
+void LogMessage(LogLevel level, LogCategory category, const char *format, ...)
+    __attribute__((format(printf, 3, 4)));
+
+extern LogLevel LogLevels[LogCategoryCount];
+
+// Arguments are not evaluated when the level is filtered out
+#define PICOBOY_LOG(level, category, ...) \
+    ((level) >= LogLevels[category] ? LogMessage(level, category, __VA_ARGS__) : (void)0)
@@ -1,35 +1,62 @@
 #include "MMU.h"
+#include "APU.h"
+#include "Debugger.h"
+#include "Instrument.h"
+#include "Log.h"
 
 MemoryManagementUnit::MemoryManagementUnit(Cartridge* cart) {
     cartridge = cart;
-    loadBIOS();
+    audio = nullptr;
+    debugger = nullptr;
+    joypad = 0;
+    serialEcho = true;
+    memset(memory, 0, sizeof(memory));
+    memset(writeVersions, 0, sizeof(writeVersions));
+    mappingVersion = 0;
+    if(!loadBIOS())
+        skipBIOS();
+    updatePendingInterrupts();
 }
 
 uint8_t MemoryManagementUnit::Read(uint16_t addr, bool isRawRead) {
     if(isRawRead)
         return memory[addr];
 
+    PICOBOY_COUNT(reads[MemoryRegionOf(addr)], 1);
+    if(debugger && (debugger->GetWatchedKinds(addr) & WatchRead))
+        debugger->CheckRead(addr);
     if (addr <= 0x7FFF) {
-        if (addr <= 0xFF && memory[0xFF50] != 0x1)
+        if (addr <= 0xFF && IsBootRomEnabled())
             return memory[addr];
         return cartridge->Read(addr);
     } else if(0xE000 <= addr && addr <= 0xFDFF) {
-        printf("Reading from: 0x%04x\n", addr);
         return memory[addr-0x2000]; // Mirrored Work RAM
     } else if(0xFEA0 <= addr && addr <= 0xFEFF) {
-        printf("Reading from: 0x%04x\n", addr);
         return 0xFF; // Unusable
-    } else
+    } else if(audio && addr >= AddrRegAudioStart && addr <= AddrRegAudioEnd)
+        return audio->Read(addr);
+    else if(addr == AddrRegJoypad)
+        return readJoypad();
+    else
         return memory[addr];
 }
 
 void MemoryManagementUnit::Write(uint16_t addr, uint8_t data, bool isRawWrite) {
+    writeVersions[(addr >> 8) + (addr >= 0xFF80)]++;
+    if(addr < 0x8000 || addr == AddrRegBootRomDisable)
+        mappingVersion++;
     if(isRawWrite) {
         memory[addr] = data;
+        if(addr == AddrRegInterruptFlag || addr == AddrRegInterruptEnabled)
+            updatePendingInterrupts();
         return;
     }
     
+    PICOBOY_COUNT(writes[MemoryRegionOf(addr)], 1);
+    if(debugger && (debugger->GetWatchedKinds(addr) & WatchWrite))
+        debugger->CheckWrite(addr, data);
     if (addr < 0x8000) {
+        PICOBOY_COUNT(bankSwitches, addr >= 0x2000 && addr < 0x4000);
         return;
     } else if (addr == AddrRegDma) {
         LoadDMA(data);
@@ -43,25 +70,136 @@ void MemoryManagementUnit::Write(uint16_t addr, uint8_t data, bool isRawWrite) {
     } else if(addr >= 0xe000 && addr < 0xfe00) {
         memory[addr] = data;
         memory[addr - 0x2000] = data; //echo RAM
+        writeVersions[(addr - 0x2000) >> 8]++;
+    } else if(addr == AddrRegJoypad) {
+        // Only the group selection is writable; selecting a group with a key
+        // held pulls its line low, which also requests the interrupt
+        uint8_t before = readJoypad();
+        memory[addr] = 0xc0 | (data & 0x30);
+        if(before & ~readJoypad() & 0x0f)
+            WriteIORegisterBit(AddrRegInterruptFlag, FlagInterruptInput, true);
     } else if(addr == 0xFF44) {
         memory[addr] = 0x0;
     } else if(addr == 0xFF04) {
         memory[addr] = 0x0;
-    } else if(addr == 0xFF01) {
+    } else if(addr == AddrRegSerialControl) {
         memory[addr] = data;
-        printf("%c", data); // Serial port
+        if((data & 0x81) == 0x81)
+            transferSerial();
+    } else if(addr == AddrRegInterruptFlag || addr == AddrRegInterruptEnabled) {
+        memory[addr] = data;
+        updatePendingInterrupts();
+    } else if(audio && addr >= AddrRegAudioStart && addr <= AddrRegAudioEnd) {
+        memory[addr] = data;
+        audio->Write(addr, data);
     } else {
-        if(addr == 0xFF50)
-            printf("Disabling boot procedure\n");
+        if(addr == AddrRegBootRomDisable)
+            PICOBOY_LOG(LogDebug, LogMemory, "Disabling boot procedure");
         memory[addr] = data;
     }
 }
 
-void MemoryManagementUnit::loadBIOS() {
+void MemoryManagementUnit::updatePendingInterrupts() {
+    pendingInterrupts = memory[AddrRegInterruptEnabled] & memory[AddrRegInterruptFlag] & 0x1f;
+}
+
+// There is never a link partner, so a transfer started on the internal clock
+// completes at once with 0xFF shifted in and the serial interrupt requested
+void MemoryManagementUnit::transferSerial() {
+    uint8_t data = memory[AddrRegSerialData];
+    serialOutput += (char)data;
+    if(serialEcho) {
+        // Logged a line at a time
+        if(data == '\n' || serialLine.size() == LogMessageSize - 1) {
+            PICOBOY_LOG(LogInfo, LogSerial, "%s", serialLine.c_str());
+            serialLine.clear();
+        }
+        if(data != '\n')
+            serialLine += (char)data;
+    }
+
+    memory[AddrRegSerialData] = 0xFF;
+    memory[AddrRegSerialControl] &= 0x7F;
+    WriteIORegisterBit(AddrRegInterruptFlag, FlagInterruptSerial, true);
+}
+
+const std::string &MemoryManagementUnit::GetSerialOutput() {
+    return serialOutput;
+}
+
+void MemoryManagementUnit::ClearSerialOutput() {
+    serialOutput.clear();
+}
+
+void MemoryManagementUnit::SetSerialEcho(bool echo) {
+    serialEcho = echo;
+}
+
+uint32_t MemoryManagementUnit::GetWriteVersion(uint16_t addr) {
+    return writeVersions[(addr >> 8) + (addr >= 0xFF80)];
+}
+
+const uint8_t *MemoryManagementUnit::GetReadPage(uint16_t addr) {
+    uint8_t page = addr >> 8;
+    if(page < 0x80) {
+        if(page == 0 && IsBootRomEnabled())
+            return &memory[0];
+        return cartridge->GetPage(addr);
+    }
+    // Echo RAM and the unusable range after OAM are not plain loads
+    if(page >= 0xE0 && page <= 0xFE)
+        return nullptr;
+    return &memory[addr & 0xFF00];
+}
+
+uint8_t MemoryManagementUnit::Peek(uint16_t addr) {
+    if(0xE000 <= addr && addr <= 0xFDFF)
+        addr -= 0x2000;
+    else if(0xFEA0 <= addr && addr <= 0xFEFF)
+        return 0xFF;
+    const uint8_t *page = GetReadPage(addr);
+    return page ? page[addr & 0xff] : memory[addr];
+}
+
+void MemoryManagementUnit::SetAudio(AudioProcessingUnit *apu) {
+    audio = apu;
+}
+
+void MemoryManagementUnit::SetDebugger(Debugger *debugger) {
+    this->debugger = debugger;
+}
+
+void MemoryManagementUnit::SetJoypad(uint8_t pressed) {
+    uint8_t before = readJoypad();
+    joypad = pressed;
+    if(before & ~readJoypad() & 0x0f)
+        WriteIORegisterBit(AddrRegInterruptFlag, FlagInterruptInput, true);
+}
+
+// Lines are active low and only report the selected groups
+uint8_t MemoryManagementUnit::readJoypad() {
+    uint8_t select = memory[AddrRegJoypad];
+    uint8_t lines = 0x0f;
+    if(!(select & (1 << FlagJoypadSelectDirections)))
+        lines &= ~joypad & 0x0f;
+    if(!(select & (1 << FlagJoypadSelectButtons)))
+        lines &= ~(joypad >> 4) & 0x0f;
+    return 0xc0 | (select & 0x30) | lines;
+}
+
+uint8_t MemoryManagementUnit::GetRomBank() {
+    return cartridge->GetSelectedBank();
+}
+
+bool MemoryManagementUnit::loadBIOS() {
     std::string path = "../roms/bios.gb";
-    printf("Loading Bios: %s\n", path.c_str());
+    PICOBOY_LOG(LogDebug, LogMemory, "Loading Bios: %s", path.c_str());
     std::ifstream biosFile;
     biosFile.open(path, std::ifstream::binary);
+    if(!biosFile.is_open()) {
+        PICOBOY_LOG(LogInfo, LogMemory, "Bios not found, starting from cartridge entry point");
+        return false;
+    }
     biosFile.seekg(0, biosFile.beg);
 
     uint8_t bios[0x100];
@@ -69,7 +207,36 @@ void MemoryManagementUnit::loadBIOS() {
     biosFile.close();
 
     memcpy(&memory, &bios, sizeof(bios));
-    printf("Loaded BIOS Data to MMU\n");
+    PICOBOY_LOG(LogDebug, LogMemory, "Loaded BIOS Data to MMU");
+    return true;
+}
+
+// IO register values left behind by the DMG boot ROM
+void MemoryManagementUnit::skipBIOS() {
+    memory[AddrRegLcdControl] = 0x91;
+    memory[AddrRegBgPalette] = 0xFC;
+    memory[AddrRegSprite0Palette] = 0xFF;
+    memory[AddrRegSprite1Palette] = 0xFF;
+    memory[0xFF10] = 0x80;
+    memory[0xFF11] = 0xBF;
+    memory[0xFF12] = 0xF3;
+    memory[0xFF14] = 0xBF;
+    memory[0xFF16] = 0x3F;
+    memory[0xFF19] = 0xBF;
+    memory[0xFF1A] = 0x7F;
+    memory[0xFF1B] = 0xFF;
+    memory[0xFF1C] = 0x9F;
+    memory[0xFF1E] = 0xBF;
+    memory[0xFF20] = 0xFF;
+    memory[0xFF23] = 0xBF;
+    memory[0xFF24] = 0x77;
+    memory[0xFF25] = 0xF3;
+    memory[0xFF26] = 0xF1;
+    memory[AddrRegBootRomDisable] = 0x1;
+}
+
+bool MemoryManagementUnit::IsBootRomEnabled() {
+    return memory[AddrRegBootRomDisable] != 0x1;
 }
 
 bool MemoryManagementUnit::ReadIORegisterBit(uint16_t addr, uint8_t flag) { 
@@ -81,6 +248,8 @@ void MemoryManagementUnit::WriteIORegisterBit(uint16_t addr, uint8_t flag, bool
         memory[addr] |= (1 << flag);
     else 
         memory[addr] &= ~(1 << flag);
+    if(addr == AddrRegInterruptFlag || addr == AddrRegInterruptEnabled)
+        updatePendingInterrupts();
 }
 
 void MemoryManagementUnit::LoadDMA(uint8_t value) {
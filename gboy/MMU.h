@@ -3,6 +3,9 @@
 #include <vector>
 #include "Cartridge.h"
 
+class AudioProcessingUnit;
+class Debugger;
+
 class MemoryManagementUnit {
 public:
     MemoryManagementUnit(Cartridge* cart);
@@ -12,12 +15,63 @@ public:
 
     bool ReadIORegisterBit(uint16_t addr, uint8_t flag);
     void WriteIORegisterBit(uint16_t addr, uint8_t flag, bool value);
+    bool IsBootRomEnabled();
+
+    const std::string &GetSerialOutput();
+    void ClearSerialOutput();
+    void SetSerialEcho(bool echo);
+
+    // Bumped on every write to a 256 byte page (HRAM counted on its own) so
+    // decoded code can tell when the memory it came from has changed
+    uint32_t GetWriteVersion(uint16_t addr);
+    uint8_t GetRomBank();
+
+    // IE & IF, kept current by every write to either register so the CPU
+    // checks for interrupts with a single byte test
+    uint8_t GetPendingInterrupts() { return pendingInterrupts; }
+
+    // Host pointer to the 256 byte page holding addr when reading it is a
+    // plain load, otherwise nullptr. A page stays valid until the mapping
+    // version changes, which happens on writes to the cartridge control
+    // range and to the boot ROM disable register.
+    const uint8_t *GetReadPage(uint16_t addr);
+    uint32_t GetMappingVersion() { return mappingVersion; }
+
+    // The byte the CPU would read, without counting the read or reporting it
+    // to the debugger: for decoding and analysing code, and for debuggers
+    uint8_t Peek(uint16_t addr);
+
+    // Sound registers are read and written through the APU once one is attached
+    void SetAudio(AudioProcessingUnit *apu);
+
+    // Keys held, as kept by Input; a key going down on a selected group
+    // requests the joypad interrupt
+    void SetJoypad(uint8_t pressed);
+
+    // Accesses to pages the debugger watches are reported to it; set by the
+    // debugger itself, and only while it has watchpoints
+    void SetDebugger(Debugger *debugger);
 private:
-    void loadBIOS();
+    bool loadBIOS();
+    void skipBIOS();
     void LoadDMA(uint8_t value);
+    void transferSerial();
+    void updatePendingInterrupts();
+    uint8_t readJoypad();
 
     Cartridge *cartridge;
+    AudioProcessingUnit *audio;
+    Debugger *debugger;
     uint8_t memory[0x10000];
+    uint32_t writeVersions[0x101];
+    uint8_t pendingInterrupts;
+    uint32_t mappingVersion;
+    uint8_t joypad;
+
+    // Bytes sent over the serial port, which test ROMs use to report results
+    std::string serialOutput;
+    std::string serialLine;     // echoed once complete
+    bool serialEcho;
 };
 
 const uint16_t AddrRegLcdControl = 0xFF40;
@@ -46,12 +100,19 @@ const uint16_t AddrVectorTimer = 0x50;
 const uint16_t AddrVectorSerial = 0x58;
 const uint16_t AddrVectorInput = 0x60;
 
+const uint16_t AddrRegJoypad = 0xFF00;
+const uint16_t AddrRegSerialData = 0xFF01;
+const uint16_t AddrRegSerialControl = 0xFF02;
 const uint16_t AddrRegTIMA = 0xFF05;
 const uint16_t AddrRegTMA = 0xFF06;
 const uint16_t AddrRegTAC = 0xFF07;
 const uint16_t AddrRegInterruptFlag = 0xFF0F;
+const uint16_t AddrRegBootRomDisable = 0xFF50;
 const uint16_t AddrRegInterruptEnabled = 0xFFFF;
 
+const uint8_t FlagJoypadSelectButtons = 5;
+const uint8_t FlagJoypadSelectDirections = 4;
+
 const uint8_t FlagInterruptInput = 4;    
 const uint8_t FlagInterruptSerial = 3;
 const uint8_t FlagInterruptTimer = 2;
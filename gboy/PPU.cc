@@ -1,4 +1,5 @@
 #include "PPU.h"
+#include "Instrument.h"
 
 PixelProcessingUnit::PixelProcessingUnit(MemoryManagementUnit *mmu) {
     this->mmu = mmu;
@@ -6,6 +7,10 @@ PixelProcessingUnit::PixelProcessingUnit(MemoryManagementUnit *mmu) {
     currentLine = 0;
     mmu->Write(AddrRegLcdY, 0, true);
     HasFrameBufferUpdated = false;
+    HasFrameBufferRendered = false;
+    frameOutput = drawing = true;
+    memset(localFrameBuffer, 0, sizeof(localFrameBuffer));
+    memset(FrameBuffer, 0, sizeof(FrameBuffer));
     setLCDMode(VBLANK);
 }
 
@@ -43,9 +48,28 @@ void PixelProcessingUnit::Cycle(uint8_t cycles) {
     }
 }
 
+uint32_t PixelProcessingUnit::CyclesUntilNextEvent() {
+    long length = 0;
+    switch (currentMode) {
+        case HBLANK:
+            length = CyclesHBlank;
+            break;
+        case VBLANK:
+            length = CyclesVBlank;
+            break;
+        case ACCESS_OAM:
+            length = CyclesOam;
+            break;
+        case ACCESS_VRAM:
+            length = CyclesTransfer;
+            break;
+    }
+    return length > cycleCount ? length - cycleCount : 1;
+}
+
 void PixelProcessingUnit::updateLine() {
     currentLine++;
-    uint8_t line = mmu->Read(AddrRegLcdY);
+    uint8_t line = mmu->Read(AddrRegLcdY, true);
     line++;
     if (currentLine > 153)
         currentLine = line = 0;
@@ -61,8 +85,10 @@ void PixelProcessingUnit::processHBlank() {
             setLCDMode(VBLANK);
             mmu->WriteIORegisterBit(AddrRegInterruptFlag, FlagInterruptVBlank, true);
             // writeSprites();
-            updateFrameBuffer();
+            if (drawing)
+                updateFrameBuffer();
             HasFrameBufferUpdated = true;
+            HasFrameBufferRendered = drawing;
         } else {
             setLCDMode(ACCESS_OAM);
         }
@@ -75,10 +101,13 @@ void PixelProcessingUnit::processVBlank() {
 
         if (currentLine == 0) {
             setLCDMode(ACCESS_OAM);
+            drawing = frameOutput;
         } else {
             updateLine();
-            if(currentLine == 0)
+            if(currentLine == 0) {
                 setLCDMode(ACCESS_OAM);
+                drawing = frameOutput;
+            }
         }
     }    
 }
@@ -95,7 +124,8 @@ void PixelProcessingUnit::processTransfer() {
         cycleCount = cycleCount % CyclesTransfer;
         setLCDMode(HBLANK);
 
-        writeBGWindowLine(currentLine);
+        if (drawing)
+            writeBGWindowLine(currentLine);
         // writeSprites();
         // bool hblank_interrupt = mmu->ReadIORegisterBit(AddrRegLcdStatus, FlagLcdStatusHBlankInterruptOn);
         // if (hblank_interrupt)
@@ -109,6 +139,10 @@ void PixelProcessingUnit::processTransfer() {
     }    
 }
 
+void PixelProcessingUnit::SetFrameOutput(bool enabled) {
+    frameOutput = enabled;
+}
+
 void PixelProcessingUnit::updateFrameBuffer() {
     for (uint8_t x = 0; x < 160; x++) {
         for (uint8_t y = 0; y < 144; y++) {
@@ -138,14 +172,15 @@ void PixelProcessingUnit::writeBGWindowLine(uint8_t line) {
     if(line >= 144)
         return;
 
+    PICOBOY_COUNT(linesRendered, 1);
     uint16_t mapStart = mmu->ReadIORegisterBit(AddrRegLcdControl, FlagLcdControlBgMap) ? AddrBgMap0Start : AddrBgMap1Start;
     bool isSignedIndex = !mmu->ReadIORegisterBit(AddrRegLcdControl, FlagLcdControlBgData);
     uint16_t dataStart = isSignedIndex ? AddrTileData0Start : AddrTileData1Start;
 
-    uint8_t scrollX = mmu->Read(AddrRegScrollX);
-    uint8_t scrollY = mmu->Read(AddrRegScrollY);
-    uint8_t windowX = mmu->Read(AddrRegWindowX) - 7;
-    uint8_t windowY = mmu->Read(AddrRegWindowY);
+    uint8_t scrollX = mmu->Read(AddrRegScrollX, true);
+    uint8_t scrollY = mmu->Read(AddrRegScrollY, true);
+    uint8_t windowX = mmu->Read(AddrRegWindowX, true) - 7;
+    uint8_t windowY = mmu->Read(AddrRegWindowY, true);
 
     bool usingWindow = (line >= windowY) && mmu->ReadIORegisterBit(AddrRegLcdControl, FlagLcdControlWindowOn);
     uint16_t tilemap = mmu->ReadIORegisterBit(AddrRegLcdControl, usingWindow ? FlagLcdControlWindowMap : FlagLcdControlBgMap) ? AddrBgMap1Start : AddrBgMap0Start;
@@ -166,9 +201,9 @@ void PixelProcessingUnit::writeBGWindowLine(uint8_t line) {
         uint16_t addr = tilemap + tile_row * 32 + tile_column;
         int16_t tilenum;
         if (isSignedIndex)
-            tilenum = (int8_t) mmu->Read(addr);
+            tilenum = (int8_t) mmu->Read(addr, true);
         else
-            tilenum = mmu->Read(addr);
+            tilenum = mmu->Read(addr, true);
 
         uint16_t tile_address;
         if (!isSignedIndex)
@@ -177,8 +212,8 @@ void PixelProcessingUnit::writeBGWindowLine(uint8_t line) {
             tile_address = dataStart + ((tilenum + 128) * 16);
 
         uint8_t lno = y % 8;
-        uint8_t byte1 = mmu->Read(tile_address + lno * 2);
-        uint8_t byte2 = mmu->Read(tile_address + lno * 2 + 1);
+        uint8_t byte1 = mmu->Read(tile_address + lno * 2, true);
+        uint8_t byte2 = mmu->Read(tile_address + lno * 2 + 1, true);
 
         uint8_t req_bit = 7 - (x % 8);
         uint8_t bit1 = (byte1 >> req_bit) & 1;
@@ -203,8 +238,8 @@ void PixelProcessingUnit::drawSprite(const uint8_t sprite_n) {
     uint16_t offset_in_oam = sprite_n * 4;
     uint16_t oam_start = AddrOAMStart + offset_in_oam;
 
-    uint8_t sprite_y = mmu->Read(oam_start);
-    uint8_t sprite_x = mmu->Read(oam_start + 1);
+    uint8_t sprite_y = mmu->Read(oam_start, true);
+    uint8_t sprite_x = mmu->Read(oam_start + 1, true);
 
     if (sprite_y == 0 || sprite_y >= 160) { return; }
     if (sprite_x == 0 || sprite_x >= 168) { return; }
@@ -213,8 +248,8 @@ void PixelProcessingUnit::drawSprite(const uint8_t sprite_n) {
 
     uint16_t tile_set_location = AddrTileData1Start;
 
-    uint8_t pattern_n = mmu->Read(oam_start + 2);
-    uint8_t sprite_attrs = mmu->Read(oam_start + 3);
+    uint8_t pattern_n = mmu->Read(oam_start + 2, true);
+    uint8_t sprite_attrs = mmu->Read(oam_start + 3, true);
 
     /* Bits 0-3 are used only for CGB */
     bool use_palette_1 = check_bit(sprite_attrs, 4);
@@ -254,7 +289,7 @@ void PixelProcessingUnit::drawSprite(const uint8_t sprite_n) {
 }
 
 int PixelProcessingUnit::getColor(int id, uint16_t palette) {
-    uint8_t data = mmu->Read(palette);
+    uint8_t data = mmu->Read(palette, true);
     int hi = 2 * id + 1, lo = 2 * id;
     int bit1 = (data >> hi) & 1;
     int bit0 = (data >> lo) & 1;
@@ -13,6 +13,7 @@ enum LcdMode {
 
 class PixelProcessingUnit
 {
+    friend struct BenchmarkAccess;
 private:
     MemoryManagementUnit *mmu;
     long cycleCount;
@@ -33,6 +34,8 @@ private:
     void updateFrameBuffer();
 
     uint8_t localFrameBuffer[160][144];
+    bool frameOutput;       // requested for frames starting from now on
+    bool drawing;           // latched when the current frame started
     int getColor(int id, uint16_t palette);
     bool check_bit(const uint8_t value, const uint8_t bit);
     
@@ -40,9 +43,15 @@ public:
     PixelProcessingUnit(MemoryManagementUnit *mmu);
     ~PixelProcessingUnit();
     void Cycle(uint8_t cycles);
+    // Cycles until the next mode change
+    uint32_t CyclesUntilNextEvent();
+    // Frames started with output off are neither drawn nor converted to
+    // FrameBuffer; they only affect what is shown, never the emulated state
+    void SetFrameOutput(bool enabled);
 
     uint8_t FrameBuffer[160][144][3];
     bool HasFrameBufferUpdated;
+    bool HasFrameBufferRendered;    // the frame that last completed was drawn
 };
 
 const uint16_t CyclesHBlank = 204;     // Mode 0 (H-Blank) 204 cycles per Scanline
@@ -0,0 +1,131 @@
+#include "Profiler.h"
+#include <algorithm>
+#include <functional>
+
+// Marks interrupt nodes, which no bank:address key can reach
+const uint32_t ProfileInterruptKey = 0x1000000;
+
+Profiler::Profiler() {
+    Reset();
+}
+
+void Profiler::Reset() {
+    addressCycles.assign(0x10000, 0);
+    nodes.assign(1, Node{0, 0, 0});
+    children.clear();
+    frames.clear();
+    current = 0;
+    totalCycles = 0;
+    pending = PendingNone;
+}
+
+// Addresses of bank 1 and outside 0x4000-0x7FFF come first; every other
+// bank gets 0x4000 counters after them
+size_t Profiler::addressIndex(uint8_t bank, uint16_t addr) {
+    if(addr < 0x4000 || addr >= 0x8000 || bank <= 1)
+        return addr;
+    return 0x10000 + (size_t)(bank - 2) * 0x4000 + (addr - 0x4000);
+}
+
+void Profiler::enter(uint32_t key, uint16_t returnSp) {
+    // A runaway stack, e.g. CALLs that never return, keeps only its top
+    if(frames.size() >= ProfileMaxDepth)
+        frames.erase(frames.begin());
+    frames.push_back(Frame{current, returnSp});
+
+    uint64_t edge = (uint64_t)current << 32 | key;
+    auto it = children.find(edge);
+    if(it == children.end()) {
+        nodes.push_back(Node{key, current, 0});
+        it = children.emplace(edge, (uint32_t)(nodes.size() - 1)).first;
+    }
+    current = it->second;
+}
+
+void Profiler::Interrupt(uint8_t flag, uint16_t sp) {
+    enter(ProfileInterruptKey | flag, sp);
+}
+
+void Profiler::leave(uint16_t sp) {
+    bool returned = false;
+    uint32_t caller = current;
+    while(!frames.empty() && frames.back().returnSp <= sp) {
+        caller = frames.back().caller;
+        frames.pop_back();
+        returned = true;
+    }
+    // A RET with no matching CALL is a jump through the stack; stay put
+    if(returned)
+        current = caller;
+}
+
+uint64_t Profiler::GetCycles(uint8_t bank, uint16_t addr) {
+    size_t index = addressIndex(bank, addr);
+    return index < addressCycles.size() ? addressCycles[index] : 0;
+}
+
+uint64_t Profiler::GetTotalCycles() {
+    return totalCycles;
+}
+
+std::string Profiler::nodeName(uint32_t index) {
+    if(index == 0)
+        return "reset";
+    uint32_t key = nodes[index].key;
+    if(key & ProfileInterruptKey) {
+        const char *names[] = {"vblank", "lcd", "timer", "serial", "joypad"};
+        uint32_t flag = key & 0xff;
+        return std::string("int:") + (flag < 5 ? names[flag] : "?");
+    }
+    char name[16];
+    snprintf(name, sizeof(name), "%02x:%04x", key >> 16, key & 0xffff);
+    return name;
+}
+
+void Profiler::WriteFolded(FILE *out) {
+    for(uint32_t i = 0; i < nodes.size(); i++) {
+        if(!nodes[i].cycles)
+            continue;
+        std::vector<uint32_t> path;
+        for(uint32_t n = i; n != 0; n = nodes[n].parent)
+            path.push_back(n);
+        std::string line = nodeName(0);
+        for(auto it = path.rbegin(); it != path.rend(); ++it)
+            line += ";" + nodeName(*it);
+        fprintf(out, "%s %llu\n", line.c_str(), (unsigned long long)nodes[i].cycles);
+    }
+}
+
+bool Profiler::WriteFolded(const char *path) {
+    FILE *out = fopen(path, "w");
+    if(!out) {
+        printf("Cannot write profile to %s\n", path);
+        return false;
+    }
+    WriteFolded(out);
+    fclose(out);
+    return true;
+}
+
+void Profiler::WriteHotspots(FILE *out, size_t top) {
+    std::vector<std::pair<uint64_t, size_t> > spots;
+    for(size_t i = 0; i < addressCycles.size(); i++) {
+        if(addressCycles[i])
+            spots.push_back(std::make_pair(addressCycles[i], i));
+    }
+    std::sort(spots.begin(), spots.end(), std::greater<std::pair<uint64_t, size_t> >());
+    if(spots.size() > top)
+        spots.resize(top);
+
+    for(const std::pair<uint64_t, size_t> &s : spots) {
+        uint8_t bank = 0;
+        uint16_t addr = (uint16_t)s.second;
+        if(s.second >= 0x10000) {
+            bank = (uint8_t)((s.second - 0x10000) / 0x4000 + 2);
+            addr = (uint16_t)(0x4000 + (s.second - 0x10000) % 0x4000);
+        } else if(addr >= 0x4000 && addr < 0x8000) {
+            bank = 1;
+        }
+        fprintf(out, "%12llu %6.2f%%  %02x:%04x\n", (unsigned long long)s.first, 100.0 * s.first / totalCycles, bank, addr);
+    }
+}
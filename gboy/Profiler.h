@@ -0,0 +1,90 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Exact profiler for emulated code. The cycles of every instruction are
+// added to a counter for its bank:address and to the node of the current
+// call stack in a call tree; CALL, RST and interrupts enter a child node and
+// RET/RETI go back to the caller. Nothing is logged while running, so a
+// profiled run stays close to full speed.
+//
+// Calls are matched to returns through the stack pointer: a return leaves
+// every frame whose return address was at or below the new SP, so code that
+// drops its return address or resets SP does not leave the tree off by one.
+// A CALL or RET takes effect after its own cycles are counted, so they stay
+// with the caller.
+
+const size_t ProfileMaxDepth = 256;
+
+class Profiler {
+private:
+    struct Node {
+        uint32_t key;       // bank << 16 | entry address, or ProfileInterruptKey | flag
+        uint32_t parent;
+        uint64_t cycles;    // spent in this node itself
+    };
+    struct Frame {
+        uint32_t caller;
+        uint16_t returnSp;  // SP once the return address is popped
+    };
+
+    std::vector<uint64_t> addressCycles;   // see addressIndex
+    std::vector<Node> nodes;
+    std::unordered_map<uint64_t, uint32_t> children;
+    std::vector<Frame> frames;
+    uint32_t current;
+    uint64_t totalCycles;
+    enum { PendingNone, PendingCall, PendingReturn } pending;
+    uint32_t pendingKey;
+    uint16_t pendingSp;
+
+    static size_t addressIndex(uint8_t bank, uint16_t addr);
+    void enter(uint32_t key, uint16_t returnSp);
+    void leave(uint16_t sp);
+    std::string nodeName(uint32_t index);
+
+public:
+    Profiler();
+    void Reset();
+
+    // bank only matters for 0x4000-0x7FFF
+    void Count(uint8_t bank, uint16_t addr, uint32_t cycles) {
+        size_t index = addressIndex(bank, addr);
+        if(index >= addressCycles.size())
+            addressCycles.resize(index + 0x4000 - (index & 0x3fff), 0);
+        addressCycles[index] += cycles;
+        nodes[current].cycles += cycles;
+        totalCycles += cycles;
+        if(pending == PendingCall)
+            enter(pendingKey, pendingSp);
+        else if(pending == PendingReturn)
+            leave(pendingSp);
+        pending = PendingNone;
+    }
+    // From within the CALL or RST, with the SP from before the push
+    void Call(uint8_t bank, uint16_t target, uint16_t sp) {
+        pending = PendingCall;
+        pendingKey = (uint32_t)bank << 16 | target;
+        pendingSp = sp;
+    }
+    // From within the RET or RETI, with the SP after the pop
+    void Return(uint16_t sp) {
+        pending = PendingReturn;
+        pendingSp = sp;
+    }
+    // Taken before the instruction at the vector runs, so applies at once
+    void Interrupt(uint8_t flag, uint16_t sp);
+
+    uint64_t GetCycles(uint8_t bank, uint16_t addr);
+    uint64_t GetTotalCycles();
+    // One "caller;callee cycles" line per call stack, for flamegraph.pl and
+    // compatible viewers; nodes are named bank:address or int:<interrupt>
+    void WriteFolded(FILE *out);
+    bool WriteFolded(const char *path);
+    // The addresses with the most cycles
+    void WriteHotspots(FILE *out, size_t top);
+};
@@ -0,0 +1,218 @@
+#include "RomBuilder.h"
+
+#include <cstdio>
+#include <cstdlib>
+
+static const uint8_t NintendoLogo[48] = {
+    0xce, 0xed, 0x66, 0x66, 0xcc, 0x0d, 0x00, 0x0b, 0x03, 0x73, 0x00, 0x83,
+    0x00, 0x0c, 0x00, 0x0d, 0x00, 0x08, 0x11, 0x1f, 0x88, 0x89, 0x00, 0x0e,
+    0xdc, 0xcc, 0x6e, 0xe6, 0xdd, 0xdd, 0xd9, 0x99, 0xbb, 0xbb, 0x67, 0x63,
+    0x6e, 0x0e, 0xec, 0xcc, 0xdd, 0xdc, 0x99, 0x9f, 0xbb, 0xb9, 0x33, 0x3e,
+};
+
+RomBuilder::RomBuilder(const std::string &title) {
+    rom = std::vector<uint8_t>(RomBuilderSize, 0x00);
+    writeHeader(title);
+    position = AddrRomCodeStart;
+}
+
+RomBuilder::~RomBuilder() {
+}
+
+void RomBuilder::writeHeader(const std::string &title) {
+    position = AddrRomEntryPoint;
+    Nop();
+    Jp(CondAlways, "main");
+
+    memcpy(&rom[0x104], NintendoLogo, sizeof(NintendoLogo));
+    for (size_t i = 0; i < title.size() && i < 16; i++)
+        rom[0x134 + i] = title[i];
+    rom[AddrCartType] = CartTypeRom;
+    rom[0x148] = 0x00; // 32KB, no banking
+    rom[0x149] = 0x00; // no external RAM
+    rom[0x14a] = 0x01; // non-japanese
+}
+
+void RomBuilder::Org(uint16_t addr) {
+    position = addr;
+}
+
+uint16_t RomBuilder::Here() {
+    return position;
+}
+
+void RomBuilder::Label(const std::string &name) {
+    if (labels.count(name)) {
+        printf("RomBuilder: duplicate label %s\n", name.c_str());
+        exit(1);
+    }
+    labels[name] = position;
+}
+
+void RomBuilder::Byte(uint8_t value) {
+    if (position >= RomBuilderSize) {
+        printf("RomBuilder: code overflows the ROM at 0x%04x\n", position);
+        exit(1);
+    }
+    rom[position++] = value;
+}
+
+void RomBuilder::Word(uint16_t value) {
+    Byte(value & 0xff);
+    Byte(value >> 8);
+}
+
+void RomBuilder::reference(const std::string &label, bool relative) {
+    fixups.push_back({position, label, relative});
+    if (relative)
+        Byte(0x00);
+    else
+        Word(0x0000);
+}
+
+void RomBuilder::Nop() { Byte(0x00); }
+void RomBuilder::Halt() { Byte(0x76); }
+void RomBuilder::Di() { Byte(0xf3); }
+void RomBuilder::Ei() { Byte(0xfb); }
+
+void RomBuilder::Ld(Reg8 dst, Reg8 src) {
+    Byte(0x40 + dst * 8 + src);
+}
+
+void RomBuilder::LdImm(Reg8 dst, uint8_t value) {
+    Byte(0x06 + dst * 8);
+    Byte(value);
+}
+
+void RomBuilder::LdImm16(Reg16 dst, uint16_t value) {
+    Byte(0x01 + dst * 16);
+    Word(value);
+}
+
+void RomBuilder::LdAFromPair(Reg16 src) {
+    Byte(src == RegBC ? 0x0a : 0x1a);
+}
+
+void RomBuilder::LdPairFromA(Reg16 dst) {
+    Byte(dst == RegBC ? 0x02 : 0x12);
+}
+
+void RomBuilder::LdAFromHLInc() { Byte(0x2a); }
+void RomBuilder::LdHLIncFromA() { Byte(0x22); }
+
+void RomBuilder::LdAFromAddr(uint16_t addr) {
+    Byte(0xfa);
+    Word(addr);
+}
+
+void RomBuilder::LdAddrFromA(uint16_t addr) {
+    Byte(0xea);
+    Word(addr);
+}
+
+void RomBuilder::LdhAFromIo(uint8_t reg) {
+    Byte(0xf0);
+    Byte(reg);
+}
+
+void RomBuilder::LdhIoFromA(uint8_t reg) {
+    Byte(0xe0);
+    Byte(reg);
+}
+
+void RomBuilder::Alu(AluOp op, Reg8 src) {
+    Byte(0x80 + op * 8 + src);
+}
+
+void RomBuilder::AluImm(AluOp op, uint8_t value) {
+    Byte(0xc6 + op * 8);
+    Byte(value);
+}
+
+void RomBuilder::Inc(Reg8 reg) { Byte(0x04 + reg * 8); }
+void RomBuilder::Dec(Reg8 reg) { Byte(0x05 + reg * 8); }
+void RomBuilder::Inc16(Reg16 reg) { Byte(0x03 + reg * 16); }
+void RomBuilder::Dec16(Reg16 reg) { Byte(0x0b + reg * 16); }
+void RomBuilder::AddHL(Reg16 src) { Byte(0x09 + src * 16); }
+void RomBuilder::Push(Reg16 reg) { Byte(0xc5 + reg * 16); }
+void RomBuilder::Pop(Reg16 reg) { Byte(0xc1 + reg * 16); }
+
+void RomBuilder::Cb(CbOp op, Reg8 reg) {
+    Byte(0xcb);
+    Byte(op * 8 + reg);
+}
+
+void RomBuilder::Bit(uint8_t bit, Reg8 reg) {
+    Byte(0xcb);
+    Byte(0x40 + (bit & 0x7) * 8 + reg);
+}
+
+void RomBuilder::Res(uint8_t bit, Reg8 reg) {
+    Byte(0xcb);
+    Byte(0x80 + (bit & 0x7) * 8 + reg);
+}
+
+void RomBuilder::Set(uint8_t bit, Reg8 reg) {
+    Byte(0xcb);
+    Byte(0xc0 + (bit & 0x7) * 8 + reg);
+}
+
+void RomBuilder::Jr(Condition cond, const std::string &label) {
+    Byte(cond == CondAlways ? 0x18 : 0x20 + cond * 8);
+    reference(label, true);
+}
+
+void RomBuilder::Jp(Condition cond, const std::string &label) {
+    Byte(cond == CondAlways ? 0xc3 : 0xc2 + cond * 8);
+    reference(label, false);
+}
+
+void RomBuilder::Call(const std::string &label) {
+    Byte(0xcd);
+    reference(label, false);
+}
+
+void RomBuilder::Call(uint16_t addr) {
+    Byte(0xcd);
+    Word(addr);
+}
+
+void RomBuilder::Ret() { Byte(0xc9); }
+void RomBuilder::Reti() { Byte(0xd9); }
+
+std::vector<uint8_t> RomBuilder::Build() {
+    for (auto &fixup : fixups) {
+        std::map<std::string, uint16_t>::iterator it = labels.find(fixup.label);
+        if (it == labels.end()) {
+            printf("RomBuilder: undefined label %s\n", fixup.label.c_str());
+            exit(1);
+        }
+
+        if (fixup.relative) {
+            int offset = (int)it->second - (fixup.at + 1);
+            if (offset < -128 || offset > 127) {
+                printf("RomBuilder: relative jump to %s out of range\n", fixup.label.c_str());
+                exit(1);
+            }
+            rom[fixup.at] = (uint8_t)(int8_t)offset;
+        } else {
+            rom[fixup.at] = it->second & 0xff;
+            rom[fixup.at + 1] = it->second >> 8;
+        }
+    }
+
+    uint8_t headerChecksum = 0;
+    for (uint16_t addr = 0x134; addr <= 0x14c; addr++)
+        headerChecksum = headerChecksum - rom[addr] - 1;
+    rom[0x14d] = headerChecksum;
+
+    uint16_t globalChecksum = 0;
+    for (uint32_t addr = 0; addr < rom.size(); addr++) {
+        if (addr != 0x14e && addr != 0x14f)
+            globalChecksum += rom[addr];
+    }
+    rom[0x14e] = globalChecksum >> 8;
+    rom[0x14f] = globalChecksum & 0xff;
+
+    return rom;
+}
@@ -0,0 +1,127 @@
+#pragma once
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "Cartridge.h"
+
+// Operand encodings follow the SM83 opcode tables (B, C, D, E, H, L, (HL), A)
+enum Reg8 {
+    RegB = 0,
+    RegC = 1,
+    RegD = 2,
+    RegE = 3,
+    RegH = 4,
+    RegL = 5,
+    RegHLIndirect = 6,
+    RegA = 7,
+};
+
+enum Reg16 {
+    RegBC = 0,
+    RegDE = 1,
+    RegHL = 2,
+    RegSP = 3,
+    RegAF = 3, // PUSH/POP only
+};
+
+enum Condition {
+    CondNZ = 0,
+    CondZ = 1,
+    CondNC = 2,
+    CondC = 3,
+    CondAlways = 4,
+};
+
+enum AluOp {
+    AluAdd = 0,
+    AluAdc = 1,
+    AluSub = 2,
+    AluSbc = 3,
+    AluAnd = 4,
+    AluXor = 5,
+    AluOr = 6,
+    AluCp = 7,
+};
+
+enum CbOp {
+    CbRlc = 0,
+    CbRrc = 1,
+    CbRl = 2,
+    CbRr = 3,
+    CbSla = 4,
+    CbSra = 5,
+    CbSwap = 6,
+    CbSrl = 7,
+};
+
+// Minimal SM83 assembler producing 32KB ROM-only cartridge images with a
+// valid header. Execution starts at the "main" label.
+class RomBuilder {
+private:
+    struct Fixup {
+        uint16_t at;
+        std::string label;
+        bool relative;
+    };
+
+    std::vector<uint8_t> rom;
+    uint16_t position;
+    std::map<std::string, uint16_t> labels;
+    std::vector<Fixup> fixups;
+
+    void writeHeader(const std::string &title);
+    void reference(const std::string &label, bool relative);
+
+public:
+    RomBuilder(const std::string &title);
+    ~RomBuilder();
+
+    void Org(uint16_t addr);
+    uint16_t Here();
+    void Label(const std::string &name);
+    void Byte(uint8_t value);
+    void Word(uint16_t value);
+
+    void Nop();
+    void Halt();
+    void Di();
+    void Ei();
+    void Ld(Reg8 dst, Reg8 src);
+    void LdImm(Reg8 dst, uint8_t value);
+    void LdImm16(Reg16 dst, uint16_t value);
+    void LdAFromPair(Reg16 src);           // LD A,(BC) / LD A,(DE)
+    void LdPairFromA(Reg16 dst);           // LD (BC),A / LD (DE),A
+    void LdAFromHLInc();                   // LD A,(HL+)
+    void LdHLIncFromA();                   // LD (HL+),A
+    void LdAFromAddr(uint16_t addr);       // LD A,(nn)
+    void LdAddrFromA(uint16_t addr);       // LD (nn),A
+    void LdhAFromIo(uint8_t reg);          // LD A,(FF00+n)
+    void LdhIoFromA(uint8_t reg);          // LD (FF00+n),A
+    void Alu(AluOp op, Reg8 src);
+    void AluImm(AluOp op, uint8_t value);
+    void Inc(Reg8 reg);
+    void Dec(Reg8 reg);
+    void Inc16(Reg16 reg);
+    void Dec16(Reg16 reg);
+    void AddHL(Reg16 src);
+    void Push(Reg16 reg);
+    void Pop(Reg16 reg);
+    void Cb(CbOp op, Reg8 reg);
+    void Bit(uint8_t bit, Reg8 reg);
+    void Res(uint8_t bit, Reg8 reg);
+    void Set(uint8_t bit, Reg8 reg);
+    void Jr(Condition cond, const std::string &label);
+    void Jp(Condition cond, const std::string &label);
+    void Call(const std::string &label);
+    void Call(uint16_t addr);
+    void Ret();
+    void Reti();
+
+    std::vector<uint8_t> Build();
+};
+
+const uint16_t AddrRomEntryPoint = 0x0100;
+const uint16_t AddrRomCodeStart = 0x0150;
+const uint32_t RomBuilderSize = 0x8000;
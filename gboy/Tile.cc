@@ -11,8 +11,8 @@ Tile::Tile(uint16_t addr, MemoryManagementUnit *mmu, uint8_t size_multiplier) {
         uint8_t index_into_tile = 2 * tile_line;
         uint16_t line_start = addr + index_into_tile;
 
-        uint8_t pixels_1 = mmu->Read(line_start);
-        uint8_t pixels_2 = mmu->Read(line_start + 1);
+        uint8_t pixels_1 = mmu->Read(line_start, true);
+        uint8_t pixels_2 = mmu->Read(line_start + 1, true);
 
         std::vector<uint8_t> pixel_line = get_pixel_line(pixels_1, pixels_2);
 
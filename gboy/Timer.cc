@@ -14,14 +14,28 @@ Timer::~Timer() {
 }
 
 void Timer::Cycle(uint8_t cycles) {
-    uint16_t internalClock = (mmu->Read(0xFF04) << 8) | mmu->Read(0xFF03);
+    uint16_t internalClock = (mmu->Read(0xFF04, true) << 8) | mmu->Read(0xFF03, true);
     internalClock += cycles;
-    mmu->Write(0xFF04, (internalClock & 0xFF00) >> 8);
-    mmu->Write(0xFF03, (internalClock & 0x00FF));
+    mmu->Write(0xFF04, (internalClock & 0xFF00) >> 8, true);
+    mmu->Write(0xFF03, (internalClock & 0x00FF), true);
 
     handleTima(cycles, internalClock);
 }
 
+uint32_t Timer::CyclesUntilNextEvent() {
+    if(!mmu->ReadIORegisterBit(AddrRegTAC, FlagTimerStart))
+        return UINT32_MAX;
+    if(!timaStarted || pendingOverflow)
+        return 1;
+
+    uint16_t internalClock = (mmu->Read(0xFF04, true) << 8) | mmu->Read(0xFF03, true);
+    uint32_t period = CyclesCpu / getTimerFrequency();
+    uint32_t untilIncrement = period - (internalClock & (period - 1));
+    uint32_t increments = 0x100 - mmu->Read(AddrRegTIMA, true);
+    // The interrupt is raised on the clock after TIMA wraps
+    return untilIncrement + (increments - 1) * period + 1;
+}
+
 void Timer::handleTima(uint8_t cycles, uint16_t internalClock) {
     bool hasTimerStarted = mmu->ReadIORegisterBit(AddrRegTAC, FlagTimerStart);
     if(!hasTimerStarted)
@@ -39,7 +53,7 @@ void Timer::handleTima(uint8_t cycles, uint16_t internalClock) {
             handleOverflow();
             bool currentPulse = clock & bitToSelect;
             if(lastVisiblePulse && !currentPulse) {                    
-                uint8_t timerValue = mmu->Read(AddrRegTIMA) + 1;
+                uint8_t timerValue = mmu->Read(AddrRegTIMA, true) + 1;
                 pendingOverflow = timerValue == 0x00;
                 mmu->Write(AddrRegTIMA, timerValue);          
             }
@@ -52,14 +66,14 @@ void Timer::handleTima(uint8_t cycles, uint16_t internalClock) {
 void Timer::handleOverflow() {
     if(pendingOverflow) {
         pendingOverflow = false;
-        mmu->Write(AddrRegTIMA, mmu->Read(AddrRegTMA));
+        mmu->Write(AddrRegTIMA, mmu->Read(AddrRegTMA, true));
         mmu->WriteIORegisterBit(AddrRegInterruptFlag, FlagInterruptTimer, true);
     }
 }
 
 uint32_t Timer::getTimerFrequency() {
     uint32_t frequency = 0;
-    uint8_t regTac = mmu->Read(AddrRegTAC);
+    uint8_t regTac = mmu->Read(AddrRegTAC, true);
     uint8_t setFrequency = regTac & FlagTimerClockMode;
     switch(setFrequency) {
         case 0:
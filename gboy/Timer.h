@@ -19,7 +19,9 @@ public:
     Timer(MemoryManagementUnit *mmu);
     ~Timer();
     void Cycle(uint8_t cycles);
+    // Cycles until TIMA overflow raises the timer interrupt
+    uint32_t CyclesUntilNextEvent();
 };
 
 const uint8_t FlagTimerClockMode = 3;
-const uint8_t FlagTimerStart = 4;
+const uint8_t FlagTimerStart = 2;
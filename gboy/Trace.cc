@@ -0,0 +1,162 @@
+#include "Trace.h"
+#include <algorithm>
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include "CPU.h"
+
+struct TraceFileHeader {
+    char magic[8];
+    uint32_t recordSize;
+    uint32_t count;
+};
+static const char TraceMagic[8] = {'P', 'B', 'T', 'R', 'A', 'C', 'E', '1'};
+
+TraceBuffer::TraceBuffer(uint32_t capacity) {
+    uint32_t size = 1;
+    while(size < capacity)
+        size <<= 1;
+    records.resize(size);
+    mask = size - 1;
+    triggerArmed = false;
+    Reset();
+}
+
+void TraceBuffer::Reset() {
+    memset(&records[0], 0, records.size() * sizeof(TraceRecord));
+    written = 0;
+    cycle = 0;
+    frozen = false;
+    remaining = 0;
+}
+
+void TraceBuffer::SetTrigger(uint8_t bank, uint16_t pc, uint32_t after) {
+    triggerArmed = true;
+    triggerBank = bank;
+    triggerPc = pc;
+    triggerAfter = after;
+}
+
+void TraceBuffer::Freeze() {
+    frozen = true;
+}
+
+bool TraceBuffer::IsFrozen() {
+    return frozen;
+}
+
+size_t TraceBuffer::GetSize() {
+    return written < records.size() ? (size_t)written : records.size();
+}
+
+const TraceRecord &TraceBuffer::Get(size_t index) {
+    return records[(written - GetSize() + index) & mask];
+}
+
+void TraceBuffer::Write(FILE *out) {
+    TraceFileHeader header;
+    memcpy(header.magic, TraceMagic, sizeof(header.magic));
+    header.recordSize = sizeof(TraceRecord);
+    header.count = (uint32_t)GetSize();
+    fwrite(&header, sizeof(header), 1, out);
+    for(size_t i = 0; i < header.count; i++)
+        fwrite(&Get(i), sizeof(TraceRecord), 1, out);
+}
+
+bool TraceBuffer::Write(const char *path) {
+    FILE *out = fopen(path, "wb");
+    if(!out) {
+        printf("Cannot write trace to %s\n", path);
+        return false;
+    }
+    Write(out);
+    fclose(out);
+    return true;
+}
+
+bool TraceBuffer::Read(FILE *in, std::vector<TraceRecord> &out) {
+    TraceFileHeader header;
+    if(fread(&header, sizeof(header), 1, in) != 1 || memcmp(header.magic, TraceMagic, sizeof(header.magic)) != 0
+        || header.recordSize != sizeof(TraceRecord))
+        return false;
+    out.resize(header.count);
+    return header.count == 0 || fread(&out[0], sizeof(TraceRecord), header.count, in) == header.count;
+}
+
+bool TraceBuffer::Read(const char *path, std::vector<TraceRecord> &out) {
+    FILE *in = fopen(path, "rb");
+    if(!in) {
+        printf("Cannot read trace from %s\n", path);
+        return false;
+    }
+    bool ok = Read(in, out);
+    fclose(in);
+    if(!ok)
+        printf("%s is not a trace file\n", path);
+    return ok;
+}
+
+std::string FormatTraceRecord(const TraceRecord &record, CentralProcessingUnit *cpu) {
+    char text[160];
+    char instruction[40];
+    if(record.opcode & TraceOpcodeInterrupt) {
+        const char *names[] = {"vblank", "lcd", "timer", "serial", "joypad"};
+        uint8_t flag = record.opcode & 0xff;
+        snprintf(instruction, sizeof(instruction), "int:%s from %04x", flag < 5 ? names[flag] : "?",
+            record.operands[1] << 8 | record.operands[0]);
+    } else {
+        int length = snprintf(instruction, sizeof(instruction), "%-14s", cpu->GetInstructionName(record.opcode).c_str());
+        for(int i = 0; i < record.operandCount && i < 2 && length < (int)sizeof(instruction); i++)
+            length += snprintf(instruction + length, sizeof(instruction) - length, " %02x", record.operands[i]);
+    }
+    snprintf(text, sizeof(text), "%12llu %02x:%04x  %-24s af=%04x bc=%04x de=%04x hl=%04x sp=%04x ime=%u",
+        (unsigned long long)record.cycle, record.bank, record.pc, instruction, record.af, record.bc, record.de,
+        record.hl, record.sp, record.ime);
+    return text;
+}
+
+// The dump may run from a signal handler, so it only uses write(2) on the
+// ring as it stands
+static TraceBuffer *dumpBuffer = nullptr;
+static char dumpPath[1024];
+static volatile sig_atomic_t dumped = 0;
+
+static void dumpTrace() {
+    if(!dumpBuffer || dumped)
+        return;
+    dumped = 1;
+    int fd = open(dumpPath, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if(fd < 0)
+        return;
+    TraceFileHeader header;
+    memcpy(header.magic, TraceMagic, sizeof(header.magic));
+    header.recordSize = sizeof(TraceRecord);
+    header.count = (uint32_t)dumpBuffer->GetSize();
+    ssize_t ignored = write(fd, &header, sizeof(header));
+    TraceRecord chunk[256];
+    for(size_t i = 0; i < header.count; ) {
+        size_t n = std::min((size_t)header.count - i, sizeof(chunk) / sizeof(chunk[0]));
+        for(size_t j = 0; j < n; j++)
+            chunk[j] = dumpBuffer->Get(i + j);
+        ignored = write(fd, chunk, n * sizeof(TraceRecord));
+        i += n;
+    }
+    (void)ignored;
+    close(fd);
+}
+
+static void dumpOnSignal(int sig) {
+    dumpTrace();
+    signal(sig, SIG_DFL);
+    raise(sig);
+}
+
+void InstallTraceDump(TraceBuffer *buffer, const char *path) {
+    dumpBuffer = buffer;
+    snprintf(dumpPath, sizeof(dumpPath), "%s", path);
+    atexit(dumpTrace);
+    for(int sig : {SIGSEGV, SIGBUS, SIGILL, SIGFPE, SIGABRT})
+        signal(sig, dumpOnSignal);
+}
@@ -0,0 +1,92 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+class CentralProcessingUnit;
+
+// Binary instruction trace. The CPU writes one fixed-size record per
+// instruction, and per interrupt taken, into a ring that keeps only the most
+// recent ones, so tracing a whole session costs a few stores per instruction
+// and a fixed amount of memory. The ring is written out when something goes
+// wrong and decoded offline with picoboytracedump.
+
+// opcode of a record for an interrupt dispatch; the low bits hold its flag
+const uint16_t TraceOpcodeInterrupt = 0x200;
+const uint32_t TraceDefaultRecords = 1 << 16;
+
+struct TraceRecord {
+    uint64_t cycle;         // machine cycles before the instruction
+    uint16_t pc;            // the vector for an interrupt
+    uint16_t opcode;        // 0x100 | opcode for CB-prefixed ones
+    uint16_t af, bc, de, hl, sp;
+    uint8_t operands[2];    // the return address for an interrupt
+    uint8_t operandCount;
+    uint8_t bank;           // ROM bank of pc, 0 outside 0x4000-0x7FFF
+    uint8_t ime;
+    uint8_t reserved[5];
+};
+static_assert(sizeof(TraceRecord) == 32, "trace files are read back as an array of records");
+
+class TraceBuffer {
+private:
+    std::vector<TraceRecord> records;
+    uint32_t mask;
+    uint64_t written;
+    uint64_t cycle;
+    bool frozen;
+    bool triggerArmed;
+    uint8_t triggerBank;
+    uint16_t triggerPc;
+    uint32_t triggerAfter;
+    uint32_t remaining;     // records left once the trigger was hit
+
+public:
+    // capacity is rounded up to a power of two
+    TraceBuffer(uint32_t capacity = TraceDefaultRecords);
+    void Reset();
+
+    // Slot for the next record, nullptr once frozen
+    TraceRecord *Next(uint8_t bank, uint16_t pc) {
+        if(frozen)
+            return nullptr;
+        if(triggerArmed && pc == triggerPc && bank == triggerBank) {
+            triggerArmed = false;
+            remaining = triggerAfter + 1;
+        }
+        if(remaining && --remaining == 0)
+            frozen = true;
+        TraceRecord *r = &records[written++ & mask];
+        r->cycle = cycle;
+        r->pc = pc;
+        r->bank = bank;
+        return r;
+    }
+    // The clock stamped on records; driven by whoever steps the machine
+    void Advance(uint32_t cycles) {
+        cycle += cycles;
+    }
+
+    // Stops recording after the instruction at bank:pc and the given number
+    // more, so the ring holds what led up to it
+    void SetTrigger(uint8_t bank, uint16_t pc, uint32_t after);
+    void Freeze();
+    bool IsFrozen();
+    size_t GetSize();
+    // Oldest first
+    const TraceRecord &Get(size_t index);
+
+    // Records oldest first after a header, in host byte order
+    void Write(FILE *out);
+    bool Write(const char *path);
+    static bool Read(FILE *in, std::vector<TraceRecord> &out);
+    static bool Read(const char *path, std::vector<TraceRecord> &out);
+};
+
+// One line per record, with the instruction names of cpu
+std::string FormatTraceRecord(const TraceRecord &record, CentralProcessingUnit *cpu);
+// Writes buffer to path when the process exits, including through exit()
+// or a fatal signal such as SIGSEGV or SIGABRT; buffer has to live until then
+void InstallTraceDump(TraceBuffer *buffer, const char *path);
@@ -0,0 +1,372 @@
+#include "Workloads.h"
+#include "MMU.h"
+
+#include <cctype>
+
+static const char *workloadNames[WorkloadCount] = {
+    "alu",
+    "memcpy",
+    "scroll",
+    "sprites",
+    "timer",
+    "halt",
+    "poll",
+    "joypad",
+};
+
+const uint16_t AddrWorkloadCounter = 0xC000;
+const uint16_t AddrWorkloadOam = 0xC100;
+const uint16_t AddrWorkloadDmaRoutine = 0xFF80;
+const uint16_t AddrWorkloadCopySource = 0x4000;
+
+const char *WorkloadName(Workload workload) {
+    return workloadNames[workload];
+}
+
+bool WorkloadFromName(const std::string &name, Workload &workload) {
+    for (int i = 0; i < WorkloadCount; i++) {
+        if (name == workloadNames[i]) {
+            workload = (Workload)i;
+            return true;
+        }
+    }
+    return false;
+}
+
+static uint8_t ioRegister(uint16_t addr) {
+    return addr & 0xff;
+}
+
+static void jumpVector(RomBuilder &rb, uint16_t vector, const std::string &label) {
+    uint16_t position = rb.Here();
+    rb.Org(vector);
+    rb.Jp(CondAlways, label);
+    rb.Org(position);
+}
+
+static void prologue(RomBuilder &rb) {
+    rb.Label("main");
+    rb.Di();
+    rb.LdImm16(RegSP, 0xfffe);
+}
+
+static void enableInterrupts(RomBuilder &rb, uint8_t mask) {
+    rb.LdImm(RegA, mask);
+    rb.LdhIoFromA(ioRegister(AddrRegInterruptEnabled));
+    rb.Alu(AluXor, RegA);
+    rb.LdhIoFromA(ioRegister(AddrRegInterruptFlag));
+    rb.Ei();
+}
+
+// Increments the byte at AddrWorkloadCounter so handlers leave a visible trace
+static void counterHandler(RomBuilder &rb, const std::string &label) {
+    rb.Label(label);
+    rb.Push(RegAF);
+    rb.LdAFromAddr(AddrWorkloadCounter);
+    rb.Inc(RegA);
+    rb.LdAddrFromA(AddrWorkloadCounter);
+    rb.Pop(RegAF);
+    rb.Reti();
+}
+
+// Loop until BC reaches zero, clobbers A
+static void loopWhileBC(RomBuilder &rb, const std::string &label) {
+    rb.Dec16(RegBC);
+    rb.Ld(RegA, RegB);
+    rb.Alu(AluOr, RegC);
+    rb.Jr(CondNZ, label);
+}
+
+static void buildAlu(RomBuilder &rb) {
+    prologue(rb);
+    rb.Label("outer");
+    rb.LdImm(RegB, 0x5a);
+    rb.LdImm(RegC, 0x00);
+    rb.LdImm(RegE, 0x37);
+    rb.LdImm(RegA, 0x13);
+    rb.Label("inner");
+    rb.Alu(AluAdd, RegB);
+    rb.Alu(AluAdc, RegE);
+    rb.Alu(AluSub, RegC);
+    rb.Alu(AluSbc, RegB);
+    rb.AluImm(AluAnd, 0xfb);
+    rb.Alu(AluOr, RegE);
+    rb.Alu(AluXor, RegC);
+    rb.Alu(AluCp, RegB);
+    rb.Cb(CbRl, RegA);
+    rb.Cb(CbSwap, RegE);
+    rb.Inc(RegB);
+    rb.Dec(RegC);
+    rb.Jr(CondNZ, "inner");
+    rb.Jr(CondAlways, "outer");
+}
+
+static void buildMemcpy(RomBuilder &rb) {
+    prologue(rb);
+    rb.Label("loop");
+    rb.LdImm16(RegHL, AddrWorkloadCopySource);
+    rb.LdImm16(RegDE, 0xc000);
+    rb.LdImm16(RegBC, 0x1000);
+    rb.Call("memcpy");
+    rb.LdImm16(RegHL, 0xc000);
+    rb.LdImm16(RegDE, 0xd000);
+    rb.LdImm16(RegBC, 0x0800);
+    rb.Call("memcpy");
+    rb.Jr(CondAlways, "loop");
+
+    rb.Label("memcpy");
+    rb.LdAFromHLInc();
+    rb.LdPairFromA(RegDE);
+    rb.Inc16(RegDE);
+    loopWhileBC(rb, "memcpy");
+    rb.Ret();
+
+    rb.Org(AddrWorkloadCopySource);
+    for (int i = 0; i < 0x1000; i++)
+        rb.Byte((uint8_t)(i * 7 + (i >> 8)));
+}
+
+// Fills tile data with a pattern and the 9800 map with ascending tile indices
+static void fillBackground(RomBuilder &rb) {
+    rb.LdImm16(RegHL, AddrTileData1Start);
+    rb.LdImm16(RegBC, 0x1000);
+    rb.Label("fillTiles");
+    rb.Ld(RegA, RegL);
+    rb.Alu(AluXor, RegH);
+    rb.LdHLIncFromA();
+    loopWhileBC(rb, "fillTiles");
+
+    rb.LdImm16(RegHL, AddrBgMap0Start);
+    rb.LdImm16(RegBC, 0x0400);
+    rb.Label("fillMap");
+    rb.Ld(RegA, RegL);
+    rb.LdHLIncFromA();
+    loopWhileBC(rb, "fillMap");
+}
+
+static void buildScroll(RomBuilder &rb) {
+    prologue(rb);
+    fillBackground(rb);
+    rb.LdImm(RegA, 0x91);
+    rb.LdhIoFromA(ioRegister(AddrRegLcdControl));
+    rb.LdImm(RegE, 0x00);
+
+    // SCX follows LY so every visible line is drawn with a different scroll
+    rb.Label("line");
+    rb.LdhAFromIo(ioRegister(AddrRegLcdY));
+    rb.Ld(RegB, RegA);
+    rb.Alu(AluAdd, RegE);
+    rb.LdhIoFromA(ioRegister(AddrRegScrollX));
+    rb.Ld(RegA, RegB);
+    rb.AluImm(AluCp, 144);
+    rb.Jr(CondNZ, "line");
+
+    rb.Inc(RegE);
+    rb.Ld(RegA, RegE);
+    rb.LdhIoFromA(ioRegister(AddrRegScrollY));
+    rb.Label("vblank");
+    rb.LdhAFromIo(ioRegister(AddrRegLcdY));
+    rb.AluImm(AluCp, 144);
+    rb.Jr(CondZ, "vblank");
+    rb.Jr(CondAlways, "line");
+}
+
+static void buildSprites(RomBuilder &rb) {
+    jumpVector(rb, AddrVectorVBlank, "vblankHandler");
+    prologue(rb);
+    fillBackground(rb);
+
+    // OAM DMA routine has to run from HRAM
+    const uint8_t dmaRoutine[] = {0xe0, 0x46, 0x3e, 0x28, 0x3d, 0x20, 0xfd, 0xc9};
+    rb.LdImm16(RegHL, AddrWorkloadDmaRoutine);
+    for (uint8_t value : dmaRoutine) {
+        rb.LdImm(RegA, value);
+        rb.LdHLIncFromA();
+    }
+
+    rb.LdImm16(RegHL, AddrWorkloadOam);
+    rb.LdImm(RegC, 40);
+    rb.Label("initOam");
+    rb.Ld(RegA, RegC);
+    rb.Alu(AluAdd, RegA);
+    rb.Alu(AluAdd, RegC);
+    rb.AluImm(AluAdd, 16);
+    rb.LdHLIncFromA();
+    rb.Ld(RegA, RegC);
+    rb.Alu(AluAdd, RegA);
+    rb.Alu(AluAdd, RegA);
+    rb.LdHLIncFromA();
+    rb.Ld(RegA, RegC);
+    rb.AluImm(AluAnd, 0x07);
+    rb.LdHLIncFromA();
+    rb.Alu(AluXor, RegA);
+    rb.LdHLIncFromA();
+    rb.Dec(RegC);
+    rb.Jr(CondNZ, "initOam");
+
+    rb.LdImm(RegA, 0x93);
+    rb.LdhIoFromA(ioRegister(AddrRegLcdControl));
+    enableInterrupts(rb, 1 << FlagInterruptVBlank);
+
+    rb.Label("frame");
+    rb.Halt();
+    rb.LdImm16(RegHL, AddrWorkloadOam);
+    rb.LdImm(RegB, 40);
+    rb.Label("moveSprite");
+    rb.Ld(RegA, RegHLIndirect);
+    rb.Inc(RegA);
+    rb.LdHLIncFromA();
+    rb.Ld(RegA, RegHLIndirect);
+    rb.AluImm(AluAdd, 2);
+    rb.LdHLIncFromA();
+    rb.Inc16(RegHL);
+    rb.Inc16(RegHL);
+    rb.Dec(RegB);
+    rb.Jr(CondNZ, "moveSprite");
+    rb.LdImm(RegA, AddrWorkloadOam >> 8);
+    rb.Call(AddrWorkloadDmaRoutine);
+    rb.Jr(CondAlways, "frame");
+
+    counterHandler(rb, "vblankHandler");
+}
+
+static void buildTimerStorm(RomBuilder &rb) {
+    jumpVector(rb, AddrVectorTimer, "timerHandler");
+    prologue(rb);
+
+    // 262144Hz input clock reloading from 0xF0 overflows every 256 cycles
+    rb.LdImm(RegA, 0xf0);
+    rb.LdhIoFromA(ioRegister(AddrRegTMA));
+    rb.LdhIoFromA(ioRegister(AddrRegTIMA));
+    rb.LdImm(RegA, 0x05);
+    rb.LdhIoFromA(ioRegister(AddrRegTAC));
+    enableInterrupts(rb, 1 << FlagInterruptTimer);
+
+    rb.Label("work");
+    rb.Inc(RegB);
+    rb.Ld(RegA, RegB);
+    rb.Alu(AluXor, RegC);
+    rb.Ld(RegC, RegA);
+    rb.Jr(CondAlways, "work");
+
+    counterHandler(rb, "timerHandler");
+}
+
+static void buildHaltIdle(RomBuilder &rb) {
+    jumpVector(rb, AddrVectorVBlank, "vblankHandler");
+    prologue(rb);
+    enableInterrupts(rb, 1 << FlagInterruptVBlank);
+
+    rb.Label("idle");
+    rb.Halt();
+    rb.Inc(RegE);
+    rb.Jr(CondAlways, "idle");
+
+    counterHandler(rb, "vblankHandler");
+}
+
+static void buildLyPoll(RomBuilder &rb) {
+    prologue(rb);
+    rb.LdImm(RegA, 0x91);
+    rb.LdhIoFromA(ioRegister(AddrRegLcdControl));
+
+    rb.Label("frame");
+    rb.LdhAFromIo(ioRegister(AddrRegLcdY));
+    rb.AluImm(AluCp, 144);
+    rb.Jr(CondNZ, "frame");
+    rb.Inc(RegE);
+    rb.Ld(RegA, RegE);
+    rb.LdhIoFromA(ioRegister(AddrRegScrollY));
+    rb.Label("vblank");
+    rb.LdhAFromIo(ioRegister(AddrRegLcdY));
+    rb.AluImm(AluCp, 144);
+    rb.Jr(CondZ, "vblank");
+    rb.Jr(CondAlways, "frame");
+}
+
+// Reads both key groups in the VBlank handler, the way most games do, and
+// turns the screen white while any key is held
+static void buildJoypad(RomBuilder &rb) {
+    jumpVector(rb, AddrVectorVBlank, "vblankHandler");
+    prologue(rb);
+    rb.LdImm(RegA, 0x91);
+    rb.LdhIoFromA(ioRegister(AddrRegLcdControl));
+    enableInterrupts(rb, 1 << FlagInterruptVBlank);
+
+    rb.Label("idle");
+    rb.Halt();
+    rb.Jr(CondAlways, "idle");
+
+    rb.Label("vblankHandler");
+    rb.Push(RegAF);
+    rb.Push(RegBC);
+    rb.LdImm(RegA, 1 << FlagJoypadSelectButtons);
+    rb.LdhIoFromA(ioRegister(AddrRegJoypad));
+    rb.LdhAFromIo(ioRegister(AddrRegJoypad));
+    rb.LdhAFromIo(ioRegister(AddrRegJoypad));
+    rb.AluImm(AluAnd, 0x0f);
+    rb.Cb(CbSwap, RegA);
+    rb.Ld(RegB, RegA);
+    rb.LdImm(RegA, 1 << FlagJoypadSelectDirections);
+    rb.LdhIoFromA(ioRegister(AddrRegJoypad));
+    rb.LdhAFromIo(ioRegister(AddrRegJoypad));
+    rb.LdhAFromIo(ioRegister(AddrRegJoypad));
+    rb.AluImm(AluAnd, 0x0f);
+    rb.Alu(AluOr, RegB);
+    rb.AluImm(AluCp, 0xff);
+    rb.LdImm(RegA, 0xff);
+    rb.Jr(CondZ, "showKeys");
+    rb.LdImm(RegA, 0x00);
+    rb.Label("showKeys");
+    rb.LdhIoFromA(ioRegister(AddrRegBgPalette));
+    rb.LdImm(RegA, 0x30);
+    rb.LdhIoFromA(ioRegister(AddrRegJoypad));
+    rb.Pop(RegBC);
+    rb.Pop(RegAF);
+    rb.Reti();
+}
+
+std::vector<uint8_t> BuildWorkloadRom(Workload workload) {
+    std::string title = std::string("PICOBOY ") + WorkloadName(workload);
+    for (char &c : title)
+        c = toupper(c);
+
+    RomBuilder rb(title);
+    switch (workload) {
+        case WorkloadAlu:
+            buildAlu(rb);
+            break;
+        case WorkloadMemcpy:
+            buildMemcpy(rb);
+            break;
+        case WorkloadScroll:
+            buildScroll(rb);
+            break;
+        case WorkloadSprites:
+            buildSprites(rb);
+            break;
+        case WorkloadTimerStorm:
+            buildTimerStorm(rb);
+            break;
+        case WorkloadHaltIdle:
+            buildHaltIdle(rb);
+            break;
+        case WorkloadLyPoll:
+            buildLyPoll(rb);
+            break;
+        case WorkloadJoypad:
+            buildJoypad(rb);
+            break;
+        default:
+            break;
+    }
+    return rb.Build();
+}
+
+// Cartridge that just spins at its entry point, for harnesses that drive the CPU directly
+std::vector<uint8_t> BuildBlankRom() {
+    RomBuilder rb("PICOBOY");
+    rb.Label("main");
+    rb.Jr(CondAlways, "main");
+    return rb.Build();
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "RomBuilder.h"
+
+// Deterministic synthetic ROMs used by benchmarks and tests in place of
+// commercial cartridges.
+enum Workload {
+    WorkloadAlu,        // register-only arithmetic and logic loop
+    WorkloadMemcpy,     // LD A,(HL+) / LD (DE),A block copies ROM to WRAM and WRAM to WRAM
+    WorkloadScroll,     // per-scanline SCX raster effect plus SCY scrolling every frame
+    WorkloadSprites,    // 40 moving sprites refreshed through OAM DMA on every VBlank
+    WorkloadTimerStorm, // timer interrupt every 256 cycles on top of a busy main loop
+    WorkloadHaltIdle,   // HALT until VBlank, the way most commercial games idle
+    WorkloadLyPoll,     // busy-wait on LY for VBlank instead of HALT
+    WorkloadJoypad,     // HALT loop whose VBlank handler reads the joypad and shows it in BGP
+    WorkloadCount
+};
+
+const char *WorkloadName(Workload workload);
+bool WorkloadFromName(const std::string &name, Workload &workload);
+std::vector<uint8_t> BuildWorkloadRom(Workload workload);
+std::vector<uint8_t> BuildBlankRom();
@@ -1,14 +1,16 @@
 #pragma once
 
 #include <vector>
+#include <cstdint>
+#include <cstring>
 
 const uint32_t CyclesCpu = 4194304;
-const uint32_t CyclesFrame = 70368;   
+const uint32_t CyclesFrame = 70224;     // 154 lines of 456 cycles, 59.73 Hz
 const uint16_t Cycles256Hz = CyclesCpu / 256;
 const uint16_t Cycles128Hz = CyclesCpu / 128;
 const uint32_t Cycles64Hz = CyclesCpu / 64;
 
-const int64_t OneFrameDurationNSec = 1000000000 / (CyclesCpu / CyclesFrame);
+const int64_t OneFrameDurationNSec = (int64_t)1000000000 * CyclesFrame / CyclesCpu;
 
 
 
@@ -1,3 +1,8 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
 enum Keys {
     None,
     Right,
@@ -15,9 +20,31 @@ enum Type {
     Direction
 };
 
+// Keys held on the joypad, one bit per key from Right (bit 0) to Start
+// (bit 7), so the low nibble is the direction group and the high nibble the
+// button group. The frontend may set keys from any thread; the emulator
+// picks up a change between two instructions by comparing the sequence.
 class Input {
 public:
-    void ButtonPressed(Keys button);
-    void ButtonReleased(Keys button);
+    Input() : pressed(0), sequence(0) {}
+
+    void ButtonPressed(Keys button) {
+        if(button == None)
+            return;
+        pressed.fetch_or(1 << (button - Right), std::memory_order_relaxed);
+        sequence.fetch_add(1, std::memory_order_release);
+    }
+
+    void ButtonReleased(Keys button) {
+        if(button == None)
+            return;
+        pressed.fetch_and(~(1 << (button - Right)), std::memory_order_relaxed);
+        sequence.fetch_add(1, std::memory_order_release);
+    }
+
+    uint8_t GetPressed() { return pressed.load(std::memory_order_relaxed); }
+    uint32_t GetSequence() { return sequence.load(std::memory_order_acquire); }
 private:
-};
\ No newline at end of file
+    std::atomic<uint8_t> pressed;
+    std::atomic<uint32_t> sequence;
+};
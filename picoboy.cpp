@@ -5,22 +5,205 @@
 #include <SDL_timer.h>
 
 #include "./gboy/GBoy.h"
+#include "./gboy/Workloads.h"
+#include "./gboy/FramePacer.h"
+#include "./gboy/Instrument.h"
+#include "./gboy/Trace.h"
+#include "./gboy/Debugger.h"
+#include "./gboy/GdbStub.h"
+#include "./gboy/Log.h"
 
-int main(int argc, char *argv[]){
+#ifdef PICOBOY_AOT
+extern const AotImage AotLinkedImage;
+#endif
+
+// Pulls queued samples for SDL; on an underrun the last sample is held to avoid a click
+static void audioCallback(void *userdata, Uint8 *stream, int len) {
+    AudioRingBuffer *ring = (AudioRingBuffer*)userdata;
+    int16_t *out = (int16_t*)stream;
+    size_t frames = len / (2 * sizeof(int16_t));
+    size_t got = ring->Read(out, frames);
+    for(size_t i = got; i < frames; i++) {
+        out[i * 2] = got ? out[(got - 1) * 2] : 0;
+        out[i * 2 + 1] = got ? out[(got - 1) * 2 + 1] : 0;
+    }
+}
+
+static Keys keyFor(SDL_Keycode key) {
+    switch(key) {
+        case SDLK_RIGHT: return Right;
+        case SDLK_LEFT: return Left;
+        case SDLK_UP: return Up;
+        case SDLK_DOWN: return Down;
+        case SDLK_x: return A;
+        case SDLK_z: return B;
+        case SDLK_BACKSPACE: case SDLK_RSHIFT: return Select;
+        case SDLK_RETURN: return Start;
+        default: return None;
+    }
+}
+
+// Drains every pending event, so a key is never held back behind another
+// one for a frame; Tab toggles fast-forward. Returns false once the window
+// is closed.
+static bool pollEvents(Input *input, bool &fastForward) {
     SDL_Event event;
+    bool running = true;
+    while (SDL_PollEvent(&event)) {
+        if (event.type == SDL_QUIT)
+            running = false;
+        else if (event.type == SDL_KEYDOWN && event.key.keysym.sym == SDLK_TAB && !event.key.repeat)
+            fastForward = !fastForward;
+        else if (event.type == SDL_KEYDOWN && !event.key.repeat)
+            input->ButtonPressed(keyFor(event.key.keysym.sym));
+        else if (event.type == SDL_KEYUP)
+            input->ButtonReleased(keyFor(event.key.keysym.sym));
+    }
+    return running;
+}
+
+int main(int argc, char *argv[]){
     SDL_Renderer *renderer;
     SDL_Window *window;
     const uint8_t scale = 2;
 
     std::string romPath = "../roms/tetris.gb";
-    if(argc >= 2)
-        romPath = argv[1];
-    GBoy *gb = new GBoy(romPath);
+    Workload workload = WorkloadCount;
+    PacingMode pacing = PacingCount; // audio when there is a device, clock otherwise
+    uint32_t turboSpeed = PacingSpeedUnlimited;
+    std::string countersPath;
+    std::string profilePath;
+    std::string tracePath;
+    uint32_t traceRecords = TraceDefaultRecords;
+    bool traceTrigger = false;
+    uint8_t triggerBank = 0;
+    uint16_t triggerPc = 0;
+    bool fastForward = false;
+    Debugger debugger;
+    bool debugging = false;
+    std::string gdbAddress;
+    for(int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if(arg == "--workload" && i + 1 < argc) {
+            if(!WorkloadFromName(argv[++i], workload)) {
+                printf("Unknown workload: %s\n", argv[i]);
+                return 1;
+            }
+        } else if(arg == "--pacing" && i + 1 < argc) {
+            if(!PacingModeFromName(argv[++i], pacing)) {
+                printf("Unknown pacing mode: %s (off, clock or audio)\n", argv[i]);
+                return 1;
+            }
+        } else if(arg == "--counters" && i + 1 < argc) {
+            // Written at exit and on SIGUSR1; empty unless built with PICOBOY_INSTRUMENT
+            countersPath = argv[++i];
+            InstallInstrumentSignal();
+        } else if(arg == "--profile" && i + 1 < argc) {
+            profilePath = argv[++i];
+        } else if(arg == "--trace" && i + 1 < argc) {
+            // The last instructions run, written at exit or on a crash
+            tracePath = argv[++i];
+        } else if(arg == "--trace-records" && i + 1 < argc) {
+            traceRecords = std::stoul(argv[++i]);
+        } else if(arg == "--trace-at" && i + 1 < argc) {
+            // bank:address or address; tracing stops shortly after it runs
+            unsigned bank = 0, pc = 0;
+            std::string at = argv[++i];
+            if(sscanf(at.c_str(), "%x:%x", &bank, &pc) != 2 && sscanf(at.c_str(), "%x", &pc) != 1) {
+                printf("Bad trace trigger: %s (bank:address in hex)\n", at.c_str());
+                return 1;
+            }
+            traceTrigger = true;
+            triggerBank = bank;
+            triggerPc = pc;
+        } else if(arg == "--break" && i + 1 < argc) {
+            // Hits are printed with the registers, then emulation goes on
+            debugger.AddBreakpoint(std::stoul(argv[++i], nullptr, 16));
+            debugging = true;
+        } else if(arg == "--watch" && i + 1 < argc) {
+            // start[-end][:r|w|rw], in hex; rw when no kind is given
+            unsigned start = 0, end = 0;
+            char kind[4] = "rw";
+            std::string watch = argv[++i];
+            int fields = sscanf(watch.c_str(), "%x-%x:%3s", &start, &end, kind);
+            if(fields < 2) {
+                fields = sscanf(watch.c_str(), "%x:%3s", &start, kind);
+                end = start;
+            }
+            std::string kinds = kind;
+            if(fields < 1 || (kinds != "r" && kinds != "w" && kinds != "rw")) {
+                printf("Bad watchpoint: %s (start[-end][:r|w|rw] in hex)\n", watch.c_str());
+                return 1;
+            }
+            debugger.AddWatchpoint(start, end, kinds == "r" ? WatchRead : kinds == "w" ? WatchWrite : WatchAccess);
+            debugging = true;
+        } else if(arg == "--gdb" && i + 1 < argc) {
+            // port, localhost:port or unix:path; waits for gdb before starting
+            gdbAddress = argv[++i];
+            debugging = true;
+        } else if(arg == "--log" && i + 1 < argc) {
+            LogLevel level;
+            if(!LogLevelFromName(argv[++i], level)) {
+                printf("Unknown log level: %s (debug, info, warning, error or off)\n", argv[i]);
+                return 1;
+            }
+            SetLogLevel(level);
+        } else if(arg == "--turbo" && i + 1 < argc) {
+            // Speed of fast-forward, which also starts enabled
+            std::string speed = argv[++i];
+            turboSpeed = speed == "max" ? PacingSpeedUnlimited : std::stoul(speed);
+            fastForward = true;
+        } else
+            romPath = arg;
+    }
+
+    GBoy *gb;
+    if(workload != WorkloadCount)
+        gb = new GBoy(new Cartridge(BuildWorkloadRom(workload)));
+    else
+        gb = new GBoy(romPath);
+#ifdef PICOBOY_AOT
+    if(gb->SetAotImage(&AotLinkedImage))
+        gb->SetCpuEngine(EngineAot);
+#endif
+    Profiler profiler;
+    if(!profilePath.empty())
+        gb->SetProfiler(&profiler);
+    if(!tracePath.empty()) {
+        // Outlives main, as the trace is written from an exit handler
+        TraceBuffer *tracer = new TraceBuffer(traceRecords);
+        if(traceTrigger)
+            tracer->SetTrigger(triggerBank, triggerPc, 64);
+        gb->SetTracer(tracer);
+        InstallTraceDump(tracer, tracePath.c_str());
+    }
 
-    if (SDL_Init(SDL_INIT_VIDEO) != 0) {
+    if (SDL_Init(SDL_INIT_VIDEO | SDL_INIT_AUDIO) != 0) {
         printf("error initializing SDL: %s\n", SDL_GetError());
     }
 
+    SDL_AudioSpec want = {}, have;
+    want.freq = AudioSampleRate;
+    want.format = AUDIO_S16SYS;
+    want.channels = 2;
+    want.samples = 1024;
+    want.callback = audioCallback;
+    want.userdata = &gb->GetAPU()->GetOutput();
+    SDL_AudioDeviceID audioDevice = SDL_OpenAudioDevice(nullptr, 0, &want, &have, 0);
+    if (audioDevice == 0)
+        printf("error opening audio: %s\n", SDL_GetError());
+    else
+        SDL_PauseAudioDevice(audioDevice, 0);
+
+    if(pacing == PacingCount || (pacing == PacingAudio && audioDevice == 0))
+        pacing = audioDevice ? PacingAudio : PacingClock;
+    FramePacer pacer(pacing, AudioSampleRate);
+    SDL_DisplayMode display;
+    if (SDL_GetCurrentDisplayMode(0, &display) == 0 && display.refresh_rate > 0)
+        pacer.SetPresentInterval(1000000000 / display.refresh_rate);
+    AudioRingBuffer &audioQueue = gb->GetAPU()->GetOutput();
+    uint32_t frameCycles = 0;
+
     SDL_CreateWindowAndRenderer(160*scale, 144*scale, 0, &window, &renderer);
     SDL_SetWindowTitle(window, "PicoBoy");
 
@@ -31,38 +214,94 @@ int main(int argc, char *argv[]){
         160, 144
     );
 
+    if(debugging)
+        gb->SetDebugger(&debugger);
+    GdbStub gdb(gb, &debugger);
+    if(!gdbAddress.empty()) {
+        if(!gdb.Listen(gdbAddress))
+            return 1;
+        printf("Waiting for gdb on %s\n", gdbAddress.c_str());
+        gdb.Accept();
+    }
+
     bool quit = false;
     while (!quit) {
-        gb->ExecuteStep();
+        frameCycles += gb->ExecuteStep();
+        if (debugging && debugger.IsStopped()) {
+            if (gdb.IsConnected()) {
+                // gdb says when to go on; the window still takes events meanwhile
+                gdb.Poll(10);
+                quit = !pollEvents(gb->GetInput(), fastForward);
+                continue;
+            }
+            const DebugStop &stop = debugger.GetStop();
+            const char *reasons[] = {"", "Breakpoint", "Read watchpoint", "Write watchpoint", "Stopped", "Step"};
+            if (stop.reason == StopBreakpoint)
+                printf("%s at %04x\n", reasons[stop.reason], stop.pc);
+            else
+                printf("%s on %04x = %02x, at %04x\n", reasons[stop.reason], stop.addr, stop.value, stop.pc);
+            gb->GetCPU()->Print();
+            debugger.Resume();
+        }
 
         if(gb->GetFrameBufferUpdatedFlag()) {
-            SDL_PollEvent(&event);
-            if (event.type == SDL_QUIT)
-                quit = true;
-
-            SDL_RenderClear(renderer);
-            void* pixels_ptr;
-            int pitch;
-            SDL_LockTexture(gb_screen_texture, nullptr, &pixels_ptr, &pitch);
-
-            uint32_t* pixels = static_cast<uint32_t*>(pixels_ptr);
-            for (int x = 0; x < 160; ++x) {
-                for (int y = 0; y < 144; ++y) {
-                    uint8_t red, green, blue;
-                    gb->GetFrameBufferColor(red, green, blue, x, y);
-                    pixels[160 * y + x] = ((uint32_t)red << 16) | ((uint32_t)green << 8) | ((uint32_t)blue << 0);
+            gb->GetAPU()->Flush();
+            gb->SetFrameBufferUpdatedFlag(false);
+
+            // While fast-forwarding most frames are not drawn at all
+            bool shown = gb->GetFrameBufferRenderedFlag();
+            if (shown) {
+                SDL_RenderClear(renderer);
+                void* pixels_ptr;
+                int pitch;
+                SDL_LockTexture(gb_screen_texture, nullptr, &pixels_ptr, &pitch);
+
+                uint32_t* pixels = static_cast<uint32_t*>(pixels_ptr);
+                for (int x = 0; x < 160; ++x) {
+                    for (int y = 0; y < 144; ++y) {
+                        uint8_t red, green, blue;
+                        gb->GetFrameBufferColor(red, green, blue, x, y);
+                        pixels[160 * y + x] = ((uint32_t)red << 16) | ((uint32_t)green << 8) | ((uint32_t)blue << 0);
+                    }
                 }
+
+                SDL_UnlockTexture(gb_screen_texture);
+
+                SDL_Rect dest_rect = { 0, 0, 160*scale, 144*scale };
+                SDL_RenderCopy(renderer, gb_screen_texture, nullptr, &dest_rect);
             }
-            gb->SetFrameBufferUpdatedFlag(false);
 
-            SDL_UnlockTexture(gb_screen_texture);
+            // Presenting right after the wait keeps the frame interval steady
+            // however long the frame took to emulate
+            FramePacer::Wait(pacer.FrameDone(FramePacer::Now(), frameCycles, audioQueue.Available(), shown));
+            frameCycles = 0;
+            if (shown)
+                SDL_RenderPresent(renderer);
 
-            SDL_Rect dest_rect = { 0, 0, 160*scale, 144*scale };
-            SDL_RenderCopy(renderer, gb_screen_texture, nullptr, &dest_rect);
-            SDL_RenderPresent(renderer);
+            // Input is read after the wait rather than before it, so a key
+            // pressed during the wait already shows in the next frame
+            quit = !pollEvents(gb->GetInput(), fastForward);
+            LogFlush();
+            if (!gdbAddress.empty())
+                gdb.Poll(0);
+            if (!countersPath.empty() && InstrumentDumpRequested())
+                WriteInstrumentJson(countersPath.c_str(), gb->GetCPU());
+            pacer.SetSpeed(fastForward ? turboSpeed : 1);
+            gb->SetFrameOutput(pacer.WantsFrame(FramePacer::Now()));
         }
     }
 
+    if (!countersPath.empty())
+        WriteInstrumentJson(countersPath.c_str(), gb->GetCPU());
+    if (!profilePath.empty())
+        profiler.WriteFolded(profilePath.c_str());
+
+    PacingStats stats = pacer.GetStats();
+    printf("Pacing %s: %llu frames, %.3f ms mean, %.3f ms jitter, %llu late\n", PacingModeName(pacing),
+        (unsigned long long)stats.frames, stats.meanNSec / 1e6, stats.jitterNSec / 1e6, (unsigned long long)stats.late);
+
+    if (audioDevice != 0)
+        SDL_CloseAudioDevice(audioDevice);
     SDL_DestroyRenderer(renderer);
     SDL_DestroyWindow(window);
     SDL_Quit();
@@ -0,0 +1,75 @@
+#include "Machine.h"
+
+#include <cstdio>
+
+Machine::Machine(const std::vector<uint8_t> &rom) {
+    cart = new Cartridge(rom);
+    gb = new GBoy(cart);
+    gb->GetMMU()->SetSerialEcho(false);
+    cycles = 0;
+    frames = 0;
+}
+
+Machine::~Machine() {
+    delete gb;
+    delete cart;
+}
+
+void Machine::RunFrame() {
+    while (!gb->GetFrameBufferUpdatedFlag())
+        cycles += gb->ExecuteStep();
+    gb->SetFrameBufferUpdatedFlag(false);
+    frames++;
+}
+
+void Machine::RunFrames(uint32_t count) {
+    for (uint32_t i = 0; i < count; i++)
+        RunFrame();
+}
+
+std::string DiffMachines(Machine &found, Machine &expected) {
+    char line[128];
+    std::string report;
+    if (found.cycles != expected.cycles) {
+        snprintf(line, sizeof(line), "    cycles %llu, expected %llu\n", (unsigned long long)found.cycles,
+            (unsigned long long)expected.cycles);
+        report += line;
+    }
+
+    CentralProcessingUnit *a = found.gb->GetCPU(), *b = expected.gb->GetCPU();
+    const char *names[] = {"af", "bc", "de", "hl", "sp", "pc"};
+    const uint16_t got[] = {(uint16_t)((a->accumulator << 8) | a->GetFlags()), a->bc, a->de, a->hl, a->stackPointer, a->programCounter};
+    const uint16_t want[] = {(uint16_t)((b->accumulator << 8) | b->GetFlags()), b->bc, b->de, b->hl, b->stackPointer, b->programCounter};
+    for (int i = 0; i < 6; i++) {
+        if (got[i] != want[i]) {
+            snprintf(line, sizeof(line), "    %s %04x, expected %04x\n", names[i], got[i], want[i]);
+            report += line;
+        }
+    }
+    if (a->interruptMasterFlag != b->interruptMasterFlag || a->isHalted != b->isHalted)
+        report += "    IME or HALT state differs\n";
+
+    MemoryManagementUnit *ma = found.gb->GetMMU(), *mb = expected.gb->GetMMU();
+    for (uint32_t addr = 0x8000; addr <= 0xFFFF; addr++) {
+        uint8_t va = ma->Read(addr, true), vb = mb->Read(addr, true);
+        if (va != vb) {
+            snprintf(line, sizeof(line), "    [%04x] %02x, expected %02x\n", addr, va, vb);
+            report += line;
+            break;
+        }
+    }
+
+    if (found.gb->GetFrameBufferRenderedFlag() && expected.gb->GetFrameBufferRenderedFlag()) {
+        for (int i = 0; i < 160 * 144; i++) {
+            uint8_t ra, ga, ba, rb, gb, bb;
+            found.gb->GetFrameBufferColor(ra, ga, ba, i % 160, i / 160);
+            expected.gb->GetFrameBufferColor(rb, gb, bb, i % 160, i / 160);
+            if (ra != rb || ga != gb || ba != bb) {
+                snprintf(line, sizeof(line), "    pixel %d,%d differs\n", i % 160, i / 160);
+                report += line;
+                break;
+            }
+        }
+    }
+    return report;
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "../gboy/GBoy.h"
+
+// A whole machine built from a ROM image and run a frame at a time, for the
+// tests that run two of them side by side or drive one through frames.
+struct Machine {
+    Cartridge *cart;
+    GBoy *gb;
+    uint64_t cycles;
+    uint32_t frames;
+
+    Machine(const std::vector<uint8_t> &rom);
+    ~Machine();
+
+    void RunFrame();
+    void RunFrames(uint32_t count);
+};
+
+// Returns an empty string when both machines agree on cycles, CPU state,
+// memory from 0x8000 up and the picture, when both drew one; otherwise a
+// line per difference, indented by four spaces
+std::string DiffMachines(Machine &found, Machine &expected);
@@ -0,0 +1,155 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+// Compact binary form of the opcode test vectors, produced at build time by
+// vectorgen from the JSON sources so the runner never parses JSON.
+//
+// File layout (little-endian): magic, vector count, then for every vector
+//   name length (u8) + name, code length (u8) + code bytes,
+//   preload state, check state
+// where a state is
+//   fields (u8), a b c d e h l f (u8 each), sp (u16), pc (u16), cycles (u8),
+//   memory entry count (u16) + entries of addr (u16), count (u16), value (u8)
+
+const uint32_t OpcodeVectorMagic = 0x31564250; // "PBV1"
+
+enum VectorField {
+    VectorRegisters = 1 << 0,
+    VectorFlags = 1 << 1,
+    VectorStackPointer = 1 << 2,
+    VectorProgramCounter = 1 << 3,
+    VectorCycles = 1 << 4,
+};
+
+struct VectorMemory {
+    uint16_t addr;
+    uint16_t count;
+    uint8_t value;
+};
+
+struct VectorState {
+    uint8_t fields;
+    uint8_t a, b, c, d, e, h, l, f;
+    uint16_t sp, pc;
+    uint8_t cycles;
+    std::vector<VectorMemory> memory;
+};
+
+struct OpcodeVector {
+    std::string name;
+    std::vector<uint8_t> code;
+    VectorState preload;
+    VectorState check;
+};
+
+class VectorWriter {
+private:
+    FILE *file;
+public:
+    VectorWriter(FILE *f) : file(f) {}
+    void U8(uint8_t v) { fputc(v, file); }
+    void U16(uint16_t v) { U8(v & 0xff); U8(v >> 8); }
+    void U32(uint32_t v) { U16(v & 0xffff); U16(v >> 16); }
+};
+
+class VectorReader {
+private:
+    const std::vector<uint8_t> &data;
+    size_t position;
+public:
+    bool overrun;
+    VectorReader(const std::vector<uint8_t> &d) : data(d), position(0), overrun(false) {}
+    uint8_t U8() {
+        if (position >= data.size()) {
+            overrun = true;
+            return 0;
+        }
+        return data[position++];
+    }
+    uint16_t U16() { uint16_t lo = U8(); return lo | (U8() << 8); }
+    uint32_t U32() { uint32_t lo = U16(); return lo | ((uint32_t)U16() << 16); }
+};
+
+inline void writeVectorState(VectorWriter &w, const VectorState &s) {
+    w.U8(s.fields);
+    w.U8(s.a); w.U8(s.b); w.U8(s.c); w.U8(s.d);
+    w.U8(s.e); w.U8(s.h); w.U8(s.l); w.U8(s.f);
+    w.U16(s.sp);
+    w.U16(s.pc);
+    w.U8(s.cycles);
+    w.U16(s.memory.size());
+    for (const VectorMemory &m : s.memory) {
+        w.U16(m.addr);
+        w.U16(m.count);
+        w.U8(m.value);
+    }
+}
+
+inline void readVectorState(VectorReader &r, VectorState &s) {
+    s.fields = r.U8();
+    s.a = r.U8(); s.b = r.U8(); s.c = r.U8(); s.d = r.U8();
+    s.e = r.U8(); s.h = r.U8(); s.l = r.U8(); s.f = r.U8();
+    s.sp = r.U16();
+    s.pc = r.U16();
+    s.cycles = r.U8();
+    s.memory.resize(r.U16());
+    for (VectorMemory &m : s.memory) {
+        m.addr = r.U16();
+        m.count = r.U16();
+        m.value = r.U8();
+    }
+}
+
+inline bool WriteOpcodeVectors(const std::string &path, const std::vector<OpcodeVector> &vectors) {
+    FILE *file = fopen(path.c_str(), "wb");
+    if (!file)
+        return false;
+
+    VectorWriter w(file);
+    w.U32(OpcodeVectorMagic);
+    w.U32(vectors.size());
+    for (const OpcodeVector &v : vectors) {
+        w.U8(v.name.size() > 255 ? 255 : v.name.size());
+        fwrite(v.name.data(), 1, v.name.size() > 255 ? 255 : v.name.size(), file);
+        w.U8(v.code.size());
+        for (uint8_t byte : v.code)
+            w.U8(byte);
+        writeVectorState(w, v.preload);
+        writeVectorState(w, v.check);
+    }
+    return fclose(file) == 0;
+}
+
+inline bool ReadOpcodeVectors(const std::string &path, std::vector<OpcodeVector> &vectors) {
+    FILE *file = fopen(path.c_str(), "rb");
+    if (!file)
+        return false;
+
+    std::vector<uint8_t> data;
+    uint8_t chunk[65536];
+    size_t n;
+    while ((n = fread(chunk, 1, sizeof(chunk), file)) > 0)
+        data.insert(data.end(), chunk, chunk + n);
+    fclose(file);
+
+    VectorReader r(data);
+    if (r.U32() != OpcodeVectorMagic)
+        return false;
+
+    vectors.resize(r.U32());
+    for (OpcodeVector &v : vectors) {
+        v.name.resize(r.U8());
+        for (char &ch : v.name)
+            ch = r.U8();
+        v.code.resize(r.U8());
+        for (uint8_t &byte : v.code)
+            byte = r.U8();
+        readVectorState(r, v.preload);
+        readVectorState(r, v.check);
+    }
+    return !r.overrun;
+}
@@ -0,0 +1,486 @@
+#include "Reference.h"
+
+int ReferenceMemory::Find(uint16_t a) {
+    for (int i = 0; i < count; i++)
+        if (addr[i] == a)
+            return i;
+    return -1;
+}
+
+void ReferenceMemory::Set(uint16_t a, uint8_t v) {
+    int i = Find(a);
+    if (i < 0) {
+        if (count == MaxEntries) {
+            outOfBounds = true;
+            return;
+        }
+        i = count++;
+        addr[i] = a;
+    }
+    value[i] = v;
+}
+
+uint8_t ReferenceMemory::Read(uint16_t a) {
+    int i = Find(a);
+    if (i < 0) {
+        outOfBounds = true;
+        return 0xff;
+    }
+    return value[i];
+}
+
+void ReferenceMemory::Write(uint16_t a, uint8_t v) {
+    int i = Find(a);
+    if (i < 0) {
+        outOfBounds = true;
+        return;
+    }
+    value[i] = v;
+}
+
+uint8_t ReferenceCpu::fetch() {
+    return mem.Read(s.pc++);
+}
+
+uint16_t ReferenceCpu::fetch16() {
+    uint16_t lo = fetch();
+    return lo | (fetch() << 8);
+}
+
+uint8_t ReferenceCpu::readReg(int index) {
+    switch (index) {
+        case 0: return s.b;
+        case 1: return s.c;
+        case 2: return s.d;
+        case 3: return s.e;
+        case 4: return s.h;
+        case 5: return s.l;
+        case 6: return mem.Read((s.h << 8) | s.l);
+        default: return s.a;
+    }
+}
+
+void ReferenceCpu::writeReg(int index, uint8_t value) {
+    switch (index) {
+        case 0: s.b = value; break;
+        case 1: s.c = value; break;
+        case 2: s.d = value; break;
+        case 3: s.e = value; break;
+        case 4: s.h = value; break;
+        case 5: s.l = value; break;
+        case 6: mem.Write((s.h << 8) | s.l, value); break;
+        default: s.a = value; break;
+    }
+}
+
+// BC, DE, HL, SP
+uint16_t ReferenceCpu::readPair(int index) {
+    switch (index) {
+        case 0: return (s.b << 8) | s.c;
+        case 1: return (s.d << 8) | s.e;
+        case 2: return (s.h << 8) | s.l;
+        default: return s.sp;
+    }
+}
+
+void ReferenceCpu::writePair(int index, uint16_t value) {
+    switch (index) {
+        case 0: s.b = value >> 8; s.c = value & 0xff; break;
+        case 1: s.d = value >> 8; s.e = value & 0xff; break;
+        case 2: s.h = value >> 8; s.l = value & 0xff; break;
+        default: s.sp = value; break;
+    }
+}
+
+// BC, DE, HL, AF
+uint16_t ReferenceCpu::readPair2(int index) {
+    if (index == 3)
+        return (s.a << 8) | s.f;
+    return readPair(index);
+}
+
+void ReferenceCpu::writePair2(int index, uint16_t value) {
+    if (index == 3) {
+        s.a = value >> 8;
+        s.f = value & 0xf0;
+    } else
+        writePair(index, value);
+}
+
+// NZ, Z, NC, C
+bool ReferenceCpu::condition(int index) {
+    switch (index) {
+        case 0: return !flag(RefFlagZero);
+        case 1: return flag(RefFlagZero);
+        case 2: return !flag(RefFlagCarry);
+        default: return flag(RefFlagCarry);
+    }
+}
+
+void ReferenceCpu::push(uint16_t value) {
+    mem.Write(--s.sp, value >> 8);
+    mem.Write(--s.sp, value & 0xff);
+}
+
+uint16_t ReferenceCpu::pop() {
+    uint16_t lo = mem.Read(s.sp++);
+    return lo | (mem.Read(s.sp++) << 8);
+}
+
+void ReferenceCpu::setFlag(uint8_t f, bool value) {
+    s.f = value ? (s.f | f) : (s.f & ~f);
+}
+
+bool ReferenceCpu::flag(uint8_t f) {
+    return (s.f & f) != 0;
+}
+
+// ADD ADC SUB SBC AND XOR OR CP
+void ReferenceCpu::alu(int op, uint8_t v) {
+    int carry = flag(RefFlagCarry) ? 1 : 0;
+    int a = s.a;
+    int result;
+    switch (op) {
+        case 0:
+        case 1:
+            if (op == 0)
+                carry = 0;
+            result = a + v + carry;
+            s.f = 0;
+            setFlag(RefFlagHalfCarry, (a & 0xf) + (v & 0xf) + carry > 0xf);
+            setFlag(RefFlagCarry, result > 0xff);
+            break;
+        case 2:
+        case 3:
+        case 7:
+            if (op != 3)
+                carry = 0;
+            result = a - v - carry;
+            s.f = RefFlagSubtract;
+            setFlag(RefFlagHalfCarry, (a & 0xf) < (v & 0xf) + carry);
+            setFlag(RefFlagCarry, result < 0);
+            break;
+        case 4:
+            result = a & v;
+            s.f = RefFlagHalfCarry;
+            break;
+        case 5:
+            result = a ^ v;
+            s.f = 0;
+            break;
+        default:
+            result = a | v;
+            s.f = 0;
+            break;
+    }
+    setFlag(RefFlagZero, (result & 0xff) == 0);
+    if (op != 7)
+        s.a = result & 0xff;
+}
+
+// RLC RRC RL RR SLA SRA SWAP SRL
+uint8_t ReferenceCpu::rotate(int op, uint8_t v) {
+    int carryIn = flag(RefFlagCarry) ? 1 : 0;
+    bool carryOut = false;
+    uint8_t result = 0;
+    switch (op) {
+        case 0: carryOut = v & 0x80; result = (v << 1) | (v >> 7); break;
+        case 1: carryOut = v & 0x01; result = (v >> 1) | (v << 7); break;
+        case 2: carryOut = v & 0x80; result = (v << 1) | carryIn; break;
+        case 3: carryOut = v & 0x01; result = (v >> 1) | (carryIn << 7); break;
+        case 4: carryOut = v & 0x80; result = v << 1; break;
+        case 5: carryOut = v & 0x01; result = (v >> 1) | (v & 0x80); break;
+        case 6: carryOut = false; result = (v << 4) | (v >> 4); break;
+        default: carryOut = v & 0x01; result = v >> 1; break;
+    }
+    s.f = 0;
+    setFlag(RefFlagZero, result == 0);
+    setFlag(RefFlagCarry, carryOut);
+    return result;
+}
+
+// SP + signed offset with the flags of ADD SP,e / LD HL,SP+e
+uint16_t ReferenceCpu::addSigned(uint16_t base, uint8_t offset) {
+    uint16_t result = base + (int8_t)offset;
+    s.f = 0;
+    setFlag(RefFlagHalfCarry, (base & 0xf) + (offset & 0xf) > 0xf);
+    setFlag(RefFlagCarry, (base & 0xff) + offset > 0xff);
+    return result;
+}
+
+int ReferenceCpu::executeExtended() {
+    uint8_t op = fetch();
+    int x = op >> 6, y = (op >> 3) & 7, z = op & 7;
+    bool indirect = (z == 6);
+    uint8_t v = readReg(z);
+
+    switch (x) {
+        case 0:
+            writeReg(z, rotate(y, v));
+            return indirect ? 16 : 8;
+        case 1:
+            setFlag(RefFlagZero, !(v & (1 << y)));
+            setFlag(RefFlagSubtract, false);
+            setFlag(RefFlagHalfCarry, true);
+            return indirect ? 12 : 8;
+        case 2:
+            writeReg(z, v & ~(1 << y));
+            return indirect ? 16 : 8;
+        default:
+            writeReg(z, v | (1 << y));
+            return indirect ? 16 : 8;
+    }
+}
+
+int ReferenceCpu::Step() {
+    if (s.imePending) {
+        s.ime = true;
+        s.imePending = false;
+    }
+    uint8_t op = fetch();
+    int x = op >> 6, y = (op >> 3) & 7, z = op & 7, p = y >> 1, q = y & 1;
+
+    if (x == 0) {
+        switch (z) {
+            case 0:
+                if (y == 0)
+                    return 4;
+                if (y == 1) {
+                    uint16_t addr = fetch16();
+                    mem.Write(addr, s.sp & 0xff);
+                    mem.Write(addr + 1, s.sp >> 8);
+                    return 20;
+                }
+                if (y == 2)
+                    return -1; // STOP
+                {
+                    int8_t offset = (int8_t)fetch();
+                    if (y == 3 || condition(y - 4)) {
+                        s.pc += offset;
+                        return 12;
+                    }
+                    return 8;
+                }
+            case 1:
+                if (q == 0) {
+                    writePair(p, fetch16());
+                    return 12;
+                } else {
+                    uint32_t hl = readPair(2), rr = readPair(p);
+                    setFlag(RefFlagSubtract, false);
+                    setFlag(RefFlagHalfCarry, (hl & 0xfff) + (rr & 0xfff) > 0xfff);
+                    setFlag(RefFlagCarry, hl + rr > 0xffff);
+                    writePair(2, hl + rr);
+                    return 8;
+                }
+            case 2: {
+                uint16_t addr = (p == 0) ? readPair(0) : (p == 1) ? readPair(1) : readPair(2);
+                if (q == 0)
+                    mem.Write(addr, s.a);
+                else
+                    s.a = mem.Read(addr);
+                if (p == 2)
+                    writePair(2, addr + 1);
+                else if (p == 3)
+                    writePair(2, addr - 1);
+                return 8;
+            }
+            case 3:
+                writePair(p, readPair(p) + (q == 0 ? 1 : -1));
+                return 8;
+            case 4: {
+                uint8_t result = readReg(y) + 1;
+                writeReg(y, result);
+                setFlag(RefFlagZero, result == 0);
+                setFlag(RefFlagSubtract, false);
+                setFlag(RefFlagHalfCarry, (result & 0xf) == 0);
+                return y == 6 ? 12 : 4;
+            }
+            case 5: {
+                uint8_t result = readReg(y) - 1;
+                writeReg(y, result);
+                setFlag(RefFlagZero, result == 0);
+                setFlag(RefFlagSubtract, true);
+                setFlag(RefFlagHalfCarry, (result & 0xf) == 0xf);
+                return y == 6 ? 12 : 4;
+            }
+            case 6:
+                writeReg(y, fetch());
+                return y == 6 ? 12 : 8;
+            default:
+                switch (y) {
+                    case 0:
+                    case 1:
+                    case 2:
+                    case 3:
+                        s.a = rotate(y, s.a);
+                        setFlag(RefFlagZero, false);
+                        return 4;
+                    case 4: {
+                        int a = s.a;
+                        if (!flag(RefFlagSubtract)) {
+                            if (flag(RefFlagCarry) || a > 0x99) {
+                                a += 0x60;
+                                setFlag(RefFlagCarry, true);
+                            }
+                            if (flag(RefFlagHalfCarry) || (a & 0x0f) > 0x09)
+                                a += 0x06;
+                        } else {
+                            if (flag(RefFlagCarry))
+                                a -= 0x60;
+                            if (flag(RefFlagHalfCarry))
+                                a -= 0x06;
+                        }
+                        s.a = a & 0xff;
+                        setFlag(RefFlagZero, s.a == 0);
+                        setFlag(RefFlagHalfCarry, false);
+                        return 4;
+                    }
+                    case 5:
+                        s.a = ~s.a;
+                        setFlag(RefFlagSubtract, true);
+                        setFlag(RefFlagHalfCarry, true);
+                        return 4;
+                    case 6:
+                        setFlag(RefFlagSubtract, false);
+                        setFlag(RefFlagHalfCarry, false);
+                        setFlag(RefFlagCarry, true);
+                        return 4;
+                    default:
+                        setFlag(RefFlagSubtract, false);
+                        setFlag(RefFlagHalfCarry, false);
+                        setFlag(RefFlagCarry, !flag(RefFlagCarry));
+                        return 4;
+                }
+        }
+    }
+
+    if (x == 1) {
+        if (op == 0x76) {
+            s.halted = true;
+            return 4;
+        }
+        writeReg(y, readReg(z));
+        return (y == 6 || z == 6) ? 8 : 4;
+    }
+
+    if (x == 2) {
+        alu(y, readReg(z));
+        return z == 6 ? 8 : 4;
+    }
+
+    switch (z) {
+        case 0:
+            if (y < 4) {
+                if (condition(y)) {
+                    s.pc = pop();
+                    return 20;
+                }
+                return 8;
+            }
+            if (y == 4) {
+                mem.Write(0xff00 + fetch(), s.a);
+                return 12;
+            }
+            if (y == 6) {
+                s.a = mem.Read(0xff00 + fetch());
+                return 12;
+            }
+            if (y == 5) {
+                s.sp = addSigned(s.sp, fetch());
+                return 16;
+            }
+            writePair(2, addSigned(s.sp, fetch()));
+            return 12;
+        case 1:
+            if (q == 0) {
+                writePair2(p, pop());
+                return 12;
+            }
+            if (p == 0) {
+                s.pc = pop();
+                return 16;
+            }
+            if (p == 1) {
+                s.pc = pop();
+                s.ime = true;
+                return 16;
+            }
+            if (p == 2) {
+                s.pc = readPair(2);
+                return 4;
+            }
+            s.sp = readPair(2);
+            return 8;
+        case 2:
+            if (y < 4) {
+                uint16_t addr = fetch16();
+                if (condition(y)) {
+                    s.pc = addr;
+                    return 16;
+                }
+                return 12;
+            }
+            if (y == 4) {
+                mem.Write(0xff00 + s.c, s.a);
+                return 8;
+            }
+            if (y == 5) {
+                mem.Write(fetch16(), s.a);
+                return 16;
+            }
+            if (y == 6) {
+                s.a = mem.Read(0xff00 + s.c);
+                return 8;
+            }
+            s.a = mem.Read(fetch16());
+            return 16;
+        case 3:
+            if (y == 0) {
+                s.pc = fetch16();
+                return 16;
+            }
+            if (y == 1)
+                return executeExtended();
+            if (y == 6) {
+                s.ime = false;
+                s.imePending = false;
+                return 4;
+            }
+            if (y == 7) {
+                s.imePending = true;
+                return 4;
+            }
+            return -1;
+        case 4:
+            if (y < 4) {
+                uint16_t addr = fetch16();
+                if (condition(y)) {
+                    push(s.pc);
+                    s.pc = addr;
+                    return 24;
+                }
+                return 12;
+            }
+            return -1;
+        case 5:
+            if (q == 0) {
+                push(readPair2(p));
+                return 16;
+            }
+            if (p == 0) {
+                uint16_t addr = fetch16();
+                push(s.pc);
+                s.pc = addr;
+                return 24;
+            }
+            return -1;
+        case 6:
+            alu(y, fetch());
+            return 8;
+        default:
+            push(s.pc);
+            s.pc = y * 8;
+            return 16;
+    }
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <cstdint>
+
+// Independent SM83 interpreter used as the oracle for the state-diff harness.
+// It is written from the opcode tables (x/y/z decode) rather than from CPU.cc
+// so the two implementations do not share mistakes.
+
+const uint8_t RefFlagZero = 0x80;
+const uint8_t RefFlagSubtract = 0x40;
+const uint8_t RefFlagHalfCarry = 0x20;
+const uint8_t RefFlagCarry = 0x10;
+
+struct ReferenceState {
+    uint8_t a, f, b, c, d, e, h, l;
+    uint16_t sp, pc;
+    bool ime, halted;
+    bool imePending;    // EI ran, IME is set before the next instruction
+};
+
+// Sparse memory holding only the bytes a test case set up. Any access
+// outside of them marks the case as invalid rather than inventing a value.
+class ReferenceMemory {
+public:
+    static const int MaxEntries = 16;
+
+    uint16_t addr[MaxEntries];
+    uint8_t value[MaxEntries];
+    int count;
+    bool outOfBounds;
+
+    void Clear() { count = 0; outOfBounds = false; }
+    int Find(uint16_t a);
+    void Set(uint16_t a, uint8_t v);
+    uint8_t Read(uint16_t a);
+    void Write(uint16_t a, uint8_t v);
+};
+
+class ReferenceCpu {
+private:
+    uint8_t fetch();
+    uint16_t fetch16();
+    uint8_t readReg(int index);
+    void writeReg(int index, uint8_t value);
+    uint16_t readPair(int index);
+    void writePair(int index, uint16_t value);
+    uint16_t readPair2(int index);
+    void writePair2(int index, uint16_t value);
+    bool condition(int index);
+    void push(uint16_t value);
+    uint16_t pop();
+    void setFlag(uint8_t flag, bool value);
+    bool flag(uint8_t flag);
+    void alu(int op, uint8_t value);
+    uint8_t rotate(int op, uint8_t value);
+    uint16_t addSigned(uint16_t base, uint8_t offset);
+    int executeExtended();
+
+public:
+    ReferenceState s;
+    ReferenceMemory mem;
+
+    // Executes one instruction and returns its cycle count, or -1 for
+    // opcodes the reference does not model (STOP and the undefined ones)
+    int Step();
+};
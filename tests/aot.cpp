@@ -0,0 +1,127 @@
+#include <string>
+#include <vector>
+
+#include "../gboy/Workloads.h"
+#include "Machine.h"
+
+// Checks the ahead-of-time images the build generated for the workload ROMs:
+// every run has to leave the same JitState as the JIT compiling the same
+// address, and a whole machine on EngineAot has to reach the same frames as
+// one on the interpreter.
+
+extern const AotImage AotImage_alu, AotImage_memcpy, AotImage_scroll, AotImage_sprites,
+    AotImage_timer, AotImage_halt, AotImage_poll, AotImage_joypad;
+
+// Same order as the Workload enum
+const AotImage *const Images[WorkloadCount] = {
+    &AotImage_alu, &AotImage_memcpy, &AotImage_scroll, &AotImage_sprites,
+    &AotImage_timer, &AotImage_halt, &AotImage_poll, &AotImage_joypad,
+};
+
+const int StatesPerRun = 64;
+
+struct Random {
+    uint32_t state;
+    uint32_t Next() {
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        return state;
+    }
+};
+
+bool sameState(const JitState &x, const JitState &y) {
+    return x.a == y.a && x.b == y.b && x.c == y.c && x.d == y.d && x.e == y.e && x.h == y.h && x.l == y.l
+        && x.f == y.f && x.pc == y.pc && x.cycles == y.cycles;
+}
+
+// Returns the number of runs that differ from the JIT
+int compareRuns(const AotImage *image, const std::vector<uint8_t> &rom, JitCompiler &jit, Random &random) {
+    int failed = 0;
+    for (size_t i = 0; i < image->count; i++) {
+        const AotBlock &block = image->blocks[i];
+        size_t offset = block.addr + (block.bank > 1 ? (block.bank - 1) * 0x4000 : 0);
+        size_t length = std::min((size_t)(0x100 - (block.addr & 0xff)), rom.size() - offset);
+        JitRunFunction compiled = jit.Compile(&rom[offset], length, block.addr, image->options);
+        if (compiled == nullptr) {
+            printf("    %04x: compiled by AOT but not by the JIT\n", block.addr);
+            failed++;
+            continue;
+        }
+
+        for (int s = 0; s < StatesPerRun; s++) {
+            JitState aot, native;
+            uint32_t r = random.Next(), q = random.Next();
+            aot.a = r, aot.b = r >> 8, aot.c = r >> 16, aot.d = r >> 24;
+            aot.e = q, aot.h = q >> 8, aot.l = q >> 16, aot.f = (q >> 24) & 0xf0;
+            aot.pc = aot.cycles = 0;
+            native = aot;
+            block.run(&aot, JitCompiler::FlagTable());
+            compiled(&native, JitCompiler::FlagTable());
+            if (!sameState(aot, native)) {
+                printf("    %04x: a=%02x f=%02x pc=%04x cycles=%u, JIT a=%02x f=%02x pc=%04x cycles=%u\n", block.addr,
+                    aot.a, aot.f, aot.pc, aot.cycles, native.a, native.f, native.pc, native.cycles);
+                failed++;
+                break;
+            }
+        }
+        if (jit.IsFull())
+            jit.Reset();
+    }
+    return failed;
+}
+
+// Returns the first frame at which the machines disagree, with report saying
+// how, or frames when they never do
+uint32_t compareMachines(const AotImage *image, const std::vector<uint8_t> &rom, uint32_t frames, std::string &report) {
+    Machine aot(rom), interpreter(rom);
+    aot.gb->SetCpuEngine(EngineAot);
+    aot.gb->SetAotImage(image);
+    interpreter.gb->SetCpuEngine(EngineInterpreter);
+
+    for (uint32_t frame = 0; frame < frames; frame++) {
+        aot.RunFrame();
+        interpreter.RunFrame();
+        report = DiffMachines(aot, interpreter);
+        if (!report.empty())
+            return frame;
+    }
+    return frames;
+}
+
+int main(int argc, char *argv[]) {
+    uint32_t frames = 60;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--frames" && i + 1 < argc)
+            frames = std::stoul(argv[++i]);
+        else {
+            printf("Usage: %s [--frames n]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    // Runs are only compared where the JIT is available
+    JitCompiler jit;
+    if (!jit.IsAvailable())
+        printf("JIT not available on this host, comparing whole machines only\n");
+
+    Random random = {1};
+    int failed = 0;
+    for (int w = 0; w < WorkloadCount; w++) {
+        std::vector<uint8_t> rom = BuildWorkloadRom((Workload)w);
+        const AotImage *image = Images[w];
+        int runsFailed = jit.IsAvailable() ? compareRuns(image, rom, jit, random) : 0;
+        std::string report;
+        uint32_t frame = compareMachines(image, rom, frames, report);
+        if (runsFailed == 0 && frame == frames) {
+            printf("%-8s %zu runs match the JIT, %u frames match the interpreter\n", WorkloadName((Workload)w),
+                image->count, frames);
+        } else {
+            failed++;
+            printf("%-8s FAILED: %d of %zu runs differ, machines differ from frame %u\n%s", WorkloadName((Workload)w),
+                runsFailed, image->count, frame, report.c_str());
+        }
+    }
+    return failed ? 1 : 0;
+}
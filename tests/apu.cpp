@@ -0,0 +1,211 @@
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "../gboy/APU.h"
+#include "../gboy/Workloads.h"
+
+// Checks the APU through its registers: pitch of the tone channels, noise,
+// length counters, power off, and that the samples do not depend on how the
+// cycles were handed to it.
+
+struct Rendering {
+    std::vector<int16_t> left, right;
+};
+
+struct Sound {
+    Cartridge cart;
+    MemoryManagementUnit mmu;
+    AudioProcessingUnit apu;
+
+    Sound() : cart(BuildBlankRom()), mmu(&cart), apu(&mmu) {
+        mmu.SetSerialEcho(false);
+        mmu.Write(AddrRegSoundOn, 0x80);
+        mmu.Write(AddrRegMasterVolume, 0x77);
+        mmu.Write(AddrRegSoundPanning, 0xff);
+    }
+
+    // Runs for the given cycles, step cycles at a time, flushing once a frame
+    Rendering Run(uint32_t cycles, uint32_t step) {
+        Rendering r;
+        int16_t frames[512 * 2];
+        uint32_t sinceFlush = 0;
+        for (uint32_t done = 0; done < cycles; done += step) {
+            apu.Cycle(step);
+            sinceFlush += step;
+            if (sinceFlush < CyclesFrame)
+                continue;
+            sinceFlush = 0;
+            apu.Flush();
+            while (size_t n = apu.GetOutput().Read(frames, 512)) {
+                for (size_t i = 0; i < n; i++) {
+                    r.left.push_back(frames[i * 2]);
+                    r.right.push_back(frames[i * 2 + 1]);
+                }
+            }
+        }
+        return r;
+    }
+};
+
+// Rising zero crossings after the first tenth of a second
+int countCycles(const std::vector<int16_t> &samples) {
+    int count = 0;
+    for (size_t i = AudioSampleRate / 10 + 1; i < samples.size(); i++)
+        count += samples[i - 1] < 0 && samples[i] >= 0;
+    return count;
+}
+
+double rms(const std::vector<int16_t> &samples) {
+    double sum = 0;
+    for (size_t i = AudioSampleRate / 10; i < samples.size(); i++)
+        sum += (double)samples[i] * samples[i];
+    return sqrt(sum / (samples.size() - AudioSampleRate / 10));
+}
+
+void playPulse(Sound &s, uint16_t frequency) {
+    s.mmu.Write(0xFF11, 0x80);
+    s.mmu.Write(0xFF12, 0xf0);
+    s.mmu.Write(0xFF13, frequency & 0xff);
+    s.mmu.Write(0xFF14, 0x80 | (frequency >> 8));
+}
+
+void playWave(Sound &s, uint16_t frequency) {
+    for (int i = 0; i < 16; i++)
+        s.mmu.Write(AddrWaveRamStart + i, i < 8 ? 0xff : 0x00);
+    s.mmu.Write(0xFF1A, 0x80);
+    s.mmu.Write(0xFF1C, 0x20);
+    s.mmu.Write(0xFF1D, frequency & 0xff);
+    s.mmu.Write(0xFF1E, 0x80 | (frequency >> 8));
+}
+
+void playNoise(Sound &s) {
+    s.mmu.Write(0xFF21, 0xf0);
+    s.mmu.Write(0xFF22, 0x33);
+    s.mmu.Write(0xFF23, 0x80);
+}
+
+bool checkPitch(std::string &report) {
+    const double hz = 131072.0 / (2048 - 1750);
+    Sound pulse, wave;
+    playPulse(pulse, 1750);
+    playWave(wave, 1899);       // 65536 / (2048 - 1899), the same pitch
+    Rendering p = pulse.Run(CyclesCpu, 4), w = wave.Run(CyclesCpu, 4);
+    int expected = (int)((p.left.size() - AudioSampleRate / 10) * hz / AudioSampleRate);
+    int pulseCycles = countCycles(p.left), waveCycles = countCycles(w.right);
+    if (abs(pulseCycles - expected) <= 2 && abs(waveCycles - expected) <= 2)
+        return true;
+    report = "pulse " + std::to_string(pulseCycles) + " and wave " + std::to_string(waveCycles)
+        + " cycles, expected " + std::to_string(expected);
+    return false;
+}
+
+bool checkNoise(std::string &report) {
+    Sound s;
+    playNoise(s);
+    double level = rms(s.Run(CyclesCpu / 2, 4).left);
+    if (level > 1000)
+        return true;
+    report = "noise rms " + std::to_string(level);
+    return false;
+}
+
+bool checkLength(std::string &report) {
+    Sound s;
+    s.mmu.Write(0xFF11, 0x3f);  // one length clock left
+    s.mmu.Write(0xFF12, 0xf0);
+    s.mmu.Write(0xFF14, 0xc7);
+    bool on = s.mmu.Read(AddrRegSoundOn) & 1;
+    s.Run(CyclesCpu / 128, 4);
+    bool off = !(s.mmu.Read(AddrRegSoundOn) & 1);
+    if (on && off)
+        return true;
+    report = std::string("channel 1 ") + (on ? "did not stop" : "did not start");
+    return false;
+}
+
+bool checkPowerOff(std::string &report) {
+    Sound s;
+    playPulse(s, 1750);
+    s.Run(CyclesFrame, 4);
+    s.mmu.Write(AddrRegSoundOn, 0x00);
+    s.mmu.Write(0xFF12, 0xf0);
+    uint8_t nr10 = s.mmu.Read(0xFF10), nr12 = s.mmu.Read(0xFF12), nr51 = s.mmu.Read(AddrRegSoundPanning);
+    uint8_t nr52 = s.mmu.Read(AddrRegSoundOn);
+    double level = rms(s.Run(CyclesCpu / 2, 4).left);
+    if (nr10 == 0x80 && nr12 == 0x00 && nr51 == 0x00 && nr52 == 0x70 && level < 50)
+        return true;
+    char line[128];
+    snprintf(line, sizeof(line), "NR10 %02x NR12 %02x NR51 %02x NR52 %02x rms %.1f", nr10, nr12, nr51, nr52, level);
+    report = line;
+    return false;
+}
+
+// Catching up in big or small steps has to give the same samples
+bool checkLazy(std::string &report) {
+    Sound fine, coarse;
+    for (Sound *s : {&fine, &coarse}) {
+        playPulse(*s, 1600);
+        playWave(*s, 1700);
+        playNoise(*s);
+        s->mmu.Write(0xFF10, 0x16);     // sweep up
+        s->mmu.Write(0xFF14, 0x86);
+    }
+    // Flushed at different times, so only the samples both have are compared
+    Rendering a = fine.Run(CyclesCpu / 2, 4), b = coarse.Run(CyclesCpu / 2, 1000);
+    size_t count = std::min(a.left.size(), b.left.size());
+    if (count < AudioSampleRate / 4) {
+        report = std::to_string(a.left.size()) + " and " + std::to_string(b.left.size()) + " samples";
+        return false;
+    }
+    for (size_t i = 0; i < count; i++) {
+        if (a.left[i] != b.left[i] || a.right[i] != b.right[i]) {
+            report = "samples differ from " + std::to_string(i);
+            return false;
+        }
+    }
+    return true;
+}
+
+bool checkRing(std::string &report) {
+    AudioRingBuffer ring(5);    // rounded up to 8 frames
+    int16_t in[20], out[20];
+    for (int i = 0; i < 20; i++)
+        in[i] = i;
+    size_t written = ring.Write(in, 10);
+    size_t read = ring.Read(out, 3);
+    written += ring.Write(in + 16, 2);
+    read += ring.Read(out + 6, 10);
+    bool ordered = true;
+    for (int i = 0; i < 20; i++)
+        ordered &= out[i] == in[i];
+    if (written == 10 && read == 10 && ordered && ring.Available() == 0)
+        return true;
+    report = "wrote " + std::to_string(written) + ", read " + std::to_string(read);
+    return false;
+}
+
+int main(int argc, char *argv[]) {
+    const struct { const char *name; std::function<bool(std::string &)> check; } checks[] = {
+        {"pitch", checkPitch},
+        {"noise", checkNoise},
+        {"length", checkLength},
+        {"poweroff", checkPowerOff},
+        {"lazy", checkLazy},
+        {"ring", checkRing},
+    };
+
+    int failed = 0;
+    for (auto &c : checks) {
+        std::string report;
+        if (c.check(report)) {
+            printf("%-8s ok\n", c.name);
+        } else {
+            failed++;
+            printf("%-8s FAILED: %s\n", c.name, report.c_str());
+        }
+    }
+    return failed ? 1 : 0;
+}
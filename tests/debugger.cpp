@@ -0,0 +1,330 @@
+#include <cstring>
+#include <functional>
+#include <string>
+
+#include "../gboy/GBoy.h"
+#include "../gboy/Debugger.h"
+#include "../gboy/RomBuilder.h"
+#include "../gboy/Workloads.h"
+
+// Stops on breakpoints and watchpoints of a small ROM, checks every engine
+// stops in the same places, and that an idle debugger leaves the fast paths on.
+
+const uint16_t AddrStored = 0xc123;
+const uint16_t AddrLoaded = 0xc200;
+const uint16_t AddrUntouched = 0xc300;
+
+struct DebugRom {
+    std::vector<uint8_t> rom;
+    uint16_t afterStore, afterLoad, sub;
+};
+
+// Stores and loads once, then calls sub forever counting in B
+DebugRom buildDebugRom() {
+    DebugRom r;
+    RomBuilder rb("DEBUGGER");
+    rb.Label("main");
+    rb.Di();
+    rb.LdImm16(RegSP, 0xfffe);
+    rb.LdImm(RegB, 0);
+    rb.LdImm(RegA, 0x42);
+    rb.LdAddrFromA(AddrStored);
+    r.afterStore = rb.Here();
+    rb.LdAFromAddr(AddrLoaded);
+    r.afterLoad = rb.Here();
+    rb.Label("loop");
+    rb.Inc(RegB);
+    rb.Call("sub");
+    rb.Jr(CondAlways, "loop");
+
+    r.sub = rb.Here();
+    rb.Label("sub");
+    rb.Ld(RegA, RegB);
+    rb.Ret();
+    r.rom = rb.Build();
+    return r;
+}
+
+// Steps until the debugger stops, or gives up
+bool runUntilStop(GBoy &gb, Debugger &debugger, uint64_t *cycles = nullptr) {
+    for (uint32_t i = 0; i < 100000 && !debugger.IsStopped(); i++) {
+        uint32_t step = gb.ExecuteStep();
+        if (cycles)
+            *cycles += step;
+    }
+    return debugger.IsStopped();
+}
+
+bool checkBreakpoint(std::string &report) {
+    DebugRom r = buildDebugRom();
+    GBoy gb(new Cartridge(r.rom));
+    Debugger debugger;
+    gb.SetDebugger(&debugger);
+    debugger.AddBreakpoint(r.sub);
+
+    for (uint8_t expected = 1; expected <= 3; expected++) {
+        if (!runUntilStop(gb, debugger)) {
+            report = "breakpoint not hit";
+            return false;
+        }
+        CentralProcessingUnit *cpu = gb.GetCPU();
+        DebugStop stop = debugger.GetStop();
+        // Stopped before the instruction, and stays there
+        bool held = gb.ExecuteStep() == 0 && gb.ExecuteStep() == 0 && cpu->programCounter == r.sub;
+        if (stop.reason != StopBreakpoint || stop.pc != r.sub || !held || cpu->b != expected) {
+            char line[96];
+            snprintf(line, sizeof(line), "stop %d at %04x, pc %04x, b %d, expected %d", stop.reason, stop.pc,
+                cpu->programCounter, cpu->b, expected);
+            report = line;
+            return false;
+        }
+        debugger.Resume();
+    }
+    return true;
+}
+
+bool checkWatchpoints(std::string &report) {
+    DebugRom r = buildDebugRom();
+    GBoy gb(new Cartridge(r.rom));
+    Debugger debugger;
+    gb.SetDebugger(&debugger);
+    debugger.AddWatchpoint(AddrStored, AddrStored, WatchWrite);
+    debugger.AddWatchpoint(AddrLoaded - 4, AddrLoaded + 4, WatchRead);
+    debugger.AddWatchpoint(AddrUntouched, AddrUntouched + 0xff, WatchAccess);
+
+    // The store and the load stop once each, after the instruction
+    DebugStop expected[] = {
+        {StopWatchWrite, r.afterStore, AddrStored, 0x42, WatchWrite},
+        {StopWatchRead, r.afterLoad, AddrLoaded, 0, WatchRead},
+    };
+    for (const DebugStop &e : expected) {
+        runUntilStop(gb, debugger);
+        DebugStop stop = debugger.GetStop();
+        if (stop.reason != e.reason || stop.pc != e.pc || stop.addr != e.addr || stop.value != e.value
+            || stop.kinds != e.kinds) {
+            char line[96];
+            snprintf(line, sizeof(line), "stop %d at %04x on %04x = %02x, expected %d at %04x", stop.reason, stop.pc,
+                stop.addr, stop.value, e.reason, e.pc);
+            report = line;
+            return false;
+        }
+        debugger.Resume();
+    }
+    if (!runUntilStop(gb, debugger))
+        return true;
+    report = "stopped on an untouched address";
+    return false;
+}
+
+// Resuming from a watchpoint must not pass over a breakpoint set later at
+// the address it stopped at
+bool checkResume(std::string &report) {
+    RomBuilder rb("RESUME");
+    rb.Label("main");
+    rb.Di();
+    rb.LdImm16(RegSP, 0xfffe);
+    rb.LdImm(RegB, 0);
+    rb.Label("loop");
+    rb.Inc(RegB);
+    rb.Ld(RegA, RegB);
+    rb.LdAddrFromA(AddrStored);
+    uint16_t afterStore = rb.Here();
+    rb.Nop();
+    rb.Jr(CondAlways, "loop");
+    GBoy gb(new Cartridge(rb.Build()));
+
+    Debugger debugger;
+    gb.SetDebugger(&debugger);
+    debugger.AddWatchpoint(AddrStored, AddrStored, WatchWrite);
+    runUntilStop(gb, debugger);
+    uint8_t stored = gb.GetCPU()->b;
+    debugger.Resume();
+    gb.ExecuteStep();
+    debugger.Clear();
+    debugger.AddBreakpoint(afterStore);
+    if (!runUntilStop(gb, debugger) || debugger.GetStop().pc != afterStore || gb.GetCPU()->b != stored + 1) {
+        report = "first hit after the watchpoint stopped with b " + std::to_string(gb.GetCPU()->b) + ", expected "
+            + std::to_string(stored + 1);
+        return false;
+    }
+    return true;
+}
+
+// A read watchpoint over code never fires: fetches, block decoding and the
+// idle-loop analysis do not read memory the way the program does
+bool checkCodeWatch(std::string &report) {
+    for (CpuEngine engine : {EngineInterpreter, EngineCached, EngineJit}) {
+        for (Workload w : {WorkloadLyPoll, WorkloadAlu, WorkloadHaltIdle}) {
+            GBoy gb(new Cartridge(BuildWorkloadRom(w)));
+            gb.GetMMU()->SetSerialEcho(false);
+            gb.SetCpuEngine(engine);
+            Debugger debugger;
+            gb.SetDebugger(&debugger);
+            debugger.AddWatchpoint(AddrRomEntryPoint, 0x3fff, WatchRead);
+            for (uint32_t frames = 0; frames < 4 && !debugger.IsStopped(); ) {
+                gb.ExecuteStep();
+                if (gb.GetFrameBufferUpdatedFlag()) {
+                    gb.SetFrameBufferUpdatedFlag(false);
+                    frames++;
+                }
+            }
+            if (debugger.IsStopped()) {
+                char line[96];
+                snprintf(line, sizeof(line), "%s on %s stopped reading %04x", WorkloadName(w), CpuEngineName(engine),
+                    debugger.GetStop().addr);
+                report = line;
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+// Idle-loop skipping must not move time on past a watchpoint: the poll loop
+// stops on every read of LY with the same cycles as without the shortcut
+bool checkIdleShortcut(std::string &report) {
+    uint64_t cycles[2][20];
+    uint8_t lines[2][20];
+    for (int skipping = 0; skipping < 2; skipping++) {
+        GBoy gb(new Cartridge(BuildWorkloadRom(WorkloadLyPoll)));
+        gb.GetMMU()->SetSerialEcho(false);
+        gb.SetIdleLoopSkipping(skipping);
+        Debugger debugger;
+        gb.SetDebugger(&debugger);
+        debugger.AddWatchpoint(AddrRegLcdY, AddrRegLcdY, WatchRead);
+        uint64_t total = 0;
+        for (int stop = 0; stop < 20; stop++) {
+            if (!runUntilStop(gb, debugger, &total)) {
+                report = "LY never read";
+                return false;
+            }
+            cycles[skipping][stop] = total;
+            lines[skipping][stop] = gb.GetMMU()->Read(AddrRegLcdY, true);
+            debugger.Resume();
+        }
+    }
+    for (int stop = 0; stop < 20; stop++) {
+        if (cycles[0][stop] != cycles[1][stop] || lines[0][stop] != lines[1][stop]) {
+            char line[96];
+            snprintf(line, sizeof(line), "stop %d after %llu cycles on line %d, %llu on line %d without skipping", stop,
+                (unsigned long long)cycles[1][stop], lines[1][stop], (unsigned long long)cycles[0][stop], lines[0][stop]);
+            report = line;
+            return false;
+        }
+    }
+    return true;
+}
+
+struct StopState {
+    uint16_t af, bc, de, hl, sp;
+    uint64_t cycles;
+};
+
+// Breakpoints in a workload's loop stop every engine with the same state
+bool checkEngines(std::string &report) {
+    for (Workload w : {WorkloadMemcpy, WorkloadLyPoll, WorkloadAlu}) {
+        std::vector<StopState> stops[EngineCount];
+        // Every instruction of the loop, so some fall inside compiled runs
+        std::vector<uint16_t> breakpoints;
+        for (CpuEngine engine : {EngineInterpreter, EngineInterpreter, EngineCached, EngineJit}) {
+            GBoy gb(new Cartridge(BuildWorkloadRom(w)));
+            gb.GetMMU()->SetSerialEcho(false);
+            gb.SetCpuEngine(engine);
+            // Two frames in, so the JIT has compiled its runs
+            for (int frames = 0; frames < 2; ) {
+                gb.ExecuteStep();
+                if (gb.GetFrameBufferUpdatedFlag()) {
+                    gb.SetFrameBufferUpdatedFlag(false);
+                    frames++;
+                }
+            }
+            if (breakpoints.empty()) {
+                for (int i = 0; i < 16; i++) {
+                    breakpoints.push_back(gb.GetCPU()->programCounter);
+                    gb.ExecuteStep();
+                }
+                continue;
+            }
+            Debugger debugger;
+            gb.SetDebugger(&debugger);
+            for (uint16_t addr : breakpoints)
+                debugger.AddBreakpoint(addr);
+            uint64_t cycles = 0;
+            for (int stop = 0; stop < 20; stop++) {
+                if (!runUntilStop(gb, debugger, &cycles)) {
+                    report = std::string(WorkloadName(w)) + ": breakpoint not hit on " + CpuEngineName(engine);
+                    return false;
+                }
+                CentralProcessingUnit *cpu = gb.GetCPU();
+                cpu->GetFlags();
+                // Counted from the first stop, which the engines reach from
+                // slightly different places
+                if (stop == 0)
+                    cycles = 0;
+                stops[engine].push_back(StopState{cpu->af, cpu->bc, cpu->de, cpu->hl, cpu->stackPointer, cycles});
+                debugger.Resume();
+            }
+        }
+        for (CpuEngine engine : {EngineCached, EngineJit}) {
+            for (size_t i = 0; i < stops[engine].size(); i++) {
+                if (memcmp(&stops[engine][i], &stops[EngineInterpreter][i], sizeof(StopState)) != 0) {
+                    report = std::string(WorkloadName(w)) + ": stop " + std::to_string(i) + " differs on "
+                        + CpuEngineName(engine);
+                    return false;
+                }
+            }
+        }
+    }
+    return true;
+}
+
+// Nothing set, nothing checked: fused groups still run, in fewer steps
+bool checkIdle(std::string &report) {
+    uint64_t steps[2] = {0, 0};
+    for (int attached = 0; attached < 2; attached++) {
+        GBoy gb(new Cartridge(BuildWorkloadRom(WorkloadMemcpy)));
+        gb.GetMMU()->SetSerialEcho(false);
+        gb.SetCpuEngine(EngineCached);
+        Debugger debugger;
+        if (attached) {
+            gb.SetDebugger(&debugger);
+            debugger.AddBreakpoint(0x0000);
+            debugger.RemoveBreakpoint(0x0000);
+        }
+        for (uint32_t frames = 0; frames < 10; steps[attached]++) {
+            gb.ExecuteStep();
+            if (gb.GetFrameBufferUpdatedFlag()) {
+                gb.SetFrameBufferUpdatedFlag(false);
+                frames++;
+            }
+        }
+    }
+    if (steps[0] == steps[1])
+        return true;
+    report = std::to_string(steps[1]) + " steps with an idle debugger, " + std::to_string(steps[0]) + " without";
+    return false;
+}
+
+int main(int argc, char *argv[]) {
+    const struct { const char *name; std::function<bool(std::string &)> check; } checks[] = {
+        {"break", checkBreakpoint},
+        {"watch", checkWatchpoints},
+        {"resume", checkResume},
+        {"code", checkCodeWatch},
+        {"shortcut", checkIdleShortcut},
+        {"engines", checkEngines},
+        {"idle", checkIdle},
+    };
+
+    int failed = 0;
+    for (auto &c : checks) {
+        std::string report;
+        if (c.check(report)) {
+            printf("%-8s ok\n", c.name);
+        } else {
+            failed++;
+            printf("%-8s FAILED: %s\n", c.name, report.c_str());
+        }
+    }
+    return failed ? 1 : 0;
+}
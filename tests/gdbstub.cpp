@@ -0,0 +1,250 @@
+#include <cstring>
+#include <functional>
+#include <string>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "../gboy/GBoy.h"
+#include "../gboy/GdbStub.h"
+#include "../gboy/RomBuilder.h"
+
+// Talks to the stub as gdb would, over a Unix socket, in the same thread as
+// the machine: each packet is written, then the stub polled, then the reply read.
+
+const uint16_t AddrStored = 0xc123;
+
+struct GdbRom {
+    std::vector<uint8_t> rom;
+    uint16_t sub;
+};
+
+// Calls sub forever counting in B, which stores B
+GdbRom buildGdbRom() {
+    GdbRom r;
+    RomBuilder rb("GDBSTUB");
+    rb.Label("main");
+    rb.Di();
+    rb.LdImm16(RegSP, 0xfffe);
+    rb.LdImm(RegB, 0);
+    rb.Label("loop");
+    rb.Inc(RegB);
+    rb.Call("sub");
+    rb.Jr(CondAlways, "loop");
+
+    r.sub = rb.Here();
+    rb.Label("sub");
+    rb.Ld(RegA, RegB);
+    rb.LdAddrFromA(AddrStored);
+    rb.Ret();
+    r.rom = rb.Build();
+    return r;
+}
+
+class Session {
+private:
+    GBoy *gb;
+    Debugger *debugger;
+    GdbStub *stub;
+    int fd;
+
+    std::string receive() {
+        std::string data;
+        for (;;) {
+            size_t start = data.find('$');
+            size_t end = data.find('#', start == std::string::npos ? 0 : start);
+            if (start != std::string::npos && end != std::string::npos && end + 2 < data.size())
+                return data.substr(start + 1, end - start - 1);
+            pollfd p = {fd, POLLIN, 0};
+            if (poll(&p, 1, 1000) <= 0)
+                return "(no reply)";
+            char buffer[4096];
+            ssize_t n = read(fd, buffer, sizeof(buffer));
+            if (n <= 0)
+                return "(closed)";
+            data.append(buffer, n);
+        }
+    }
+
+public:
+    Session(GBoy *gb, Debugger *debugger, GdbStub *stub, const char *path) {
+        this->gb = gb;
+        this->debugger = debugger;
+        this->stub = stub;
+        sockaddr_un remote = {};
+        remote.sun_family = AF_UNIX;
+        strncpy(remote.sun_path, path, sizeof(remote.sun_path) - 1);
+        fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (connect(fd, (sockaddr*)&remote, sizeof(remote)) != 0) {
+            close(fd);
+            fd = -1;
+        }
+    }
+    ~Session() {
+        if (fd >= 0)
+            close(fd);
+    }
+    bool IsOpen() { return fd >= 0; }
+
+    void Send(const std::string &payload) {
+        uint8_t checksum = 0;
+        for (char c : payload)
+            checksum += (uint8_t)c;
+        char tail[8];
+        snprintf(tail, sizeof(tail), "#%02x", checksum);
+        std::string packet = "$" + payload + tail;
+        if (write(fd, packet.c_str(), packet.size()) != (ssize_t)packet.size())
+            return;
+        stub->Poll(100);
+    }
+
+    std::string Exchange(const std::string &payload) {
+        Send(payload);
+        return receive();
+    }
+
+    // Runs the machine until the stub has a stop reply for gdb
+    std::string Wait() {
+        for (uint32_t i = 0; i < 100000 && !debugger->IsStopped(); i++)
+            gb->ExecuteStep();
+        stub->Poll(0);
+        return receive();
+    }
+
+    void Interrupt() {
+        if (write(fd, "\x03", 1) == 1)
+            stub->Poll(100);
+    }
+};
+
+uint16_t registerValue(const std::string &reply, int reg) {
+    if (reply.size() < (size_t)reg * 4 + 4)
+        return 0;
+    uint16_t value = (uint16_t)strtol(reply.substr(reg * 4, 4).c_str(), nullptr, 16);
+    return (uint16_t)(value >> 8 | value << 8);
+}
+
+bool expect(const std::string &what, const std::string &got, const std::string &expected, std::string &report) {
+    if (got == expected)
+        return true;
+    report = what + ": got \"" + got + "\", expected \"" + expected + "\"";
+    return false;
+}
+
+bool checkSession(std::string &report) {
+    const char *path = "picoboygdbstub.sock";
+    GdbRom r = buildGdbRom();
+    GBoy gb(new Cartridge(r.rom));
+    Debugger debugger;
+    gb.SetDebugger(&debugger);
+    GdbStub stub(&gb, &debugger);
+    if (!stub.Listen(std::string("unix:") + path)) {
+        report = "cannot listen";
+        return false;
+    }
+    Session gdb(&gb, &debugger, &stub, path);
+    if (!gdb.IsOpen() || !stub.Accept()) {
+        report = "cannot connect";
+        return false;
+    }
+    unlink(path);
+
+    // Stopped on connecting, before anything ran
+    if (!expect("?", gdb.Exchange("?"), "S02", report)
+        || !expect("QStartNoAckMode", gdb.Exchange("QStartNoAckMode"), "OK", report))
+        return false;
+    if (!expect("p", gdb.Exchange("p5"), "0001", report))
+        return false;
+
+    // The cartridge header's title
+    if (!expect("m", gdb.Exchange("m134,7"), "47444253545542", report))
+        return false;
+
+    // Breakpoint at sub, hit with B counting up
+    char packet[32];
+    snprintf(packet, sizeof(packet), "Z0,%x,1", r.sub);
+    if (!expect("Z0", gdb.Exchange(packet), "OK", report))
+        return false;
+    for (int i = 1; i <= 2; i++) {
+        gdb.Send("c");
+        if (!expect("c", gdb.Wait(), "S05", report))
+            return false;
+        std::string registers = gdb.Exchange("g");
+        if (registerValue(registers, 5) != r.sub || (registerValue(registers, 1) >> 8) != i) {
+            report = "stopped with registers " + registers;
+            return false;
+        }
+    }
+
+    // Steps over the breakpoint, one instruction at a time
+    gdb.Send("s");
+    if (!expect("s", gdb.Wait(), "S05", report))
+        return false;
+    if (registerValue(gdb.Exchange("g"), 5) != r.sub + 1) {
+        report = "step did not run one instruction";
+        return false;
+    }
+    snprintf(packet, sizeof(packet), "z0,%x,1", r.sub);
+    if (!expect("z0", gdb.Exchange(packet), "OK", report))
+        return false;
+
+    // Writes to memory and registers
+    if (!expect("M", gdb.Exchange("Mc300,2:beef"), "OK", report)
+        || !expect("m", gdb.Exchange("mc300,2"), "beef", report)
+        || !expect("P", gdb.Exchange("P3=3412"), "OK", report)
+        || !expect("p", gdb.Exchange("p3"), "3412", report))
+        return false;
+    if (gb.GetCPU()->hl != 0x1234) {
+        report = "P did not set hl";
+        return false;
+    }
+
+    // A write watchpoint stops after the store
+    snprintf(packet, sizeof(packet), "Z2,%x,1", AddrStored);
+    if (!expect("Z2", gdb.Exchange(packet), "OK", report))
+        return false;
+    gdb.Send("c");
+    snprintf(packet, sizeof(packet), "T05watch:%04x;", AddrStored);
+    if (!expect("watch", gdb.Wait(), packet, report))
+        return false;
+    gdb.Exchange("z2,c123,1");
+
+    // Ctrl-C stops a running machine
+    gdb.Send("c");
+    for (int i = 0; i < 1000; i++)
+        gb.ExecuteStep();
+    gdb.Interrupt();
+    if (!expect("interrupt", gdb.Wait(), "S02", report))
+        return false;
+
+    // Detaching clears everything and lets the machine run
+    gdb.Exchange("Z0,0,1");
+    if (!expect("D", gdb.Exchange("D"), "OK", report))
+        return false;
+    for (int i = 0; i < 1000; i++)
+        gb.ExecuteStep();
+    if (debugger.IsStopped() || stub.IsConnected()) {
+        report = "still stopped after detaching";
+        return false;
+    }
+    return true;
+}
+
+int main(int argc, char *argv[]) {
+    const struct { const char *name; std::function<bool(std::string &)> check; } checks[] = {
+        {"session", checkSession},
+    };
+
+    int failed = 0;
+    for (auto &c : checks) {
+        std::string report;
+        if (c.check(report)) {
+            printf("%-8s ok\n", c.name);
+        } else {
+            failed++;
+            printf("%-8s FAILED: %s\n", c.name, report.c_str());
+        }
+    }
+    return failed ? 1 : 0;
+}
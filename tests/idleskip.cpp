@@ -0,0 +1,170 @@
+#include <string>
+#include <vector>
+
+#include "../gboy/RomBuilder.h"
+#include "../gboy/Workloads.h"
+#include "Machine.h"
+
+// Runs every workload ROM with a shortcut (idle-loop skipping, fusion in
+// the cached engine, compiled runs against the interpreter, or drawing only
+// some frames as when fast-forwarding) on and off and checks that both machines agree on cycles, CPU state and
+// memory at every frame, and on the picture of every frame both drew.
+
+enum Shortcut {
+    ShortcutIdleSkip,
+    ShortcutFusion,
+    ShortcutJit,
+    ShortcutFrameSkip
+};
+
+// With frame skipping, one frame in this many is drawn
+const uint32_t FrameSkipShown = 4;
+
+// Configures a machine with the shortcut on or off
+void setShortcut(Machine &m, Shortcut shortcut, bool enabled) {
+    if (shortcut == ShortcutIdleSkip) {
+        m.gb->SetIdleLoopSkipping(enabled);
+    } else if (shortcut == ShortcutFusion) {
+        m.gb->SetCpuEngine(EngineCached);
+        m.gb->SetFusion(enabled);
+    } else if (shortcut == ShortcutJit) {
+        m.gb->SetCpuEngine(enabled ? EngineJit : EngineInterpreter);
+    }
+}
+
+// Runs a frame of the machine with the shortcut on, drawing only some of
+// them when the shortcut is frame skipping
+void runShortcutFrame(Machine &m, Shortcut shortcut) {
+    if (shortcut == ShortcutFrameSkip)
+        m.gb->SetFrameOutput(m.frames % FrameSkipShown == FrameSkipShown - 1);
+    m.RunFrame();
+}
+
+// Runs rom with the shortcut on and off; returns the first frame at which
+// the machines disagree, with report saying how, or frames
+uint32_t compareFrames(const std::vector<uint8_t> &rom, Shortcut shortcut, uint32_t frames, std::string &report,
+    double *skippedShare = nullptr) {
+    Machine fast(rom), stepping(rom);
+    setShortcut(fast, shortcut, true);
+    setShortcut(stepping, shortcut, false);
+    for (uint32_t frame = 0; frame < frames; frame++) {
+        runShortcutFrame(fast, shortcut);
+        stepping.RunFrame();
+        report = DiffMachines(fast, stepping);
+        if (!report.empty())
+            return frame;
+    }
+    if (skippedShare)
+        *skippedShare = 100.0 * fast.gb->GetIdleCyclesSkipped() / fast.cycles;
+    return frames;
+}
+
+// The same polling loop entered first through LY, which only events change,
+// then again and again through DIV, which may not be skipped. Each pass
+// waits for DIV to move on by two and counts itself in WRAM.
+std::vector<uint8_t> buildReentryRom() {
+    RomBuilder rb("REENTRY");
+    rb.Label("main");
+    rb.Di();
+    rb.LdImm16(RegSP, 0xfffe);
+    rb.LdImm16(RegHL, AddrRegLcdY);
+    rb.LdImm(RegB, 0x90);
+    rb.Label("loop");
+    rb.Ld(RegA, RegHLIndirect);
+    rb.Alu(AluCp, RegB);
+    rb.Jr(CondNZ, "loop");
+    rb.LdAFromAddr(0xc000);
+    rb.Inc(RegA);
+    rb.LdAddrFromA(0xc000);
+    rb.LdImm16(RegHL, 0xff04);
+    rb.Ld(RegA, RegHLIndirect);
+    rb.AluImm(AluAdd, 2);
+    rb.Ld(RegB, RegA);
+    rb.Jp(CondAlways, "loop");
+    return rb.Build();
+}
+
+// EI, then a compare and branch the cached engine fuses, with VBlank already
+// requested: the interrupt is taken right after the compare, and the handler
+// keeps the address it returns to in WRAM
+std::vector<uint8_t> buildEnableRom() {
+    RomBuilder rb("ENABLE");
+    rb.Label("main");
+    rb.Di();
+    rb.LdImm16(RegSP, 0xfffe);
+    rb.LdImm(RegA, 0x01);
+    rb.LdhIoFromA(AddrRegInterruptEnabled & 0xff);
+    rb.LdhIoFromA(AddrRegInterruptFlag & 0xff);
+    rb.Ei();
+    rb.AluImm(AluCp, 0);
+    rb.Jr(CondNZ, "spin");
+    rb.Label("spin");
+    rb.Jr(CondAlways, "spin");
+
+    uint16_t position = rb.Here();
+    rb.Org(AddrVectorVBlank);
+    rb.Jp(CondAlways, "handler");
+    rb.Org(position);
+    rb.Label("handler");
+    rb.Pop(RegHL);
+    rb.Ld(RegA, RegL);
+    rb.LdAddrFromA(0xc000);
+    rb.Ld(RegA, RegH);
+    rb.LdAddrFromA(0xc001);
+    rb.Label("done");
+    rb.Jr(CondAlways, "done");
+    return rb.Build();
+}
+
+// Runs one ROM with the shortcut on and off, for the cases no workload has
+bool compareRom(const char *name, const std::vector<uint8_t> &rom, Shortcut shortcut, uint32_t frames) {
+    std::string report;
+    uint32_t frame = compareFrames(rom, shortcut, frames, report);
+    if (frame < frames) {
+        printf("%-8s FAILED at frame %u\n%s", name, frame, report.c_str());
+        return false;
+    }
+    printf("%-8s %u frames match\n", name, frames);
+    return true;
+}
+
+int main(int argc, char *argv[]) {
+    uint32_t frames = 60;
+    Shortcut shortcut = ShortcutIdleSkip;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--frames" && i + 1 < argc)
+            frames = std::stoul(argv[++i]);
+        else if (arg == "--fusion")
+            shortcut = ShortcutFusion;
+        else if (arg == "--jit")
+            shortcut = ShortcutJit;
+        else if (arg == "--frame-skip")
+            shortcut = ShortcutFrameSkip;
+        else {
+            printf("Usage: %s [--frames n] [--fusion | --jit | --frame-skip]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    int failed = 0;
+    for (int w = 0; w < WorkloadCount; w++) {
+        std::string report;
+        double share = 0;
+        uint32_t frame = compareFrames(BuildWorkloadRom((Workload)w), shortcut, frames, report, &share);
+        if (frame == frames && shortcut == ShortcutIdleSkip) {
+            printf("%-8s %u frames match, %.1f%% of cycles skipped\n", WorkloadName((Workload)w), frames, share);
+        } else if (frame == frames) {
+            printf("%-8s %u frames match\n", WorkloadName((Workload)w), frames);
+        } else {
+            failed++;
+            printf("%-8s FAILED at frame %u\n%s", WorkloadName((Workload)w), frame, report.c_str());
+        }
+    }
+
+    if (shortcut == ShortcutIdleSkip && !compareRom("reentry", buildReentryRom(), shortcut, frames))
+        failed++;
+    if ((shortcut == ShortcutFusion || shortcut == ShortcutJit) && !compareRom("enable", buildEnableRom(), shortcut, frames))
+        failed++;
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,191 @@
+#include <cstring>
+#include <functional>
+#include <string>
+
+#include "../gboy/GBoy.h"
+#include "../gboy/Instrument.h"
+#include "../gboy/Workloads.h"
+
+// Built with PICOBOY_INSTRUMENT. Checks the counters against what the
+// workload ROMs are known to do, and that every engine counts the same
+// opcodes.
+
+void runFrames(GBoy &gb, uint32_t frames, uint64_t *cycles = nullptr) {
+    while (frames > 0) {
+        uint32_t step = gb.ExecuteStep();
+        if (cycles)
+            *cycles += step;
+        if (gb.GetFrameBufferUpdatedFlag()) {
+            gb.SetFrameBufferUpdatedFlag(false);
+            frames--;
+        }
+    }
+}
+
+// The same frames on the interpreter and the cached engine with fusion
+bool checkOpcodes(std::string &report) {
+    uint64_t counts[2][0x200];
+    for (int i = 0; i < 2; i++) {
+        GBoy gb(new Cartridge(BuildWorkloadRom(WorkloadMemcpy)));
+        gb.GetMMU()->SetSerialEcho(false);
+        gb.SetCpuEngine(i ? EngineCached : EngineInterpreter);
+        ResetInstrumentCounters();
+        runFrames(gb, 30);
+        memcpy(counts[i], Instrument.opcodes, sizeof(counts[i]));
+    }
+    uint64_t total = 0;
+    for (int op = 0; op < 0x200; op++) {
+        total += counts[0][op];
+        if (counts[0][op] != counts[1][op]) {
+            char line[96];
+            snprintf(line, sizeof(line), "opcode %03x ran %llu times, %llu on the cached engine", op,
+                (unsigned long long)counts[0][op], (unsigned long long)counts[1][op]);
+            report = line;
+            return false;
+        }
+    }
+    if (total > 0)
+        return true;
+    report = "no opcodes counted";
+    return false;
+}
+
+// Pairs are counted as instructions run, whether or not the cached engine
+// gets to run them fused
+bool checkPairs(std::string &report) {
+    std::string profiles[3];
+    for (int i = 0; i < 3; i++) {
+        GBoy gb(new Cartridge(BuildWorkloadRom(WorkloadMemcpy)));
+        gb.GetMMU()->SetSerialEcho(false);
+        gb.SetCpuEngine(i ? EngineCached : EngineInterpreter);
+        gb.SetFusion(i == 2);
+        gb.GetCPU()->SetPairProfiling(true);
+        runFrames(gb, 30);
+        char *text = nullptr;
+        size_t size = 0;
+        FILE *out = open_memstream(&text, &size);
+        gb.GetCPU()->DumpPairProfile(out, 16);
+        fclose(out);
+        profiles[i] = text;
+        free(text);
+    }
+    const char *names[] = {"interpreter", "cached engine without fusion", "cached engine"};
+    for (int i = 1; i < 3; i++) {
+        if (profiles[i] != profiles[0]) {
+            report = std::string("pairs differ on the ") + names[i] + ":\n" + profiles[i];
+            return false;
+        }
+    }
+    if (!profiles[0].empty())
+        return true;
+    report = "no pairs counted";
+    return false;
+}
+
+bool checkMemory(std::string &report) {
+    GBoy gb(new Cartridge(BuildWorkloadRom(WorkloadMemcpy)));
+    gb.GetMMU()->SetSerialEcho(false);
+    ResetInstrumentCounters();
+    runFrames(gb, 10);
+    gb.GetMMU()->Write(0x2000, 2);
+    if (Instrument.reads[RegionRom] > 0 && Instrument.writes[RegionWram] > 1000 && Instrument.writes[RegionRom] == 1
+        && Instrument.bankSwitches == 1 && Instrument.reads[RegionEcho] == 0)
+        return true;
+    report = "rom reads " + std::to_string(Instrument.reads[RegionRom]) + ", wram writes "
+        + std::to_string(Instrument.writes[RegionWram]) + ", bank switches " + std::to_string(Instrument.bankSwitches);
+    return false;
+}
+
+// Every engine reads and writes the same memory for the same frames, however
+// it decodes, plans or skips over the code
+bool checkAccesses(std::string &report) {
+    for (int w = 0; w < WorkloadCount; w++) {
+        InstrumentCounters counted[3];
+        const CpuEngine engines[] = {EngineInterpreter, EngineCached, EngineJit};
+        for (int i = 0; i < 3; i++) {
+            GBoy gb(new Cartridge(BuildWorkloadRom((Workload)w)));
+            gb.GetMMU()->SetSerialEcho(false);
+            gb.SetCpuEngine(engines[i]);
+            ResetInstrumentCounters();
+            runFrames(gb, 10);
+            counted[i] = Instrument;
+        }
+        for (int i = 1; i < 3; i++) {
+            for (int r = 0; r < RegionCount; r++) {
+                if (counted[i].reads[r] != counted[0].reads[r] || counted[i].writes[r] != counted[0].writes[r]) {
+                    char line[128];
+                    snprintf(line, sizeof(line), "%s: %s %llu reads and %llu writes, %llu and %llu on %s",
+                        WorkloadName((Workload)w), MemoryRegionName((MemoryRegion)r),
+                        (unsigned long long)counted[0].reads[r], (unsigned long long)counted[0].writes[r],
+                        (unsigned long long)counted[i].reads[r], (unsigned long long)counted[i].writes[r],
+                        CpuEngineName(engines[i]));
+                    report = line;
+                    return false;
+                }
+            }
+        }
+    }
+    return true;
+}
+
+// The halt workload sleeps through most of every frame and wakes on VBlank
+bool checkEvents(std::string &report) {
+    GBoy gb(new Cartridge(BuildWorkloadRom(WorkloadHaltIdle)));
+    gb.GetMMU()->SetSerialEcho(false);
+    runFrames(gb, 2);
+    ResetInstrumentCounters();
+    uint64_t cycles = 0;
+    runFrames(gb, 20, &cycles);
+    InstrumentCounters counted = Instrument;
+    gb.SetFrameOutput(false);
+    runFrames(gb, 3);
+    uint64_t skipped = Instrument.linesRendered - counted.linesRendered;
+    if (counted.interrupts[FlagInterruptVBlank] == 20 && counted.haltCycles > cycles / 2
+        && counted.linesRendered == 20 * 143 && skipped == 0)
+        return true;
+    report = std::to_string(counted.interrupts[FlagInterruptVBlank]) + " VBlanks, " + std::to_string(counted.haltCycles)
+        + " of " + std::to_string(cycles) + " cycles halted, " + std::to_string(counted.linesRendered) + " lines drawn, "
+        + std::to_string(skipped) + " with output off";
+    return false;
+}
+
+bool checkJson(std::string &report) {
+    GBoy gb(new Cartridge(BuildWorkloadRom(WorkloadAlu)));
+    gb.GetMMU()->SetSerialEcho(false);
+    ResetInstrumentCounters();
+    runFrames(gb, 1);
+    FILE *out = tmpfile();
+    WriteInstrumentJson(out, gb.GetCPU());
+    std::string json(ftell(out), '\0');
+    rewind(out);
+    fread(&json[0], 1, json.size(), out);
+    fclose(out);
+    if (json.find("\"instrumented\": true") != std::string::npos && json.find("\"lines_rendered\"") != std::string::npos
+        && json.find("\"name\": \"JR NZ n\"") != std::string::npos)
+        return true;
+    report = "unexpected JSON: " + json.substr(0, 80);
+    return false;
+}
+
+int main(int argc, char *argv[]) {
+    const struct { const char *name; std::function<bool(std::string &)> check; } checks[] = {
+        {"opcodes", checkOpcodes},
+        {"pairs", checkPairs},
+        {"memory", checkMemory},
+        {"accesses", checkAccesses},
+        {"events", checkEvents},
+        {"json", checkJson},
+    };
+
+    int failed = 0;
+    for (auto &c : checks) {
+        std::string report;
+        if (c.check(report)) {
+            printf("%-8s ok\n", c.name);
+        } else {
+            failed++;
+            printf("%-8s FAILED: %s\n", c.name, report.c_str());
+        }
+    }
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,116 @@
+#include <functional>
+#include <string>
+#include <thread>
+
+#include "../gboy/Workloads.h"
+#include "Machine.h"
+
+// Checks the joypad register, its interrupt and that keys set from another
+// thread reach the running joypad workload.
+
+// The workload shows the keys held through BGP
+uint8_t palette(Machine &m) {
+    return m.gb->GetMMU()->Read(AddrRegBgPalette);
+}
+
+bool checkRegister(std::string &report) {
+    Cartridge cart(BuildBlankRom());
+    MemoryManagementUnit mmu(&cart);
+    mmu.SetJoypad((1 << (Right - Right)) | (1 << (Start - Right)));
+    mmu.Write(AddrRegJoypad, 1 << FlagJoypadSelectButtons);
+    uint8_t directions = mmu.Read(AddrRegJoypad);
+    mmu.Write(AddrRegJoypad, 1 << FlagJoypadSelectDirections);
+    uint8_t buttons = mmu.Read(AddrRegJoypad);
+    mmu.Write(AddrRegJoypad, 0x30);
+    uint8_t neither = mmu.Read(AddrRegJoypad);
+    if (directions == 0xee && buttons == 0xd7 && neither == 0xff)
+        return true;
+    char line[96];
+    snprintf(line, sizeof(line), "directions %02x buttons %02x neither %02x", directions, buttons, neither);
+    report = line;
+    return false;
+}
+
+bool checkInterrupt(std::string &report) {
+    Cartridge cart(BuildBlankRom());
+    MemoryManagementUnit mmu(&cart);
+    mmu.Write(AddrRegJoypad, 1 << FlagJoypadSelectDirections);
+    mmu.Write(AddrRegInterruptFlag, 0);
+    mmu.SetJoypad(1 << (Right - Right));        // not selected
+    bool unselected = mmu.Read(AddrRegInterruptFlag) & 0x10;
+    mmu.SetJoypad(1 << (A - Right));
+    bool pressed = mmu.Read(AddrRegInterruptFlag) & 0x10;
+    if (!unselected && pressed)
+        return true;
+    report = unselected ? "raised for an unselected key" : "not raised on a press";
+    return false;
+}
+
+bool checkWorkload(std::string &report) {
+    Machine m(BuildWorkloadRom(WorkloadJoypad));
+    m.RunFrames(3);
+    uint8_t before = palette(m);
+    m.gb->GetInput()->ButtonPressed(Down);
+    m.RunFrames(2);
+    uint8_t held = palette(m);
+    m.gb->GetInput()->ButtonReleased(Down);
+    m.RunFrames(2);
+    uint8_t after = palette(m);
+    if (before == 0xff && held == 0x00 && after == 0xff)
+        return true;
+    char line[96];
+    snprintf(line, sizeof(line), "BGP %02x, %02x while held, %02x after", before, held, after);
+    report = line;
+    return false;
+}
+
+// Keys toggled from another thread while the emulator runs; once that thread
+// is done the workload has to show the final state
+bool checkThreaded(std::string &report) {
+    Machine m(BuildWorkloadRom(WorkloadJoypad));
+    Input *input = m.gb->GetInput();
+    std::thread presser([input] {
+        for (int i = 0; i < 20000; i++) {
+            input->ButtonPressed((Keys)(Right + i % 8));
+            input->ButtonReleased((Keys)(Right + (i + 3) % 8));
+        }
+        for (int key = Right; key <= Start; key++)
+            input->ButtonReleased((Keys)key);
+        input->ButtonPressed(Select);
+    });
+    while (input->GetSequence() < 10000)
+        m.RunFrames(1);
+    presser.join();
+    m.RunFrames(2);
+    uint8_t held = palette(m);
+    input->ButtonReleased(Select);
+    m.RunFrames(2);
+    uint8_t released = palette(m);
+    if (held == 0x00 && released == 0xff)
+        return true;
+    char line[96];
+    snprintf(line, sizeof(line), "BGP %02x while held, %02x after", held, released);
+    report = line;
+    return false;
+}
+
+int main(int argc, char *argv[]) {
+    const struct { const char *name; std::function<bool(std::string &)> check; } checks[] = {
+        {"register", checkRegister},
+        {"irq", checkInterrupt},
+        {"workload", checkWorkload},
+        {"threaded", checkThreaded},
+    };
+
+    int failed = 0;
+    for (auto &c : checks) {
+        std::string report;
+        if (c.check(report)) {
+            printf("%-8s ok\n", c.name);
+        } else {
+            failed++;
+            printf("%-8s FAILED: %s\n", c.name, report.c_str());
+        }
+    }
+    return failed ? 1 : 0;
+}
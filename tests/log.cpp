@@ -0,0 +1,173 @@
+#include <functional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../gboy/GBoy.h"
+#include "../gboy/Log.h"
+#include "../gboy/RomBuilder.h"
+
+// Checks the core's messages reach the sink only when flushed, that filtered
+// levels cost no formatting, and that a noisy category is rate limited.
+
+struct Captured {
+    std::vector<LogRecord> records;
+};
+
+void capture(const LogRecord &record, void *context) {
+    ((Captured*)context)->records.push_back(record);
+}
+
+// Sends each byte of text over the serial port, then spins
+std::vector<uint8_t> buildSerialRom(const std::string &text) {
+    RomBuilder rb("LOG");
+    rb.Label("main");
+    rb.Di();
+    for (char c : text) {
+        rb.LdImm(RegA, (uint8_t)c);
+        rb.LdhIoFromA(AddrRegSerialData & 0xff);
+        rb.LdImm(RegA, 0x81);
+        rb.LdhIoFromA(AddrRegSerialControl & 0xff);
+    }
+    rb.Label("spin");
+    rb.Jr(CondAlways, "spin");
+    return rb.Build();
+}
+
+bool checkBuffered(std::string &report) {
+    Captured captured;
+    SetLogSink(capture, &captured);
+    SetLogLevel(LogInfo);
+    GBoy gb(new Cartridge(buildSerialRom("Passed\nsecond\n")));
+    LogFlush();
+    captured.records.clear();
+    for (int i = 0; i < 1000; i++)
+        gb.ExecuteStep();
+
+    bool early = !captured.records.empty();
+    LogFlush();
+    SetLogSink(nullptr, nullptr);
+    if (early) {
+        report = "the sink saw a record before the flush";
+        return false;
+    }
+    std::vector<std::string> lines;
+    for (const LogRecord &record : captured.records) {
+        if (record.category == LogSerial)
+            lines.push_back(record.message);
+    }
+    if (lines.size() != 2 || lines[0] != "Passed" || lines[1] != "second") {
+        report = std::to_string(lines.size()) + " serial lines, first \"" + (lines.empty() ? "" : lines[0]) + "\"";
+        return false;
+    }
+    return true;
+}
+
+int formatted = 0;
+
+int countFormatted() {
+    return ++formatted;
+}
+
+bool checkLevels(std::string &report) {
+    Captured captured;
+    SetLogSink(capture, &captured);
+    SetLogLevel(LogInfo);
+    SetLogLevel(LogCpu, LogWarning);
+    PICOBOY_LOG(LogInfo, LogCpu, "filtered %d", countFormatted());
+    PICOBOY_LOG(LogError, LogCpu, "kept %d", countFormatted());
+    PICOBOY_LOG(LogDebug, LogMemory, "filtered %d", countFormatted());
+    LogFlush();
+    SetLogSink(nullptr, nullptr);
+    SetLogLevel(LogInfo);
+    if (formatted != 1 || captured.records.size() != 1 || std::string(captured.records[0].message) != "kept 1") {
+        report = std::to_string(formatted) + " formatted, " + std::to_string(captured.records.size()) + " records";
+        return false;
+    }
+    return true;
+}
+
+bool checkRateLimit(std::string &report) {
+    Captured captured;
+    SetLogSink(capture, &captured);
+    SetLogLevel(LogInfo);
+    for (int flush = 0; flush < 2; flush++) {
+        captured.records.clear();
+        for (int i = 0; i < 1000; i++)
+            PICOBOY_LOG(LogWarning, LogMemory, "noisy %d", i);
+        PICOBOY_LOG(LogInfo, LogCartridge, "quiet");
+        LogFlush();
+        // The limit is per category and per flush
+        std::string expected = std::to_string(1000 - LogRateLimit) + " messages dropped";
+        size_t count = captured.records.size();
+        if (count != LogRateLimit + 2 || std::string(captured.records[LogRateLimit].message) != "quiet"
+            || std::string(captured.records[count - 1].message) != expected) {
+            report = std::to_string(count) + " records on flush " + std::to_string(flush);
+            SetLogSink(nullptr, nullptr);
+            return false;
+        }
+    }
+    SetLogSink(nullptr, nullptr);
+    return true;
+}
+
+// Machines built and logging on several threads at once, as picoboyromrunner
+// does; nothing is lost or counted twice
+bool checkThreads(std::string &report) {
+    const int threads = 4, machines = 8, messages = 50;
+    Captured captured;
+    SetLogSink(capture, &captured);
+    SetLogLevel(LogInfo);
+    std::vector<std::thread> workers;
+    for (int t = 0; t < threads; t++) {
+        workers.push_back(std::thread([&]() {
+            for (int i = 0; i < machines; i++) {
+                GBoy gb(new Cartridge(buildSerialRom("")));
+                PICOBOY_LOG(LogInfo, LogCartridge, "machine %d", i);
+            }
+            for (int i = 0; i < messages; i++)
+                PICOBOY_LOG(LogWarning, LogCpu, "message %d", i);
+        }));
+    }
+    for (std::thread &worker : workers)
+        worker.join();
+    LogFlush();
+    SetLogSink(nullptr, nullptr);
+
+    uint32_t counts[LogCategoryCount] = {};
+    std::string droppedCpu;
+    for (const LogRecord &record : captured.records) {
+        if (std::string(record.message).find("messages dropped") != std::string::npos)
+            droppedCpu = record.category == LogCpu ? record.message : droppedCpu;
+        else
+            counts[record.category]++;
+    }
+    std::string expected = std::to_string(threads * messages - LogRateLimit) + " messages dropped";
+    if (counts[LogCartridge] != threads * machines || counts[LogCpu] != LogRateLimit || droppedCpu != expected) {
+        report = std::to_string(counts[LogCartridge]) + " cartridge and " + std::to_string(counts[LogCpu]) + " cpu records, "
+            + droppedCpu;
+        return false;
+    }
+    return true;
+}
+
+int main(int argc, char *argv[]) {
+    const struct { const char *name; std::function<bool(std::string &)> check; } checks[] = {
+        {"buffered", checkBuffered},
+        {"levels", checkLevels},
+        {"limit", checkRateLimit},
+        {"threads", checkThreads},
+    };
+
+    int failed = 0;
+    for (auto &c : checks) {
+        std::string report;
+        if (c.check(report)) {
+            printf("%-8s ok\n", c.name);
+        } else {
+            failed++;
+            printf("%-8s FAILED: %s\n", c.name, report.c_str());
+        }
+    }
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,167 @@
+#include <cmath>
+#include <functional>
+#include <string>
+
+#include "../gboy/FramePacer.h"
+
+// Drives the frame pacer with a fake clock: it has to hold emulated time to
+// real time, recover from stalls without a burst, follow the audio fill level
+// and stay exact over long runs.
+
+struct Host {
+    FramePacer pacer;
+    int64_t now;
+
+    Host(PacingMode mode) : pacer(mode, 48000), now(1000000000) {}
+
+    // Emulates one frame taking work ns, then waits as told and presents it
+    int64_t Frame(int64_t work, size_t audioQueued = 0, bool presented = true) {
+        now += work;
+        int64_t wait = pacer.FrameDone(now, CyclesFrame, audioQueued, presented);
+        now += wait;
+        return wait;
+    }
+};
+
+bool near(int64_t value, int64_t expected, int64_t tolerance) {
+    return std::llabs(value - expected) <= tolerance;
+}
+
+bool checkSteady(std::string &report) {
+    Host host(PacingClock);
+    host.Frame(0);
+    int64_t start = host.now;
+    for (int i = 0; i < 600; i++)
+        host.Frame(5000000 + (i % 7) * 300000);
+    PacingStats stats = host.pacer.GetStats();
+    if (near(host.now - start, 600 * OneFrameDurationNSec, 1000) && near((int64_t)stats.meanNSec, OneFrameDurationNSec, 1000)
+        && stats.jitterNSec < 1000 && stats.late == 0)
+        return true;
+    report = "600 frames in " + std::to_string(host.now - start) + " ns, jitter " + std::to_string(stats.jitterNSec);
+    return false;
+}
+
+bool checkStall(std::string &report) {
+    Host host(PacingClock);
+    for (int i = 0; i < 10; i++)
+        host.Frame(2000000);
+    int64_t stalled = host.Frame(200000000);
+    int64_t next = host.Frame(2000000);
+    if (stalled == 0 && near(next, OneFrameDurationNSec - 2000000, 1000))
+        return true;
+    report = "waited " + std::to_string(stalled) + " then " + std::to_string(next) + " ns";
+    return false;
+}
+
+bool checkSlowHost(std::string &report) {
+    Host host(PacingClock);
+    int64_t waited = 0;
+    for (int i = 0; i < 100; i++)
+        waited += host.Frame(OneFrameDurationNSec + 1000000);
+    if (waited == 0)
+        return true;
+    report = "waited " + std::to_string(waited) + " ns while behind";
+    return false;
+}
+
+bool checkAudio(std::string &report) {
+    Host host(PacingAudio);
+    int64_t over = host.Frame(0, PacingAudioTarget + 480);
+    int64_t under = host.Frame(0, PacingAudioTarget - 100);
+    int64_t capped = host.Frame(0, 8192);
+    if (over == 10000000 && under == 0 && capped == 2 * OneFrameDurationNSec)
+        return true;
+    report = "waits " + std::to_string(over) + ", " + std::to_string(under) + ", " + std::to_string(capped);
+    return false;
+}
+
+bool checkOff(std::string &report) {
+    Host host(PacingOff);
+    int64_t waited = 0;
+    for (int i = 0; i < 10; i++)
+        waited += host.Frame(1000000, 8192);
+    if (waited == 0)
+        return true;
+    report = "waited " + std::to_string(waited) + " ns";
+    return false;
+}
+
+// Ten hours of frames must not drift
+bool checkLongRun(std::string &report) {
+    Host host(PacingClock);
+    host.Frame(0);
+    int64_t start = host.now;
+    const uint64_t frames = 10ull * 3600 * CyclesCpu / CyclesFrame;
+    for (uint64_t i = 0; i < frames; i++)
+        host.Frame(3000000);
+    uint64_t cycles = frames * CyclesFrame;
+    int64_t expected = (int64_t)(cycles / CyclesCpu * 1000000000 + cycles % CyclesCpu * 1000000000 / CyclesCpu);
+    if (near(host.now - start, expected, 1))
+        return true;
+    report = "off by " + std::to_string(host.now - start - expected) + " ns";
+    return false;
+}
+
+// Fast-forward ignores the audio, holds 4x to the clock and presents one
+// frame per host refresh; uncapped it never waits
+bool checkTurbo(std::string &report) {
+    Host host(PacingAudio);
+    host.pacer.SetSpeed(4);
+    host.Frame(0, 8192, false);
+    int64_t start = host.now;
+    bool shown = true;
+    uint32_t presented = 0;
+    for (int i = 0; i < 480; i++) {
+        host.Frame(1000000, 8192, shown);
+        presented += shown;
+        shown = host.pacer.WantsFrame(host.now);
+    }
+    int64_t elapsed = host.now - start;
+    PacingStats stats = host.pacer.GetStats();
+
+    host.pacer.SetSpeed(PacingSpeedUnlimited);
+    int64_t waited = 0;
+    for (int i = 0; i < 100; i++)
+        waited += host.Frame(1000000, 8192, false);
+    if (near(elapsed, 120 * OneFrameDurationNSec, 1000) && presented == 120 && stats.late == 0
+        && stats.meanNSec >= PacingPresentNSec && waited == 0)
+        return true;
+    report = std::to_string(presented) + " of 480 frames presented in " + std::to_string(elapsed) + " ns, then waited "
+        + std::to_string(waited) + " ns uncapped";
+    return false;
+}
+
+bool checkWait(std::string &report) {
+    int64_t start = FramePacer::Now();
+    FramePacer::Wait(2000000);
+    int64_t elapsed = FramePacer::Now() - start;
+    if (elapsed >= 2000000)
+        return true;
+    report = "returned after " + std::to_string(elapsed) + " ns";
+    return false;
+}
+
+int main(int argc, char *argv[]) {
+    const struct { const char *name; std::function<bool(std::string &)> check; } checks[] = {
+        {"steady", checkSteady},
+        {"stall", checkStall},
+        {"slowhost", checkSlowHost},
+        {"audio", checkAudio},
+        {"off", checkOff},
+        {"longrun", checkLongRun},
+        {"turbo", checkTurbo},
+        {"wait", checkWait},
+    };
+
+    int failed = 0;
+    for (auto &c : checks) {
+        std::string report;
+        if (c.check(report)) {
+            printf("%-8s ok\n", c.name);
+        } else {
+            failed++;
+            printf("%-8s FAILED: %s\n", c.name, report.c_str());
+        }
+    }
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,188 @@
+#include <algorithm>
+#include <functional>
+#include <map>
+#include <sstream>
+#include <string>
+
+#include "../gboy/GBoy.h"
+#include "../gboy/RomBuilder.h"
+#include "../gboy/Workloads.h"
+
+// Profiles a ROM with known calls and interrupts and checks the call tree,
+// that every cycle is attributed, and that the engines agree per address.
+
+struct CallRom {
+    std::vector<uint8_t> rom;
+    uint16_t outer, inner, escape;
+};
+
+// main calls outer, which calls inner twice and then escape. escape drops
+// its return address and jumps back into outer, so only outer's RET
+// unwinds it. VBlank interrupts land anywhere in between.
+CallRom buildCallRom() {
+    CallRom r;
+    RomBuilder rb("PROFILE");
+    uint16_t position = rb.Here();
+    rb.Org(AddrVectorVBlank);
+    rb.Jp(CondAlways, "vblank");
+    rb.Org(position);
+
+    rb.Label("main");
+    rb.Di();
+    rb.LdImm16(RegSP, 0xfffe);
+    rb.LdImm(RegA, 1 << FlagInterruptVBlank);
+    rb.LdhIoFromA(0xff);
+    rb.Alu(AluXor, RegA);
+    rb.LdhIoFromA(0x0f);
+    rb.Ei();
+    rb.Label("loop");
+    rb.Call("outer");
+    rb.Jr(CondAlways, "loop");
+
+    r.outer = rb.Here();
+    rb.Label("outer");
+    rb.Call("inner");
+    rb.Call("inner");
+    rb.Call("escape");
+    rb.Label("escaped");
+    rb.Ret();
+
+    r.inner = rb.Here();
+    rb.Label("inner");
+    rb.LdImm(RegB, 200);
+    rb.Label("innerLoop");
+    rb.Dec(RegB);
+    rb.Jr(CondNZ, "innerLoop");
+    rb.Ret();
+
+    r.escape = rb.Here();
+    rb.Label("escape");
+    rb.Inc16(RegSP);
+    rb.Inc16(RegSP);
+    rb.Jp(CondAlways, "escaped");
+
+    rb.Label("vblank");
+    rb.Push(RegAF);
+    rb.Pop(RegAF);
+    rb.Reti();
+    r.rom = rb.Build();
+    return r;
+}
+
+// Cycles per folded stack
+std::map<std::string, uint64_t> runFolded(const std::vector<uint8_t> &rom, uint32_t frames, CpuEngine engine,
+    Profiler &profiler, uint64_t *cycles = nullptr) {
+    GBoy gb(new Cartridge(rom));
+    gb.GetMMU()->SetSerialEcho(false);
+    gb.SetCpuEngine(engine);
+    gb.SetProfiler(&profiler);
+    while (frames > 0) {
+        uint32_t step = gb.ExecuteStep();
+        if (cycles)
+            *cycles += step;
+        if (gb.GetFrameBufferUpdatedFlag()) {
+            gb.SetFrameBufferUpdatedFlag(false);
+            frames--;
+        }
+    }
+    gb.SetProfiler(nullptr);
+
+    FILE *out = tmpfile();
+    profiler.WriteFolded(out);
+    std::string text(ftell(out), '\0');
+    rewind(out);
+    fread(&text[0], 1, text.size(), out);
+    fclose(out);
+
+    std::map<std::string, uint64_t> stacks;
+    std::istringstream lines(text);
+    std::string stack;
+    uint64_t count;
+    while (lines >> stack >> count)
+        stacks[stack] += count;
+    return stacks;
+}
+
+std::string frame(uint16_t addr) {
+    char name[16];
+    snprintf(name, sizeof(name), ";00:%04x", addr);
+    return name;
+}
+
+bool checkTree(std::string &report) {
+    CallRom r = buildCallRom();
+    Profiler profiler;
+    std::map<std::string, uint64_t> stacks = runFolded(r.rom, 10, EngineInterpreter, profiler);
+    std::string outer = "reset" + frame(r.outer);
+    bool interrupted = false, tooDeep = false;
+    for (auto &s : stacks) {
+        interrupted |= s.first.find(";int:vblank") != std::string::npos;
+        // reset;outer;inner plus at most one interrupt
+        tooDeep |= std::count(s.first.begin(), s.first.end(), ';') > 3;
+    }
+    if (stacks[outer] > 0 && stacks[outer + frame(r.inner)] > stacks[outer] && stacks[outer + frame(r.escape)] > 0
+        && interrupted && !tooDeep && stacks.size() < 20)
+        return true;
+    report = std::to_string(stacks.size()) + " stacks:";
+    for (auto &s : stacks)
+        report += " " + s.first;
+    return false;
+}
+
+// Halted and skipped cycles are attributed too
+bool checkTotal(std::string &report) {
+    for (int w = 0; w < WorkloadCount; w++) {
+        Profiler profiler;
+        uint64_t cycles = 0;
+        runFolded(BuildWorkloadRom((Workload)w), 20, EngineCached, profiler, &cycles);
+        if (profiler.GetTotalCycles() != cycles) {
+            report = std::string(WorkloadName((Workload)w)) + ": " + std::to_string(profiler.GetTotalCycles()) + " of "
+                + std::to_string(cycles) + " cycles attributed";
+            return false;
+        }
+    }
+    return true;
+}
+
+// Fused groups split their cycles over their instructions like the interpreter
+bool checkEngines(std::string &report) {
+    for (Workload w : {WorkloadMemcpy, WorkloadLyPoll, WorkloadAlu}) {
+        Profiler interpreted, cached;
+        std::map<std::string, uint64_t> a = runFolded(BuildWorkloadRom(w), 20, EngineInterpreter, interpreted);
+        std::map<std::string, uint64_t> b = runFolded(BuildWorkloadRom(w), 20, EngineCached, cached);
+        for (uint32_t addr = 0; addr < 0x10000; addr++) {
+            if (interpreted.GetCycles(0, addr) != cached.GetCycles(0, addr)) {
+                char line[128];
+                snprintf(line, sizeof(line), "%s: %04x has %llu cycles, %llu on the cached engine", WorkloadName(w), addr,
+                    (unsigned long long)interpreted.GetCycles(0, addr), (unsigned long long)cached.GetCycles(0, addr));
+                report = line;
+                return false;
+            }
+        }
+        if (a != b) {
+            report = std::string(WorkloadName(w)) + ": call stacks differ";
+            return false;
+        }
+    }
+    return true;
+}
+
+int main(int argc, char *argv[]) {
+    const struct { const char *name; std::function<bool(std::string &)> check; } checks[] = {
+        {"tree", checkTree},
+        {"total", checkTotal},
+        {"engines", checkEngines},
+    };
+
+    int failed = 0;
+    for (auto &c : checks) {
+        std::string report;
+        if (c.check(report)) {
+            printf("%-8s ok\n", c.name);
+        } else {
+            failed++;
+            printf("%-8s FAILED: %s\n", c.name, report.c_str());
+        }
+    }
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,226 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <dirent.h>
+#include <string>
+#include <sys/stat.h>
+#include <thread>
+#include <vector>
+
+#include "../gboy/GBoy.h"
+
+// Runs test ROMs headless and decides pass/fail from what they report:
+//  - blargg style: "Passed" / "Failed" text sent over the serial port
+//  - mooneye style: LD B,B breakpoint with B,C,D,E,H,L = 3,5,8,13,21,34 on success
+// Anything else is a timeout once the cycle budget runs out.
+
+const uint8_t OpcodeBreakpoint = 0x40; // LD B,B
+const uint64_t DefaultTimeoutCycles = 4194304ull * 120;
+const uint32_t SerialCheckInterval = 1 << 16;
+
+enum RomStatus {
+    RomPassed,
+    RomFailed,
+    RomTimeout,
+    RomUnsupported,
+};
+
+const char *RomStatusNames[] = {"PASS", "FAIL", "TIMEOUT", "UNSUPPORTED"};
+
+struct RomResult {
+    std::string path;
+    RomStatus status;
+    uint64_t cycles;
+    double seconds;
+    std::string serial;
+};
+
+bool isDirectory(const std::string &path) {
+    struct stat st;
+    return stat(path.c_str(), &st) == 0 && S_ISDIR(st.st_mode);
+}
+
+bool isFile(const std::string &path) {
+    struct stat st;
+    return stat(path.c_str(), &st) == 0 && S_ISREG(st.st_mode);
+}
+
+bool hasRomExtension(const std::string &name) {
+    size_t dot = name.rfind('.');
+    if (dot == std::string::npos)
+        return false;
+    std::string ext = name.substr(dot);
+    return ext == ".gb" || ext == ".gbc";
+}
+
+// Collects ROMs below path, recursing into directories
+void collectRoms(const std::string &path, std::vector<std::string> &roms) {
+    if (!isDirectory(path)) {
+        if (isFile(path))
+            roms.push_back(path);
+        else
+            printf("Skipping missing path: %s\n", path.c_str());
+        return;
+    }
+
+    DIR *dir = opendir(path.c_str());
+    if (!dir)
+        return;
+    std::vector<std::string> entries;
+    while (struct dirent *entry = readdir(dir)) {
+        std::string name = entry->d_name;
+        if (name != "." && name != "..")
+            entries.push_back(name);
+    }
+    closedir(dir);
+
+    std::sort(entries.begin(), entries.end());
+    for (const std::string &name : entries) {
+        std::string child = path + "/" + name;
+        if (isDirectory(child))
+            collectRoms(child, roms);
+        else if (hasRomExtension(name))
+            roms.push_back(child);
+    }
+}
+
+bool isBreakpointPass(CentralProcessingUnit *cpu) {
+    return cpu->b == 3 && cpu->c == 5 && cpu->d == 8 && cpu->e == 13 && cpu->h == 21 && cpu->l == 34;
+}
+
+void runRom(RomResult &result, uint64_t timeoutCycles, bool idleSkipping) {
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    Cartridge *cart = new Cartridge(result.path);
+    result.status = RomTimeout;
+    result.cycles = 0;
+
+    if (!cart->IsSupported()) {
+        result.status = RomUnsupported;
+        delete cart;
+        return;
+    }
+
+    GBoy *gb = new GBoy(cart);
+    CentralProcessingUnit *cpu = gb->GetCPU();
+    MemoryManagementUnit *mmu = gb->GetMMU();
+    mmu->SetSerialEcho(false);
+    gb->SetIdleLoopSkipping(idleSkipping);
+
+    uint32_t sinceCheck = 0;
+    while (result.cycles < timeoutCycles) {
+        if (mmu->Read(cpu->programCounter) == OpcodeBreakpoint && !cpu->isHalted) {
+            result.status = isBreakpointPass(cpu) ? RomPassed : RomFailed;
+            break;
+        }
+
+        uint32_t cycles = gb->ExecuteStep();
+        result.cycles += cycles;
+        sinceCheck += cycles;
+
+        if (sinceCheck >= SerialCheckInterval) {
+            sinceCheck = 0;
+            const std::string &serial = mmu->GetSerialOutput();
+            if (serial.find("Passed") != std::string::npos) {
+                result.status = RomPassed;
+                break;
+            }
+            if (serial.find("Failed") != std::string::npos) {
+                result.status = RomFailed;
+                break;
+            }
+        }
+    }
+
+    result.serial = mmu->GetSerialOutput();
+    result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    delete gb;
+    delete cart;
+}
+
+// Last non-empty line of the serial output, for the summary table
+std::string lastLine(const std::string &text) {
+    size_t end = text.find_last_not_of("\r\n ");
+    if (end == std::string::npos)
+        return "";
+    size_t begin = text.find_last_of('\n', end);
+    begin = (begin == std::string::npos) ? 0 : begin + 1;
+    return text.substr(begin, end - begin + 1);
+}
+
+void writeReport(FILE *out, const std::vector<RomResult> &results, bool verbose) {
+    int counts[4] = {};
+    for (const RomResult &r : results) {
+        counts[r.status]++;
+        fprintf(out, "%-11s %-48s %12llu cycles %7.2fs  %s\n", RomStatusNames[r.status], r.path.c_str(),
+            (unsigned long long)r.cycles, r.seconds, lastLine(r.serial).c_str());
+        if (verbose && r.status != RomPassed && !r.serial.empty())
+            fprintf(out, "%s\n", r.serial.c_str());
+    }
+    fprintf(out, "%zu roms: %d passed, %d failed, %d timed out, %d unsupported\n",
+        results.size(), counts[RomPassed], counts[RomFailed], counts[RomTimeout], counts[RomUnsupported]);
+}
+
+int main(int argc, char *argv[]) {
+    uint64_t timeoutCycles = DefaultTimeoutCycles;
+    int threads = std::thread::hardware_concurrency();
+    std::string reportPath;
+    bool verbose = false;
+    bool idleSkipping = true;
+    std::vector<std::string> roms;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--timeout" && i + 1 < argc)
+            timeoutCycles = std::stoull(argv[++i]);
+        else if (arg == "--threads" && i + 1 < argc)
+            threads = std::stoi(argv[++i]);
+        else if (arg == "--report" && i + 1 < argc)
+            reportPath = argv[++i];
+        else if (arg == "--verbose")
+            verbose = true;
+        else if (arg == "--no-idle-skip")
+            idleSkipping = false;
+        else if (arg.size() > 2 && arg.compare(0, 2, "--") == 0) {
+            printf("Usage: %s [--timeout cycles] [--threads n] [--report file] [--verbose] [--no-idle-skip] rom-or-dir...\n", argv[0]);
+            return 1;
+        } else
+            collectRoms(arg, roms);
+    }
+    if (roms.empty()) {
+        printf("No test ROMs found\n");
+        return 1;
+    }
+    if (threads < 1)
+        threads = 1;
+
+    std::vector<RomResult> results(roms.size());
+    for (size_t i = 0; i < roms.size(); i++)
+        results[i].path = roms[i];
+
+    std::atomic<size_t> next(0);
+    std::vector<std::thread> workers;
+    for (int t = 0; t < threads; t++) {
+        workers.push_back(std::thread([&]() {
+            for (size_t i = next++; i < results.size(); i = next++)
+                runRom(results[i], timeoutCycles, idleSkipping);
+        }));
+    }
+    for (std::thread &worker : workers)
+        worker.join();
+
+    writeReport(stdout, results, verbose);
+    if (!reportPath.empty()) {
+        FILE *out = fopen(reportPath.c_str(), "w");
+        if (!out) {
+            printf("Unable to write %s\n", reportPath.c_str());
+            return 1;
+        }
+        writeReport(out, results, true);
+        fclose(out);
+    }
+
+    for (const RomResult &r : results)
+        if (r.status != RomPassed)
+            return 1;
+    return 0;
+}
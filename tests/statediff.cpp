@@ -0,0 +1,377 @@
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../gboy/CPU.h"
+#include "../gboy/Workloads.h"
+#include "Reference.h"
+
+// Runs every opcode of both instruction sets against randomized states on the
+// real CPU and on the reference interpreter, diffing registers, flags, IME,
+// HALT state, memory and cycle counts. Pointers the opcode dereferences are
+// confined to WRAM/HRAM so both sides see plain memory. Every other case is
+// preceded by a random 8-bit ALU op, so the opcode also sees flags the CPU has
+// not materialized yet.
+
+const uint16_t CodeStart = 0xC001;
+
+// Compile every block at once and stop runs after one instruction, so the JIT
+// is held to the same single-step results as the reference
+const JitOptions SingleStepJitOptions = {0, 1, false};
+const uint16_t CodeEnd = 0xDFF0;
+
+struct OpcodeResult {
+    uint32_t opcode;
+    uint64_t cases;
+    uint64_t failures;
+    std::string firstFailure;
+};
+
+// Per-thread xorshift64*, deterministic for a given seed
+class Random {
+private:
+    uint64_t state;
+public:
+    Random(uint64_t seed) : state(seed ? seed : 0x9e3779b97f4a7c15ull) {}
+    uint64_t Next() {
+        state ^= state >> 12;
+        state ^= state << 25;
+        state ^= state >> 27;
+        return state * 0x2545f4914f6cdd1dull;
+    }
+    uint8_t Byte() { return Next() >> 56; }
+    uint16_t Range(uint16_t lo, uint16_t hi) { return lo + (Next() >> 32) % (hi - lo + 1); }
+};
+
+// Memory operands an opcode touches, so the generator can keep them in RAM
+struct CaseShape {
+    bool hl, bc, de, stack, absolute, highImmediate, highC;
+};
+
+bool isUnmodelled(uint8_t opcode) {
+    switch (opcode) {
+        case 0x10:
+        case 0xD3: case 0xDB: case 0xDD:
+        case 0xE3: case 0xE4: case 0xEB: case 0xEC: case 0xED:
+        case 0xF4: case 0xFC: case 0xFD:
+            return true;
+    }
+    return false;
+}
+
+CaseShape shapeOf(bool extended, uint8_t op) {
+    CaseShape shape = {};
+    int x = op >> 6, y = (op >> 3) & 7, z = op & 7;
+    if (extended) {
+        shape.hl = (z == 6);
+        return shape;
+    }
+    shape.hl = (x == 1 && (y == 6 || z == 6) && op != 0x76) || (x == 2 && z == 6)
+        || (x == 0 && z >= 4 && z <= 6 && y == 6)
+        || op == 0x22 || op == 0x2A || op == 0x32 || op == 0x3A;
+    shape.bc = (op == 0x02 || op == 0x0A);
+    shape.de = (op == 0x12 || op == 0x1A);
+    shape.stack = (x == 3 && ((z == 0 && y < 4) || (z == 4 && y < 4) || z == 5 || z == 7))
+        || op == 0xC1 || op == 0xD1 || op == 0xE1 || op == 0xF1 || op == 0xC9 || op == 0xD9;
+    shape.absolute = (op == 0x08 || op == 0xEA || op == 0xFA);
+    shape.highImmediate = (op == 0xE0 || op == 0xF0);
+    shape.highC = (op == 0xE2 || op == 0xF2);
+    return shape;
+}
+
+uint16_t ramPointer(Random &random, uint16_t span) {
+    return random.Next() & 1 ? random.Range(0xC000, 0xE000 - span) : random.Range(0xFF80, 0xFFFF - span);
+}
+
+void addRandomBytes(ReferenceMemory &mem, Random &random, uint16_t addr, int count) {
+    for (int i = 0; i < count; i++)
+        mem.Set(addr + i, random.Byte());
+}
+
+// Builds a random starting state for one opcode into ref
+void generateCase(Random &random, bool extended, uint8_t op, const CaseShape &shape, ReferenceCpu &ref) {
+    ReferenceState &s = ref.s;
+    s.a = random.Byte(), s.f = random.Byte() & 0xf0;
+    s.b = random.Byte(), s.c = random.Byte(), s.d = random.Byte(), s.e = random.Byte();
+    s.h = random.Byte(), s.l = random.Byte();
+    s.sp = random.Next();
+    s.pc = random.Range(CodeStart, CodeEnd);
+    s.ime = random.Next() & 1;
+    s.imePending = random.Next() & 1;
+    s.halted = false;
+
+    uint16_t operand = random.Next();
+    if (shape.absolute)
+        operand = random.Range(0xC000, 0xDFFE);
+    if (shape.highImmediate)
+        operand = random.Range(0x80, 0xFE);
+    if (shape.highC)
+        s.c = random.Range(0x80, 0xFE);
+
+    ReferenceMemory &mem = ref.mem;
+    mem.Clear();
+    if (shape.hl) {
+        uint16_t hl = ramPointer(random, 1);
+        s.h = hl >> 8, s.l = hl & 0xff;
+        addRandomBytes(mem, random, hl, 1);
+    }
+    if (shape.bc) {
+        uint16_t bc = ramPointer(random, 1);
+        s.b = bc >> 8, s.c = bc & 0xff;
+        addRandomBytes(mem, random, bc, 1);
+    }
+    if (shape.de) {
+        uint16_t de = ramPointer(random, 1);
+        s.d = de >> 8, s.e = de & 0xff;
+        addRandomBytes(mem, random, de, 1);
+    }
+    if (shape.stack) {
+        s.sp = random.Range(0xC002, 0xDFFE);
+        addRandomBytes(mem, random, s.sp - 2, 4);
+    }
+    if (shape.absolute)
+        addRandomBytes(mem, random, operand, 2);
+    if (shape.highImmediate)
+        addRandomBytes(mem, random, 0xFF00 + (operand & 0xff), 1);
+    if (shape.highC)
+        addRandomBytes(mem, random, 0xFF00 + s.c, 1);
+
+    // Code goes in last so it wins over any overlapping operand
+    if (extended) {
+        mem.Set(s.pc, 0xCB);
+        mem.Set(s.pc + 1, op);
+    } else {
+        mem.Set(s.pc, op);
+        mem.Set(s.pc + 1, operand & 0xff);
+        mem.Set(s.pc + 2, operand >> 8);
+    }
+}
+
+void loadCpu(CentralProcessingUnit *cpu, MemoryManagementUnit *mmu, const ReferenceCpu &ref) {
+    const ReferenceState &s = ref.s;
+    cpu->accumulator = s.a;
+    cpu->b = s.b, cpu->c = s.c, cpu->d = s.d;
+    cpu->e = s.e, cpu->h = s.h, cpu->l = s.l;
+    cpu->SetFlags(s.f);
+    cpu->stackPointer = s.sp;
+    cpu->programCounter = s.pc;
+    cpu->interruptMasterFlag = s.ime;
+    cpu->interruptEnablePending = s.imePending;
+    cpu->isHalted = s.halted;
+    for (int i = 0; i < ref.mem.count; i++)
+        mmu->Write(ref.mem.addr[i], ref.mem.value[i], true);
+}
+
+std::string describeState(const ReferenceState &s) {
+    char line[160];
+    snprintf(line, sizeof(line), "a=%02x f=%02x b=%02x c=%02x d=%02x e=%02x h=%02x l=%02x sp=%04x pc=%04x ime=%d%s halted=%d",
+        s.a, s.f, s.b, s.c, s.d, s.e, s.h, s.l, s.sp, s.pc, s.ime, s.imePending ? "+ei" : "", s.halted);
+    return line;
+}
+
+// Returns an empty string when the real CPU matches the reference
+std::string diffCpu(CentralProcessingUnit *cpu, MemoryManagementUnit *mmu, const ReferenceCpu &ref, int refCycles, int cycles) {
+    const ReferenceState &s = ref.s;
+    std::string report;
+    char line[128];
+
+    const char *names[] = {"a", "b", "c", "d", "e", "h", "l"};
+    const uint8_t expected[] = {s.a, s.b, s.c, s.d, s.e, s.h, s.l};
+    const uint8_t found[] = {cpu->accumulator, cpu->b, cpu->c, cpu->d, cpu->e, cpu->h, cpu->l};
+    for (int i = 0; i < 7; i++) {
+        if (expected[i] != found[i]) {
+            snprintf(line, sizeof(line), "    %s expected %02x found %02x\n", names[i], expected[i], found[i]);
+            report += line;
+        }
+    }
+    uint8_t flags = cpu->GetFlags();
+    if (flags != s.f) {
+        snprintf(line, sizeof(line), "    f expected %02x found %02x\n", s.f, flags);
+        report += line;
+    }
+    if (cpu->stackPointer != s.sp) {
+        snprintf(line, sizeof(line), "    sp expected %04x found %04x\n", s.sp, cpu->stackPointer);
+        report += line;
+    }
+    if (cpu->programCounter != s.pc) {
+        snprintf(line, sizeof(line), "    pc expected %04x found %04x\n", s.pc, cpu->programCounter);
+        report += line;
+    }
+    if (cpu->interruptMasterFlag != s.ime) {
+        snprintf(line, sizeof(line), "    ime expected %d found %d\n", s.ime, cpu->interruptMasterFlag);
+        report += line;
+    }
+    if (cpu->interruptEnablePending != s.imePending) {
+        snprintf(line, sizeof(line), "    pending EI expected %d found %d\n", s.imePending, cpu->interruptEnablePending);
+        report += line;
+    }
+    if (cpu->isHalted != s.halted) {
+        snprintf(line, sizeof(line), "    halted expected %d found %d\n", s.halted, cpu->isHalted);
+        report += line;
+    }
+    if (cycles != refCycles) {
+        snprintf(line, sizeof(line), "    cycles expected %d found %d\n", refCycles, cycles);
+        report += line;
+    }
+    for (int i = 0; i < ref.mem.count; i++) {
+        uint8_t v = mmu->Read(ref.mem.addr[i], true);
+        if (v != ref.mem.value[i]) {
+            snprintf(line, sizeof(line), "    [%04x] expected %02x found %02x\n", ref.mem.addr[i], ref.mem.value[i], v);
+            report += line;
+        }
+    }
+    return report;
+}
+
+// ADD/ADC/SUB/SBC/AND/XOR/OR/CP A,r with r not (HL); these only change A and F
+uint8_t randomAluOp(Random &random) {
+    uint8_t op;
+    do
+        op = 0x80 | (random.Byte() & 0x3f);
+    while ((op & 7) == 6);
+    return op;
+}
+
+void runOpcode(CentralProcessingUnit *cpu, MemoryManagementUnit *mmu, Random &random, uint64_t cases, OpcodeResult &result) {
+    bool extended = result.opcode > 0xff;
+    uint8_t op = result.opcode & 0xff;
+    CaseShape shape = shapeOf(extended, op);
+    ReferenceCpu ref;
+
+    for (uint64_t i = 0; i < cases; i++) {
+        generateCase(random, extended, op, shape, ref);
+        bool prefixed = i & 1;
+        uint8_t prefix = 0;
+        if (prefixed) {
+            prefix = randomAluOp(random);
+            ref.s.pc--;
+            ref.mem.Set(ref.s.pc, prefix);
+        }
+        loadCpu(cpu, mmu, ref);
+        ReferenceState before = ref.s;
+
+        int refCycles = 0, cycles = 0;
+        if (prefixed) {
+            refCycles += ref.Step();
+            cycles += cpu->ExecuteInstruction();
+        }
+        refCycles += ref.Step();
+        cycles += cpu->ExecuteInstruction();
+        result.cases++;
+
+        if (ref.mem.outOfBounds) {
+            if (result.firstFailure.empty())
+                result.firstFailure = "    reference accessed memory outside the generated case\n";
+            result.failures++;
+            continue;
+        }
+
+        std::string report = diffCpu(cpu, mmu, ref, refCycles, cycles);
+        if (report.empty())
+            continue;
+        if (result.failures++ == 0) {
+            result.firstFailure = "    before: " + describeState(before) + "\n";
+            if (prefixed) {
+                char line[64];
+                snprintf(line, sizeof(line), "    after prefix op %02x\n", prefix);
+                result.firstFailure += line;
+            }
+            for (int m = 0; m < ref.mem.count; m++) {
+                char line[64];
+                snprintf(line, sizeof(line), "    [%04x] = %02x\n", ref.mem.addr[m], ref.mem.value[m]);
+                result.firstFailure += line;
+            }
+            result.firstFailure += report;
+        }
+    }
+}
+
+int main(int argc, char *argv[]) {
+    uint64_t cases = 20000;
+    uint64_t seed = 1;
+    int threads = std::thread::hardware_concurrency();
+    int only = -1;
+    CpuEngine engine = EngineInterpreter;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--cases" && i + 1 < argc)
+            cases = std::stoull(argv[++i]);
+        else if (arg == "--seed" && i + 1 < argc)
+            seed = std::stoull(argv[++i]);
+        else if (arg == "--threads" && i + 1 < argc)
+            threads = std::stoi(argv[++i]);
+        else if (arg == "--opcode" && i + 1 < argc)
+            only = std::stoi(argv[++i], nullptr, 16);
+        else if (arg == "--engine" && i + 1 < argc && CpuEngineFromName(argv[i + 1], engine))
+            i++;
+        else {
+            printf("Usage: %s [--cases n] [--seed n] [--threads n] [--opcode hex (cbxx for extended)] [--engine name]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (threads < 1)
+        threads = 1;
+
+    std::vector<OpcodeResult> results;
+    for (uint32_t opcode = 0; opcode < 0x200; opcode++) {
+        if (opcode == 0xCB || (opcode < 0x100 && isUnmodelled(opcode)))
+            continue;
+        if (only >= 0 && (uint32_t)only != (opcode < 0x100 ? opcode : 0xCB00 | (opcode & 0xff)))
+            continue;
+        results.push_back({opcode, 0, 0, ""});
+    }
+
+    std::vector<uint8_t> rom = BuildBlankRom();
+    std::atomic<size_t> next(0);
+    std::mutex outputLock;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    std::vector<std::thread> workers;
+    for (int t = 0; t < threads; t++) {
+        workers.push_back(std::thread([&, t]() {
+            Cartridge cart(rom);
+            MemoryManagementUnit *mmu;
+            CentralProcessingUnit *cpu;
+            {
+                std::lock_guard<std::mutex> lock(outputLock);
+                mmu = new MemoryManagementUnit(&cart);
+                cpu = new CentralProcessingUnit(mmu);
+            }
+            cpu->SetEngine(engine);
+            cpu->SetJitOptions(SingleStepJitOptions);
+            for (size_t i = next++; i < results.size(); i = next++) {
+                Random random(seed * 0x100000001b3ull + results[i].opcode);
+                runOpcode(cpu, mmu, random, cases, results[i]);
+            }
+            delete cpu;
+            delete mmu;
+        }));
+    }
+    for (std::thread &worker : workers)
+        worker.join();
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    uint64_t total = 0, failures = 0;
+    int failedOpcodes = 0;
+    for (const OpcodeResult &r : results) {
+        total += r.cases;
+        failures += r.failures;
+        if (!r.failures)
+            continue;
+        failedOpcodes++;
+        if (r.opcode > 0xff)
+            printf("FAILED CB %02X: %llu of %llu cases\n", r.opcode & 0xff, (unsigned long long)r.failures, (unsigned long long)r.cases);
+        else
+            printf("FAILED %02X: %llu of %llu cases\n", r.opcode, (unsigned long long)r.failures, (unsigned long long)r.cases);
+        printf("%s", r.firstFailure.c_str());
+    }
+
+    printf("%zu opcodes, %d failed, %llu cases (%llu failed) in %.3fs, %.1fM cases/s on %d threads (seed %llu, %s engine)\n",
+        results.size(), failedOpcodes, (unsigned long long)total, (unsigned long long)failures,
+        seconds, total / seconds / 1e6, threads, (unsigned long long)seed, CpuEngineName(engine));
+    return failedOpcodes == 0 ? 0 : 1;
+}
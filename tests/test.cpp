@@ -1,154 +1,160 @@
+#include <chrono>
 #include <iostream>
 #include <string>
-#include <sstream>
 
 #include "../gboy/CPU.h"
-#include "json.hpp"
-
-using json = nlohmann::json;
-
-uint16_t convertHexaString(std::string hexstr) {
-    uint16_t res = 0;
-    std::stringstream ss;
-    ss << std::hex << hexstr;
-    ss >> res;
-    return res;
+#include "../gboy/Workloads.h"
+#include "OpcodeVectors.h"
+
+const int MaxReportedFailures = 20;
+
+// Compile every block at once and stop runs after one instruction, since each
+// vector checks the state after a single instruction
+const JitOptions SingleStepJitOptions = {0, 1, false};
+
+// Vectors are only run when every address they touch is plain RAM, since
+// the cartridge and IO ranges are not writable the way a flat test memory is.
+bool isPlainRam(uint16_t addr, uint16_t count) {
+    for (uint32_t a = addr; a < (uint32_t)addr + count; a++) {
+        bool ram = (a >= 0x8000 && a <= 0xDFFF) || (a >= 0xFF80 && a <= 0xFFFE);
+        if (!ram)
+            return false;
+    }
+    return true;
 }
 
-void loadCPURegisters(CentralProcessingUnit* cpu, json registers) {
-    if(registers.is_null()) 
-        return;
-
-    cpu->b = registers["b"];
-    cpu->c = registers["c"];
-    cpu->d = registers["d"];
-    cpu->e = registers["e"];
-    cpu->h = registers["h"];
-    cpu->l = registers["l"];
-    cpu->accumulator = registers["a"];
+bool isRunnable(const OpcodeVector &v, uint16_t pc) {
+    if (!isPlainRam(pc, v.code.size()))
+        return false;
+    for (const VectorMemory &m : v.preload.memory)
+        if (!isPlainRam(m.addr, m.count))
+            return false;
+    for (const VectorMemory &m : v.check.memory)
+        if (!isPlainRam(m.addr, m.count))
+            return false;
+    return true;
 }
 
-void loadCPUFlags(CentralProcessingUnit* cpu, json flags) {
-    if(flags.is_null()) 
-        return;
-
-    cpu->isZero = flags["z"];
-    cpu->isSubtract = flags["n"];
-    cpu->isHalfCarry = flags["h"];
-    cpu->isCarry = flags["c"];
+void loadState(CentralProcessingUnit *cpu, MemoryManagementUnit *mmu, const VectorState &s) {
+    if (s.fields & VectorRegisters) {
+        cpu->accumulator = s.a;
+        cpu->b = s.b, cpu->c = s.c, cpu->d = s.d;
+        cpu->e = s.e, cpu->h = s.h, cpu->l = s.l;
+    }
+    if (s.fields & VectorFlags) {
+        cpu->SetFlags(s.f);
+    }
+    if (s.fields & VectorStackPointer)
+        cpu->stackPointer = s.sp;
+    if (s.fields & VectorProgramCounter)
+        cpu->programCounter = s.pc;
+    for (const VectorMemory &m : s.memory)
+        for (uint32_t i = 0; i < m.count; i++)
+            mmu->Write(m.addr + i, m.value, true);
 }
 
-void loadMemory(MemoryManagementUnit* mmu, json memory) {
-    if(memory.is_null()) 
-        return;
-
-    for (auto& element : memory) {
-        uint16_t address = convertHexaString(element["at"]);
-        uint16_t count = element["next"];
-        uint8_t value = element["value"];
-        for (int i = 0; i < count; i++) {
-            mmu->Write(address + i, value);
+// Appends a description of every mismatch to report, returns true if the state matched
+bool checkState(CentralProcessingUnit *cpu, MemoryManagementUnit *mmu, const VectorState &s, uint8_t cycles, std::string &report) {
+    char line[128];
+    size_t before = report.size();
+
+    if (s.fields & VectorRegisters) {
+        const char names[] = "abcdehl";
+        const uint8_t expected[] = {s.a, s.b, s.c, s.d, s.e, s.h, s.l};
+        const uint8_t found[] = {cpu->accumulator, cpu->b, cpu->c, cpu->d, cpu->e, cpu->h, cpu->l};
+        for (int i = 0; i < 7; i++) {
+            if (expected[i] != found[i]) {
+                snprintf(line, sizeof(line), "  [Register check failed] %d expected in register %c but found %d\n", expected[i], names[i], found[i]);
+                report += line;
+            }
         }
     }
+    if (s.fields & VectorFlags) {
+        uint8_t found = cpu->GetFlags();
+        if (found != (s.f & 0xf0)) {
+            snprintf(line, sizeof(line), "  [Flag check failed] znhc %d%d%d%d expected but found %d%d%d%d\n",
+                (s.f >> 7) & 1, (s.f >> 6) & 1, (s.f >> 5) & 1, (s.f >> 4) & 1,
+                (found >> 7) & 1, (found >> 6) & 1, (found >> 5) & 1, (found >> 4) & 1);
+            report += line;
+        }
+    }
+    if ((s.fields & VectorStackPointer) && cpu->stackPointer != s.sp) {
+        snprintf(line, sizeof(line), "  [CPU StackPointer check failed] 0x%04x expected but got 0x%04x\n", s.sp, cpu->stackPointer);
+        report += line;
+    }
+    if ((s.fields & VectorProgramCounter) && cpu->programCounter != s.pc) {
+        snprintf(line, sizeof(line), "  [CPU ProgramCounter check failed] 0x%04x expected but got 0x%04x\n", s.pc, cpu->programCounter);
+        report += line;
+    }
+    if ((s.fields & VectorCycles) && cycles != s.cycles) {
+        snprintf(line, sizeof(line), "  [CPU Cycles check failed] %d expected but got %d\n", s.cycles, cycles);
+        report += line;
+    }
+    for (const VectorMemory &m : s.memory) {
+        uint8_t v = mmu->Read(m.addr, true);
+        if (v != m.value) {
+            snprintf(line, sizeof(line), "  [Mem check failed] %d expected at 0x%04x but found %d\n", m.value, m.addr, v);
+            report += line;
+        }
+    }
+    return report.size() == before;
 }
 
-void checkCPURegisters(CentralProcessingUnit* cpu, json registers) {
-    if(registers.is_null()) 
-        return;
-
-    if (cpu->b != registers["b"])
-        printf("[Register check failed] %d expected in register b but found %d\n", registers["b"].get<int>(), cpu->b);
-
-    if (cpu->c != registers["c"])
-        printf("[Register check failed] %d expected in register c but found %d\n", registers["c"].get<int>(), cpu->c);
-
-    if (cpu->d != registers["d"])
-        printf("[Register check failed] %d expected in register d but found %d\n", registers["d"].get<int>(), cpu->d);
-
-    if (cpu->e != registers["e"])
-        printf("[Register check failed] %d expected in register e but found %d\n", registers["e"].get<int>(), cpu->e);
-
-    if (cpu->h != registers["h"])
-        printf("[Register check failed] %d expected in register h but found %d\n", registers["h"].get<int>(), cpu->h);
-
-    if (cpu->l != registers["l"])
-        printf("[Register check failed] %d expected in register l but found %d\n", registers["l"].get<int>(), cpu->l);
-
-    if (cpu->accumulator != registers["a"])
-        printf("[Register check failed] %d expected in register a but found %d\n", registers["a"].get<int>(), cpu->accumulator);
-}
-
-void checkCPUFlags(CentralProcessingUnit* cpu, json flags) {
-    if(flags.is_null()) 
-        return;
-
-    if (cpu->isZero != flags["z"])
-        printf("[Flag check failed] %d expected in zero flag but found %d\n", flags["z"].get<int>(), cpu->isZero);
-
-    if (cpu->isSubtract != flags["n"])
-        printf("[Flag check failed] %d expected in subtract flag but found %d\n", flags["n"].get<int>(), cpu->isSubtract);
-
-    if (cpu->isHalfCarry != flags["h"])
-        printf("[Flag check failed] %d expected in half carry flag but found %d\n", flags["h"].get<int>(), cpu->isHalfCarry);
-
-    if (cpu->isCarry != flags["c"])
-        printf("[Flag check failed] %d expected in half carry flag but found %d\n", flags["c"].get<int>(), cpu->isCarry);
-}
-
-void checkMemory(MemoryManagementUnit* mmu, json memory) {
-    if(memory.is_null()) 
-        return;
+int main(int argc, char *argv[]) {
+    std::string path = "gb-dmg.bin";
+    CpuEngine engine = EngineInterpreter;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--engine" && i + 1 < argc) {
+            if (!CpuEngineFromName(argv[++i], engine)) {
+                printf("Unknown engine: %s\n", argv[i]);
+                return 1;
+            }
+        } else
+            path = arg;
+    }
 
-    for (auto& element : memory) {
-        uint16_t address = convertHexaString(element["at"]);
-        uint8_t value = element["value"];
-        uint8_t v = mmu->Read(address, true);
-        if(v != value)
-            printf("[Mem check failed] %d expected at 0x%04x but found %d\n", value, address, v);
+    std::vector<OpcodeVector> vectors;
+    if (!ReadOpcodeVectors(path, vectors)) {
+        printf("Unable to read opcode vectors from %s\n", path.c_str());
+        return 1;
     }
-}
 
-int main(int argc, char *argv[]) {
-    Cartridge *cart = new Cartridge("../roms/tetris.gb");
+    Cartridge *cart = new Cartridge(BuildBlankRom());
     MemoryManagementUnit *mmu = new MemoryManagementUnit(cart);
-    CentralProcessingUnit *cpu = new CentralProcessingUnit(mmu); 
-
-    std::ifstream testConditionsFile("gb-dmg.json");
-    json j;
-    testConditionsFile >> j;
-    cpu->Print();
-
-    for (auto& element : j["tests"]) {
-        auto preload = element["preload"];
-        std::cout << "Testing opcode " << element["opcodedata"][0] << "\n";
-
-        loadCPURegisters(cpu, preload["register"]);
-        loadCPUFlags(cpu, preload["flag"]);
-        loadMemory(mmu, preload["memory"]);
-        cpu->stackPointer = convertHexaString(preload["sp"]);
-        cpu->programCounter = convertHexaString(preload["pc"]);
-
-        for (uint8_t i = 0; i < element["opcodedata"].size(); i++) {
-            uint8_t v = convertHexaString(element["opcodedata"][i]);
-            mmu->Write(cpu->programCounter + i, v, true);
+    CentralProcessingUnit *cpu = new CentralProcessingUnit(mmu);
+    cpu->SetEngine(engine);
+    cpu->SetJitOptions(SingleStepJitOptions);
+
+    int passed = 0, failed = 0, skipped = 0;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    for (const OpcodeVector &v : vectors) {
+        uint16_t pc = (v.preload.fields & VectorProgramCounter) ? v.preload.pc : cpu->programCounter;
+        if (!isRunnable(v, pc)) {
+            skipped++;
+            continue;
         }
 
-        auto check = element["check"];
-        uint8_t cycles = cpu->ExecuteInstruction();
-        if(cycles != check["cycles"]) {
-            printf("[CPU Cycles check failed] %d expected but got %d\n", check["cycles"].get<int>(), cycles);
-        }
+        loadState(cpu, mmu, v.preload);
+        for (size_t i = 0; i < v.code.size(); i++)
+            mmu->Write(cpu->programCounter + i, v.code[i], true);
 
-        checkCPURegisters(cpu, check["register"]);
-        checkCPUFlags(cpu, check["flag"]);
-        checkMemory(mmu, check["memory"]);
-        if(check.contains("sp") && cpu->stackPointer != convertHexaString(check["sp"])) 
-            printf("[CPU StackPointer check failed] %s expected but got 0x%04x\n", check["sp"].get<std::string>().c_str(), cpu->stackPointer);
-        if(check.contains("pc") && cpu->programCounter != convertHexaString(check["pc"])) 
-            printf("[CPU ProgramCounter check failed] %s expected but got 0x%04x\n", check["pc"].get<std::string>().c_str(), cpu->programCounter);
+        uint8_t cycles = cpu->ExecuteInstruction();
 
-        cpu->Print();
+        std::string report;
+        if (checkState(cpu, mmu, v.check, cycles, report)) {
+            passed++;
+            continue;
+        }
+        if (failed < MaxReportedFailures)
+            printf("FAILED %s\n%s", v.name.c_str(), report.c_str());
+        failed++;
     }
-    
-    return 0;
-}
\ No newline at end of file
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    if (failed > MaxReportedFailures)
+        printf("... %d more failures not shown\n", failed - MaxReportedFailures);
+    printf("%d passed, %d failed, %d skipped (%zu vectors in %.3fs)\n", passed, failed, skipped, vectors.size(), seconds);
+    return failed == 0 ? 0 : 1;
+}
@@ -0,0 +1,186 @@
+#include <algorithm>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "../gboy/GBoy.h"
+#include "../gboy/Trace.h"
+#include "../gboy/Workloads.h"
+
+// Traces the workload ROMs and checks the ring, the trigger, that every
+// engine records the same instructions, and the files written and decoded.
+
+void runFrames(GBoy &gb, uint32_t frames) {
+    while (frames > 0) {
+        gb.ExecuteStep();
+        if (gb.GetFrameBufferUpdatedFlag()) {
+            gb.SetFrameBufferUpdatedFlag(false);
+            frames--;
+        }
+    }
+}
+
+std::vector<TraceRecord> traceFrames(Workload w, CpuEngine engine, uint32_t frames, TraceBuffer &tracer) {
+    GBoy gb(new Cartridge(BuildWorkloadRom(w)));
+    gb.GetMMU()->SetSerialEcho(false);
+    gb.SetCpuEngine(engine);
+    gb.SetTracer(&tracer);
+    runFrames(gb, frames);
+    std::vector<TraceRecord> records;
+    for (size_t i = 0; i < tracer.GetSize(); i++)
+        records.push_back(tracer.Get(i));
+    return records;
+}
+
+std::string describe(const TraceRecord &r) {
+    char text[64];
+    snprintf(text, sizeof(text), "%03x at %04x, cycle %llu", r.opcode, r.pc, (unsigned long long)r.cycle);
+    return text;
+}
+
+// A small ring keeps exactly the end of the full trace
+bool checkRing(std::string &report) {
+    TraceBuffer full(1 << 20), ring(64);
+    std::vector<TraceRecord> all = traceFrames(WorkloadAlu, EngineInterpreter, 3, full);
+    std::vector<TraceRecord> last = traceFrames(WorkloadAlu, EngineInterpreter, 3, ring);
+    if (last.size() != 64 || all.size() < 1000 || all.size() >= (1 << 20)) {
+        report = std::to_string(all.size()) + " records, " + std::to_string(last.size()) + " in the ring";
+        return false;
+    }
+    for (size_t i = 1; i < all.size(); i++) {
+        if (all[i].cycle < all[i - 1].cycle) {
+            report = "cycles go back at " + describe(all[i]);
+            return false;
+        }
+    }
+    if (memcmp(&last[0], &all[all.size() - 64], 64 * sizeof(TraceRecord)) == 0)
+        return true;
+    report = "ring ends with " + describe(last.back()) + ", trace with " + describe(all.back());
+    return false;
+}
+
+bool checkTrigger(std::string &report) {
+    TraceBuffer full(1 << 20);
+    std::vector<TraceRecord> all = traceFrames(WorkloadMemcpy, EngineInterpreter, 2, full);
+    // Stops after the first time the PC of a later instruction runs
+    size_t at = 0;
+    while (all[at].pc != all[500].pc || all[at].bank != all[500].bank)
+        at++;
+
+    TraceBuffer ring(256);
+    ring.SetTrigger(all[500].bank, all[500].pc, 10);
+    std::vector<TraceRecord> last = traceFrames(WorkloadMemcpy, EngineInterpreter, 2, ring);
+    if (ring.IsFrozen() && last.size() == std::min<size_t>(256, at + 11) && memcmp(&last.back(), &all[at + 10], sizeof(TraceRecord)) == 0)
+        return true;
+    report = "stopped at " + describe(last.back()) + ", expected " + describe(all[at + 10]);
+    return false;
+}
+
+// Tracing turns fusion and compiled runs off, so all engines see the same
+bool checkEngines(std::string &report) {
+    for (Workload w : {WorkloadMemcpy, WorkloadLyPoll, WorkloadHaltIdle}) {
+        TraceBuffer interpreted(1 << 18);
+        std::vector<TraceRecord> a = traceFrames(w, EngineInterpreter, 5, interpreted);
+        for (CpuEngine engine : {EngineCached, EngineJit}) {
+            TraceBuffer other(1 << 18);
+            std::vector<TraceRecord> b = traceFrames(w, engine, 5, other);
+            for (size_t i = 0; i < a.size() && i < b.size(); i++) {
+                if (memcmp(&a[i], &b[i], sizeof(TraceRecord)) != 0) {
+                    report = std::string(WorkloadName(w)) + ": " + CpuEngineName(engine) + " records " + describe(b[i])
+                        + ", interpreter " + describe(a[i]);
+                    return false;
+                }
+            }
+            if (a.size() != b.size()) {
+                report = std::string(WorkloadName(w)) + ": " + std::to_string(b.size()) + " records on "
+                    + CpuEngineName(engine) + ", " + std::to_string(a.size()) + " on the interpreter";
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+// Written, read back and decoded with instruction and interrupt names
+bool checkFile(std::string &report) {
+    TraceBuffer tracer(4096);
+    std::vector<TraceRecord> records = traceFrames(WorkloadHaltIdle, EngineCached, 3, tracer);
+    FILE *file = tmpfile();
+    tracer.Write(file);
+    rewind(file);
+    std::vector<TraceRecord> read;
+    bool ok = TraceBuffer::Read(file, read);
+    fclose(file);
+    if (!ok || read.size() != records.size() || memcmp(&read[0], &records[0], read.size() * sizeof(TraceRecord))) {
+        report = "read back " + std::to_string(read.size()) + " of " + std::to_string(records.size()) + " records";
+        return false;
+    }
+
+    GBoy gb(new Cartridge(BuildWorkloadRom(WorkloadHaltIdle)));
+    bool halt = false, vblank = false;
+    for (const TraceRecord &r : read) {
+        std::string line = FormatTraceRecord(r, gb.GetCPU());
+        halt |= line.find("HALT") != std::string::npos;
+        vblank |= line.find("int:vblank from") != std::string::npos;
+    }
+    if (halt && vblank)
+        return true;
+    report = "decoded without " + std::string(halt ? "" : "HALT ") + (vblank ? "" : "int:vblank");
+    return false;
+}
+
+// A crashing process still leaves its trace behind
+bool checkDump(std::string &report) {
+    char path[] = "/tmp/picoboytraceXXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0) {
+        report = "no temporary file";
+        return false;
+    }
+    close(fd);
+
+    pid_t child = fork();
+    if (child == 0) {
+        TraceBuffer *tracer = new TraceBuffer(1024);
+        GBoy gb(new Cartridge(BuildWorkloadRom(WorkloadAlu)));
+        gb.GetMMU()->SetSerialEcho(false);
+        gb.SetTracer(tracer);
+        InstallTraceDump(tracer, path);
+        runFrames(gb, 1);
+        abort();
+    }
+    int status = 0;
+    waitpid(child, &status, 0);
+    std::vector<TraceRecord> records;
+    bool ok = TraceBuffer::Read(path, records);
+    unlink(path);
+    if (WIFSIGNALED(status) && ok && records.size() == 1024)
+        return true;
+    report = "child " + std::string(WIFSIGNALED(status) ? "aborted" : "exited") + ", " + std::to_string(records.size())
+        + " records dumped";
+    return false;
+}
+
+int main(int argc, char *argv[]) {
+    const struct { const char *name; std::function<bool(std::string &)> check; } checks[] = {
+        {"ring", checkRing},
+        {"trigger", checkTrigger},
+        {"engines", checkEngines},
+        {"file", checkFile},
+        {"dump", checkDump},
+    };
+
+    int failed = 0;
+    for (auto &c : checks) {
+        std::string report;
+        if (c.check(report)) {
+            printf("%-8s ok\n", c.name);
+        } else {
+            failed++;
+            printf("%-8s FAILED: %s\n", c.name, report.c_str());
+        }
+    }
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,124 @@
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+#include "OpcodeVectors.h"
+#include "json.hpp"
+
+using json = nlohmann::json;
+
+// Converts JSON opcode tests into the binary format read by picoboytest.
+// Accepts both the gb-dmg.json layout ({"tests": [...]} with hex strings)
+// and the per-opcode SingleStepTests layout (an array of initial/final states).
+
+uint16_t convertHexaString(std::string hexstr) {
+    uint16_t res = 0;
+    std::stringstream ss;
+    ss << std::hex << hexstr;
+    ss >> res;
+    return res;
+}
+
+uint8_t packFlags(json flags) {
+    return (flags["z"].get<bool>() << 7) | (flags["n"].get<bool>() << 6)
+        | (flags["h"].get<bool>() << 5) | (flags["c"].get<bool>() << 4);
+}
+
+void convertDmgState(json state, VectorState &s, bool isCheck) {
+    s = VectorState();
+    if (!state["register"].is_null()) {
+        json registers = state["register"];
+        s.fields |= VectorRegisters;
+        s.a = registers["a"], s.b = registers["b"], s.c = registers["c"], s.d = registers["d"];
+        s.e = registers["e"], s.h = registers["h"], s.l = registers["l"];
+    }
+    if (!state["flag"].is_null()) {
+        s.fields |= VectorFlags;
+        s.f = packFlags(state["flag"]);
+    }
+    if (state.contains("sp")) {
+        s.fields |= VectorStackPointer;
+        s.sp = convertHexaString(state["sp"]);
+    }
+    if (state.contains("pc")) {
+        s.fields |= VectorProgramCounter;
+        s.pc = convertHexaString(state["pc"]);
+    }
+    if (state.contains("cycles")) {
+        s.fields |= VectorCycles;
+        s.cycles = state["cycles"];
+    }
+    if (!state["memory"].is_null()) {
+        for (auto &element : state["memory"]) {
+            VectorMemory m;
+            m.addr = convertHexaString(element["at"]);
+            m.count = isCheck ? 1 : element["next"].get<uint16_t>();
+            m.value = element["value"];
+            s.memory.push_back(m);
+        }
+    }
+}
+
+void convertDmgTests(json j, std::vector<OpcodeVector> &vectors) {
+    for (auto &element : j["tests"]) {
+        OpcodeVector v;
+        for (auto &byte : element["opcodedata"])
+            v.code.push_back(convertHexaString(byte));
+        v.name = "gb-dmg " + element["opcodedata"][0].get<std::string>();
+        convertDmgState(element["preload"], v.preload, false);
+        convertDmgState(element["check"], v.check, true);
+        vectors.push_back(v);
+    }
+}
+
+void convertSingleStepState(json state, VectorState &s) {
+    s = VectorState();
+    s.fields = VectorRegisters | VectorFlags | VectorStackPointer | VectorProgramCounter;
+    s.a = state["a"], s.b = state["b"], s.c = state["c"], s.d = state["d"];
+    s.e = state["e"], s.h = state["h"], s.l = state["l"], s.f = state["f"];
+    s.sp = state["sp"];
+    s.pc = state["pc"];
+    for (auto &entry : state["ram"])
+        s.memory.push_back({entry[0].get<uint16_t>(), 1, entry[1].get<uint8_t>()});
+}
+
+void convertSingleStepTests(json j, std::vector<OpcodeVector> &vectors) {
+    for (auto &element : j) {
+        OpcodeVector v;
+        v.name = element["name"];
+        convertSingleStepState(element["initial"], v.preload);
+        convertSingleStepState(element["final"], v.check);
+        v.check.fields |= VectorCycles;
+        v.check.cycles = element["cycles"].size() * 4;
+        vectors.push_back(v);
+    }
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 3) {
+        printf("Usage: %s output.bin input.json...\n", argv[0]);
+        return 1;
+    }
+
+    std::vector<OpcodeVector> vectors;
+    for (int i = 2; i < argc; i++) {
+        std::ifstream input(argv[i]);
+        if (!input.is_open()) {
+            printf("Unable to open %s\n", argv[i]);
+            return 1;
+        }
+        json j;
+        input >> j;
+        if (j.is_array())
+            convertSingleStepTests(j, vectors);
+        else
+            convertDmgTests(j, vectors);
+    }
+
+    if (!WriteOpcodeVectors(argv[1], vectors)) {
+        printf("Unable to write %s\n", argv[1]);
+        return 1;
+    }
+    printf("Wrote %zu opcode vectors to %s\n", vectors.size(), argv[1]);
+    return 0;
+}